@@ -1970,6 +1970,74 @@ bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	return r;
 }
 
+/**
+ * Send several datagrams with a single system call, as bandwidth permits.
+ *
+ * Datagrams are sent in order, stopping at the first one for which there
+ * is no bandwidth left.  The first datagram is subject to the same rules
+ * as in bio_sendto(), to let large datagrams go through.
+ *
+ * @param bio		the I/O source
+ * @param dg		the datagrams to send
+ * @param cnt		amount of datagrams in ``dg''
+ *
+ * @return the amount of leading datagrams sent, -1 with errno set if the
+ * first one could not be sent (EAGAIN meaning no bandwidth is available).
+ */
+int
+bio_sendmmsg(bio_source_t *bio, wrap_dgram_t *dg, int cnt)
+{
+	size_t available, requested = 0, used;
+	int i, n, r;
+
+	bio_check(bio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(cnt > 0);
+
+	for (i = 0; i < cnt; i++)
+		requested += dg[i].len + BW_UDP_MSG;
+
+	available = bw_available(bio, requested);
+
+	if (available == 0 || available + BW_UDP_OVERSIZE < dg[0].len) {
+		errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	used = dg[0].len + BW_UDP_MSG;
+	for (n = 1; n < cnt; n++) {
+		size_t len = dg[n].len + BW_UDP_MSG;
+
+		if (used + len > available)
+			break;
+		used += len;
+	}
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(wio=%d, cnt=%d) available=%zu, sending %d",
+			G_STRFUNC, bio->wio->fd(bio->wio), cnt, available, n);
+
+	g_assert(bio->wio != NULL);
+	g_assert(bio->wio->sendmmsg != NULL);
+	r = (*bio->wio->sendmmsg)(bio->wio, dg, n);
+
+	if (-1 == r && 0 == errno) {
+		g_warning("wio->sendmmsg(fd=%d, cnt=%d) returned -1 with errno = 0, "
+			"assuming EAGAIN", bio->wio->fd(bio->wio), n);
+		errno = VAL_EAGAIN;
+	}
+
+	if (r > 0) {
+		for (i = 0, used = 0; i < r; i++)
+			used += dg[i].len + BW_UDP_MSG;
+
+		bsched_bw_update(bsched_get(bio->bws), used, used);
+		bio_bw_update(bio, used);
+	}
+
+	return r;
+}
+
 /**
  * Write at most `len' bytes to source's fd, as bandwidth permits.
  *
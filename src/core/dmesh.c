@@ -55,6 +55,7 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/altloc.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
@@ -72,6 +73,7 @@
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/parse.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
@@ -94,10 +96,39 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  */
 static hikset_t *mesh = NULL;
 
+/**
+ * Each mesh bucket stores its entries inline, in a packed array which is
+ * managed as a ring buffer: entries are kept in insertion order, the oldest
+ * one being at index `head'.  Once the ring holds MAX_ENTRIES items, adding
+ * a new entry evicts the oldest one.  The array starts small and is doubled
+ * as needed, since most SHA1s only have a handful of known sources.
+ *
+ * There is no per-bucket hash table: entries are located by scanning the
+ * `hkey' array, which holds the hashed key of each entry (host for regular
+ * entries, GUID for firewalled ones) at the same position as the entry.
+ *
+ * A Bloom filter summarizes the keys present in the bucket, so that we can
+ * cheaply determine that an alt-loc is not known yet, which is the most
+ * common case when collecting X-Alt headers.  It is sized to the ring and
+ * grown with it, keeping DMESH_BLOOM_RATIO bits per slot: with two bits set
+ * per key, a full ring yields about 1.5% of false positives.  Since bits
+ * cannot be cleared from a Bloom filter, removals only count as "stale"
+ * keys and the filter is rebuilt during the next expiration sweep.
+ */
+#define DMESH_BLOOM_RATIO	16		/**< Bloom filter bits per ring slot */
+#define DMESH_MIN_SLOTS		8		/**< Initial ring capacity */
+
+#define DMESH_BLOOM_WORDS(c)	((c) * DMESH_BLOOM_RATIO / (8 * sizeof(uint64)))
+
 struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
-	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
-	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
+	struct dmesh_entry *entry;	/**< Ring buffer holding the entries */
+	uint32 *hkey;			/**< Hashed keys, indexed as `entry' */
+	uint64 *bloom;			/**< Bloom filter of hashed keys */
+	uint capacity;			/**< Ring capacity, a power of 2 */
+	uint head;				/**< Index of oldest entry in the ring */
+	uint count;				/**< Amount of entries held in the ring */
+	uint stale;				/**< Keys removed since Bloom filter was built */
+	time_t oldest;			/**< Lower bound for the stamp of all entries */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
 	const sha1_t *sha1;		/**< The SHA1 of this mesh */
 };
@@ -112,8 +143,22 @@ struct dmesh_entry {
 	hash_list_t *bad;		/**< Keeps track of IPs reporting entry as bad */
 	uint8 good;				/**< Whether marked as being a good entry */
 	uint8 fw_entry;			/**< Whether entry is that of a firewalled host */
+	uint8 alt_len;			/**< Length of `alt', 0 if not pre-rendered */
+	char alt[ALTLOC_IPV4_BUFLEN];	/**< Pre-rendered compact form */
 };
 
+/**
+ * Iterate over all the entries of mesh bucket `dm', oldest first.
+ * The `dme' variable is set to each entry in turn, `i' being the loop index.
+ */
+#define DM_FOREACH(dm, i, dme)								\
+	for (													\
+		(i) = 0;											\
+		(i) < (dm)->count &&								\
+			((dme) = dm_entry_at((dm), (i)), TRUE);			\
+		(i)++												\
+	)
+
 #define MAX_LIFETIME	43200		/**< half a day */
 #define MAX_LIBLIFETIME	3600		/**< 1 hour for shared/seeded files */
 #define MAX_ENTRIES		256			/**< Max amount of entries kept per SHA1 */
@@ -215,10 +260,10 @@ dmesh_init(void)
 }
 
 /**
- * Free download mesh entry.
+ * Release resources held by download mesh entry.
  */
 static void
-dmesh_entry_free(struct dmesh_entry *dme)
+dmesh_entry_release(struct dmesh_entry *dme)
 {
 	g_assert(dme);
 
@@ -230,7 +275,6 @@ dmesh_entry_free(struct dmesh_entry *dme)
 			atom_str_free(dme->e.url.name);
 	}
 	hash_list_free_all(&dme->bad, wfree_host_addr1);
-	WFREE(dme);
 }
 
 /**
@@ -577,6 +621,239 @@ dmesh_url_parse(const char *url, dmesh_urlinfo_t *info)
 	return TRUE;
 }
 
+/**
+ * @return the entry at logical index `i' in the ring, 0 being the oldest.
+ */
+static inline struct dmesh_entry *
+dm_entry_at(const struct dmesh *dm, uint i)
+{
+	g_assert(i < dm->count);
+
+	return &dm->entry[(dm->head + i) & (dm->capacity - 1)];
+}
+
+/**
+ * @return the physical ring slot of the entry at logical index `i'.
+ */
+static inline uint
+dm_slot(const struct dmesh *dm, uint i)
+{
+	return (dm->head + i) & (dm->capacity - 1);
+}
+
+/**
+ * @return hashed key for a regular entry, identified by its IP:port.
+ */
+static inline uint32
+dm_host_key(const host_addr_t addr, uint16 port)
+{
+	return host_addr_port_hash(addr, port);
+}
+
+/**
+ * @return hashed key for a firewalled entry, identified by its GUID.
+ */
+static inline uint32
+dm_guid_key(const guid_t *guid)
+{
+	return hashing_mix32(guid_hash(guid));
+}
+
+/**
+ * Compute the two Bloom filter bits for a given hashed key.
+ */
+static inline void
+dm_bloom_bits(const struct dmesh *dm, uint32 key, uint *b1, uint *b2)
+{
+	uint mask = dm->capacity * DMESH_BLOOM_RATIO - 1;
+
+	*b1 = key & mask;
+	*b2 = (key >> 16) & mask;
+}
+
+/**
+ * Record hashed key in the Bloom filter of the mesh bucket.
+ */
+static void
+dm_bloom_add(struct dmesh *dm, uint32 key)
+{
+	uint b1, b2;
+
+	dm_bloom_bits(dm, key, &b1, &b2);
+	dm->bloom[b1 >> 6] |= (uint64) 1 << (b1 & 0x3f);
+	dm->bloom[b2 >> 6] |= (uint64) 1 << (b2 & 0x3f);
+}
+
+/**
+ * @return whether hashed key may be present in the mesh bucket.
+ */
+static inline bool
+dm_bloom_contains(const struct dmesh *dm, uint32 key)
+{
+	uint b1, b2;
+
+	dm_bloom_bits(dm, key, &b1, &b2);
+
+	return
+		0 != (dm->bloom[b1 >> 6] & ((uint64) 1 << (b1 & 0x3f))) &&
+		0 != (dm->bloom[b2 >> 6] & ((uint64) 1 << (b2 & 0x3f)));
+}
+
+/**
+ * Rebuild the Bloom filter from the keys currently present in the bucket,
+ * which gets rid of the bits set by keys that have since been removed.
+ */
+static void
+dm_bloom_rebuild(struct dmesh *dm)
+{
+	uint i;
+
+	memset(dm->bloom, 0, DMESH_BLOOM_WORDS(dm->capacity) * sizeof dm->bloom[0]);
+
+	for (i = 0; i < dm->count; i++) {
+		dm_bloom_add(dm, dm->hkey[dm_slot(dm, i)]);
+	}
+
+	dm->stale = 0;
+}
+
+/**
+ * Locate the entry bearing the given hashed key and satisfying the supplied
+ * equality test.
+ *
+ * @return the logical index of the entry in the ring, -1 if not found.
+ */
+static int
+dm_lookup_key(const struct dmesh *dm, uint32 key,
+	bool (*eq)(const struct dmesh_entry *, const void *), const void *data)
+{
+	uint i;
+
+	if (!dm_bloom_contains(dm, key))
+		return -1;
+
+	for (i = 0; i < dm->count; i++) {
+		uint n = dm_slot(dm, i);
+
+		if G_LIKELY(dm->hkey[n] != key)
+			continue;
+
+		if ((*eq)(&dm->entry[n], data))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Equality test between a regular mesh entry and the IP:port of an URL info.
+ */
+static bool
+dm_host_eq(const struct dmesh_entry *dme, const void *data)
+{
+	const dmesh_urlinfo_t *info = data;
+
+	return !dme->fw_entry &&
+		dme->e.url.port == info->port &&
+		host_addr_equiv(dme->e.url.addr, info->addr);
+}
+
+/**
+ * Equality test between a firewalled mesh entry and a GUID.
+ */
+static bool
+dm_guid_eq(const struct dmesh_entry *dme, const void *data)
+{
+	return dme->fw_entry && guid_eq(dme->e.fwh.guid, data);
+}
+
+/**
+ * Locate the regular entry for given IP:port.
+ *
+ * @return the logical index of the entry in the ring, -1 if not found.
+ */
+static int
+dm_lookup_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	dmesh_urlinfo_t info;
+
+	info.addr = addr;
+	info.port = port;
+
+	return dm_lookup_key(dm, dm_host_key(addr, port), dm_host_eq, &info);
+}
+
+/**
+ * Locate the firewalled entry for given GUID.
+ *
+ * @return the logical index of the entry in the ring, -1 if not found.
+ */
+static int
+dm_lookup_guid(const struct dmesh *dm, const guid_t *guid)
+{
+	return dm_lookup_key(dm, dm_guid_key(guid), dm_guid_eq, guid);
+}
+
+/**
+ * @return the regular entry for given IP:port, NULL if not found.
+ */
+static struct dmesh_entry *
+dm_find_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	int i = dm_lookup_host(dm, addr, port);
+
+	return i < 0 ? NULL : dm_entry_at(dm, i);
+}
+
+/**
+ * @return the firewalled entry for given GUID, NULL if not found.
+ */
+static struct dmesh_entry *
+dm_find_guid(const struct dmesh *dm, const guid_t *guid)
+{
+	int i = dm_lookup_guid(dm, guid);
+
+	return i < 0 ? NULL : dm_entry_at(dm, i);
+}
+
+/**
+ * Resize the ring to hold `capacity' entries, laying out existing entries
+ * from the start of the new arrays.  The Bloom filter is resized as well
+ * and rebuilt from the kept keys.
+ */
+static void
+dm_resize(struct dmesh *dm, uint capacity)
+{
+	struct dmesh_entry *entry;
+	uint32 *hkey;
+	uint i;
+
+	g_assert(is_pow2(capacity));
+	g_assert(capacity >= dm->count);
+
+	WALLOC_ARRAY(entry, capacity);
+	WALLOC_ARRAY(hkey, capacity);
+
+	for (i = 0; i < dm->count; i++) {
+		uint n = dm_slot(dm, i);
+
+		entry[i] = dm->entry[n];
+		hkey[i] = dm->hkey[n];
+	}
+
+	WFREE_ARRAY_NULL(dm->entry, dm->capacity);
+	WFREE_ARRAY_NULL(dm->hkey, dm->capacity);
+	WFREE_ARRAY_NULL(dm->bloom, DMESH_BLOOM_WORDS(dm->capacity));
+
+	dm->entry = entry;
+	dm->hkey = hkey;
+	dm->capacity = capacity;
+	dm->head = 0;
+
+	WALLOC_ARRAY(dm->bloom, DMESH_BLOOM_WORDS(capacity));
+	dm_bloom_rebuild(dm);
+}
+
 /**
  * Allocate a new download mesh structure (there is one per SHA1).
  */
@@ -585,13 +862,10 @@ dm_alloc(const struct sha1 *sha1)
 {
 	struct dmesh *dm;
 
-	WALLOC(dm);
+	WALLOC0(dm);
 	dm->last_update = 0;
-	dm->entries = list_new();
 	dm->sha1 = atom_sha1_get(sha1);
-	dm->by_host = htable_create_any(packed_host_hash_func,
-		packed_host_hash_func2, packed_host_eq_func);
-	dm->by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
+	dm_resize(dm, DMESH_MIN_SLOTS);
 
 	return dm;
 }
@@ -602,37 +876,79 @@ dm_alloc(const struct sha1 *sha1)
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
-
-	/*
-	 * Values in the dme->by_host table were the dmesh_entry structures
-	 * we just disposed of above, so we only need to get rid of the keys.
-	 */
-
-	htable_foreach_key(dm->by_host, wfree_packed_host, NULL);
-	htable_free_null(&dm->by_host);
+	struct dmesh_entry *dme;
+	uint i;
 
-	/* Keys were GUID in the dmesh_entry, no need to free them */
-	htable_free_null(&dm->by_guid);
+	DM_FOREACH(dm, i, dme) {
+		dmesh_entry_release(dme);
+	}
 
+	WFREE_ARRAY_NULL(dm->entry, dm->capacity);
+	WFREE_ARRAY_NULL(dm->hkey, dm->capacity);
+	WFREE_ARRAY_NULL(dm->bloom, DMESH_BLOOM_WORDS(dm->capacity));
 	atom_sha1_free_null(&dm->sha1);
 	WFREE(dm);
 }
 
 /**
- * Remove specified entry from mesh bucket and reclaim it.
+ * Append new entry at the tail of the ring, evicting the oldest entry if
+ * the ring already holds the maximum amount of entries.
+ *
+ * @return pointer to the (uninitialized) slot where the new entry is to be
+ * filled-in.
+ */
+static struct dmesh_entry *
+dm_append(struct dmesh *dm, uint32 key, time_t stamp)
+{
+	uint n;
+
+	if (dm->count == MAX_ENTRIES) {
+		struct dmesh_entry *oldest = dm_entry_at(dm, 0);
+
+		if (GNET_PROPERTY(dmesh_debug) > 1) {
+			g_debug("dmesh %sentry evicted for urn:sha1:%s at %s",
+				oldest->fw_entry ? "firewalled " : "", sha1_base32(dm->sha1),
+				oldest->fw_entry ?
+					guid_hex_str(oldest->e.fwh.guid) :
+					host_addr_port_to_string(
+						oldest->e.url.addr, oldest->e.url.port));
+		}
+
+		dmesh_entry_release(oldest);
+		dm->head = (dm->head + 1) & (dm->capacity - 1);
+		dm->count--;
+		dm->stale++;
+	} else if (dm->count == dm->capacity) {
+		dm_resize(dm, dm->capacity * 2);
+	}
+
+	g_assert(dm->count < dm->capacity);
+
+	n = dm_slot(dm, dm->count++);
+	dm->hkey[n] = key;
+	dm_bloom_add(dm, key);
+
+	if (1 == dm->count || delta_time(stamp, dm->oldest) < 0)
+		dm->oldest = stamp;
+
+	return &dm->entry[n];
+}
+
+/**
+ * Remove entry at logical index `i' from the ring and reclaim it.
+ *
+ * Entries after the removed one are shifted to keep the ring contiguous and
+ * in insertion order.
  */
 static void
-dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
+dm_remove_at(struct dmesh *dm, uint i)
 {
-	struct packed_host packed;
-	const void *key;
-	void *value;
-	bool found;
+	struct dmesh_entry *dme;
+	uint j;
 
-	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(i < dm->count);
+
+	dme = dm_entry_at(dm, i);
 
 	if (GNET_PROPERTY(dmesh_debug) > 1) {
 		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
@@ -642,32 +958,38 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 				host_addr_port_to_string(dme->e.url.addr, dme->e.url.port));
 	}
 
-	if (dme->fw_entry) {
-		found = htable_lookup_extended(dm->by_guid,
-					dme->e.fwh.guid, &key, &value);
-	} else {
-		packed = host_pack(dme->e.url.addr, dme->e.url.port);
-		found = htable_lookup_extended(dm->by_host,
-					&packed, &key, &value);
-	}
+	dmesh_entry_release(dme);
 
-	g_assert(found);
-	g_assert(value == (void *) dme);
+	if (0 == i) {
+		dm->head = (dm->head + 1) & (dm->capacity - 1);
+	} else {
+		for (j = i + 1; j < dm->count; j++) {
+			uint from = dm_slot(dm, j), to = dm_slot(dm, j - 1);
 
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
+			dm->entry[to] = dm->entry[from];
+			dm->hkey[to] = dm->hkey[from];
+		}
+	}
 
-	g_assert(found);
+	dm->count--;
+	dm->stale++;
+}
 
-	/* ...and from the proper hash table */
+/**
+ * Remove specified entry from mesh bucket and reclaim it.
+ */
+static void
+dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
+{
+	uint n;
 
-	if (dme->fw_entry) {
-		htable_remove(dm->by_guid, dme->e.fwh.guid);
-	} else {
-		htable_remove(dm->by_host, &packed);
-		wfree_packed_host(deconstify_pointer(key), NULL);
-	}
+	g_assert(dm);
+	g_assert(dm->count > 0);
+	g_assert(ptr_cmp(dme, dm->entry) >= 0);
+	g_assert(ptr_cmp(dme, &dm->entry[dm->capacity]) < 0);
 
-	dmesh_entry_free(dme);
+	n = dme - dm->entry;
+	dm_remove_at(dm, (n - dm->head) & (dm->capacity - 1));
 }
 
 /**
@@ -676,35 +998,14 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 static void
 dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
 {
-	struct packed_host packed;
-	struct dmesh_entry *dme;
-	const void *key;
-	void *value;
-	bool found;
+	int i;
 
 	g_assert(dm);
 
-	packed = host_pack(addr, port);
-	found = htable_lookup_extended(dm->by_host, &packed, &key, &value);
+	i = dm_lookup_host(dm, addr, port);
 
-	if (!found)
-		return;
-
-	if (GNET_PROPERTY(dmesh_debug) > 1) {
-		g_debug("dmesh entry removed for urn:sha1:%s at %s",
-			sha1_base32(dm->sha1), host_addr_port_to_string(addr, port));
-	}
-
-	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
-
-	g_assert(found);
-	g_assert(!dme->fw_entry);
-
-	htable_remove(dm->by_host, &packed);	/* And from hash table */
-	wfree_packed_host(deconstify_pointer(key), NULL);
-
-	dmesh_entry_free(dme);
+	if (i >= 0)
+		dm_remove_at(dm, i);
 }
 
 /**
@@ -745,21 +1046,46 @@ dm_lifetime(const struct dmesh *dm)
 static void
 dm_expire(struct dmesh *dm)
 {
-	pslist_t *expired = NULL;
-	pslist_t *sl;
 	time_t now = tm_time();
+	time_t oldest = now;
 	long agemax;
-	list_iter_t *iter;
+	uint i, kept;
+
+	/*
+	 * Entry stamps can only move forward, hence `oldest' is a lower bound
+	 * for all the stamps in the bucket: when it is recent enough, nothing
+	 * can have expired and we do not need to sweep through the entries.
+	 */
+
+	if (delta_time(now, dm->oldest) <= MAX_LIBLIFETIME)
+		goto done;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
+	if (delta_time(now, dm->oldest) <= agemax)
+		goto done;
+
+	/*
+	 * Compact the ring in place, keeping the surviving entries in their
+	 * insertion order and computing the new lower bound for stamps.
+	 */
+
+	for (i = kept = 0; i < dm->count; i++) {
+		uint n = dm_slot(dm, i);
+		struct dmesh_entry *dme = &dm->entry[n];
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+		if (delta_time(now, dme->stamp) <= agemax) {
+			if (kept != i) {
+				uint k = dm_slot(dm, kept);
 
-		if (delta_time(now, dme->stamp) <= agemax)
+				dm->entry[k] = *dme;
+				dm->hkey[k] = dm->hkey[n];
+			}
+			if (delta_time(dme->stamp, oldest) < 0)
+				oldest = dme->stamp;
+			kept++;
 			continue;
+		}
 
 		/*
 		 * Remove the entry.
@@ -776,20 +1102,18 @@ dm_expire(struct dmesh *dm)
 					dmesh_urlinfo_to_string(&dme->e.url),
 				(unsigned) delta_time(now, dme->stamp));
 
-		expired = pslist_prepend(expired, dme);
+		dmesh_entry_release(dme);
+		dm->stale++;
 	}
 
-	list_iter_free(&iter);
-
-	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
+	dm->count = kept;
+	dm->oldest = oldest;
 
-		dm_remove_entry(dm, dme);
-	}
-
-	pslist_free(expired);
+done:
+	if (dm->stale != 0)
+		dm_bloom_rebuild(dm);
 
-	dm->last_update = tm_time();
+	dm->last_update = now;
 }
 
 /**
@@ -806,7 +1130,7 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(0 == dm->count);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
@@ -847,7 +1171,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (0 == dm->count)
 		dmesh_dispose(sha1);
 
     return TRUE;
@@ -876,13 +1200,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (0 == dm->count) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? dm->count : 0;
 }
 
 /**
@@ -914,6 +1238,34 @@ dmesh_get(const struct sha1 *sha1)
 	return dm;
 }
 
+/**
+ * Pre-render the compact form of IPv4 URN_INDEX entries, which are the
+ * ones we emit in X-Alt headers, so that generating these headers does
+ * not require formatting the same addresses over and over.
+ */
+static void
+dmesh_entry_render(struct dmesh_entry *dme)
+{
+	const dmesh_urlinfo_t *info = &dme->e.url;
+	size_t len;
+
+	dme->alt_len = 0;
+	dme->alt[0] = '\0';
+
+	if (dme->fw_entry || info->idx != URN_INDEX)
+		return;
+
+	if (!host_addr_is_ipv4(info->addr))
+		return;
+
+	len = altloc_format_ipv4(host_addr_ipv4(info->addr), info->port,
+		GTA_PORT, ARYLEN(dme->alt));
+
+	g_assert(len != 0 && len < sizeof dme->alt);
+
+	dme->alt_len = len;
+}
+
 /**
  * Add entry to the download mesh, indexed by the binary `sha1' digest.
  * If `stamp' is 0, then the current time is used.
@@ -935,7 +1287,6 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	uint16 port = info->port;
 	uint idx = info->idx;
 	const char *name = info->name;
-	struct packed_host packed;
 	const char *reason = NULL;
 
 	g_return_val_if_fail(sha1, FALSE);
@@ -998,8 +1349,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_find_host(dm, addr, port);
 
 	if (dme) {
 		/*
@@ -1016,6 +1366,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		if (dme->e.url.idx != idx && idx == URN_INDEX) {
 			dme->e.url.idx = idx;
 			atom_str_change(&dme->e.url.name, name);
+			dmesh_entry_render(dme);
 		}
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
@@ -1026,10 +1377,11 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 	} else {
 		/*
-		 * Allocate new entry.
+		 * New entries are appended at the tail of the ring, which evicts
+		 * the oldest entry when we have MAX_ENTRIES already.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm, dm_host_key(addr, port), stamp);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1040,6 +1392,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		dme->bad = NULL;
 		dme->good = FALSE;
 		dme->fw_entry = FALSE;
+		dmesh_entry_render(dme);
 
 		entropy_harvest_many(name, vstrlen(name),
 			VARLEN(dme), PTRLEN(sha1), NULL);
@@ -1048,20 +1401,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 			g_debug("dmesh entry created for urn:sha1:%s at %s",
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 
-		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by host.
-		 */
-
-		list_append(dm->entries, dme);
 		dm->last_update = now;
-
-		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
 	}
 
 	/*
@@ -1133,7 +1473,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	dme = htable_lookup(dm->by_guid, info->guid);
+	dme = dm_find_guid(dm, info->guid);
 
 	if (dme) {
 		/*
@@ -1162,10 +1502,11 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 				info->proxies ? "new" : "no new");
 	} else {
 		/*
-		 * Allocate new entry.
+		 * New entries are appended at the tail of the ring, which evicts
+		 * the oldest entry when we have MAX_ENTRIES already.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm, dm_guid_key(info->guid), stamp);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1174,6 +1515,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		dme->bad = NULL;
 		dme->good = FALSE;
 		dme->fw_entry = TRUE;
+		dme->alt_len = 0;
 
 		entropy_harvest_many(PTRLEN(info->guid),
 			VARLEN(dme), PTRLEN(sha1), NULL);
@@ -1182,20 +1524,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 			g_debug("dmesh entry created for urn:sha1:%s for %s",
 				sha1_base32(sha1), guid_hex_str(info->guid));
 
-		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by GUID.
-		 */
-
-		list_append(dm->entries, dme);
 		dm->last_update = now;
-
-		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
 	}
 
 	/*
@@ -1309,7 +1638,6 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	host_addr_t addr, uint16 port)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	host_addr_t net;
 
@@ -1322,8 +1650,7 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return;
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_find_host(dm, addr, port);
 
 	if (dme == NULL)
 		return;
@@ -1368,7 +1695,6 @@ dmesh_good_mark(const struct sha1 *sha1,
 	host_addr_t addr, uint16 port, bool good)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	bool retried = FALSE;
 
@@ -1376,10 +1702,8 @@ dmesh_good_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	packed = host_pack(addr, port);
-
 retry:
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_find_host(dm, addr, port);
 
 	if (dme == NULL) {
 		/*
@@ -1449,7 +1773,7 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	dme = htable_lookup(dm->by_guid, guid);
+	dme = dm_find_guid(dm, guid);
 
 	if (dme == NULL)
 		return;
@@ -1652,8 +1976,6 @@ static size_t
 dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 {
 	const dmesh_urlinfo_t *info = &dme->e.url;
-	const char *host;
-	size_t rw;
 
 	g_assert(!dme->fw_entry);
 	g_assert(size > 0);
@@ -1662,12 +1984,14 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 	if (info->idx != URN_INDEX)
 		return (size_t) -1;
 
-	host = info->port == GTA_PORT
-		? host_addr_to_string(info->addr)
-		: host_addr_port_to_string(info->addr, info->port);
+	if (dme->alt_len != 0) {
+		if (dme->alt_len >= size)
+			return (size_t) -1;
+		memcpy(buf, dme->alt, dme->alt_len + 1);	/* Includes trailing NUL */
+		return dme->alt_len;
+	}
 
-	rw = g_strlcpy(buf, host, size);
-	return rw < size ? rw : (size_t) -1;
+	return altloc_format(info->addr, info->port, GTA_PORT, buf, size);
 }
 
 /**
@@ -1787,8 +2111,9 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	int nselected;
 	int i;
 	int j;
+	uint n;
 	bool complete_file;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
@@ -1804,11 +2129,8 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 
 	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
 
+	DM_FOREACH(dm, n, dme) {
 		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
 			continue;
 
@@ -1840,12 +2162,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		return 0;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass: choose at most `hcnt' entries at random.
@@ -1857,8 +2178,6 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	SHUFFLE_ARRAY_N(selected, nselected);
 
 	for (i = j = 0; i < nselected && j < hcnt; i++, j++) {
-		struct dmesh_entry *dme;
-
 		dme = selected[i];
 		gnet_host_set(&hvec[j], dme->e.url.addr, dme->e.url.port);
 	}
@@ -1974,7 +2293,8 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	uint n;
+	struct dmesh_entry *dme;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2048,9 +2368,10 @@ dmesh_alternate_location(const struct sha1 *sha1,
 				continue;
 
 			if (delta_time(banned->created, last_sent) > 0) {
-				const char *value;
+				char value[ALTLOC_BUFLEN];
 
-				value = host_addr_port_to_string(info->addr, info->port);
+				/* X-Nalt values always carry the port, hence no default */
+				altloc_format(info->addr, info->port, 0, ARYLEN(value));
 				if (!header_fmt_append_value(fmt, value))
 					break;
 				added = TRUE;
@@ -2096,8 +2417,9 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	if (can_share_partials && !GNET_PROPERTY(is_firewalled)) {
-		static const char tls_hex[] = "tls=8";	/* Only us at index zero */
-		size_t url_len;
+		char tls_hex[sizeof "tls=8"];
+		bool tls = tls_enabled();	/* Only us, at index zero */
+		size_t url_len, tls_len;
 		struct dmesh_entry ourselves;
 		time_t now = tm_time();
 
@@ -2109,15 +2431,19 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		ourselves.e.url.name = NULL;
 		ourselves.good = TRUE;
 		ourselves.fw_entry = FALSE;
+		ourselves.alt_len = 0;
 
 		url_len = dmesh_entry_compact(&ourselves, ARYLEN(url));
 		g_assert((size_t) -1 != url_len && url_len < sizeof url);
 
-		if (!header_fmt_value_fits(fmt, url_len + vstrlen(tls_hex)))
+		tls_len = altloc_format_tls(&tls, 1, ARYLEN(tls_hex));
+		g_assert((size_t) -1 != tls_len);
+
+		if (!header_fmt_value_fits(fmt, url_len + tls_len))
 			goto nomore;
 
-		if (tls_enabled()) {
-			/* FIXME: what's the semantic of a leading "tls=8"? */
+		if (tls_len != 0) {
+			/* Flags the first item, ourselves, as supporting TLS */
 			header_fmt_append_value(fmt, tls_hex);
 		}
 		if (header_fmt_append_value(fmt, url))
@@ -2140,7 +2466,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (0 == dm->count) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2159,12 +2485,9 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-
+	DM_FOREACH(dm, n, dme) {
 		if (dme->fw_entry)
 			continue;
 
@@ -2206,12 +2529,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass.
@@ -2220,9 +2542,9 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	SHUFFLE_ARRAY_N(selected, nselected);
 
 	for (i = 0; i < nselected; i++) {
-		struct dmesh_entry *dme = selected[i];
 		size_t url_len;
 
+		dme = selected[i];
 		g_assert(delta_time(dme->inserted, last_sent) > 0);
 
 		url_len = dmesh_entry_compact(dme, ARYLEN(url));
@@ -2292,10 +2614,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	DM_FOREACH(dm, n, dme) {
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2367,8 +2686,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2451,6 +2768,28 @@ dmesh_collect_sha1(const char *value, struct sha1 *sha1)
 	return found;
 }
 
+/**
+ * Context for dmesh_parse_addr_port_list().
+ */
+struct dmesh_parse_ctx {
+	const struct sha1 *sha1;	/**< The SHA1 being parsed */
+	dmesh_add_cb func;			/**< Callback for each parsed item */
+	void *udata;				/**< Opaque user-supplied data */
+};
+
+/**
+ * altloc_parse() callback, dispatching to the user-supplied callback.
+ */
+static void
+dmesh_parse_addr_port_item(host_addr_t addr, uint16 port, bool tls, void *data)
+{
+	struct dmesh_parse_ctx *ctx = data;
+
+	(void) tls;		/* TLS support is not recorded in the mesh */
+
+	(*ctx->func)(ctx->sha1, addr, port, ctx->udata);
+}
+
 /**
  * Parse a list of addr:port, such as typically found in "X-Alt" or "X-Nalt"
  * headers to extract alternate sources.
@@ -2461,66 +2800,33 @@ dmesh_collect_sha1(const char *value, struct sha1 *sha1)
  *
  * where udata is opaque user-supplied data.
  *
+ * In the original X-Alt specs, there could be a GUID in an item if the host
+ * is not directly connectible but LimeWire chose to emit firewalled sources
+ * in a dedicated X-Falt header, and only if the "fwalt" feature was
+ * advertised in X-Features.  Therefore, we only parse a list of IP:port in
+ * X-Alt and X-Nalt.
+ *
  * @return whether we successfully parsed all the altnernate locations.
  */
 static bool
 dmesh_parse_addr_port_list(const struct sha1 *sha1, const char *value,
 	dmesh_add_cb func, void *udata)
 {
-	const char *tls_hex, *p, *next;
-	bool good = TRUE;
-
-	tls_hex = NULL;
-	next = value;
-
-	while (NULL != (p = next)) {
-		const char *start, *endptr;
-		host_addr_t addr;
-		uint16 port;
-		bool ok;
-
-		start = skip_ascii_blanks(p);
-		if ('\0' == *start)
-			break;
+	struct dmesh_parse_ctx ctx;
+	size_t invalid;
 
-		next = strpbrk(start, ",;");
-		if (next) {
-			next++;
-		}
-
-		/* TODO: Handle tls=<hex> */
-		if (NULL == tls_hex && (tls_hex = is_strcaseprefix(start, "tls=")))
-			continue;
+	ctx.sha1 = sha1;
+	ctx.func = func;
+	ctx.udata = udata;
 
-		/*
-		 * In the original X-Alt specs, there could be a GUID here if the host
-		 * is not directly connectible but LimeWire chose to emit firewalled
-		 * sources in a dedicated X-Falt header, and only if the "fwalt" feature
-		 * was advertised in X-Features.
-		 *
-		 * Therefore, we only parse a list of IP:port in X-Alt and X-Nalt.
-		 */
-
-		ok = string_to_host_addr(start, &endptr, &addr);
-		if (ok && ':' == *endptr) {
-			int error;
-
-			port = parse_uint16(&endptr[1], &endptr, 10, &error);
-			ok = !error && port > 0;
-		} else {
-			port = GTA_PORT;
-		}
+	altloc_parse(value, GTA_PORT, dmesh_parse_addr_port_item, &ctx, &invalid);
 
-		if (ok) {
-			(*func)(sha1, addr, port, udata);
-		} else {
-			good = FALSE;
-			if (GNET_PROPERTY(dmesh_debug))
-				g_warning("ignoring invalid compact alt-loc \"%s\"", start);
-		}
+	if (invalid != 0 && GNET_PROPERTY(dmesh_debug)) {
+		g_warning("ignoring %zu invalid compact alt-loc%s in \"%s\"",
+			invalid, plural(invalid), value);
 	}
 
-	return good;
+	return 0 == invalid;
 }
 
 static void
@@ -2948,7 +3254,8 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
+	uint n;
 	int i;
 
 	g_assert(sha1);
@@ -2960,12 +3267,13 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	DM_FOREACH(dm, n, dme) {
 		dmesh_urlinfo_t *from;
 
+		if (i >= count)
+			break;
+
 		if (dme->fw_entry)
 			continue;
 
@@ -2975,8 +3283,6 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		buf[i++] = *from;
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3270,19 +3576,15 @@ dmesh_store_kv(void *value, void *udata)
 {
 	const struct dmesh *dm = value;
 	FILE *out = udata;
-	list_iter_t *iter;
+	const struct dmesh_entry *dme;
+	uint i;
 
 	fprintf(out, "%s\n", sha1_base32(dm->sha1));
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
+	DM_FOREACH(dm, i, dme) {
 		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
 	}
 
-	list_iter_free(&iter);
-
 	fputs("\n", out);
 }
 
@@ -88,6 +88,7 @@
 
 #include "lib/adns.h"
 #include "lib/aging.h"
+#include "lib/altloc.h"
 #include "lib/array.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
@@ -11224,84 +11225,51 @@ is_dumb_spammer(const char *user_agent)
 	return FALSE;
 }
 
+struct xalt_tls_ctx {
+	host_addr_t addr;		/**< Address of the server we're downloading from */
+	uint16 port;			/**< Its port */
+	bool found;				/**< Whether server was listed */
+	bool tls;				/**< Whether server was flagged as supporting TLS */
+};
+
+/**
+ * altloc_parse() callback, looking for the server in the X-Alt list.
+ */
+static void
+xalt_detect_tls_item(host_addr_t addr, uint16 port, bool tls, void *udata)
+{
+	struct xalt_tls_ctx *ctx = udata;
+
+	if (!ctx->found && port == ctx->port && host_addr_equiv(addr, ctx->addr)) {
+		ctx->found = TRUE;
+		ctx->tls = tls;
+	}
+}
+
+/**
+ * Check whether the server lists itself in its X-Alt header, flagged as
+ * supporting TLS by the "tls=<hex>" item.
+ */
 static bool
 xalt_detect_tls_support(struct download *d, header_t *header)
 {
-	const char *tls_hex = NULL, *next;
-	size_t host_index = 0;
-	bool found = FALSE;
+	struct xalt_tls_ctx ctx;
+	const char *value;
 
 	download_check(d);
 
-	next = header_get(header, "X-Alt");
-	while (NULL != next) {
-		const char *start, *endptr, *p;
-		host_addr_t addr;
-		uint16 port;
-		bool ok;
-
-		p = next;
-		start = skip_ascii_blanks(p);
-		if ('\0' == *start)
-			break;
-
-		next = strpbrk(start, ",;");
-		if (next) {
-			next++;
-		}
-
-		if (NULL == tls_hex && (tls_hex = is_strcaseprefix(start, "tls=")))
-			continue;
-
-		/*
-		 * There could be a GUID here if the host is not directly connectible
-		 * but we ignore this apparently.
-		 */
-		ok = string_to_host_addr(start, &endptr, &addr);
-		if (ok && ':' == *endptr) {
-			int error;
-
-			port = parse_uint16(&endptr[1], &endptr, 10, &error);
-			ok = !error && port > 0;
-		} else {
-			port = GTA_PORT;
-		}
-		if (!ok)
-			continue;
-
-		if (
-			port == download_port(d) &&
-			host_addr_equiv(addr, download_addr(d))
-		) {
-			found = TRUE;
-			break;
-		}
-		host_index++;
-	}
-
-	if (found) {
-		size_t i = 0;
+	value = header_get(header, "X-Alt");
+	if (NULL == value)
+		return FALSE;
 
-		if G_UNLIKELY(0 == hex2int_inline('a'))
-			misc_init();	/* Auto-initialization of hex2int_inline() */
+	ctx.addr = download_addr(d);
+	ctx.port = download_port(d);
+	ctx.found = FALSE;
+	ctx.tls = FALSE;
 
-		/*
-		 * We parse something like "tls_hex=4cbd040533a2" whereas
-		 * each nibble refers to the next 4 hosts in the list.
-		 * The MSB refers to the first of these, the LSB to the last.
-		 */
-		while (tls_hex && is_ascii_xdigit(tls_hex[0])) {
-			int nibble, mask;
+	altloc_parse(value, GTA_PORT, xalt_detect_tls_item, &ctx, NULL);
 
-			nibble = hex2int_inline(*tls_hex++);
-			for (mask = 0x8; 0 != mask; mask >>= 1, i++) {
-				if (i == host_index)
-					return 0 != (nibble & mask);
-			}
-		}
-	}
-
-	return FALSE;
+	return ctx.found && ctx.tls;
 }
 
 /**
@@ -58,6 +58,7 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/atoms.h"
+#include "lib/bit_array.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
 #include "lib/glib-missing.h"
@@ -72,6 +73,7 @@
 #include "lib/tm.h"
 #include "lib/vsort.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"		   /* Must be the last header included */
 
@@ -101,6 +103,7 @@
 
 #define DQ_MQ_EPSILON		2048   /**< Queues identical at +/- 2K */
 #define DQ_FUZZY_FACTOR		0.80   /**< Corrector for theoretical horizon */
+#define DQ_SCHED_PERIOD		100	   /**< Scheduler tick period, in ms */
 
 #define DQ_TTL_PROBE		(1 << 8)	/**< Flags probed requests */
 #define DQ_TTL_MASK			(DQ_TTL_PROBE - 1)
@@ -115,24 +118,6 @@
 #define DQ_LEAF_RESULTS		(SEARCH_MAX_RESULTS / 3)
 #define DQ_LOCAL_RESULTS	SEARCH_MAX_RESULTS
 
-/**
- * Structure produced by dq_fill_next_up, representing the nodes to which
- * we could send the query, along with routing information to be able to favor
- * UPs that report a QRP match early in the querying process.
- *
- * Because we save the last array of nodes computed and sorted at each
- * invocation of the querying steps (to avoid costly calls to the
- * qrp_node_can_route() routine if possible), we store both the selected
- * node ID (nodes can disappear between invocations but the ID is unique)
- * and cache the result of qrp_node_can_route() calls into `can_route'.
- */
-struct next_up {
-	struct nid *node_id;	/**< Selected node ID */
-	query_hashvec_t *qhv;	/**< Query hash vector for the query */
-	int can_route;			/**< -1 = unknown, otherwise TRUE / FALSE */
-	int queue_pending;		/**< -1 = unknown, otherwise cached queue size */
-};
-
 typedef enum {
 	DQUERY_MAGIC = 0x53608af3
 } dquery_magic_t;
@@ -167,13 +152,13 @@ typedef struct dquery {
 	uint32 result_timeout;	/**< The current timeout for getting results */
 	uint32 stat_timeouts;	/**< The amount of status request timeouts we had */
 	cevent_t *expire_ev;	/**< Callout queue global expiration event */
-	cevent_t *results_ev;	/**< Callout queue results expiration event */
+	uint64 results_due;		/**< Scheduler time at which step is due */
 	void *alive;			/**< Alive ping stats for computing timeouts */
 	time_t start;			/**< Time at which it started */
 	time_t stop;			/**< Time at which it was terminated */
-	struct next_up *nv;		/**< Previous "next UP vector" */
-	int nv_count;			/**< Number of items allocated for `nv' */
-	int nv_found;			/**< Valid entries in `nv' */
+	bit_array_t *qrp_known;	/**< UP slots whose QRP match is known */
+	bit_array_t *qrp_match;	/**< UP slots whose QRP table matches query */
+	size_t qrp_slots;		/**< Amount of UP slots covered by bitsets */
 	pmsg_t *by_ttl[DQ_MAX_TTL];	/**< Copied mesages, one for each TTL */
 } dquery_t;
 
@@ -189,6 +174,52 @@ enum {
 	DQ_F_ID_CLEANING	= 1 << 0	/**< Cleaning the `by_node_id' table */
 };
 
+/**
+ * An ultrapeer known to the dynamic query scheduler.
+ *
+ * Each ultrapeer is given a slot which remains stable as long as the node
+ * is connected, so that queries can cache the outcome of QRP matching in
+ * bitsets indexed by the slot number.
+ */
+struct dq_up {
+	struct nid *node_id;	/**< Node ID, NULL if slot is free */
+	int pending;			/**< Queued bytes, plus the ones assigned */
+	uint32 tick;			/**< Last tick at which node could be queried */
+};
+
+/**
+ * Structure produced by dq_fill_next_up, representing the nodes to which
+ * we could send the query.
+ */
+struct next_up {
+	struct dq_up *up;		/**< Scheduler slot of the node */
+	gnutella_node_t *node;	/**< The node */
+	dquery_t *dq;			/**< The query being scheduled */
+	size_t slot;			/**< Slot number */
+};
+
+/**
+ * The dynamic query scheduler.
+ *
+ * Queries waiting for their next step are "armed" with a due time instead
+ * of each owning a callout event.  A single periodic event collects all the
+ * queries that are due and processes them in one batch, against a snapshot
+ * of the ultrapeers taken once for that batch.  As queries are assigned to
+ * ultrapeers, the snapshot accounts for the bytes we queue, so that the
+ * next queries in the batch see the updated pressure on each ultrapeer and
+ * spread over the least loaded ones.
+ */
+static struct dq_sched {
+	cperiodic_t *tick_ev;	/**< Shared timer, present when queries armed */
+	hset_t *armed;			/**< Queries waiting for their next step */
+	htable_t *slots;		/**< Maps UP node ID to slot number + 1 */
+	struct dq_up *up;		/**< Ultrapeer slots */
+	size_t up_count;		/**< Allocated slots */
+	uint64 now;				/**< Scheduler time, in ms */
+	uint32 tick;			/**< Current tick number */
+	bool in_tick;			/**< Whether a batch is being processed */
+} dq_sched;
+
 /**
  * This table keeps track of all the dynamic query objects that we have
  * created and which are alive.
@@ -256,6 +287,7 @@ static uint32 hosts[MAX_DEGREE][MAX_TTL];	/**< Pre-computed horizon */
 
 static void dq_send_next(dquery_t *dq);
 static void dq_terminate(dquery_t *dq);
+static void dq_results_expired(dquery_t *dq);
 
 static void
 dquery_check(dquery_t *dq)
@@ -464,6 +496,339 @@ dq_alive(struct nid qid)
 	return dq;
 }
 
+/**
+ * Get the scheduler slot of an ultrapeer, allocating one if needed.
+ *
+ * @return the slot number.
+ */
+static size_t
+dq_sched_slot(const struct nid *node_id)
+{
+	struct dq_sched *ds = &dq_sched;
+	struct dq_up *up;
+	void *value;
+	size_t i;
+
+	value = htable_lookup(ds->slots, node_id);
+	if (value != NULL)
+		return pointer_to_uint(value) - 1;
+
+	for (i = 0; i < ds->up_count; i++) {
+		if (NULL == ds->up[i].node_id)
+			goto found;
+	}
+
+	/*
+	 * No free slot, extend the array.  Slot numbers are kept, only
+	 * their addresses may change.
+	 */
+
+	{
+		size_t count = MAX(8, 2 * ds->up_count);
+
+		XREALLOC_ARRAY(ds->up, count);
+		memset(&ds->up[i], 0, (count - i) * sizeof ds->up[0]);
+		ds->up_count = count;
+	}
+
+found:
+	up = &ds->up[i];
+	up->node_id = nid_ref(node_id);
+	up->pending = 0;
+	up->tick = 0;
+	htable_insert(ds->slots, up->node_id, uint_to_pointer(i + 1));
+
+	return i;
+}
+
+/**
+ * Forget about the QRP match of a released UP slot.
+ * -- hash table iterator callback
+ */
+static void
+dq_qrp_forget(void *value, void *udata)
+{
+	dquery_t *dq = value;
+	size_t slot = pointer_to_uint(udata);
+
+	dquery_check(dq);
+
+	if (slot < dq->qrp_slots)
+		bit_array_clear(dq->qrp_known, slot);
+}
+
+/**
+ * Release scheduler slot of an ultrapeer which is gone.
+ */
+static void
+dq_sched_slot_free(size_t slot)
+{
+	struct dq_up *up = &dq_sched.up[slot];
+
+	g_assert(slot < dq_sched.up_count);
+	g_assert(up->node_id != NULL);
+
+	htable_remove(dq_sched.slots, up->node_id);
+	nid_unref(up->node_id);
+	up->node_id = NULL;
+
+	/*
+	 * The slot will be reused for another ultrapeer, the QRP match
+	 * cached by queries for that slot is therefore meaningless now.
+	 */
+
+	if (dqueries != NULL)
+		hevset_foreach(dqueries, dq_qrp_forget, uint_to_pointer(slot));
+}
+
+/**
+ * Check whether a node can route the query according to its QRP table.
+ *
+ * Because qrp_node_can_route() is costly, the outcome is computed once per
+ * ultrapeer and cached in the query bitsets, indexed by the scheduler slot
+ * of the node.  The QRP table of the node may change during the lifetime
+ * of the query, so the cached outcome is only used to order ultrapeers:
+ * deciding whether to actually send the query to a node must be done by
+ * calling qrp_node_can_route() afresh.
+ *
+ * @param dq		the dynamic query
+ * @param n			the ultrapeer node
+ * @param slot		the scheduler slot of the node
+ */
+static bool
+dq_can_route(dquery_t *dq, const gnutella_node_t *n, size_t slot)
+{
+	dquery_check(dq);
+	g_assert(slot < dq_sched.up_count);
+
+	if G_UNLIKELY(slot >= dq->qrp_slots) {
+		size_t count = dq_sched.up_count;
+
+		bit_array_resize(&dq->qrp_known, dq->qrp_slots, count);
+		bit_array_resize(&dq->qrp_match, dq->qrp_slots, count);
+		dq->qrp_slots = count;
+	}
+
+	if (!bit_array_get(dq->qrp_known, slot)) {
+		bit_array_set(dq->qrp_known, slot);
+
+		if (qrp_node_can_route(n, dq->qhv))
+			bit_array_set(dq->qrp_match, slot);
+		else
+			bit_array_clear(dq->qrp_match, slot);
+	}
+
+	return bit_array_get(dq->qrp_match, slot);
+}
+
+/**
+ * Take a snapshot of the ultrapeers to which we could send queries during
+ * this scheduler tick, along with their current queue pressure.
+ */
+static void
+dq_sched_snapshot(void)
+{
+	struct dq_sched *ds = &dq_sched;
+	const pslist_t *sl;
+	size_t i;
+
+	ds->tick++;
+
+	PSLIST_FOREACH(node_all_ultranodes(), sl) {
+		gnutella_node_t *n = sl->data;
+		struct dq_up *up;
+		size_t slot;
+
+		/*
+		 * Dont bother sending anything to transient nodes, we're going
+		 * to shut them down soon.
+		 */
+
+		if (NODE_IS_TRANSIENT(n) || !NODE_IS_WRITABLE(n))
+			continue;
+
+		/*
+		 * Skip node if we haven't received the handshaking ping yet.
+		 */
+
+		if (n->received == 0)
+			continue;
+
+		/*
+		 * Skip node if we're in TX flow-control (query will likely not
+		 * be transmitted before the next timeout, and it could even be
+		 * dropped) or if we're remotely flow-controlled (no queries to
+		 * be sent for now).
+		 */
+
+		if (NODE_IN_TX_FLOW_CONTROL(n) || n->hops_flow == 0)
+			continue;
+
+		slot = dq_sched_slot(NODE_ID(n));
+		up = &ds->up[slot];
+		up->pending = NODE_MQUEUE_PENDING(n);
+		up->tick = ds->tick;
+	}
+
+	/*
+	 * Release the slots of ultrapeers which are gone.
+	 */
+
+	for (i = 0; i < ds->up_count; i++) {
+		struct dq_up *up = &ds->up[i];
+
+		if (up->node_id != NULL && NULL == node_by_id(up->node_id))
+			dq_sched_slot_free(i);
+	}
+}
+
+/**
+ * @return whether query is waiting for its next step.
+ */
+static inline bool
+dq_results_armed(const dquery_t *dq)
+{
+	return hset_contains(dq_sched.armed, dq);
+}
+
+/**
+ * Stop waiting for the next step of the query.
+ */
+static inline void
+dq_results_disarm(dquery_t *dq)
+{
+	hset_remove(dq_sched.armed, dq);
+}
+
+struct dq_due {
+	struct nid qid;			/**< Query ID */
+	uint64 due;				/**< When query step is due */
+};
+
+struct dq_due_context {
+	struct dq_due *dv;		/**< Due queries */
+	size_t count;			/**< Amount of due queries */
+	size_t size;			/**< Allocated entries */
+};
+
+/**
+ * Collect queries whose next step is due.
+ * -- hash set iterator callback
+ */
+static void
+dq_sched_collect(const void *value, void *udata)
+{
+	const dquery_t *dq = value;
+	struct dq_due_context *ctx = udata;
+
+	if (dq->results_due > dq_sched.now)
+		return;
+
+	g_assert(ctx->count < ctx->size);
+
+	ctx->dv[ctx->count].qid = dq->qid;
+	ctx->dv[ctx->count].due = dq->results_due;
+	ctx->count++;
+}
+
+/**
+ * vsort() callback for sorting queries by increasing due time.
+ */
+static int
+dq_due_cmp(const void *p1, const void *p2)
+{
+	const struct dq_due *d1 = p1, *d2 = p2;
+
+	return CMP(d1->due, d2->due);
+}
+
+/**
+ * Scheduler tick, processing all the queries whose next step is due.
+ *
+ * @return TRUE to keep the periodic event, FALSE when no query is armed.
+ */
+static bool
+dq_sched_tick(void *unused_data)
+{
+	struct dq_sched *ds = &dq_sched;
+	struct dq_due_context ctx;
+	size_t i;
+
+	(void) unused_data;
+	g_assert(!ds->in_tick);
+
+	ds->now += DQ_SCHED_PERIOD;
+
+	ctx.size = hset_count(ds->armed);
+	ctx.count = 0;
+
+	if (0 == ctx.size)
+		goto done;
+
+	XMALLOC_ARRAY(ctx.dv, ctx.size);
+	hset_foreach(ds->armed, dq_sched_collect, &ctx);
+
+	if (ctx.count != 0) {
+		/*
+		 * Older steps are processed first, so that they get to pick the
+		 * least loaded ultrapeers.
+		 */
+
+		vsort(ctx.dv, ctx.count, sizeof ctx.dv[0], dq_due_cmp);
+
+		ds->in_tick = TRUE;
+		dq_sched_snapshot();
+
+		for (i = 0; i < ctx.count; i++) {
+			dquery_t *dq = dq_alive(ctx.dv[i].qid);
+
+			/*
+			 * Processing previous queries can free or re-arm others.
+			 */
+
+			if (NULL == dq || !dq_results_armed(dq))
+				continue;
+
+			if (dq->results_due > ds->now)
+				continue;
+
+			dq_results_disarm(dq);
+			dq_results_expired(dq);
+		}
+
+		ds->in_tick = FALSE;
+	}
+
+	XFREE_NULL(ctx.dv);
+
+done:
+	if (0 != hset_count(ds->armed))
+		return TRUE;
+
+	ds->tick_ev = NULL;
+	return FALSE;		/* Removes periodic event until next query armed */
+}
+
+/**
+ * Arm query for its next step, due in `delay' ms.
+ *
+ * The step is processed by the first scheduler tick past that time,
+ * meaning a null delay defers it to the next tick.
+ */
+static void
+dq_results_arm(dquery_t *dq, uint delay)
+{
+	struct dq_sched *ds = &dq_sched;
+
+	dquery_check(dq);
+
+	dq->results_due = ds->now + delay;
+	hset_insert(ds->armed, dq);
+
+	if (NULL == ds->tick_ev)
+		ds->tick_ev = cq_periodic_main_add(DQ_SCHED_PERIOD, dq_sched_tick, NULL);
+}
+
 /**
  * Free routine for an extended message block.
  */
@@ -534,12 +899,12 @@ dq_pmsg_free(pmsg_t *mb, void *arg)
 		 * If we don't have any more pending message and we're waiting
 		 * for results, chances are we're going to wait for nothing!
 		 *
-		 * We can't re-enter mq from here, so reschedule the event for
-		 * immediate delivery (in 1 ms, since we can't say 0).
+		 * We can't re-enter mq from here, so reschedule the next step
+		 * for the next scheduler tick.
 		 */
 
-		if (0 == dq->pending && dq->results_ev)
-			cq_resched(dq->results_ev, 1);
+		if (0 == dq->pending && dq_results_armed(dq))
+			dq_results_arm(dq, 0);
 
 	} else {
 		/*
@@ -686,10 +1051,11 @@ dq_fill_probe_up(dquery_t *dq, gnutella_node_t **nv, int ncount)
 		if (NODE_IN_TX_FLOW_CONTROL(n) || n->hops_flow == 0)
 			continue;
 
-		if (!qrp_node_can_route(n, dq->qhv))
+		if (!NODE_IS_WRITABLE(n))
 			continue;
 
-		g_assert(NODE_IS_WRITABLE(n));	/* Checked by qrp_node_can_route() */
+		if (!qrp_node_can_route(n, dq->qhv))
+			continue;
 
 		nv[i++] = n;		/* Node or one of its leaves could answer */
 	}
@@ -697,30 +1063,11 @@ dq_fill_probe_up(dquery_t *dq, gnutella_node_t **nv, int ncount)
 	return i;
 }
 
-static void
-dq_free_next_up(dquery_t *dq)
-{
-	dquery_check(dq);
-	g_assert(dq->nv_count >= 0);
-	g_assert(dq->nv_count >= dq->nv_found);
-	g_assert((NULL == dq->nv) ^ (dq->nv_count > 0));
-
-	if (dq->nv) {
-		int i;
-
-		for (i = 0; i < dq->nv_found; i++) {
-			nid_unref(dq->nv[i].node_id);
-		}
-		WFREE_ARRAY(dq->nv, dq->nv_count);
-		dq->nv = NULL;
-		dq->nv_count = 0;
-		dq->nv_found = 0;
-	}
-}
-
 /**
  * Fill node vector with UP hosts to which we could send our next query.
  *
+ * Candidates are taken from the scheduler snapshot of the current tick.
+ *
  * @param dq		the dynamic query
  * @param nv		the pre-allocated new node vector
  * @param ncount	the size of the vector
@@ -730,35 +1077,15 @@ dq_free_next_up(dquery_t *dq)
 static int
 dq_fill_next_up(dquery_t *dq, struct next_up *nv, int ncount)
 {
-	const pslist_t *sl;
+	struct dq_sched *ds = &dq_sched;
+	size_t slot;
 	int i = 0;
-	htable_t *old = NULL;
 
 	dquery_check(dq);
+	g_assert(ds->in_tick);
 
-	/*
-	 * To save time and avoid too many calls to qrp_node_can_route(), we
-	 * look at a previous node vector that we could have filled and record
-	 * the associations between the node IDs and the "next_up" structure.
-	 */
-
-	if (dq->nv != NULL) {
-		int j;
-
-		old = htable_create_any(nid_hash, nid_hash2, nid_equal);
-
-		for (j = 0; j < dq->nv_found; j++) {
-			struct next_up *nup = &dq->nv[j];
-			htable_insert(old, nup->node_id, nup);
-		}
-	}
-
-	/*
-	 * Select candidate ultra peers for sending query.
-	 */
-
-	PSLIST_FOREACH(node_all_ultranodes(), sl) {
-		struct next_up *nup, *old_nup;
+	for (slot = 0; slot < ds->up_count; slot++) {
+		struct dq_up *up = &ds->up[slot];
 		gnutella_node_t *n;
 		const void *knid;
 		void *ttlv;
@@ -767,33 +1094,32 @@ dq_fill_next_up(dquery_t *dq, struct next_up *nv, int ncount)
 		if (i >= ncount)
 			break;
 
-		n = sl->data;
-
 		/*
-		 * Dont bother sending anything to transient nodes, we're going
-		 * to shut them down soon.
+		 * Skip nodes we could not query when the snapshot was taken,
+		 * and nodes that went away or became unwritable since then.
 		 */
 
-		if (NODE_IS_TRANSIENT(n) || !NODE_IS_WRITABLE(n))
+		if (NULL == up->node_id || up->tick != ds->tick)
+			continue;
+
+		n = node_by_id(up->node_id);
+
+		if (NULL == n || !NODE_IS_WRITABLE(n))
 			continue;
 
 		/*
 		 * Skip node if we already have a pending query.
 		 */
 
-		if (hset_contains(dq->enqueued, NODE_ID(n)))
+		if (hset_contains(dq->enqueued, up->node_id))
 			continue;
 
 		/*
-		 * Skip node if we haven't received the handshaking ping yet
-		 * or if we already queried it at a lower TTL (and it did not
+		 * Skip node if we already queried it at a lower TTL (and it did not
 		 * advertise support for probing queries).
 		 */
 
-		if (n->received == 0)
-			continue;
-
-		found = htable_lookup_extended(dq->queried, NODE_ID(n), &knid, &ttlv);
+		found = htable_lookup_extended(dq->queried, up->node_id, &knid, &ttlv);
 
 		if (found) {
 			if (!(n->attrs & NODE_A_DQ_PROBE))
@@ -802,49 +1128,13 @@ dq_fill_next_up(dquery_t *dq, struct next_up *nv, int ncount)
 				continue;	/* Node already queried and not through a probe */
 		}
 
-		/*
-		 * Skip node if we're in TX flow-control (query will likely not
-		 * be transmitted before the next timeout, and it could even be
-		 * dropped) or if we're remotely flow-controlled (no queries to
-		 * be sent for now).
-		 */
-
-		if (NODE_IN_TX_FLOW_CONTROL(n) || n->hops_flow == 0)
-			continue;
-
-		nup = &nv[i++];
-
-		/*
-		 * If there's an old entry known for this node, copy its `can_route'
-		 * information, assuming it did not change since last time (reasonable
-		 * assumption, and we use this only for sorting so it's not critical
-		 * to not have it accurate).
-		 */
-
-		nup->node_id = nid_ref(NODE_ID(n)); /* To be able to compare */
-		nup->qhv = dq->qhv;
-
-		if (old && NULL != (old_nup = htable_lookup(old, nup->node_id))) {
-			g_assert(nid_equal(NODE_ID(n), old_nup->node_id));
-			nup->can_route = old_nup->can_route;
-		} else
-			nup->can_route = -1;	/* We don't know yet */
+		nv[i].up = up;
+		nv[i].node = n;
+		nv[i].dq = dq;
+		nv[i].slot = slot;
+		i++;
 	}
 
-	/*
-	 * Discard old vector and save new.
-	 */
-
-	if (old) {
-		g_assert(dq->nv != NULL);
-		dq_free_next_up(dq);
-		htable_free_null(&old);
-	}
-
-	dq->nv = nv;
-	dq->nv_count = ncount;
-	dq->nv_found = i;
-
 	return i;
 }
 
@@ -912,7 +1202,7 @@ dq_free(dquery_t *dq)
 			nid_to_string2(dq->node_id), dq->ttl, dq->up_sent, dq->horizon,
 			dq->results, dq->linger_results);
 
-	cq_cancel(&dq->results_ev);
+	dq_results_disarm(dq);
 	cq_cancel(&dq->expire_ev);
 
 	/*
@@ -949,7 +1239,8 @@ dq_free(dquery_t *dq)
 	hset_free_null(&dq->enqueued);
 
 	qhvec_free(dq->qhv);
-	dq_free_next_up(dq);
+	HFREE_NULL(dq->qrp_known);
+	HFREE_NULL(dq->qrp_match);
 
 	for (i = 0; i < DQ_MAX_TTL; i++) {
 		if (dq->by_ttl[i] != NULL) {
@@ -1069,17 +1360,16 @@ dq_expired(cqueue_t *cq, void *obj)
 	 * that come back after we stopped querying.
 	 */
 
-	cq_cancel(&dq->results_ev);
+	dq_results_disarm(dq);
 	dq_terminate(dq);
 }
 
 /**
- * Callout queue callback invoked when the result timer has expired.
+ * Invoked by the scheduler when the result timer has expired.
  */
 static void
-dq_results_expired(cqueue_t *cq, void *obj)
+dq_results_expired(dquery_t *dq)
 {
-	dquery_t *dq = obj;
 	gnutella_node_t *n;
 	int timeout;
 	uint32 avg;
@@ -1088,9 +1378,7 @@ dq_results_expired(cqueue_t *cq, void *obj)
 
 	dquery_check(dq);
 	g_assert(!(dq->flags & DQ_F_LINGER));
-	g_assert(dq->results_ev != NULL);
-
-	cq_zero(cq, &dq->results_ev);	/* Indicates callback fired */
+	g_assert(!dq_results_armed(dq));
 
 	/*
 	 * If we were waiting for a status reply from the queryier, well, we
@@ -1219,7 +1507,7 @@ dq_results_expired(cqueue_t *cq, void *obj)
 		g_debug("DQ[%s] status reply timeout set to %d s",
 			nid_to_string(&dq->qid), timeout / 1000);
 
-	dq->results_ev = cq_main_insert(timeout, dq_results_expired, dq);
+	dq_results_arm(dq, timeout);
 }
 
 /**
@@ -1231,7 +1519,7 @@ dq_terminate(dquery_t *dq)
 	int delay;
 
 	g_assert(!(dq->flags & DQ_F_LINGER));
-	g_assert(dq->results_ev == NULL);
+	g_assert(!dq_results_armed(dq));
 
 	/*
 	 * Put the query in lingering mode, so we can continue to monitor
@@ -1285,50 +1573,37 @@ node_mq_cmp(const void *np1, const void *np2)
 /**
  * qsort() callback for sorting nodes by increasing queue size, with a
  * preference towards nodes that have a QRP match.
+ *
+ * Queue sizes come from the scheduler snapshot, which also accounts for the
+ * queries assigned to each node since the snapshot was taken.
  */
 static int
 node_mq_qrp_cmp(const void *np1, const void *np2)
 {
-	struct next_up *nu1 = deconstify_pointer(np1);
-	struct next_up *nu2 = deconstify_pointer(np2);
-	const gnutella_node_t *n1, *n2;
-	int qs1 = nu1->queue_pending;
-	int qs2 = nu2->queue_pending;
-
-	/*
-	 * Cache the results of NODE_MQUEUE_PENDING() since it involves
-	 * several function calls to go down to the link layer buffers.
-	 */
-
-	n1 = node_by_id(nu1->node_id);
-	n2 = node_by_id(nu2->node_id);
-
-	if (qs1 == -1) {
-		qs1 = nu1->queue_pending = NODE_MQUEUE_PENDING(n1);
-	}
-	if (qs2 == -1)
-		qs2 = nu2->queue_pending = NODE_MQUEUE_PENDING(n2);
+	const struct next_up *nu1 = np1;
+	const struct next_up *nu2 = np2;
+	int qs1 = nu1->up->pending;
+	int qs2 = nu2->up->pending;
 
 	/*
 	 * If queue sizes are rather identical, compare based on whether
 	 * the node can route or not (i.e. whether it advertises a "match"
 	 * in its QRP table).
 	 *
-	 * Since this determination is a rather costly operation, cache it.
+	 * Since this determination is a rather costly operation, it is cached
+	 * by dq_can_route().
 	 */
 
 	if (ABS(qs1 - qs2) < DQ_MQ_EPSILON) {
-		if (nu1->can_route == -1)
-			nu1->can_route = qrp_node_can_route(n1, nu1->qhv);
-		if (nu2->can_route == -1)
-			nu2->can_route = qrp_node_can_route(n2, nu2->qhv);
+		bool r1 = dq_can_route(nu1->dq, nu1->node, nu1->slot);
+		bool r2 = dq_can_route(nu2->dq, nu2->node, nu2->slot);
 
-		if (!nu1->can_route == !nu2->can_route) {
+		if (r1 == r2) {
 			/* Both can equally route or not route */
 			return CMP(qs1, qs2);
 		}
 
-		return nu1->can_route ? -1 : +1;
+		return r1 ? -1 : +1;
 	}
 
 	return qs1 < qs2 ? -1 : +1;
@@ -1394,8 +1669,8 @@ dq_send_query(dquery_t *dq, gnutella_node_t *n, int ttl, bool probe)
 static void
 dq_send_next(dquery_t *dq)
 {
-	struct next_up *nv;
-	int ncount = GNET_PROPERTY(max_connections);
+	struct next_up *nv = NULL;
+	int ncount = dq_sched.up_count;
 	int found;
 	int timeout;
 	int i;
@@ -1403,8 +1678,9 @@ dq_send_next(dquery_t *dq)
 	uint32 results;
 
 	dquery_check(dq);
-	g_assert(dq->results_ev == NULL);
+	g_assert(!dq_results_armed(dq));
 	g_assert(!(dq->flags & DQ_F_LINGER));
+	g_assert(dq_sched.in_tick);
 
 	/*
 	 * Terminate query immediately if we're no longer an UP.
@@ -1482,16 +1758,16 @@ dq_send_next(dquery_t *dq)
 		if (GNET_PROPERTY(dq_debug) > 19)
 			g_debug("DQ[%s] waiting for %u ms (pending=%u)",
 				nid_to_string(&dq->qid), dq->result_timeout, dq->pending);
-		dq->results_ev = cq_main_insert(
-			dq->result_timeout, dq_results_expired, dq);
+		dq_results_arm(dq, dq->result_timeout);
 		return;
 	}
 
+	if (0 == ncount)
+		goto terminate;	/* No UP known to the scheduler */
+
 	WALLOC_ARRAY(nv, ncount);
 	found = dq_fill_next_up(dq, nv, ncount);
 
-	g_assert(dq->nv == nv);		/* Saved for next time */
-
 	if (GNET_PROPERTY(dq_debug) > 19)
 		g_debug("DQ[%s] still %d UP%s to query (results %sso far: %u)",
 			nid_to_string(&dq->qid), found, plural(found),
@@ -1516,13 +1792,12 @@ dq_send_next(dquery_t *dq)
 	 */
 
 	for (i = 0; i < found; i++) {
-		gnutella_node_t *node;
-		struct nid *nid = nv[i].node_id;
+		gnutella_node_t *node = nv[i].node;
+		const struct nid *nid = nv[i].up->node_id;
 		const void *knid;
 		void *ttlv;
 		unsigned ttl;
 
-		node = node_by_id(nid);
 		ttl = dq_select_ttl(dq, node, found);
 
 		/*
@@ -1566,6 +1841,13 @@ dq_send_next(dquery_t *dq)
 
 		dq_send_query(dq, node, ttl, FALSE);
 		sent = TRUE;
+
+		/*
+		 * Account for the query we just queued, so that the next queries
+		 * scheduled during this tick see the increased pressure on the node.
+		 */
+
+		nv[i].up->pending += pmsg_written_size(dq->mb);
 		break;
 	}
 
@@ -1603,11 +1885,15 @@ dq_send_next(dquery_t *dq)
 			nid_to_string(&dq->qid), (int) (tm_time() - dq->start),
 			timeout, dq->pending);
 
-	dq->results_ev = cq_main_insert(timeout, dq_results_expired, dq);
-	return;
+	dq_results_arm(dq, timeout);
+	goto cleanup;
 
 terminate:
 	dq_terminate(dq);
+
+cleanup:
+	if (nv != NULL)
+		WFREE_ARRAY(nv, ncount);
 }
 
 /**
@@ -1625,7 +1911,7 @@ dq_send_probe(dquery_t *dq)
 	int i;
 
 	dquery_check(dq);
-	g_assert(dq->results_ev == NULL);
+	g_assert(!dq_results_armed(dq));
 	g_assert(!(dq->flags & DQ_F_LINGER));
 
 	WALLOC_ARRAY(nv, ncount);
@@ -1638,11 +1924,11 @@ dq_send_probe(dquery_t *dq)
 	/*
 	 * If we don't find any suitable UP holding that content, then
 	 * the query might be for something that is rare enough.  Start
-	 * the sequential probing.
+	 * the sequential probing at the next scheduler tick.
 	 */
 
 	if (found == 0) {
-		dq_send_next(dq);
+		dq_results_arm(dq, 0);
 		goto cleanup;
 	}
 
@@ -1681,9 +1967,8 @@ dq_send_probe(dquery_t *dq)
 	 * assse how popular the query is.
 	 */
 
-	dq->results_ev = cq_main_insert(
-		MIN(found, DQ_PROBE_UP) * (DQ_PROBE_TIMEOUT + dq->result_timeout),
-		dq_results_expired, dq);
+	dq_results_arm(dq,
+		MIN(found, DQ_PROBE_UP) * (DQ_PROBE_TIMEOUT + dq->result_timeout));
 
 cleanup:
 	WFREE_ARRAY(nv, ncount);
@@ -2493,7 +2778,7 @@ dq_got_query_status(const struct guid *muid,
 		dq->flags |= DQ_F_USR_CANCELLED;
 
 		if (!(dq->flags & DQ_F_LINGER)) {
-			cq_cancel(&dq->results_ev);
+			dq_results_disarm(dq);
 			dq_terminate(dq);
 		}
 		return;
@@ -2504,12 +2789,10 @@ dq_got_query_status(const struct guid *muid,
 	 */
 
 	if (dq->flags & DQ_F_WAITING) {
-		g_assert(dq->results_ev != NULL);	/* The "timeout" for status */
+		g_assert(dq_results_armed(dq));	/* The "timeout" for status */
 
-		cq_cancel(&dq->results_ev);
 		dq->flags &= ~DQ_F_WAITING;
-
-		dq_send_next(dq);
+		dq_results_arm(dq, 0);			/* Next step at next tick */
 		return;
 	}
 }
@@ -2624,6 +2907,8 @@ dq_init(void)
 	by_muid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	by_leaf_muid = hikset_create(
 		offsetof(struct dquery, lmuid), HASH_KEY_FIXED, GUID_RAW_SIZE);
+	dq_sched.armed = hset_create(HASH_KEY_SELF, 0);
+	dq_sched.slots = htable_create_any(nid_hash, nid_hash2, nid_equal);
 	fill_hosts();
 }
 
@@ -2717,6 +3002,22 @@ dq_close(void)
 
 	hikset_foreach(by_leaf_muid, free_leaf_muid, NULL);
 	hikset_free_null(&by_leaf_muid);
+
+	cq_periodic_remove(&dq_sched.tick_ev);
+	hset_free_null(&dq_sched.armed);
+
+	{
+		size_t i;
+
+		for (i = 0; i < dq_sched.up_count; i++) {
+			if (dq_sched.up[i].node_id != NULL)
+				nid_unref(dq_sched.up[i].node_id);
+		}
+	}
+
+	htable_free_null(&dq_sched.slots);
+	XFREE_NULL(dq_sched.up);
+	dq_sched.up_count = 0;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -39,6 +39,7 @@
 #include "extensions.h"
 #include "ggep.h"
 
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/halloc.h"
@@ -104,6 +105,7 @@ typedef struct extdesc {
 	uint16 ext_phys_paylen;		/**< Extension payload length */
 	uint16 ext_paylen;			/**< "virtual" payload length */
 	uint16 ext_rpaylen;			/**< Length of buffer for "virtual" payload */
+	bool ext_arena;				/**< Allocated from the thread arena */
 
 	union {
 		struct {
@@ -324,18 +326,72 @@ rw_is_sorted(const char *name,
 	}
 }
 
+/*
+ * Known GGEP IDs are mapped to slots through a hash of their name, which
+ * is computed as the ID is read from the message, so that we can screen
+ * them with a direct lookup instead of a dichotomic search.
+ */
+
+#define GGEP_SLOTS		256			/**< Must be a power of 2 */
+#define GGEP_SLOT_MASK	(GGEP_SLOTS - 1)
+
+#define GGEP_ID_HASH(h,c)	((h) * 31 + (uchar) (c))
+#define GGEP_ID_SLOT(h)		(((h) ^ ((h) >> 8)) & GGEP_SLOT_MASK)
+
+static uint8 ggep_slot[GGEP_SLOTS];	/**< Index + 1 in ggeptable[], 0 if free */
+
 /**
+ * Fill the slot table from the GGEP extension table.
+ */
+static void G_COLD
+rw_ggep_slot_init(void)
+{
+	size_t i;
+
+	STATIC_ASSERT(N_ITEMS(ggeptable) < GGEP_SLOTS / 2);
+
+	for (i = 0; i < N_ITEMS(ggeptable); i++) {
+		const char *p;
+		uint h = 0, slot;
+
+		for (p = ggeptable[i].rw_name; *p != '\0'; p++)
+			h = GGEP_ID_HASH(h, *p);
+
+		for (slot = GGEP_ID_SLOT(h); 0 != ggep_slot[slot]; /* empty */)
+			slot = (slot + 1) & GGEP_SLOT_MASK;
+
+		ggep_slot[slot] = i + 1;
+	}
+}
+
+/**
+ * @param word		the GGEP ID
+ * @param hash		the hash of the ID, as computed by GGEP_ID_HASH()
+ * @param retkw		where the static shared string of known IDs is returned
+ *
  * @return the GGEP token value upon success, EXT_T_UNKNOWN_GGEP if not found.
  * If keyword was found, its static shared string is returned in `retkw'.
  */
 static ext_token_t
-rw_ggep_screen(char *word, const char **retkw)
+rw_ggep_screen(const char *word, uint hash, const char **retkw)
 {
-	ext_token_t t;
-
-	t = rw_screen(TRUE, ggeptable, N_ITEMS(ggeptable), word, retkw);
+	uint slot, idx;
+
+	for (
+		slot = GGEP_ID_SLOT(hash);
+		0 != (idx = ggep_slot[slot]);
+		slot = (slot + 1) & GGEP_SLOT_MASK
+	) {
+		const struct rwtable *e = &ggeptable[idx - 1];
+
+		if (0 == strcmp(e->rw_name, word)) {
+			*retkw = e->rw_name;
+			return e->rw_token;
+		}
+	}
 
-	return (t == EXT_T_UNKNOWN) ? EXT_T_UNKNOWN_GGEP : t;
+	*retkw = NULL;
+	return EXT_T_UNKNOWN_GGEP;
 }
 
 /**
@@ -408,6 +464,39 @@ ext_names_kv_free(const void *key, void *value, void *unused_udata)
 	wfree(deconstify_pointer(key), 1 + vstrlen(key));
 }
 
+/**
+ * Allocate a new extension descriptor.
+ *
+ * Whilst a message is being processed, descriptors are taken from the
+ * thread arena since they will not outlive the message.
+ */
+static extdesc_t *
+ext_desc_alloc(void)
+{
+	arena_t *ar = arena_scope();
+	extdesc_t *d;
+
+	if (ar != NULL) {
+		d = arena_alloc(ar, sizeof *d);
+		d->ext_arena = TRUE;
+	} else {
+		WALLOC(d);
+		d->ext_arena = FALSE;
+	}
+
+	return d;
+}
+
+/**
+ * Free extension descriptor.
+ */
+static void
+ext_desc_free(extdesc_t *d)
+{
+	if (!d->ext_arena)
+		WFREE(d);
+}
+
 /***
  *** Extension parsing.
  ***
@@ -440,7 +529,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	for (count = 0; count < exvcnt && p < end; /* empty */) {
 		uchar flags;
 		char id[GGEP_F_IDLEN + 1];
-		uint id_len, data_length, i;
+		uint id_len, data_length, i, id_hash = 0;
 		bool length_ended = FALSE;
 		const char *name;
 		extdesc_t *d;
@@ -480,6 +569,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 			if (c == '\0' || !isascii(c) || is_ascii_cntrl(c))
 				goto abort;
 			id[i] = c;
+			id_hash = GGEP_ID_HASH(id_hash, c);
 		}
 		id[i] = '\0';
 
@@ -566,7 +656,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 * OK, at this point we have validated the GGEP header.
 		 */
 
-		WALLOC(d);
+		d = ext_desc_alloc();
 
 		d->ext_phys_payload = p;
 		d->ext_phys_paylen = data_length;
@@ -592,7 +682,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 */
 
 		exv->ext_type = EXT_GGEP;
-		exv->ext_token = rw_ggep_screen(id, &name);
+		exv->ext_token = rw_ggep_screen(id, id_hash, &name);
 		exv->ext_name = name;
 
 		if (name != NULL)
@@ -628,7 +718,7 @@ abort:
 
 	while (count--) {
 		exv--;
-		wfree(exv->opaque, sizeof(extdesc_t));
+		ext_desc_free(exv->opaque);
 		exv->opaque = NULL;
 	}
 
@@ -655,7 +745,7 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -782,7 +872,7 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 found:
 	g_assert(payload_start);
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = payload_start;
 	d->ext_phys_paylen = data_length;
@@ -831,7 +921,7 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * We don't analyze the XML, encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -911,7 +1001,7 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -970,7 +1060,7 @@ ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -1044,7 +1134,7 @@ ext_merge_adjacent(extvec_t *exv, extvec_t *next)
 	g_assert(
 		nd->ext_payload == NULL || nd->ext_payload == nd->ext_phys_payload);
 
-	WFREE(nd);
+	ext_desc_free(nd);
 	next->opaque = NULL;
 }
 
@@ -1769,8 +1859,13 @@ ext_ggep_decode(const extvec_t *e)
 	 */
 
 	if (d->ext_ggep_cobs) {
-		uncobs = walloc(plen);		/* At worse slightly oversized */
-		uncobs_len = plen;
+		if (d->ext_arena) {
+			uncobs = arena_alloc(arena_scope(), plen);
+			uncobs_len = 0;			/* Signals it was not walloc()'ed */
+		} else {
+			uncobs = walloc(plen);	/* At worse slightly oversized */
+			uncobs_len = plen;
+		}
 
 		if (!cobs_decode_into(pbase, plen, uncobs, plen, &result)) {
 			if (GNET_PROPERTY(ggep_debug))
@@ -1784,7 +1879,7 @@ ext_ggep_decode(const extvec_t *e)
 
 			d->ext_payload = uncobs;
 			d->ext_paylen = result;
-			d->ext_rpaylen = plen;		/* Signals it was walloc()'ed */
+			d->ext_rpaylen = plen;		/* Signals it was not halloc()'ed */
 
 			return;
 		} else {
@@ -1816,7 +1911,7 @@ ext_ggep_decode(const extvec_t *e)
 
 	/* FALL THROUGH */
 out:
-	if (uncobs != NULL)
+	if (uncobs_len != 0)
 		wfree(uncobs, uncobs_len);
 
 	/*
@@ -2222,14 +2317,14 @@ ext_reset(extvec_t *exv, int exvcnt)
 			void *p = deconstify_pointer(d->ext_payload);
 			if (d->ext_rpaylen == 0) {
 				HFREE_NULL(p);
-			} else {
+			} else if (!d->ext_arena) {
 				wfree(p, d->ext_rpaylen);
 				p = NULL;
 			}
 			d->ext_payload = NULL;
 		}
 
-		WFREE(d);
+		ext_desc_free(d);
 		e->opaque = NULL;
 	}
 }
@@ -2263,6 +2358,7 @@ ext_init(void)
 
 	rw_is_sorted("ggeptable", ggeptable, N_ITEMS(ggeptable));
 	rw_is_sorted("urntable", urntable, N_ITEMS(urntable));
+	rw_ggep_slot_init();
 }
 
 /**
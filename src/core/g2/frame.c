@@ -167,6 +167,7 @@
 #include "frame.h"
 #include "tree.h"
 
+#include "lib/arena.h"
 #include "lib/endian.h"
 #include "lib/halloc.h"
 #include "lib/unsigned.h"
@@ -182,6 +183,7 @@
 struct frame_dctx {
 	const void *p;				/* Reading pointer */
 	const void *end;			/* End of reading buffer */
+	arena_t *arena;				/* Arena for tree nodes, NULL if none */
 	unsigned copy:1;			/* Whether to copy payload data */
 };
 
@@ -273,61 +275,79 @@ g2_frame_read_data(struct frame_dctx *dctx, void *dst, size_t len)
 }
 
 /**
- * Recursively deserialize the G2 packet.
+ * Decode the header of the G2 packet: control byte, length, name.
  *
- * @return NULL if an error occurred, the deserialized tree otherwise.
+ * Upon return, the reading pointer is on the first byte after the header.
+ *
+ * @param dctx		the deserialization context
+ * @param control	where the control byte is stored
+ * @param name		where the NUL-terminated packet name is written
+ * @param length	where the length of the packet, after the header, is stored
+ *
+ * @return TRUE if OK and the whole packet fits in the buffer.
  */
-static g2_tree_t *
-g2_frame_recursive_deserialize(struct frame_dctx *dctx)
+static bool
+g2_frame_read_header(struct frame_dctx *dctx,
+	uint8 *control, char name[G2_FRAME_NAME_LEN_MAX + 1], size_t *length)
 {
-	uint8 control;
-	char name[G2_FRAME_NAME_LEN_MAX + 1];
-	size_t length, bytelen, namelen, remain, paylen;
-	g2_tree_t *node;
-	const void *start;
+	size_t bytelen, namelen, remain;
 
-	/*
-	 * Decode the header: control byte, length, name.
-	 */
-
-	if (!g2_frame_read_byte(dctx, &control))
-		return NULL;
+	if (!g2_frame_read_byte(dctx, control))
+		return FALSE;
 
-	if (control & G2_FRAME_BE)
-		return NULL;				/* Only handle little-endian packets */
+	if (*control & G2_FRAME_BE)
+		return FALSE;				/* Only handle little-endian packets */
 
-	if (0 == control)
-		return NULL;				/* End of stream */
+	if (0 == *control)
+		return FALSE;				/* End of stream */
 
-	bytelen = G2_BYTELEN(control);
-	namelen = G2_NAMELEN(control);
+	bytelen = G2_BYTELEN(*control);
+	namelen = G2_NAMELEN(*control);
 
 	if (0 != bytelen) {
-		if (!g2_frame_read_length(dctx, bytelen, &length))
-			return NULL;
+		if (!g2_frame_read_length(dctx, bytelen, length))
+			return FALSE;
 	} else {
-		length = 0;
+		*length = 0;
 	}
 
 	if (!g2_frame_read_data(dctx, name, namelen))
-		return NULL;
+		return FALSE;
 
 	name[namelen] = '\0';
-	start = dctx->p;				/* First byte after header */
 
 	/*
 	 * Make sure the whole packet fits into what we were given to deserialize.
 	 */
 
 	remain = ptr_diff(dctx->end, dctx->p);
-	if (remain < length)
+	return remain >= *length;
+}
+
+/**
+ * Recursively deserialize the G2 packet.
+ *
+ * @return NULL if an error occurred, the deserialized tree otherwise.
+ */
+static g2_tree_t *
+g2_frame_recursive_deserialize(struct frame_dctx *dctx)
+{
+	uint8 control;
+	char name[G2_FRAME_NAME_LEN_MAX + 1];
+	size_t length, paylen;
+	g2_tree_t *node;
+	const void *start;
+
+	if (!g2_frame_read_header(dctx, &control, name, &length))
 		return NULL;
 
+	start = dctx->p;				/* First byte after header */
+
 	/*
 	 * OK, create the node.  We don't know whether there will be a payload yet.
 	 */
 
-	node = g2_tree_alloc_empty(name);
+	node = g2_tree_alloc_empty_arena(name, dctx->arena);
 
 	/*
 	 * If it is a compound packet, deserialize its children.
@@ -340,6 +360,7 @@ g2_frame_recursive_deserialize(struct frame_dctx *dctx)
 		childctx.p = dctx->p;
 		childctx.end = const_ptr_add_offset(dctx->p, length);
 		childctx.copy = dctx->copy;
+		childctx.arena = dctx->arena;
 
 		while (ptr_cmp(childctx.p, childctx.end) < 0) {
 			const uint8 *cptr = childctx.p;		/* Control byte location */
@@ -397,6 +418,165 @@ failure:
 	return NULL;
 }
 
+/**
+ * Recursively validate the framing of the G2 packet, without building
+ * anything.
+ *
+ * @return TRUE if the packet is well-formed, the reading pointer being then
+ * moved to the first byte after the packet.
+ */
+static bool
+g2_frame_recursive_validate(struct frame_dctx *dctx)
+{
+	uint8 control;
+	char name[G2_FRAME_NAME_LEN_MAX + 1];
+	size_t length, paylen;
+	const void *start;
+
+	if (!g2_frame_read_header(dctx, &control, name, &length))
+		return FALSE;
+
+	start = dctx->p;				/* First byte after header */
+
+	if (length != 0 && (control & G2_FRAME_CF)) {
+		struct frame_dctx childctx;
+		size_t children = 0;
+
+		childctx.p = dctx->p;
+		childctx.end = const_ptr_add_offset(dctx->p, length);
+
+		while (ptr_cmp(childctx.p, childctx.end) < 0) {
+			const uint8 *cptr = childctx.p;		/* Control byte location */
+
+			if (0 == *cptr) {		/* End of child stream */
+				childctx.p++;
+				break;
+			}
+
+			children++;
+
+			if (!g2_frame_recursive_validate(&childctx))
+				return FALSE;
+		}
+
+		if (0 == children)
+			return FALSE;
+
+		dctx->p = childctx.p;
+	}
+
+	paylen = length - ptr_diff(dctx->p, start);
+
+	if (!size_is_non_negative(paylen))
+		return FALSE;				/* Length was bad, we got garbage */
+
+	dctx->p = const_ptr_add_offset(dctx->p, paylen);
+
+	g_assert(ptr_cmp(dctx->p, dctx->end) <= 0);
+
+	return TRUE;
+}
+
+/**
+ * Create a node for the already validated G2 packet at the reading position,
+ * recording its serialized children without parsing them.
+ *
+ * Children are skipped over using their length, so that only the boundary
+ * between the children and the payload of the packet needs to be located.
+ *
+ * @return the new node, the reading pointer being moved past the packet.
+ */
+static g2_tree_t *
+g2_frame_lazy_node(struct frame_dctx *dctx)
+{
+	uint8 control;
+	char name[G2_FRAME_NAME_LEN_MAX + 1];
+	size_t length, paylen;
+	g2_tree_t *node;
+	const void *start, *end, *payload;
+	bool ok;
+
+	ok = g2_frame_read_header(dctx, &control, name, &length);
+	g_assert(ok);					/* Packet was validated */
+
+	start = payload = dctx->p;		/* First byte after header */
+	end = const_ptr_add_offset(start, length);
+
+	node = g2_tree_alloc_empty_arena(name, dctx->arena);
+
+	if (length != 0 && (control & G2_FRAME_CF)) {
+		struct frame_dctx childctx;
+		const void *cend = end;			/* End of children */
+
+		childctx.p = start;
+		childctx.end = end;
+
+		while (ptr_cmp(childctx.p, end) < 0) {
+			uint8 ccontrol;
+			char cname[G2_FRAME_NAME_LEN_MAX + 1];
+			size_t clength;
+
+			if (0 == *(const uint8 *) childctx.p) {	/* End of child stream */
+				cend = childctx.p;
+				childctx.p = const_ptr_add_offset(childctx.p, 1);
+				break;
+			}
+
+			ok = g2_frame_read_header(&childctx, &ccontrol, cname, &clength);
+			g_assert(ok);
+
+			childctx.p = const_ptr_add_offset(childctx.p, clength);
+		}
+
+		g2_tree_set_lazy_children(node, start, ptr_diff(cend, start));
+		payload = childctx.p;
+	}
+
+	paylen = ptr_diff(end, payload);
+
+	if (0 != paylen)
+		g2_tree_set_payload(node, payload, paylen, FALSE);
+
+	dctx->p = end;
+
+	return node;
+}
+
+/**
+ * Parse the serialized children of a node whose packet was lazily
+ * deserialized, adding them to the node.
+ *
+ * The children are themselves lazy: their own children are only parsed
+ * when they are accessed.
+ *
+ * @param parent	the node whose children we are parsing
+ * @param buf		start of the serialized children
+ * @param len		length of the serialized children
+ * @param ar		the arena to use for the new nodes (NULL if none)
+ */
+void
+g2_frame_expand(g2_tree_t *parent, const void *buf, size_t len, arena_t *ar)
+{
+	struct frame_dctx dctx;
+
+	g_assert(buf != NULL);
+	g_assert(size_is_positive(len));
+
+	dctx.p = buf;
+	dctx.end = const_ptr_add_offset(buf, len);
+	dctx.copy = FALSE;
+	dctx.arena = ar;
+
+	while (ptr_cmp(dctx.p, dctx.end) < 0)
+		g2_tree_add_child(parent, g2_frame_lazy_node(&dctx));
+
+	/*
+	 * Restore the order of children since g2_tree_add_child() prepends.
+	 */
+
+	g2_tree_reverse_children(parent);
+}
+
 /**
  * Probe the leading of the supplied buffer to know how long the G2 packet
  * is in the serialized form.
@@ -517,6 +697,10 @@ g2_frame_name(const void *buf, size_t len, size_t *nlen)
  * @param packet_len	if non-NULL, set with the amount of data consumed
  * @param copy			if TRUE, payload is copied, otherwise it refers input
  *
+ * When the payload is not copied, the packet framing is validated once and
+ * children are only parsed when accessed through the g2_tree_*() routines,
+ * since most handlers only look at a few of them.
+ *
  * @return a newly created G2 tree if data was valid, NULL if packet
  * was malformed or incompletely held in the buffer.
  */
@@ -533,7 +717,27 @@ g2_frame_deserialize(const void *buf, size_t len, size_t *packet_len, bool copy)
 	dctx.end = const_ptr_add_offset(buf, len);
 	dctx.copy = booleanize(copy);
 
-	t = g2_frame_recursive_deserialize(&dctx);
+	/*
+	 * When the payload is not copied, the tree cannot outlive the buffer
+	 * it refers to.  If we are processing a message, that buffer is the
+	 * message itself, and the nodes can be allocated from the thread arena.
+	 */
+
+	if (copy) {
+		dctx.arena = NULL;
+		t = g2_frame_recursive_deserialize(&dctx);
+	} else {
+		dctx.arena = arena_scope();
+		if (g2_frame_recursive_validate(&dctx)) {
+			const void *end = dctx.p;
+
+			dctx.p = buf;
+			t = g2_frame_lazy_node(&dctx);
+			g_assert(dctx.p == end);
+		} else {
+			t = NULL;
+		}
+	}
 
 	if (packet_len != NULL)
 		*packet_len = ptr_diff(dctx.p, buf);
@@ -43,12 +43,15 @@
  */
 
 struct g2_tree;
+struct arena;
 
 size_t g2_frame_serialize(const struct g2_tree *root, void *dest, size_t len);
 struct g2_tree *g2_frame_deserialize(const void *buf,
 	size_t len, size_t *packet_len, bool copy);
 size_t g2_frame_whole_length(const void *buf, size_t len);
 const char *g2_frame_name(const void *buf, size_t len, size_t *namelen);
+void g2_frame_expand(struct g2_tree *parent,
+	const void *buf, size_t len, struct arena *ar);
 
 #endif /* _core_g2_frame_h_ */
 
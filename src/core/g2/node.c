@@ -64,6 +64,7 @@
 #include "if/core/guid.h"
 
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/halloc.h"
 #include "lib/host_addr.h"
@@ -1014,6 +1015,9 @@ done:
 
 /**
  * Handle message coming from G2 node.
+ *
+ * Transient objects allocated from the thread arena whilst processing the
+ * message are released when we return.
  */
 void
 g2_node_handle(gnutella_node_t *n)
@@ -1025,6 +1029,8 @@ g2_node_handle(gnutella_node_t *n)
 	node_check(n);
 	g_assert(NODE_TALKS_G2(n));
 
+	arena_scope_enter();
+
 	t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
 	if (NULL == t) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
@@ -1033,7 +1039,7 @@ g2_node_handle(gnutella_node_t *n)
 		}
 		if (GNET_PROPERTY(log_bad_g2))
 			dump_hex(stderr, "G2 Packet", n->data, n->size);
-		return;
+		goto done;
 	} else if (plen != n->size) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
 			g_warning("%s(): consumed %zu bytes but /%s from %s had %u",
@@ -1085,6 +1091,7 @@ g2_node_handle(gnutella_node_t *n)
 
 done:
 	g2_tree_free_null(&t);
+	arena_scope_leave();
 }
 
 /**
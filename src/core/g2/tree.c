@@ -99,7 +99,9 @@
 #endif
 
 #include "tree.h"
+#include "frame.h"
 
+#include "lib/arena.h"
 #include "lib/atoms.h"
 #include "lib/etree.h"
 #include "lib/halloc.h"
@@ -108,7 +110,6 @@
 
 #ifdef TREE_TESTING
 #include "tfmt.h"
-#include "frame.h"
 #endif
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -117,14 +118,21 @@ enum g2_tree_magic { G2_TREE_MAGIC = 0x67f8b9e7 };
 
 /**
  * A G2 packet (tree structure).
+ *
+ * When deserialized without copying the payload, the children of a node are
+ * only parsed when first accessed: until then, `children' points to their
+ * serialized form within the message buffer.
  */
 struct g2_tree {
 	enum g2_tree_magic magic;		/**< Magic number */
-	const char *name;				/**< Node name (atom) */
+	const char *name;				/**< Node name (atom, unless in arena) */
 	void *payload;					/**< Payload buffer, NULL if none */
 	size_t paylen;					/**< Payload length */
+	const void *children;			/**< Unparsed children, NULL if none */
+	size_t childlen;				/**< Length of unparsed children */
 	node_t node;					/**< Embedded tree node */
 	unsigned copied:1;				/**< Whether payload was copied */
+	unsigned arena:1;				/**< Whether node lies in an arena */
 };
 
 static inline void
@@ -143,6 +151,44 @@ g2_tree_is_valid(const struct g2_tree * const t)
 	return t != NULL && G2_TREE_MAGIC == t->magic;
 }
 
+/**
+ * Parse the serialized children of the node, if not already done.
+ */
+static inline void
+g2_tree_expand(const g2_tree_t *root)
+{
+	if G_UNLIKELY(root->children != NULL) {
+		g2_tree_t *n = deconstify_pointer(root);
+		const void *children = n->children;
+
+		n->children = NULL;		/* Prevents recursion when adding children */
+		g2_frame_expand(n, children, n->childlen,
+			n->arena ? arena_scope() : NULL);
+	}
+}
+
+/**
+ * Recursively parse all the serialized children underneath the node.
+ */
+static void
+g2_tree_expand_all(const g2_tree_t *root)
+{
+	etree_t t;
+	const g2_tree_t *child;
+
+	g2_tree_expand(root);
+
+	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
+
+	for (
+		child = etree_first_child(&t, root);
+		child != NULL;
+		child = etree_next_sibling(&t, child)
+	) {
+		g2_tree_expand_all(child);
+	}
+}
+
 /**
  * Internal lookup of the tree root.
  *
@@ -270,6 +316,7 @@ g2_tree_lookup(const g2_tree_t *root, const char *path)
 				continue;
 			}
 		}
+		g2_tree_expand(r);
 		r = etree_first_child(&t, r);
 		if (NULL == r)					/* No children */
 			goto done;
@@ -374,6 +421,7 @@ g2_tree_child_foreach(const g2_tree_t *root, data_fn_t cb, void *data)
 	g2_tree_check(root);
 	g_assert(cb != NULL);
 
+	g2_tree_expand(root);
 	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
 	etree_foreach(&t, cb, data);
 }
@@ -388,6 +436,7 @@ g2_tree_first_child(const g2_tree_t *root)
 
 	g2_tree_check(root);
 
+	g2_tree_expand(root);
 	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
 	return etree_first_child(&t, root);
 }
@@ -436,6 +485,34 @@ g2_tree_alloc_empty(const char *name)
 	return n;
 }
 
+/**
+ * Create a node without any payload, allocated from an arena.
+ *
+ * The node memory and its name are reclaimed when the arena is reset, but
+ * the tree must still be freed before that to release the other resources
+ * it uses.
+ *
+ * @param name		name of the node
+ * @param ar		the arena to use (NULL means: use regular allocation)
+ *
+ * @return a new node with no payload.
+ */
+g2_tree_t *
+g2_tree_alloc_empty_arena(const char *name, arena_t *ar)
+{
+	g2_tree_t *n;
+
+	if (NULL == ar)
+		return g2_tree_alloc_empty(name);
+
+	n = arena_alloc0(ar, sizeof *n);
+	n->magic = G2_TREE_MAGIC;
+	n->name = arena_strndup(ar, name, G2_FRAME_NAME_LEN_MAX);
+	n->arena = TRUE;
+
+	return n;
+}
+
 /**
  * Release memory used by node.
  */
@@ -449,10 +526,14 @@ g2_tree_free_node(void *data)
 	if (n->payload != NULL && n->copied)
 		hfree(n->payload);
 
-	atom_str_free_null(&n->name);
 	n->payload = NULL;
+	n->children = NULL;
 	n->magic = 0;
-	WFREE(n);
+
+	if (!n->arena) {
+		atom_str_free_null(&n->name);
+		WFREE(n);
+	}
 }
 
 /**
@@ -527,6 +608,33 @@ g2_tree_set_payload(g2_tree_t *root, const void *payload,
 	root->copied = booleanize(copy);
 }
 
+/**
+ * Record the serialized children of the node, which will only be parsed
+ * when they are first accessed.
+ *
+ * The data are not copied: they must remain valid as long as the tree is,
+ * which is the case when the payload also refers to the message buffer.
+ *
+ * @param root		the node whose children are given
+ * @param data		the start of the serialized children
+ * @param len		the length of the serialized children, in bytes
+ */
+void
+g2_tree_set_lazy_children(g2_tree_t *root, const void *data, size_t len)
+{
+	etree_t t;
+
+	g2_tree_check(root);
+	g_assert(data != NULL);
+	g_assert(size_is_positive(len));
+
+	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
+	g_assert(NULL == etree_first_child(&t, root));
+
+	root->children = data;
+	root->childlen = len;
+}
+
 /**
  * Append data to node's payload, copying data.
  *
@@ -594,6 +702,7 @@ g2_tree_add_child(g2_tree_t *parent, g2_tree_t *child)
 	g2_tree_check(parent);
 	g2_tree_check(child);
 
+	g2_tree_expand(parent);
 	etree_init_root(&t, parent, FALSE, offsetof(g2_tree_t, node));
 	etree_prepend_child(&t, parent, child);
 }
@@ -608,6 +717,7 @@ g2_tree_reverse_children(g2_tree_t *root)
 
 	g2_tree_check(root);
 
+	g2_tree_expand(root);
 	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
 	etree_reverse_children(&t, root);
 }
@@ -663,6 +773,7 @@ g2_tree_enter_leave(g2_tree_t *root,
 
 	g2_tree_check(root);
 
+	g2_tree_expand_all(root);
 	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
 	etree_traverse(&t, ETREE_TRAVERSE_ALL | ETREE_CALL_AFTER,
 		0, ETREE_MAX_DEPTH, enter, leave, data);
@@ -751,6 +862,28 @@ g2_tree_test(void)
 	g_assert(node != c2);
 	g_assert(0 == strcmp("c2", g2_tree_name(node)));
 
+	g2_tree_free_null(&retrieved);
+
+	/*
+	 * Lazy deserialization, children being parsed on access.
+	 */
+
+	retrieved = g2_frame_deserialize(buffer, length, &rlen, FALSE);
+	g_assert(retrieved != NULL);
+	g_assert(length == rlen);
+
+	node = g2_tree_lookup(retrieved, "/root/rchild/c2/d1");
+	g_assert(node != NULL);
+	g_assert(0 == strcmp("d1", g2_tree_name(node)));
+	node = g2_tree_lookup(retrieved, "/root/rchild/c1");
+	g_assert(node != NULL);
+	g_assert(g2_tree_node_payload(node, &rlen) != NULL);
+	g_assert(LARGE_PAYLOAD == rlen);
+
+	g_debug("%s(): lazily deserialized tree:", G_STRFUNC);
+	ok = g2_tfmt_tree_dump(retrieved, stderr, G2FMT_O_PAYLOAD | G2FMT_O_PAYLEN);
+	g_assert(ok);
+
 	HFREE_NULL(buffer);
 	HFREE_NULL(large);
 	g2_tree_free_null(&root);
@@ -37,6 +37,8 @@
 struct g2_tree;
 typedef struct g2_tree g2_tree_t;
 
+struct arena;
+
 /*
  * Public interface.
  */
@@ -52,11 +54,13 @@ g2_tree_t *g2_tree_first_child(const g2_tree_t *root);
 g2_tree_t *g2_tree_next_sibling(const g2_tree_t *child);
 g2_tree_t *g2_tree_next_twin(const g2_tree_t *child);
 g2_tree_t *g2_tree_alloc_empty(const char *name);
+g2_tree_t *g2_tree_alloc_empty_arena(const char *name, struct arena *ar);
 g2_tree_t *g2_tree_alloc(const char *name, const void *payload, size_t paylen);
 g2_tree_t *g2_tree_alloc_copy(const char *name,
 	const void *payload, size_t paylen);
 void g2_tree_set_payload(g2_tree_t *root,
 	const void *payload, size_t paylen, bool copy);
+void g2_tree_set_lazy_children(g2_tree_t *root, const void *data, size_t len);
 size_t g2_tree_append_payload(g2_tree_t *root,
 	const void *payload, size_t paylen);
 void g2_tree_add_child(g2_tree_t *parent, g2_tree_t *child);
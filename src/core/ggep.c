@@ -40,6 +40,7 @@
 
 #include "lib/cobs.h"
 #include "lib/halloc.h"
+#include "lib/iovec.h"
 #include "lib/mempcpy.h"
 #include "lib/misc.h"
 #include "lib/str.h"
@@ -202,6 +203,34 @@ ggep_stream_append(ggep_stream_t *gs, const void *data, size_t len)
 	return TRUE;
 }
 
+/**
+ * Encode the length of a GGEP payload.
+ *
+ * @param plen		the payload length
+ * @param hlen		where the encoded length is written (up to 3 bytes)
+ *
+ * @return the amount of bytes used to encode the length, 0 if too large.
+ */
+static size_t
+ggep_length_encode(size_t plen, int8 hlen[3])
+{
+	if (plen <= 63) {
+		hlen[0] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
+		return 1;
+	} else if (plen <= 4095) {
+		hlen[0] = GGEP_L_CONT | ((plen >> GGEP_L_VSHIFT) & GGEP_L_VALUE);
+		hlen[1] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
+		return 2;
+	} else if (plen <= 262143) {
+		hlen[0] = GGEP_L_CONT | ((plen >> (2*GGEP_L_VSHIFT)) & GGEP_L_VALUE);
+		hlen[1] = GGEP_L_CONT | ((plen >> GGEP_L_VSHIFT) & GGEP_L_VALUE);
+		hlen[2] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
+		return 3;
+	}
+
+	return 0;
+}
+
 /**
  * Begin emission of GGEP extension.
  *
@@ -610,19 +639,9 @@ ggep_stream_end(ggep_stream_t *gs)
 			(int) plen, plen == 1 ? "" : "s");
 	}
 
-	if (plen <= 63) {
-		slen = 1;
-		hlen[0] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
-	} else if (plen <= 4095) {
-		slen = 2;
-		hlen[0] = GGEP_L_CONT | ((plen >> GGEP_L_VSHIFT) & GGEP_L_VALUE);
-		hlen[1] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
-	} else if (plen <= 262143) {
-		slen = 3;
-		hlen[0] = GGEP_L_CONT | ((plen >> (2*GGEP_L_VSHIFT)) & GGEP_L_VALUE);
-		hlen[1] = GGEP_L_CONT | ((plen >> GGEP_L_VSHIFT) & GGEP_L_VALUE);
-		hlen[2] = GGEP_L_LAST | (plen & GGEP_L_VALUE);
-	} else {
+	slen = ggep_length_encode(plen, hlen);
+
+	if (0 == slen) {
 		g_carp("too large GGEP payload length (%d bytes) for \"%.*s\"",
 			(int) plen, (int) (*gs->fp & GGEP_F_IDLEN), gs->fp + 1);
 		ggep_errno = GGEP_E_LARGE;
@@ -710,6 +729,152 @@ ggep_stream_close(ggep_stream_t *gs)
 	return len;
 }
 
+/**
+ * Close the stream, keeping the written extensions as a reusable block.
+ *
+ * The block can later be copied into another stream via
+ * ggep_stream_append_block(): the leading GGEP magic is stripped and
+ * none of the extensions is flagged as being the last one.
+ *
+ * @param gs		the GGEP stream
+ * @param last		where the offset of the last extension flags is written
+ *
+ * @return the length of the block, starting at the stream's base address,
+ * 0 meaning nothing was written.
+ */
+size_t
+ggep_stream_close_block(ggep_stream_t *gs, size_t *last)
+{
+	char *base = gs->outbuf;
+	char *last_fp = gs->last_fp;
+	size_t len;
+
+	g_assert(last != NULL);
+
+	len = ggep_stream_close(gs);
+
+	if (0 == len) {
+		*last = 0;
+		return 0;
+	}
+
+	g_assert(len > 1);
+	g_assert(GGEP_MAGIC == (uchar) base[0]);
+	g_assert(last_fp > base && last_fp < &base[len]);
+
+	*last_fp &= ~GGEP_F_LAST;
+	*last = last_fp - base - 1;
+	memmove(base, &base[1], len - 1);
+
+	return len - 1;
+}
+
+/**
+ * Append a block of extensions built by ggep_stream_close_block().
+ *
+ * @param gs		the GGEP stream
+ * @param data		start of the block
+ * @param len		length of the block
+ * @param last		offset of the last extension flags within the block
+ *
+ * @return TRUE if written successfully, FALSE with ggep_errno set otherwise,
+ * in which case nothing was written to the stream.
+ */
+bool
+ggep_stream_append_block(ggep_stream_t *gs,
+	const void *data, size_t len, size_t last)
+{
+	size_t needed;
+
+	g_assert(ggep_stream_is_valid(gs));
+	g_assert(!gs->begun);
+	g_assert(data != NULL || 0 == len);
+	g_assert(last < len || 0 == len);
+
+	if (0 == len)
+		return TRUE;
+
+	needed = len + (gs->magic_sent ? 0 : 1);
+
+	if (needed > ggep_stream_avail(gs)) {
+		ggep_errno = GGEP_E_SPACE;
+		return FALSE;
+	}
+
+	if (!gs->magic_sent) {
+		*gs->o++ = GGEP_MAGIC;
+		gs->magic_sent = TRUE;
+	}
+
+	gs->last_fp = gs->o + last;
+	gs->o = mempcpy(gs->o, data, len);
+
+	return TRUE;
+}
+
+/**
+ * Pack plain extension data, whose payload is written as-is.
+ *
+ * @return TRUE if written successfully, FALSE with ggep_errno set otherwise,
+ * in which case nothing was written to the stream.
+ */
+static bool
+ggep_stream_packv_plain(ggep_stream_t *gs,
+	const char *id, const iovec_t *iov, int iovcnt, uint32 wflags)
+{
+	size_t idlen, plen, slen, needed;
+	int8 hlen[3];
+	int i;
+
+	g_assert(ggep_stream_is_valid(gs));
+	g_assert(gs->outbuf != NULL);		/* Stream not closed */
+	g_assert(!gs->begun);
+
+	idlen = vstrlen(id);
+
+	g_assert(idlen > 0);
+	g_assert(idlen < 16);
+
+	plen = iov_calculate_size(iov, iovcnt);
+
+	if (0 == plen && (wflags & GGEP_W_STRIP))
+		return TRUE;				/* Success, but payload was empty */
+
+	slen = ggep_length_encode(plen, hlen);
+
+	if (0 == slen) {
+		g_carp("too large GGEP payload length (%zu bytes) for \"%s\"",
+			plen, id);
+		ggep_errno = GGEP_E_LARGE;
+		return FALSE;
+	}
+
+	needed = (gs->magic_sent ? 0 : 1) + 1 + idlen + slen + plen;
+
+	if (needed > ggep_stream_avail(gs)) {
+		ggep_errno = GGEP_E_SPACE;
+		return FALSE;
+	}
+
+	if (!gs->magic_sent) {
+		*gs->o++ = GGEP_MAGIC;
+		gs->magic_sent = TRUE;
+	}
+
+	gs->last_fp = gs->o;			/* Last successfully written ext. */
+	*gs->o++ = idlen & GGEP_F_IDLEN;
+	gs->o = mempcpy(gs->o, id, idlen);
+	gs->o = mempcpy(gs->o, hlen, slen);
+
+	for (i = 0; i < iovcnt; i++) {
+		gs->o = mempcpy(gs->o, iovec_base(&iov[i]), iovec_len(&iov[i]));
+	}
+
+	g_assert((size_t) (gs->end - gs->o) <= gs->size);	/* No overwriting */
+
+	return TRUE;
+}
+
 /**
  * The vectorized version of ggep_stream_pack().
  *
@@ -721,6 +886,16 @@ ggep_stream_packv(ggep_stream_t *gs,
 {
 	g_assert(iovcnt >= 0);
 
+	/*
+	 * When the payload is neither COBS-ed nor deflated, its final length is
+	 * known upfront: write the extension header with the proper length and
+	 * gather the payload right after it, avoiding the need to shift data
+	 * around once the payload has been written.
+	 */
+
+	if (0 == (wflags & (GGEP_W_COBS | GGEP_W_DEFLATE)))
+		return ggep_stream_packv_plain(gs, id, iov, iovcnt, wflags);
+
 	if (!ggep_stream_begin(gs, id, wflags))
 		return FALSE;
 
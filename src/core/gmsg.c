@@ -667,6 +667,51 @@ gmsg_split_routeto_one(gnutella_node_t *from, gnutella_node_t *to,
 	gmsg_split_send_from_to(from, to, head, data, size);
 }
 
+/**
+ * Route message from ``from'' consisting of header and data to the nodes
+ * in the list that can receive it.
+ *
+ * The message is serialized at most once and its data buffer is then shared
+ * by all the recipients, each getting its own pmsg_clone() of it, instead of
+ * copying the whole payload for every destination.
+ */
+static void
+gmsg_split_routeto_multi(gnutella_node_t *from, const pslist_t *sl,
+	const void *head, const void *data, uint32 size)
+{
+	pmsg_t *mb = NULL;
+
+	gmsg_header_check(head, size);
+
+	for (/* empty */; sl; sl = pslist_next(sl)) {
+		gnutella_node_t *dn = sl->data;
+
+		node_check(dn);
+
+		if (NODE_TALKS_G2(dn))
+			continue;
+		if (from->header_flags && !NODE_CAN_SFLAG(dn))
+			continue;
+		if (NODE_IS_UDP(dn) || !NODE_IS_WRITABLE(dn))
+			continue;
+
+		/*
+		 * Lazily build the message: none of the recipients may be writable.
+		 */
+
+		if (NULL == mb) {
+			mb = gmsg_split_to_pmsg(head, data, size);
+
+			if (GNET_PROPERTY(gmsg_debug) > 6)
+				gmsg_split_dump(stdout, head, data, size);
+		}
+
+		mq_tcp_putq(dn->outq, pmsg_clone(mb), from);
+	}
+
+	pmsg_free_null(&mb);
+}
+
 /**
  * Broadcast message to all nodes in the list.
  */
@@ -805,7 +850,6 @@ void
 gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 {
 	gnutella_node_t *rt_node = rt->ur.u_node;
-	const pslist_t *sl;
 
 	/*
 	 * If during processing (e.g. in search_request_preprocess()) after
@@ -857,16 +901,8 @@ gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 			&n->header, n->data, n->size + GTA_HEADER_SIZE);
 		return;
 	case ROUTE_MULTI:
-		PSLIST_FOREACH(rt->ur.u_nodes, sl) {
-			rt_node = sl->data;
-			node_check(rt_node);
-			if (NODE_TALKS_G2(rt_node))
-				continue;
-			if (n->header_flags && !NODE_CAN_SFLAG(rt_node))
-				continue;
-			gmsg_split_routeto_one(n, rt_node,
-				&n->header, n->data, n->size + GTA_HEADER_SIZE);
-		}
+		gmsg_split_routeto_multi(n, rt->ur.u_nodes,
+			&n->header, n->data, n->size + GTA_HEADER_SIZE);
 		return;
 	}
 
@@ -955,6 +991,36 @@ gmsg_can_drop(const void *pdu, int size)
 	}
 }
 
+#define GMSG_QUERY_STALE	30		/**< Queued queries stale after 30 secs */
+#define GMSG_QHIT_STALE		120		/**< Queued hits stale after 2 minutes */
+
+/**
+ * Message queue callback: test whether the Gnutella message has been queued
+ * for so long that it is no longer worth sending.
+ *
+ * Queries and query hits lingering in the queue of a slow connection are
+ * unlikely to still matter by the time we would send them: the querying
+ * servent has moved on, and we would only delay more useful traffic.
+ *
+ * @param mb		the message, not yet partially written
+ * @param age		amount of seconds the message has been queued
+ */
+bool
+gmsg_is_stale(const pmsg_t *mb, uint age)
+{
+	if (pmsg_written_size(mb) < GTA_HEADER_SIZE)
+		return FALSE;
+
+	switch (gnutella_header_get_function(pmsg_phys_base(mb))) {
+	case GTA_MSG_SEARCH:
+		return age >= GMSG_QUERY_STALE;
+	case GTA_MSG_SEARCH_RESULTS:
+		return age >= GMSG_QHIT_STALE;
+	default:
+		return FALSE;
+	}
+}
+
 /**
  * Perform a priority comparison between two messages, given as whole PDUs.
  *
@@ -131,6 +131,7 @@ void gmsg_split_routeto_all(const struct pslist *l,
 void gmsg_sendto_route(struct gnutella_node *n, struct route_dest *rt);
 
 bool gmsg_can_drop(const void *pdu, int size);
+bool gmsg_is_stale(const pmsg_t *mb, uint age);
 bool gmsg_is_oob_query(const void *msg);
 bool gmsg_split_is_oob_query(const void *head, const void *data);
 int gmsg_cmp(const void *pdu1, const void *pdu2);
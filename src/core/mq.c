@@ -48,6 +48,7 @@
 #include "lib/pmsg.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For plural() */
+#include "lib/tm.h"
 #include "lib/unsigned.h"		/* For size_saturate_add() */
 #include "lib/walloc.h"
 #include "lib/xsort_data.h"
@@ -382,6 +383,34 @@ mq_free(mqueue_t *q)
 	WFREE(q);
 }
 
+/**
+ * @return whether link is the tail of the queue and is partially written.
+ */
+static inline bool
+mq_is_partial_tail(const mqueue_t *q, const plist_t *l)
+{
+	return l == q->qtail && !pmsg_is_unread(l->data);
+}
+
+/**
+ * Get the head-most link of a priority band, where a prioritary message
+ * can be inserted.
+ *
+ * A partially written tail no longer belongs to its band: it is going
+ * out first whatever we insert before it, and messages of higher priority
+ * may already sit right before it.  Using it as the band head would let
+ * the next message of its priority jump ahead of these.
+ *
+ * @return the band head, NULL if the band holds no insertable anchor.
+ */
+static inline plist_t *
+mq_band_head(const mqueue_t *q, uint prio)
+{
+	plist_t *l = q->qband[prio];
+
+	return (l != NULL && mq_is_partial_tail(q, l)) ? NULL : l;
+}
+
 /**
  * Remove link from message queue and return the previous item.
  * The `size' parameter refers to the size of the removed message.
@@ -393,6 +422,21 @@ static plist_t *
 mq_rmlink_prev(mqueue_t *q, plist_t *l, int size)
 {
 	plist_t *prev = plist_prev(l);
+	uint prio = pmsg_prio(l->data);
+
+	/*
+	 * If we are removing the head-most message of its priority band, the
+	 * next one towards the tail, if within the same band, becomes the new
+	 * insertion point for that priority.
+	 */
+
+	if (q->qband[prio] == l) {
+		plist_t *next = plist_next(l);
+
+		q->qband[prio] =
+			(next != NULL && pmsg_prio(next->data) == prio &&
+				!mq_is_partial_tail(q, next)) ? next : NULL;
+	}
 
 	mq_remove_linkable(q, l);
 	q->qhead = plist_remove_link(q->qhead, l);
@@ -1397,7 +1441,9 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 	 *
 	 * A higher priority message needs to be inserted at the right place,
 	 * near the *tail* but after any partially sent message, and of course
-	 * after all enqueued messages with the same priority.
+	 * after all enqueued messages with the same priority.  That place is
+	 * right before the head-most message of the lowest non-empty band whose
+	 * priority is at least ours, which `qband' gives us directly.
 	 */
 
 	if (has_normal_prio) {
@@ -1405,47 +1451,36 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 		if (q->qtail == NULL)
 			q->qtail = q->qhead;
 	} else {
-		plist_t *l;
+		plist_t *l = NULL;
 		uint prio = pmsg_prio(mb);
-		bool inserted = FALSE;
-
-		for (l = q->qtail; l; l = plist_prev(l)) {
-			pmsg_t *m = l->data;
-
-			if (
-				pmsg_is_unread(m) &&			/* Not partially written */
-				pmsg_prio(m) < prio				/* Reached insert point */
-			) {
-				/*
-				 * Insert after current item, which is less prioritary than
-				 * we are, then leave the loop.
-				 */
-
-				q->qhead = plist_insert_after(q->qhead, l, mb);
-				new = plist_next(l);
+		uint p;
 
-				if (l == q->qtail)				/* Inserted at tail */
-					q->qtail = new;				/* New tail */
-
-				inserted = TRUE;
-				break;
-			}
-		}
+		for (p = prio; p < PMSG_P_COUNT && NULL == l; p++)
+			l = mq_band_head(q, p);
 
 		/*
-		 * If we haven't inserted anything, then we've reached the
-		 * head of the list.
+		 * With no such band, the message goes to the tail, unless the tail
+		 * is being written already, in which case we insert before it.
 		 */
 
-		if (!inserted) {
-			g_assert(l == NULL);
+		if (NULL == l && q->qtail != NULL && !pmsg_is_unread(q->qtail->data))
+			l = q->qtail;
 
-			new = q->qhead = plist_prepend(q->qhead, mb);
-			if (q->qtail == NULL)
-				q->qtail = q->qhead;
+		if (l != NULL) {
+			q->qhead = plist_insert_before(q->qhead, l, mb);
+			new = plist_prev(l);
+		} else {
+			q->qhead = plist_insert_after(q->qhead, q->qtail, mb);
+			new = q->qtail = (NULL == q->qtail) ? q->qhead :
+				plist_next(q->qtail);
 		}
+
+		g_assert(new != NULL && new->data == mb);
+
+		q->qband[prio] = new;
 	}
 
+	pmsg_set_qtime(mb, tm_time());
 	mq_add_linkable(q, new);
 
 	q->size += msize;
@@ -87,6 +87,17 @@ typedef void (*mq_msgcount_t)(void *node, const pmsg_t *mb);
 typedef void (*mq_msglog_t)(const pmsg_t *mb, const char *fmt, ...)
 	G_PRINTF(2, 3);
 
+/**
+ * Staleness check, invoked by the service routine before sending a message
+ * that was not yet partially written.
+ *
+ * @param mb			the message about to be sent
+ * @param age			amount of seconds the message has been queued
+ *
+ * @return TRUE if the message is no longer worth sending and can be dropped.
+ */
+typedef bool (*mq_msgstale_t)(const pmsg_t *mb, uint age);
+
 /**
  * User-supplied parameters, which are callbacks necessary for the message
  * queue operations but which are dependent on the messages being enqueued.
@@ -99,6 +110,7 @@ struct mq_uops {
 	mq_msgcount_t msg_flowc;	/**< Message dropped by flow-control */
 	mq_msgcount_t msg_queued;	/**< Message queued */
 	mq_msglog_t msg_log;		/**< Message logging for dropped messages */
+	mq_msgstale_t msg_stale;	/**< Whether queued message became stale */
 };
 
 #ifdef MQ_INTERNAL
@@ -145,6 +157,14 @@ enum mq_magic {
  *
  * The `header' is used to hold the function/hops/TTL of a reference message
  * to be used as a comparison point when speeding up dropping in flow-control.
+ *
+ * Messages are kept sorted by decreasing priority from the tail, each
+ * priority forming a contiguous band, save for a partially written message
+ * which always remains at the tail.  The `qband' array records the link of
+ * the most recently enqueued message (the one closest to the head) within
+ * each band, so that prioritary messages can be inserted without traversing
+ * the queue.  A partially written tail is never used as a band head.
+ * Regular data messages are simply prepended at the head.
  */
 struct mqueue {
 	enum mq_magic magic;	/**< Magic number */
@@ -154,6 +174,7 @@ struct mqueue {
 	const struct mq_uops *uops;		/**< User-defined operations */
 	txdrv_t *tx_drv;				/**< Network TX stack driver */
 	plist_t *qhead, *qtail, **qlink;
+	plist_t *qband[PMSG_P_COUNT];	/**< Head-most link of priority bands */
 	slist_t *qwait;			/**< Waiting queue during putq recursions */
 	cevent_t *swift_ev;		/**< Callout queue event in "swift" mode */
 	const uint32 *debug;	/**< Debug config variable for this queue */
@@ -45,6 +45,7 @@
 
 #include "lib/plist.h"
 #include "lib/pmsg.h"
+#include "lib/tm.h"
 #include "lib/walloc.h"
 
 #include "if/gnet_property_priv.h"
@@ -52,7 +53,7 @@
 
 #include "lib/override.h"		/* Must be the last header included */
 
-#define MQ_MAXIOV		256		/**< Our limit on the I/O vectors we build */
+#define MQ_MAXIOV		MAX_IOV_COUNT	/**< Limit on I/O vectors we build */
 #define MQ_MINIOV		2		/**< Minimum amount of I/O vectors in service */
 #define MQ_MINSEND		256		/**< Minimum size we try to send */
 
@@ -97,6 +98,23 @@ mq_tcp_make(int maxsize,
 	return q;
 }
 
+/**
+ * Has message been sitting in the queue for so long that it is no longer
+ * worth sending?
+ *
+ * Only messages that have not been partially written yet can be dropped.
+ * This is checked lazily by the service routine, so that stale traffic is
+ * pruned as it reaches the tail of the queue without requiring any scan.
+ */
+static inline bool
+mq_tcp_is_stale(const mqueue_t *q, const pmsg_t *mb, time_t now)
+{
+	if (NULL == q->uops->msg_stale || !pmsg_is_unread(mb))
+		return FALSE;
+
+	return q->uops->msg_stale(mb, pmsg_queued_for(mb, now));
+}
+
 /**
  * Service routine for TCP message queue.
  */
@@ -114,6 +132,7 @@ mq_tcp_service(void *data)
 	int maxsize;
 	bool saturated;
 	bool has_prioritary = FALSE;
+	time_t now = tm_time();
 
 again:
 	mq_check(q, 0);
@@ -148,9 +167,10 @@ again:
 
 		/*
 		 * Honour hops-flow, and ensure there is a route for possible replies.
+		 * Messages which became stale whilst queued are dropped as well.
 		 */
 
-		if (pmsg_can_send(mb, q)) {
+		if (pmsg_can_send(mb, q) && !mq_tcp_is_stale(q, mb, now)) {
 			/* send the message */
 			l = plist_prev(l);
 			iovsize--;
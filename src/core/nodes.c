@@ -87,8 +87,10 @@
 #include "tx_deflate.h"
 #include "tx_dgram.h"
 #include "tx_link.h"
+#include "tx_sink.h"
 #include "tx_ut.h"
 #include "udp.h"
+#include "udp_ingress.h"
 #include "udp_reliable.h"
 #include "udp_sched.h"
 #include "uploads.h"			/* For handle_push_request() */
@@ -102,6 +104,7 @@
 
 #include "lib/adns.h"
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/concat.h"
@@ -125,6 +128,7 @@
 #include "lib/iovec.h"
 #include "lib/listener.h"
 #include "lib/log.h"			/* For log_printable() */
+#include "lib/lprobe.h"
 #include "lib/nid.h"
 #include "lib/parse.h"
 #include "lib/pattern.h"
@@ -4112,6 +4116,11 @@ static struct tx_dgram_cb node_tx_sr_dgram_cb = {
 	NULL,						/* add_tx_dropped */
 };
 
+static struct tx_dgram_cb node_tx_g2_sink_cb = {
+	node_g2_msg_accounting,		/* msg_account */
+	node_add_txdrop,			/* add_tx_dropped */
+};
+
 static struct tx_ut_cb node_tx_ut_cb = {
 	node_msg_ut_accounting,		/* msg_account */
 	node_add_txdrop,			/* add_tx_dropped */
@@ -4935,6 +4944,7 @@ static struct mq_uops node_mq_cb = {
 	node_msg_flowc,				/* msg_flowc */
 	node_msg_queued,			/* msg_queued */
 	gmsg_log_dropped_pmsg,		/* msg_log */
+	gmsg_is_stale,				/* msg_stale */
 };
 
 static struct mq_uops node_g2_mq_cb = {
@@ -4945,6 +4955,7 @@ static struct mq_uops node_g2_mq_cb = {
 	node_g2_msg_flowc,			/* msg_flowc */
 	node_g2_msg_queued,			/* msg_queued */
 	g2_msg_log_dropped_pmsg,	/* msg_log */
+	NULL,						/* msg_stale -- can be NULL */
 };
 
 /**
@@ -9040,7 +9051,7 @@ node_patch_push_fw2fw(gnutella_node_t *n)
  * since we may invalidate that node during the processing.
  */
 static void
-node_parse(gnutella_node_t *n)
+node_parse_message(gnutella_node_t *n)
 {
 	bool drop = FALSE;
 	bool has_ggep = FALSE;
@@ -9049,6 +9060,10 @@ node_parse(gnutella_node_t *n)
 	query_hashvec_t *qhv = NULL;
 	int results = 0;						/* # of results in query hits */
 	search_request_info_t *sri = NULL;
+	static lprobe_t *route_probe;
+	uint64 start;
+	bool handle;
+	gnutella_node_t *sender = n;			/* Routing can nullify ``n'' */
 
 	g_return_if_fail(n != NULL);
 	g_assert(NODE_IS_CONNECTED(n));
@@ -9281,7 +9296,7 @@ node_parse(gnutella_node_t *n)
 	if (G_UNLIKELY(in_shutdown)) {
 		if (GTA_MSG_BYE == gnutella_header_get_function(&n->header)) {
 			node_got_bye(n);
-			return;
+			goto node_gone;
 		}
 		goto reset_header;
 	}
@@ -9313,7 +9328,7 @@ node_parse(gnutella_node_t *n)
 	switch (gnutella_header_get_function(&n->header)) {
 	case GTA_MSG_BYE:				/* Good bye! */
 		node_got_bye(n);
-		return;
+		goto node_gone;
 	case GTA_MSG_INIT:				/* Ping */
 		pcache_ping_received(n);
 		goto reset_header;
@@ -9335,7 +9350,7 @@ node_parse(gnutella_node_t *n)
 		if (n->qrt_receive != NULL) {
 			bool done;
 			if (!qrt_receive_next(n->qrt_receive, &done))
-				return;				/* Node BYE-ed */
+				goto node_gone;		/* Node BYE-ed */
 			if (done) {
 				qrt_receive_free(n->qrt_receive);
 				n->qrt_receive = NULL;
@@ -9369,7 +9384,11 @@ node_parse(gnutella_node_t *n)
 	/* Compute route (destination) then handle the message if required */
 
 route_only:
-	if (route_message(&n, &dest)) {		/* We have to handle the message */
+	start = lprobe_start();
+	handle = route_message(&n, &dest);
+	lprobe_end(&route_probe, "query_routing", start);
+
+	if (handle) {						/* We have to handle the message */
 		node_check(n);
 
 		switch (gnutella_header_get_function(&n->header)) {
@@ -9604,13 +9623,47 @@ dropped:
 reset_header:
 	n->have_header = FALSE;
 	n->pos = 0;
-	ext_reset(n->extvec, n->extcount);
-	n->extcount = 0;
+
+	/* FALL THROUGH */
 
 clean_dest:
+	/*
+	 * The node may have been removed during routing, but the extensions
+	 * we parsed may lie in the thread arena, which will be reset when we
+	 * return: dispose of them.
+	 */
+
+	ext_reset(sender->extvec, sender->extcount);
+	sender->extcount = 0;
 	search_request_info_free_null(&sri);
 	if (dest.type == ROUTE_MULTI)
 		pslist_free(dest.ur.u_nodes);
+	return;
+
+node_gone:
+	/*
+	 * The node is going away, but the extensions we parsed may lie in the
+	 * thread arena, which will be reset when we return: dispose of them.
+	 */
+
+	ext_reset(n->extvec, n->extcount);
+	n->extcount = 0;
+}
+
+/**
+ * Processing of messages, releasing all the transient objects allocated
+ * from the thread arena whilst handling the message.
+ *
+ * @attention
+ * NB: callers of this routine must not use the node structure upon return,
+ * since we may invalidate that node during the processing.
+ */
+static void
+node_parse(gnutella_node_t *n)
+{
+	arena_scope_enter();
+	node_parse_message(n);
+	arena_scope_leave();
 }
 
 static void
@@ -9662,6 +9715,10 @@ bool
 node_udp_is_old(const gnutella_node_t *n)
 {
 	node_check(n);
+
+	if G_UNLIKELY(NULL == n->socket)
+		return FALSE;		/* Replay node, never attached to a socket */
+
 	return socket_udp_is_old(n->socket);
 }
 
@@ -9906,24 +9963,17 @@ done:
 }
 
 /**
- * Data indication callback for the semi-reliable UDP layer for G2.
+ * Process a G2 message received from UDP on the pseudo node.
  *
- * @return TRUE, since it is always OK.
+ * @param n		the G2 pseudo node
+ * @param data	start of the G2 message
+ * @param len	length of the message
  */
-static bool
-node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
+static void
+node_udp_g2_process(gnutella_node_t *n, const void *data, size_t len)
 {
-	gnutella_node_t *n;
 	bool drop_hostile = TRUE;
 
-	(void) unused_rx;
-
-	n = node_udp_g2_get_addr_port(
-			gnet_host_get_addr(from), gnet_host_get_port(from));
-
-	if (NULL == n)
-		goto done;		/* G2 support is disabled */
-
 	node_check(n);
 	g_assert(NODE_TALKS_G2(n));
 
@@ -9956,8 +10006,8 @@ node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
 	 * issued a node_g2_read().
 	 */
 
-	n->size = pmsg_size(mb);
-	n->data = deconstify_pointer(pmsg_start(mb));
+	n->size = len;
+	n->data = deconstify_pointer(data);
 
 	n->received++;
 	gnet_stats_count_received_payload(n, n->data);
@@ -9980,7 +10030,7 @@ node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
 	}
 
 	if (drop_hostile && node_hostile_udp(n))
-		goto done;
+		return;
 
 	/*
 	 * Check limits.
@@ -9995,18 +10045,147 @@ node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
 		}
 
 		gnet_stats_count_dropped(n, MSG_DROP_LIMIT);
-		goto done;
+		return;
 	}
 
 	/* Handle the G2 message we got from the UDP layer */
 
 	g2_node_handle(n);
+}
+
+/**
+ * Data indication callback for the semi-reliable UDP layer for G2.
+ *
+ * @return TRUE, since it is always OK.
+ */
+static bool
+node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
+{
+	gnutella_node_t *n;
+
+	(void) unused_rx;
+
+	n = node_udp_g2_get_addr_port(
+			gnet_host_get_addr(from), gnet_host_get_port(from));
+
+	if (NULL == n)
+		goto done;		/* G2 support is disabled */
+
+	node_udp_g2_process(n, pmsg_start(mb), pmsg_size(mb));
 
 done:
 	pmsg_free(mb);
 	return TRUE;
 }
 
+/**
+ * Create a pseudo node for replaying captured or synthetic traffic.
+ *
+ * The node is never attached to a socket: its TX stack ends with a "sink"
+ * driver which accounts for the messages sent and then discards them, so
+ * that replies generated whilst processing replayed messages never reach
+ * the network.
+ *
+ * @param g2		whether the node will be fed with G2 messages
+ * @param addr		the address of the host the node stands for
+ * @param port		the port of the host the node stands for
+ *
+ * @return new node, to be freed with node_replay_free().
+ */
+gnutella_node_t *
+node_replay_create(bool g2, host_addr_t addr, uint16 port)
+{
+	gnutella_node_t *n;
+	struct tx_sink_args args;
+	gnet_host_t host;
+	txdrv_t *tx;
+
+	n = node_pseudo_create(host_addr_net(addr), NODE_P_UDP,
+			g2 ? _("Replay G2 node") : _("Replay node"));
+
+	n->addr = addr;
+	n->port = port;
+	n->country = gip_country(addr);
+
+	if (g2) {
+		n->attrs2 |=
+			NODE_A2_UDP_TRANCVR | NODE_A2_HAS_SR_UDP | NODE_A2_TALKS_G2;
+	}
+
+	args.cb = g2 ? &node_tx_g2_sink_cb : &node_tx_dgram_cb;
+	gnet_host_set(&host, addr, port);
+
+	tx = tx_make(n, &host, tx_sink_get_ops(), &args);	/* Cannot fail */
+
+	n->outq = mq_udp_make(GNET_PROPERTY(node_udp_sendqueue_size), n, tx,
+		g2 ? &node_g2_mq_cb : &node_mq_cb);
+
+	return n;
+}
+
+/**
+ * Process a replayed message on the replay node, as if it had been
+ * received from UDP.
+ *
+ * The message data may be modified during processing.
+ *
+ * @param n		the replay node
+ * @param data	start of the message (Gnutella header or G2 packet)
+ * @param len	length of the message
+ *
+ * @return TRUE if message was handled, FALSE if it was found invalid.
+ */
+bool
+node_replay_process(gnutella_node_t *n, void *data, size_t len)
+{
+	node_check(n);
+	g_assert(NODE_IS_UDP(n));
+	g_assert(NULL == n->socket);
+
+	if (NODE_TALKS_G2(n)) {
+		node_udp_g2_process(n, data, len);
+		return TRUE;
+	}
+
+	if (
+		!udp_is_valid_gnet_split(n, NULL, FALSE, data,
+			const_ptr_add_offset(data, GTA_HEADER_SIZE), len)
+	)
+		return FALSE;
+
+	node_pseudo_setup(n, data, len);
+	node_handle(n);
+
+	return TRUE;
+}
+
+/**
+ * Free replay node and nullify its pointer.
+ */
+void
+node_replay_free(gnutella_node_t **n_ptr)
+{
+	gnutella_node_t *n = *n_ptr;
+
+	if (n != NULL) {
+		node_check(n);
+		g_assert(NULL == n->socket);
+
+		if (n->routing_data != NULL) {
+			routing_node_remove(n);
+			n->routing_data = NULL;
+		}
+
+		/*
+		 * Not a genuine host: keep it out of the host cache.
+		 */
+
+		n->flags &= ~NODE_F_VALID;
+		node_real_remove(n);
+		*n_ptr = NULL;
+	}
+}
+
 /**
  * Called when asynchronous connection to an outgoing node is established.
  */
@@ -13795,6 +13974,12 @@ node_update_udp_socket(void)
 
 	if ((dht_node || dht6_node) && udp_active())
 		node_dht_enable();
+
+	/*
+	 * The UDP ingress thread, if enabled, must read the new sockets.
+	 */
+
+	udp_ingress_update();
 }
 
 /**
@@ -732,6 +732,10 @@ uint feed_host_cache_from_headers(header_t *headers,
 	host_type_t sender, bool gnet, const host_addr_t peer,
 	const char *vendor);
 
+gnutella_node_t *node_replay_create(bool g2, host_addr_t addr, uint16 port);
+bool node_replay_process(gnutella_node_t *n, void *data, size_t len);
+void node_replay_free(gnutella_node_t **n_ptr);
+
 gnutella_node_t *node_browse_prepare(
 	gnet_host_t *host, const char *vendor, gnutella_header_t *header,
 	char *data, uint32 size);
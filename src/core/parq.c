@@ -62,9 +62,12 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/bit_array.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
 #include "lib/cstr.h"
+#include "lib/dbmw.h"
+#include "lib/dbstore.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/getline.h"
@@ -74,8 +77,11 @@
 #include "lib/hikset.h"
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
+#include "lib/ostree.h"
 #include "lib/parse.h"
+#include "lib/path.h"
 #include "lib/plist.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/stats.h"
 #include "lib/str.h"
@@ -83,6 +89,7 @@
 #include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/tokenizer.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"			/* Must be the last header included */
@@ -99,6 +106,7 @@
 #define QUEUE_PERIOD		600		/**< Try to resend a queue every 10 min. */
 #define QUEUE_DEAD_SCAN		60		/**< Scan the "dead" queue every 60 secs. */
 #define QUEUE_SAVE_PERIOD	60		/**< Save queues every minute */
+#define QUEUE_FLUSH_DELAY	5		/**< Persist changes within 5 seconds */
 #define QUEUE_HOST_DELAY	12		/**< No more than 1 QUEUE per 12 seconds */
 #define MAX_QUEUE			144		/**< Max amount of QUEUE we can send */
 #define MAX_QUEUE_REFUSED	2		/**< Max QUEUE they can refuse in a row */
@@ -135,7 +143,40 @@ static uint parq_max_upload_size = MAX_UPLOAD_QSIZE;
 static uint parq_upload_active_size = 20;
 
 static uint parq_upload_ban_window = 600;
-static const char file_parq_file[] = "parq";
+static const char file_parq_file[] = "parq";	/**< Legacy text format */
+
+/**
+ * DBM wrapper to persist the queued uploads, keyed by PARQ ID.
+ */
+static dbmw_t *db_parq;
+static char db_parq_base[] = "parq_uploads";
+static char db_parq_what[] = "PARQ upload queues";
+
+#define PARQ_DATA_VERSION	0		/**< Serialization version number */
+#define PARQ_NAME_MAXLEN	1024	/**< Longest persisted name, with NUL */
+
+/**
+ * Information about a queued upload that is stored to disk.
+ * The structure is serialized first, not written as-is.
+ */
+struct parqdata {
+	uint8 version;			/**< Serialization version, when read back */
+	uint64 seq;				/**< Arrival sequence number */
+	time_t enter;			/**< Time upload entered PARQ */
+	time_t saved;			/**< Time at which record was written */
+	time_t expire;			/**< Expiration time, 0 if entry had a slot */
+	time_t last_queue_sent;	/**< When we last sent the QUEUE */
+	uint32 queue_sent;		/**< Amount of QUEUE messages sent */
+	filesize_t file_size;
+	filesize_t downloaded;
+	host_addr_t remote_addr;
+	host_addr_t x_addr;		/**< Contact IP, from X-Node, if any */
+	uint16 x_port;			/**< Contact port, 0 if none */
+	bool supports_parq;
+	bool has_sha1;
+	struct sha1 sha1;
+	char name[PARQ_NAME_MAXLEN];
+};
 
 static plist_t *ul_parqs;			/**< List of all queued uploads */
 static int ul_parqs_cnt;			/**< Amount of queues */
@@ -146,6 +187,8 @@ static hevset_t *ul_all_parq_by_addr;
 static htable_t *ul_all_parq_by_id;
 static cperiodic_t *parq_dead_timer_ev;
 static cperiodic_t *parq_save_timer_ev;
+static hash_list_t *ul_parq_dirty;	/**< Entries to persist in `db_parq' */
+static cevent_t *parq_flush_ev;		/**< Deferred persisting of dirty entries */
 static bool parq_closed;
 
 /**
@@ -167,6 +210,7 @@ struct parq_banned {
 static bool parq_shutdown;
 static time_t parq_start;					/**< Init time */
 static uint64 parq_slots_removed = 0;		/**< Amount of slots removed */
+static uint64 parq_ul_seq;					/**< Arrival sequence numbers */
 
 enum parq_ul_queue_magic {
 	PARQ_UL_QUEUE_MAGIC = 0x7dbab331
@@ -177,19 +221,20 @@ enum parq_ul_queue_magic {
  */
 struct parq_ul_queue {
 	enum parq_ul_queue_magic magic;
-	plist_t *by_position;		/**< Queued items sorted on position. Newest is
-								 added to the end. */
-	hash_list_t *by_rel_pos;	/**< Queued items sorted by relative position */
+	ostree_t by_position;		/**< Queued items sorted on arrival order */
+	ostree_t by_rel_pos;		/**< Alive, non-frozen items without a regular
+								 slot, sorted on arrival order */
 	hash_list_t *by_date_dead;	/**< Dead items sorted on last update */
 	statx_t *slot_stats;		/**< Slot kept-time statistics */
 	int by_position_length;	/**< Number of items in "by_position" */
+	time_t eta_computed;	/**< When ETAs were last computed */
 
 	int num;				/**< Queue number */
 	int active_uploads;
 	int active_queued_cnt;	/**< Number of actively queued entries */
 	int alive;				/**< Amount of alive entries */
 	int frozen;				/**< Subset of alive entries that are frozen */
-	unsigned recompute:1;	/**< Flagged as requiring update of internal data */
+	unsigned eta_stale:1;	/**< Flagged as requiring update of ETAs */
 	unsigned active:1;		/**< Set to false when the number of upload slots
 								 was decreased but the queue still contained
 								 queued items. This queue shall be removed when
@@ -226,9 +271,12 @@ enum parq_ul_magic {
 struct parq_ul_queued {
 	enum parq_ul_magic magic;			/**< Magic number */
 	uint32 flags;			/**< Operating flags */
-	uint position;			/**< Current position in the queue */
-	uint relative_position; /**< Relative position in the queue, if 'not alive'
-								  uploads are taken into account */
+	uint64 seq;				/**< Arrival sequence number, orders the queue */
+	ostnode_t pos_node;		/**< Embedded node in queue's "by_position" */
+	ostnode_t rel_node;		/**< Embedded node in queue's "by_rel_pos" */
+	uint relative_position; /**< Relative position when removed from the
+								 "by_rel_pos" tree, 0 if given a regular slot.
+								 Use parq_ul_rel_position() to read it */
 	uint eta;				/**< Expected time in seconds till an upload slot is
 							     reached, this is a relative timestamp */
 
@@ -287,6 +335,37 @@ parq_ul_queued_check(const struct parq_ul_queued * const puq)
 	g_assert(PARQ_UL_MAGIC == puq->magic);
 }
 
+/**
+ * @return absolute position of entry in its queue, starting at 1.
+ */
+static inline uint
+parq_ul_position(const struct parq_ul_queued * const puq)
+{
+	return ostree_rank(&puq->queue->by_position, &puq->pos_node);
+}
+
+/**
+ * @return relative position of entry in its queue, starting at 1, which is
+ * its position amongst the alive entries not holding a regular slot.
+ *
+ * For entries which are not competing for a slot, this is the position
+ * they had when they were removed from the competition, or 0 if they got
+ * a regular slot.
+ */
+static inline uint
+parq_ul_rel_position(const struct parq_ul_queued * const puq)
+{
+	if (ostree_linked(&puq->rel_node))
+		return ostree_rank(&puq->queue->by_rel_pos, &puq->rel_node);
+
+	return puq->relative_position;
+}
+
+#define parq_ul_by_position(q, n) \
+	((struct parq_ul_queued *) ostree_data(&(q)->by_position, (n)))
+#define parq_ul_by_rel_pos(q, n) \
+	((struct parq_ul_queued *) ostree_data(&(q)->by_rel_pos, (n)))
+
 /*
  * Flags for parq_ul_queued.
  */
@@ -301,6 +380,210 @@ enum {
 	PARQ_UL_QUEUE		= 1 << 0	/**< Scheduled for QUEUE sending */
 };
 
+/**
+ * Serialization routine for parqdata.
+ */
+static void
+serialize_parqdata(pmsg_t *mb, const void *data)
+{
+	const struct parqdata *pd = data;
+
+	pmsg_write_u8(mb, PARQ_DATA_VERSION);
+	pmsg_write_be64(mb, pd->seq);
+	pmsg_write_time(mb, pd->enter);
+	pmsg_write_time(mb, pd->saved);
+	pmsg_write_time(mb, pd->expire);
+	pmsg_write_time(mb, pd->last_queue_sent);
+	pmsg_write_be32(mb, pd->queue_sent);
+	pmsg_write_be64(mb, pd->file_size);
+	pmsg_write_be64(mb, pd->downloaded);
+	pmsg_write_ipv4_or_ipv6_addr(mb, pd->remote_addr);
+	pmsg_write_be16(mb, pd->x_port);
+	if (pd->x_port != 0)
+		pmsg_write_ipv4_or_ipv6_addr(mb, pd->x_addr);
+	pmsg_write_boolean(mb, pd->supports_parq);
+	pmsg_write_boolean(mb, pd->has_sha1);
+	if (pd->has_sha1)
+		pmsg_write(mb, &pd->sha1, SHA1_RAW_SIZE);
+	pmsg_write_fixed_string(mb, pd->name, sizeof pd->name - 1);
+}
+
+/**
+ * Deserialization routine for parqdata.
+ */
+static void
+deserialize_parqdata(bstr_t *bs, void *valptr, size_t len)
+{
+	struct parqdata *pd = valptr;
+	uint8 version;
+	size_t slen;
+
+	g_assert(sizeof *pd == len);
+
+	bstr_read_u8(bs, &version);
+
+	/*
+	 * We cannot parse records written with a layout we do not know: skip
+	 * their content, they will be rejected when loaded.
+	 */
+
+	if (version > PARQ_DATA_VERSION) {
+		ZERO(pd);
+		pd->version = version;
+		bstr_skip(bs, bstr_unread_size(bs));
+		return;
+	}
+
+	pd->version = version;
+	bstr_read_be64(bs, &pd->seq);
+	bstr_read_time(bs, &pd->enter);
+	bstr_read_time(bs, &pd->saved);
+	bstr_read_time(bs, &pd->expire);
+	bstr_read_time(bs, &pd->last_queue_sent);
+	bstr_read_be32(bs, &pd->queue_sent);
+	bstr_read_be64(bs, &pd->file_size);
+	bstr_read_be64(bs, &pd->downloaded);
+	bstr_read_packed_ipv4_or_ipv6_addr(bs, &pd->remote_addr);
+	bstr_read_be16(bs, &pd->x_port);
+	if (pd->x_port != 0)
+		bstr_read_packed_ipv4_or_ipv6_addr(bs, &pd->x_addr);
+	else
+		pd->x_addr = zero_host_addr;
+	bstr_read_boolean(bs, &pd->supports_parq);
+	bstr_read_boolean(bs, &pd->has_sha1);
+	if (pd->has_sha1)
+		bstr_read(bs, &pd->sha1, SHA1_RAW_SIZE);
+	bstr_read_fixed_string(bs, &slen, ARYLEN(pd->name));
+}
+
+/**
+ * @return whether address can be persisted.
+ */
+static inline bool
+parq_addr_is_ip(const host_addr_t addr)
+{
+	return host_addr_is_ipv4(addr) || host_addr_is_ipv6(addr);
+}
+
+/**
+ * Fill the persistent information about a queued upload.
+ *
+ * @return TRUE if the entry must be persisted, FALSE if it must be forgotten.
+ */
+static bool
+parq_upload_fill_data(const struct parq_ul_queued *puq, struct parqdata *pd)
+{
+	time_t now = tm_time();
+
+	/* We are not saving uploads which already finished an upload */
+	if (puq->had_slot && !puq->has_slot)
+		return FALSE;
+
+	if (puq->has_slot) {
+		/* If we have a slot, puq->expire is meaningless */
+		pd->expire = 0;
+	} else {
+		if (delta_time(puq->expire, now) < 0)
+			return FALSE;
+		pd->expire = puq->expire;
+	}
+
+	if (!parq_addr_is_ip(puq->remote_addr))
+		return FALSE;
+
+	if (!cstr_fcpy(ARYLEN(pd->name), puq->name))
+		return FALSE;		/* Name too long */
+
+	pd->seq = puq->seq;
+	pd->enter = puq->enter;
+	pd->saved = now;
+	pd->last_queue_sent = puq->last_queue_sent;
+	pd->queue_sent = puq->queue_sent;
+	pd->file_size = puq->file_size;
+	pd->downloaded = puq->downloaded;
+	pd->remote_addr = puq->remote_addr;
+	pd->supports_parq = puq->supports_parq;
+
+	if (
+		!(puq->flags & PARQ_UL_NOQUEUE) &&
+		puq->port != 0 && parq_addr_is_ip(puq->addr)
+	) {
+		pd->x_addr = puq->addr;
+		pd->x_port = puq->port;
+	} else {
+		pd->x_addr = zero_host_addr;
+		pd->x_port = 0;
+	}
+
+	pd->has_sha1 = puq->sha1 != NULL;
+	if (pd->has_sha1)
+		pd->sha1 = *puq->sha1;
+
+	return TRUE;
+}
+
+/**
+ * Persist all the queued entries whose state changed since last time.
+ */
+static void
+parq_upload_flush(void)
+{
+	struct parqdata pd;
+	size_t n = 0;
+
+	while (0 != hash_list_length(ul_parq_dirty)) {
+		struct parq_ul_queued *puq = hash_list_shift(ul_parq_dirty);
+
+		parq_ul_queued_check(puq);
+
+		if (parq_upload_fill_data(puq, &pd))
+			dbmw_write(db_parq, &puq->id, VARLEN(pd));
+		else
+			dbmw_delete(db_parq, &puq->id);
+
+		n++;
+	}
+
+	if (GNET_PROPERTY(parq_debug) > 3 && n != 0)
+		g_debug("PARQ UL: persisted %zu entr%s", n, plural_y(n));
+}
+
+/**
+ * Callout queue callback invoked to persist changed entries.
+ */
+static void
+parq_upload_flush_due(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
+
+	cq_zero(cq, &parq_flush_ev);	/* Indicates callback fired */
+	parq_upload_flush();
+	dbstore_sync_flush(db_parq);
+}
+
+/**
+ * Record that the persistent state of a queued entry changed.
+ *
+ * Changes are written to the database at most QUEUE_FLUSH_DELAY seconds
+ * later, coalescing all the changes made to the entry in-between.
+ */
+static void
+parq_upload_dirty(struct parq_ul_queued *puq)
+{
+	parq_ul_queued_check(puq);
+
+	if (parq_shutdown)
+		return;			/* Everything was flushed by parq_close_pre() */
+
+	if (!hash_list_contains(ul_parq_dirty, puq))
+		hash_list_append(ul_parq_dirty, puq);
+
+	if (NULL == parq_flush_ev) {
+		parq_flush_ev = cq_main_insert(QUEUE_FLUSH_DELAY * 1000,
+			parq_upload_flush_due, NULL);
+	}
+}
+
 /**
  * Contains the queued download status.
  */
@@ -1420,16 +1703,17 @@ parq_estimated_slot_time(const struct parq_ul_queued *puq)
 }
 
 /**
- * Updates the ETA of all queued items in the given queue.
+ * Computes the ETA of all queued items in the given queue.
  */
 static void
-parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
+parq_upload_compute_eta(struct parq_ul_queue *which_ul_queue)
 {
 	plist_t *l;
+	ostnode_t *n;
 	uint eta = 0;
 	uint avg_bps;
+	uint rel_pos = 0;
 	time_delta_t running_time = delta_time(tm_time(), parq_start);
-	hash_list_iter_t *iter;
 
 	avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
 	avg_bps = MAX(1024, avg_bps);		/* Assume at least 1 KiB/s */
@@ -1442,8 +1726,9 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 		 * Locate the first active upload in this queue.
 		 */
 
-		PLIST_FOREACH(which_ul_queue->by_position, l) {
-			struct parq_ul_queued *puq = l->data;
+		OSTREE_FOREACH(&which_ul_queue->by_position, n) {
+			struct parq_ul_queued *puq =
+				parq_ul_by_position(which_ul_queue, n);
 
 			if (puq->has_slot) {		/* Recompute ETA */
 				eta += parq_estimated_slot_time(puq);
@@ -1472,14 +1757,13 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 			g_warning("[PARQ UL] Was unable to calculate an accurate ETA");
 	}
 
-	iter = hash_list_iterator(which_ul_queue->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	OSTREE_FOREACH(&which_ul_queue->by_rel_pos, n) {
+		struct parq_ul_queued *puq = parq_ul_by_rel_pos(which_ul_queue, n);
 
 		g_assert(puq->is_alive);
 
 		puq->eta = eta;
+		rel_pos++;
 
 		if (puq->has_slot)
 			continue;			/* Skip already uploading uploads */
@@ -1493,9 +1777,9 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 		 * rate from all the queues.
 		 */
 
-		if (puq->relative_position > GNET_PROPERTY(max_uploads)) {
+		if (rel_pos > GNET_PROPERTY(max_uploads)) {
 			time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
-			uint cheap_eta = puq->relative_position * per_slot;
+			uint cheap_eta = rel_pos * per_slot;
 
 			if (cheap_eta < eta)
 				puq->eta = cheap_eta;
@@ -1504,149 +1788,91 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 		eta += parq_estimated_slot_time(puq);
 	}
 
-	hash_list_iter_release(&iter);
+	which_ul_queue->eta_computed = tm_time();
+	which_ul_queue->eta_stale = FALSE;
 }
 
 /**
- * Decreases the position of all queued items after the given queued item.
+ * Flags the ETA of all queued items in the given queue as needing an update.
+ *
+ * Computing the ETA requires a traversal of the whole queue, so this is
+ * done lazily, at most once per second, when an ETA is actually needed or
+ * from the periodic timer.
  */
-static void
-parq_upload_decrease_all_after(struct parq_ul_queued *puq)
+static inline void
+parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 {
-	plist_t *l;
-	int pos_cnt = 0;	/* Used for assertion */
-
-	g_assert(puq != NULL);
-	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_position_length > 0);
-
-	l = plist_find(puq->queue->by_position, puq);
-	pos_cnt = ((struct parq_ul_queued *) l->data)->position;
-
-	l = plist_next(l);	/* Decrease _after_ current parq */
-
-	/*
-	 * Cycle through list and decrease all positions by one. Position should
-	 * never reach 0 which would mean the queued item is currently uploading
-	 */
-	for (;	l; l = plist_next(l)) {
-		struct parq_ul_queued *p = l->data;
-
-		g_assert(p != NULL);
-		g_assert(p->position > 1);
-		g_assert(p->position - 1 == UNSIGNED(pos_cnt));
-
-		p->position--;
-		pos_cnt++;
-	}
+	which_ul_queue->eta_stale = TRUE;
 }
 
 /**
- * Function used to keep the relative position list sorted by absolute
- * queue positions, which refer to the order of arrival in the queue.
+ * Recompute the ETA of the queued items in the given queue if they are
+ * stale and were not computed during the last second.
  */
-static int
-parq_ul_rel_pos_cmp(const void *a, const void *b)
+static void
+parq_upload_refresh_eta(struct parq_ul_queue *q)
 {
-	const struct parq_ul_queued *as = a, *bs = b;
+	parq_ul_queue_check(q);
 
-	return CMP(as->position, bs->position);
+	if (q->eta_stale && delta_time(tm_time(), q->eta_computed) > 0)
+		parq_upload_compute_eta(q);
 }
 
 /**
- * Insert item in relative position list.
+ * @return the ETA of the queued item, in seconds.
  */
-static inline void
-parq_upload_insert_relative(struct parq_ul_queued *puq)
+static uint
+parq_ul_eta(const struct parq_ul_queued *puq)
 {
-	parq_ul_queued_check(puq);
-
-	g_assert(!(puq->flags & PARQ_UL_FROZEN));
+	parq_upload_refresh_eta(puq->queue);
 
-	puq->relative_position = 0;
-	hash_list_insert_sorted(puq->queue->by_rel_pos, puq, parq_ul_rel_pos_cmp);
+	return puq->eta;
 }
 
 /**
- * Remove item from relative position list.
+ * Function used to keep the queues sorted by arrival order.
  */
-static inline void
-parq_upload_remove_relative(struct parq_ul_queued *puq)
+static int
+parq_ul_seq_cmp(const void *a, const void *b)
 {
-	parq_ul_queued_check(puq);
+	const struct parq_ul_queued *as = a, *bs = b;
 
-	hash_list_remove(puq->queue->by_rel_pos, puq);
-	parq_slots_removed++;
+	return CMP(as->seq, bs->seq);
 }
 
 /**
- * Recomputes all absolute positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
+ * Insert item in relative position tree.
  */
-static void
-parq_upload_recompute_positions(struct parq_ul_queue *q)
+static inline void
+parq_upload_insert_relative(struct parq_ul_queued *puq)
 {
-	uint pos = 0;
-	uint prev_pos = 0;
-	plist_t *l;
+	void *dup;
 
-	parq_ul_queue_check(q);
-
-	PLIST_FOREACH(q->by_position, l) {
-		struct parq_ul_queued *puq = l->data;
+	parq_ul_queued_check(puq);
 
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(puq->position > prev_pos,	/* Was sorted by construction */
-			"pos=%u,, prev=%u", puq->position, prev_pos);
+	g_assert(!(puq->flags & PARQ_UL_FROZEN));
 
-		prev_pos = puq->position;
-		puq->position = ++pos;
-	}
+	puq->relative_position = 0;
+	dup = ostree_insert(&puq->queue->by_rel_pos, &puq->rel_node);
+	g_assert(NULL == dup);
 
-	g_assert(pos <= UNSIGNED(q->by_position_length));
+	parq_upload_update_eta(puq->queue);
 }
 
 /**
- * Recomputes all relative positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
+ * Remove item from relative position tree.
  */
-static void
-parq_upload_recompute_relative_positions(struct parq_ul_queue *q)
+static inline void
+parq_upload_remove_relative(struct parq_ul_queued *puq)
 {
-	uint rel = 0;
-	uint prev_rel = 0;
-	uint prev_pos = 0;
-	hash_list_iter_t *iter;
-
-	parq_ul_queue_check(q);
-
-	iter = hash_list_iterator(q->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(
-			0 == puq->relative_position || puq->relative_position > prev_rel,
-			"rel=%u, prev=%u", puq->relative_position, prev_rel);
-		g_assert_log(puq->position > prev_pos,			/* Was sorted */
-			"pos=%u, prev=%u", puq->position, prev_pos);
+	parq_ul_queued_check(puq);
 
-		if (puq->relative_position != 0)
-			prev_rel = puq->relative_position;
-		prev_pos = puq->position;
-		puq->relative_position = ++rel;
+	if (ostree_linked(&puq->rel_node)) {
+		puq->relative_position = parq_ul_rel_position(puq);
+		ostree_remove(&puq->queue->by_rel_pos, &puq->rel_node);
+		parq_upload_update_eta(puq->queue);
 	}
-
-	hash_list_iter_release(&iter);
-
-	g_assert(rel <= UNSIGNED(q->by_position_length));
-	g_assert(hash_list_length(q->by_rel_pos) == rel);
+	parq_slots_removed++;
 }
 
 /**
@@ -1692,7 +1918,7 @@ parq_upload_free(struct parq_ul_queued *puq)
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->queue != NULL);
 	g_assert(puq->queue->by_position_length > 0);
-	g_assert(puq->queue->by_position != NULL);
+	g_assert(ostree_linked(&puq->pos_node));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->total > 0);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -1700,11 +1926,18 @@ parq_upload_free(struct parq_ul_queued *puq)
 	if (puq->u != NULL)
 		puq->u->parq_ul = NULL;
 
-	parq_upload_decrease_all_after(puq);
-
 	if (puq->flags & PARQ_UL_QUEUE)
 		hash_list_remove(ul_parq_queue, puq);
 
+	/*
+	 * On shutdown, entries are freed but must persist across the restart.
+	 * Any pending change was already flushed by parq_close_pre().
+	 */
+
+	hash_list_remove(ul_parq_dirty, puq);
+	if (!parq_shutdown)
+		dbmw_delete(db_parq, &puq->id);
+
 	puq->by_addr->list = plist_remove(puq->by_addr->list, puq);
 	puq->by_addr->total--;
 
@@ -1733,7 +1966,7 @@ parq_upload_free(struct parq_ul_queued *puq)
 	}
 
 	/* Remove the current queued item from all lists */
-	puq->queue->by_position = plist_remove(puq->queue->by_position, puq);
+	ostree_remove(&puq->queue->by_position, &puq->pos_node);
 
 	parq_upload_remove_relative(puq);
 
@@ -1741,7 +1974,7 @@ parq_upload_free(struct parq_ul_queued *puq)
 	htable_remove(ul_all_parq_by_id, &puq->id);
 
 	g_assert(!hash_list_contains(puq->queue->by_date_dead, puq));
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+	g_assert(!ostree_linked(&puq->rel_node));
 
 	/*
 	 * Queued upload is now removed from all lists. So queue size can be
@@ -1756,11 +1989,8 @@ parq_upload_free(struct parq_ul_queued *puq)
 	 * not all entries are removed the 'correct' way, we just want to free
 	 * the memory
 	 */
-	if (!parq_shutdown) {
-		parq_upload_recompute_positions(puq->queue);
-		parq_upload_recompute_relative_positions(puq->queue);
+	if (!parq_shutdown)
 		parq_upload_update_eta(puq->queue);
-	}
 
 	/* Free the memory used by the current queued item */
 	HFREE_NULL(puq->addr_and_name);
@@ -1783,7 +2013,7 @@ static uint32
 parq_ul_calc_retry(struct parq_ul_queued *puq)
 {
 	int result = PARQ_TIMER_BY_POS +
-		(puq->relative_position - 1) * (PARQ_TIMER_BY_POS / 2);
+		(parq_ul_rel_position(puq) - 1) * (PARQ_TIMER_BY_POS / 2);
 
 	if (GNET_PROPERTY(parq_optimistic)) {
 		struct parq_ul_queued *puq_prev = NULL;
@@ -1792,7 +2022,10 @@ parq_ul_calc_retry(struct parq_ul_queued *puq)
 		avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
 		avg_bps = MAX(1, avg_bps);
 
-		puq_prev = hash_list_previous(puq->queue->by_rel_pos, puq);
+		if (ostree_linked(&puq->rel_node)) {
+			puq_prev = parq_ul_by_rel_pos(puq->queue,
+				ostree_prev(&puq->rel_node));
+		}
 
 		if (puq_prev != NULL && puq_prev->has_slot) {
 			int fast_result =
@@ -1823,7 +2056,10 @@ parq_upload_new_queue(void)
 	queue->magic = PARQ_UL_QUEUE_MAGIC;
 	queue->active = TRUE;
 	queue->slot_stats = statx_make();
-	queue->by_rel_pos = hash_list_new(NULL, NULL);
+	ostree_init(&queue->by_position, parq_ul_seq_cmp,
+		offsetof(struct parq_ul_queued, pos_node));
+	ostree_init(&queue->by_rel_pos, parq_ul_seq_cmp,
+		offsetof(struct parq_ul_queued, rel_node));
 	queue->by_date_dead = hash_list_new(NULL, NULL);
 
 	ul_parqs = plist_append(ul_parqs, queue);
@@ -1934,15 +2170,15 @@ parq_upload_create(struct upload *u)
 	g_assert(q != NULL);
 
 	/* Locate the last alive queued item so we can calculate the ETA */
-	prev_puq = hash_list_tail(q->by_rel_pos);
+	prev_puq = ostree_tail(&q->by_rel_pos);
 
 	if (prev_puq != NULL) {
 		parq_ul_queued_check(prev_puq);
-		g_assert(prev_puq->is_alive);	/* Must be to belong to that list */
+		g_assert(prev_puq->is_alive);	/* Must be to belong to that tree */
 
-		rel_pos = prev_puq->relative_position + 1;
+		rel_pos = ostree_count(&q->by_rel_pos) + 1;
 
-		eta = prev_puq->eta;
+		eta = parq_ul_eta(prev_puq);
 
 		if (GNET_PROPERTY(max_uploads) <= 0) {
 			eta = (uint) -1;
@@ -1951,8 +2187,8 @@ parq_upload_create(struct upload *u)
 		}
 	}
 
-	/* Will append item to the list */
-	g_assert(hash_list_length(q->by_rel_pos) + 1 == rel_pos);
+	/* Will append item to the tree */
+	g_assert(ostree_count(&q->by_rel_pos) + 1 == rel_pos);
 
 	/* Create new parq_upload item */
 	WALLOC0(puq);
@@ -1969,8 +2205,7 @@ parq_upload_create(struct upload *u)
 	g_assert(puq->addr_and_name != NULL);
 
 	/* Fill puq structure */
-	puq->position = q->by_position_length + 1;
-	puq->relative_position = rel_pos;
+	puq->seq = ++parq_ul_seq;
 	puq->eta = eta;
 	puq->enter = now;
 	puq->updated = now;
@@ -2004,16 +2239,15 @@ parq_upload_create(struct upload *u)
 	htable_insert(ul_all_parq_by_id, &puq->id, puq);
 
 	q->by_position_length++;
-	q->by_position = plist_append(q->by_position, puq);
-
-	hash_list_append(puq->queue->by_rel_pos, puq);
+	ostree_insert(&q->by_position, &puq->pos_node);
+	ostree_insert(&q->by_rel_pos, &puq->rel_node);
 
 	if (GNET_PROPERTY(parq_debug) > 3) {
 		g_debug("PARQ UL Q %d/%zd (%3d[%3d]/%3d): New: %s \"%s\"; ID=\"%s\"",
 			puq->queue->num,
 			plist_length(ul_parqs),
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_position(puq),
 			puq->queue->by_position_length,
 			host_addr_to_string(puq->remote_addr),
 			puq->name,
@@ -2040,16 +2274,13 @@ parq_upload_create(struct upload *u)
 	puq->by_addr->list = plist_prepend(puq->by_addr->list, puq);
 
 	g_assert(puq != NULL);
-	g_assert(puq->position > 0);
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->name != NULL);
 	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_rel_pos != NULL);
-	g_assert(puq->queue->by_position->data != NULL);
-	g_assert(puq->relative_position > 0);
-	g_assert(puq->relative_position <=
-		UNSIGNED(puq->queue->by_position_length));
+	g_assert(ostree_linked(&puq->pos_node));
+	g_assert(ostree_linked(&puq->rel_node));
+	g_assert(parq_ul_rel_position(puq) == rel_pos);
+	g_assert(rel_pos <= UNSIGNED(puq->queue->by_position_length));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
 
@@ -2097,7 +2328,8 @@ parq_upload_free_queue(struct parq_ul_queue *queue)
 	ul_parqs_cnt--;
 
 	/* Free memory */
-	hash_list_free(&queue->by_rel_pos);
+	g_assert(0 == ostree_count(&queue->by_position));
+	g_assert(0 == ostree_count(&queue->by_rel_pos));
 	hash_list_free(&queue->by_date_dead);
 	statx_free(queue->slot_stats);
 	queue->magic = 0;
@@ -2214,8 +2446,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"not PARQ-aware, not sending QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2232,8 +2464,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"no valid address to send QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2299,14 +2531,15 @@ parq_upload_send_queue(struct parq_ul_queued *puq)
 	puq->queue_sent++;
 	puq->send_next_queue = parq_upload_next_queue(now, puq);
 	puq->by_addr->last_queue_sent = now;
+	parq_upload_dirty(puq);
 
 	if (GNET_PROPERTY(parq_debug)) {
 		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): "
 			"Sending QUEUE #%d to %s for ID=%s: '%s'",
 			puq->queue->num,
 			ul_parqs_cnt,
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_position(puq),
 			puq->queue->by_position_length,
 			puq->queue_sent,
 			host_addr_port_to_string(puq->addr, puq->port),
@@ -2514,13 +2747,11 @@ parq_dead_timer(void *unused_udata)
 static void
 parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 {
-	hash_list_iter_t *iter;
+	ostnode_t *n;
 	pslist_t *to_remove = *rlp;
 
-	iter = hash_list_iterator(q->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	OSTREE_FOREACH(&q->by_rel_pos, n) {
+		struct parq_ul_queued *puq = parq_ul_by_rel_pos(q, n);
 		time_delta_t grace;
 
 		g_assert(puq != NULL);
@@ -2567,8 +2798,8 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 					"Timeout: ID=%s %s '%s'",
 					puq->queue->num,
 					ul_parqs_cnt,
-					puq->position,
-					puq->relative_position,
+					parq_ul_position(puq),
+					parq_ul_rel_position(puq),
 					puq->queue->by_position_length,
 					guid_hex_str(&puq->id),
 					host_addr_to_string(puq->remote_addr),
@@ -2577,15 +2808,13 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 
 			/*
 			 * Mark for removal. Can't remove now as we are still using the
-			 * ul_parq_by_position linked list. (prepend is probably the
+			 * "by_rel_pos" tree. (prepend is probably the
 			 * fastest function)
 			 */
 			to_remove = pslist_prepend(to_remove, puq);
 		}
 	}
 
-	hash_list_iter_release(&iter);
-
 	*rlp = to_remove;
 }
 
@@ -2650,6 +2879,7 @@ parq_upload_send_queue_callbacks(time_t now)
 			}
 			puq->last_queue_sent = last_queue_sent;	/* We considered it... */
 			puq->flags &= ~PARQ_UL_QUEUE;
+			parq_upload_dirty(puq);
 			goto remove;
 		}
 
@@ -2742,7 +2972,6 @@ parq_upload_timer(time_t now)
 			parq_upload_frozen_clear(puq);
 
 		parq_upload_remove_relative(puq);
-		puq->queue->recompute = TRUE;	/* Defer costly recomputations */
 
 		if (enable_real_passive && parq_still_sharing(puq)) {
 			hash_list_append(puq->queue->by_date_dead, puq);
@@ -2751,17 +2980,15 @@ parq_upload_timer(time_t now)
 	}
 
 	/*
-	 * Recompute data only for the queues in which we removed items --RAM.
+	 * Refresh the ETA of the queues in which we removed items, now that
+	 * the per-queue positions are no longer moving --RAM.
 	 */
 
 	PLIST_FOREACH(ul_parqs, queues) {
 		struct parq_ul_queue *q = queues->data;
 
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			parq_upload_update_eta(q);
-			q->recompute = FALSE;
-		}
+		if (q->eta_stale)
+			parq_upload_compute_eta(q);
 	}
 
 	pslist_free_null(&to_remove);
@@ -3011,11 +3238,10 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 					uqx->is_alive ? "alive" : "dead",
 					guid_hex_str(&uqx->id), uqx->queue->num,
 					host_addr_to_string(puq->by_addr->addr),
-					uqx->relative_position);
+					parq_ul_rel_position(uqx));
 
 			parq_upload_remove_relative(uqx);
 			parq_upload_frozen_set(uqx);
-			uqx->queue->recompute = TRUE;	/* Defer update */
 			extra++;
 		}
 
@@ -3028,19 +3254,6 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), frozen);
 
 	g_assert(puq->by_addr->frozen == frozen);
-
-	/*
-	 * Recompute data only for the queues in which we removed items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3065,10 +3278,9 @@ parq_upload_unfreeze_one(struct parq_ul_queued *puq)
 
 	parq_upload_frozen_clear(puq);
 
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+	g_assert(!ostree_linked(&puq->rel_node));
 
 	parq_upload_insert_relative(puq);
-	parq_upload_recompute_relative_positions(puq->queue);
 }
 
 /**
@@ -3099,7 +3311,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			parq_upload_frozen_clear(uqx);
 			if (uqx->is_alive) {
 				parq_upload_insert_relative(uqx);
-				uqx->queue->recompute = TRUE;		/* Defer update */
 				inserted++;
 			}
 
@@ -3119,19 +3330,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), inserted);
 
 	g_assert(0 == puq->by_addr->frozen);
-
-	/*
-	 * Recompute data only for the queues in which we inserted items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3142,41 +3340,37 @@ static void
 parq_ul_dump_earlier(struct parq_ul_queued *item)
 {
 	struct parq_ul_queue *q;
-	hash_list_iter_t *iter;
-	unsigned old_relative = 0;
+	ostnode_t *n;
+	unsigned relative = 0, item_relative;
 
 	parq_ul_queued_check(item);
 
 	q = item->queue;
 	parq_ul_queue_check(q);
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	item_relative = parq_ul_rel_position(item);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	OSTREE_FOREACH(&q->by_rel_pos, n) {
+		struct parq_ul_queued *puq = parq_ul_by_rel_pos(q, n);
 
 		parq_ul_queued_check(puq);
-		g_assert_log(puq->relative_position > old_relative,
-			"relative=%u, old=%u", puq->relative_position, old_relative);
-		old_relative = puq->relative_position;
+		relative++;
 
 		if (
-			puq->relative_position >= item->relative_position ||
-			puq->relative_position > GNET_PROPERTY(max_uploads)
+			relative >= item_relative ||
+			relative > GNET_PROPERTY(max_uploads)
 		)
 			break;
 
 		g_debug("[PARQ UL] Q#%d pos=%u, rel=%u, slot<has=%s had=%s> updated=%s"
 			" active=%s, quick=%s, alive=%s, flags=0x%x, ID=%s, expire=%s ",
-			q->num, puq->position, puq->relative_position,
+			q->num, parq_ul_position(puq), relative,
 			puq->has_slot ? "y" : "n", puq->had_slot ? "y" : "n",
 			compact_time(delta_time(tm_time(), puq->updated)),
 			puq->active_queued ? "y" : "n", puq->quick ? "y" : "n",
 			puq->is_alive ? "y" : "n", puq->flags, guid_hex_str(&puq->id),
 			timestamp_utc_to_string(puq->expire));
 	}
-
-	hash_list_iter_release(&iter);
 }
 
 /**
@@ -3289,7 +3483,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 	 * already downloading something in another queue.
 	 */
 
-	if (puq->relative_position <= UNSIGNED(slots_free)) {
+	if (parq_ul_rel_position(puq) <= UNSIGNED(slots_free)) {
 		if (GNET_PROPERTY(parq_debug))
 			g_debug("[PARQ UL] [#%d] allowing %supload \"%s\" from %s (%s), "
 				"relative pos = %u [%s]",
@@ -3299,7 +3493,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 				host_addr_port_to_string(
 					puq->u->socket->addr, puq->u->socket->port),
 				upload_vendor_str(puq->u),
-				puq->relative_position, guid_hex_str(&puq->id));
+				parq_ul_rel_position(puq), guid_hex_str(&puq->id));
 
 		return TRUE;
 	}
@@ -3310,8 +3504,8 @@ parq_upload_continue(struct parq_ul_queued *puq)
 			puq->queue->num, puq->u->name,
 			host_addr_port_to_string(
 				puq->u->socket->addr, puq->u->socket->port),
-			upload_vendor_str(puq->u), puq->position,
-			puq->relative_position);
+			upload_vendor_str(puq->u), parq_ul_position(puq),
+			parq_ul_rel_position(puq));
 
 		if (GNET_PROPERTY(parq_debug) > 5)
 			parq_ul_dump_earlier(puq);
@@ -3463,8 +3657,8 @@ parq_upload_get(struct upload *u, const header_t *header)
 				"ETA: %s Added: %s '%s' %s",
 				puq->queue->num,
 				ul_parqs_cnt,
-				puq->position,
-				puq->relative_position,
+				parq_ul_position(puq),
+				parq_ul_rel_position(puq),
 				puq->queue->by_position_length,
 				short_time_ascii(parq_upload_lookup_eta(u)),
 				host_addr_to_string(puq->remote_addr),
@@ -3530,14 +3724,11 @@ parq_upload_get(struct upload *u, const header_t *header)
 		puq->queue->alive++;
 		puq->is_alive = TRUE;
 		g_assert(puq->queue->alive > 0);
-		g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+		g_assert(!ostree_linked(&puq->rel_node));
 
-		/* Re-insert in the relative position list, unless entry is frozen */
-		if (!(puq->flags & PARQ_UL_FROZEN)) {
+		/* Re-insert in the relative position tree, unless entry is frozen */
+		if (!(puq->flags & PARQ_UL_FROZEN))
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
-			parq_upload_update_eta(puq->queue);
-		}
 	}
 
 	buf = header_get(header, "X-Queue");
@@ -3583,6 +3774,7 @@ parq_upload_get(struct upload *u, const header_t *header)
 					uq->addr = addr;
 					uq->port = port;
 					uq->flags &= ~PARQ_UL_NOQUEUE;
+					parq_upload_dirty(uq);
 				}
 			}
 		}
@@ -3595,6 +3787,7 @@ parq_upload_get(struct upload *u, const header_t *header)
 	 */
 
 	puq->u = u;
+	parq_upload_dirty(puq);
 
 	return puq;
 }
@@ -3698,8 +3891,10 @@ parq_upload_update_downloaded(const struct upload *u)
 
 	puq = handle_to_queued(u->parq_ul);
 
-	if (u->downloaded <= puq->file_size)
+	if (u->downloaded <= puq->file_size) {
 		puq->downloaded = u->downloaded;
+		parq_upload_dirty(puq);
+	}
 }
 
 /**
@@ -3725,6 +3920,7 @@ parq_upload_request(struct upload *u)
 	g_assert(delta_time(puq->retry, now) >= 0);
 
 	puq->expire = time_advance(puq->retry, MIN_LIFE_TIME + PARQ_RETRY_SAFETY);
+	parq_upload_dirty(puq);
 
 	if (GNET_PROPERTY(parq_debug) > 1)
 		g_debug("[PARQ UL] %srequest for \"%s\" from %s <%s>: %s, "
@@ -3788,11 +3984,11 @@ parq_upload_request(struct upload *u)
 
 	if (puq->has_slot) {
 		if (!puq->quick) {
-			g_assert(puq->relative_position == 0);
+			g_assert(parq_ul_rel_position(puq) == 0);
 			return TRUE;			/* Has regular slot */
 		}
 		if (parq_upload_quick_continue(puq)) {
-			g_assert(puq->relative_position > 0);
+			g_assert(parq_ul_rel_position(puq) > 0);
 			return TRUE;			/* Has quick slot */
 		}
 		if (GNET_PROPERTY(parq_debug))
@@ -3826,7 +4022,7 @@ parq_upload_request(struct upload *u)
 		 *		--RAM, 2007-08-17
 		 */
 
-		g_assert(puq->relative_position > 0);	/* Was a quick slot */
+		g_assert(parq_ul_rel_position(puq) > 0);	/* Was a quick slot */
 
 		puq->by_addr->uploading--;
 		puq->has_slot = FALSE;
@@ -3868,7 +4064,7 @@ parq_upload_request(struct upload *u)
 			if (puq->flags & PARQ_UL_FROZEN)
 				puq->active_queued = FALSE;
 			else if (
-				puq->relative_position <=
+				parq_ul_rel_position(puq) <=
 				1 + UNSIGNED(free_upload_slots(puq->queue)) / 2
 			)
 				u->status = GTA_UL_QUEUED;	/* Maintain active queuing */
@@ -3887,7 +4083,7 @@ parq_upload_request(struct upload *u)
 					"switching from active to passive for %s (%s)",
 					puq->queue->num, guid_hex_str(&puq->id),
 					fd_avail_status_string(fds),
-					puq->relative_position, u->push ? "y" : "n",
+					parq_ul_rel_position(puq), u->push ? "y" : "n",
 					(puq->flags & PARQ_UL_FROZEN) ? "y" : "n",
 					host_addr_port_to_string(u->socket->addr, u->socket->port),
 					upload_vendor_str(u));
@@ -3929,7 +4125,7 @@ parq_upload_request(struct upload *u)
 		queueable = GNET_PROPERTY(sys_nofile) * 4 / 5 >
 			max_fd_used + (MIN_ALWAYS_QUEUE * GNET_PROPERTY(max_uploads));
 
-		if (puq->relative_position <= MIN_ALWAYS_QUEUE)
+		if (parq_ul_rel_position(puq) <= MIN_ALWAYS_QUEUE)
 			queueable = TRUE;
 
 		/*
@@ -3955,8 +4151,8 @@ parq_upload_request(struct upload *u)
 		}
 
 		if (
-			(u->push && puq->relative_position <= max_slot) ||
-			(queueable && puq->relative_position <=
+			(u->push && parq_ul_rel_position(puq) <= max_slot) ||
+			(queueable && parq_ul_rel_position(puq) <=
 				UNSIGNED(free_upload_slots(puq->queue)) + MIN_UPLOAD_ASLOT)
 		) {
 			if ((puq->flags & PARQ_UL_FROZEN) && !activeable) {
@@ -4011,7 +4207,8 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	if (GNET_PROPERTY(parq_debug) > 2) {
 		g_debug("PARQ UL [#%d] upload pos=%d rel=%d (%s, %s, %s) "
 			"is now busy [%s]",
-			puq->queue->num, puq->position, puq->relative_position,
+			puq->queue->num,
+			parq_ul_position(puq), parq_ul_rel_position(puq),
 			puq->active_queued ? "active" : "passive",
 			puq->has_slot ? "with slot" : "no slot yet",
 			puq->quick ? "quick" : "regular",
@@ -4035,9 +4232,8 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	 *		--RAM, 2007-08-16
 	 */
 
-	if (!puq->quick && puq->relative_position) {
+	if (!puq->quick && parq_ul_rel_position(puq)) {
 		parq_upload_remove_relative(puq);
-		parq_upload_recompute_relative_positions(puq->queue);
 
 		puq->relative_position = 0;		/* Signals: has regular slot */
 		puq->had_slot = TRUE;			/* Had a regular slot */
@@ -4058,6 +4254,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	puq->has_slot = TRUE;
 	puq->by_addr->uploading++;
 	puq->slot_granted = tm_time();
+	parq_upload_dirty(puq);
 }
 
 void
@@ -4231,7 +4428,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 	 */
 
 	if (puq->has_slot) {
-		hash_list_iter_t *iter;
+		ostnode_t *n;
 
 		if (GNET_PROPERTY(parq_debug) > 2)
 			g_debug("PARQ UL: [#%d] [%s] Freed an upload slot%s",
@@ -4249,10 +4446,9 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 		 * Tell next waiting upload that a slot is available, using QUEUE
 		 */
 
-		iter = hash_list_iterator(puq->queue->by_rel_pos);
-
-		while (hash_list_iter_has_next(iter)) {
-			struct parq_ul_queued *puq_next = hash_list_iter_next(iter);
+		OSTREE_FOREACH(&puq->queue->by_rel_pos, n) {
+			struct parq_ul_queued *puq_next =
+				parq_ul_by_rel_pos(puq->queue, n);
 
 			parq_ul_queued_check(puq_next);
 
@@ -4277,13 +4473,11 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			break;
 		}
 
-		hash_list_iter_release(&iter);
-
 		/*
 		 * Put back in queue until it expires.
 		 */
 
-		if (0 == puq->relative_position) {
+		if (0 == parq_ul_rel_position(puq)) {
 			puq->queue->active_uploads--;
 			puq->expire = time_advance(now, GUARDING_TIME);
 
@@ -4296,10 +4490,9 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			if (puq->had_slot)
 				puq->flags |= PARQ_UL_NOQUEUE;
 
-			g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+			g_assert(!ostree_linked(&puq->rel_node));
 
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
 		}
 
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
@@ -4379,6 +4572,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 done:
 	puq->has_slot = FALSE;
 	puq->slot_granted = 0;
+	parq_upload_dirty(puq);
 
 	return FALSE;
 }
@@ -4404,12 +4598,12 @@ parq_upload_add_old_queue_header(char *buf, size_t size,
 	if (small_reply) {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, min_poll, max_poll);
+				parq_ul_rel_position(puq), min_poll, max_poll);
 	} else {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, length=%d, "
 				"limit=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, puq->queue->by_position_length,
+				parq_ul_rel_position(puq), puq->queue->by_position_length,
 				1, min_poll, max_poll);
 	}
 	if (len >= size || (len > 0 && '\n' != buf[len - 1])) {
@@ -4445,7 +4639,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 		puq->flags |= PARQ_UL_ID_SENT;
 
 		len = concat_strings(&buf[rw], size,
-			"; position=", uint32_to_string(puq->relative_position),
+			"; position=", uint32_to_string(parq_ul_rel_position(puq)),
 			NULL_PTR);
 
 		if (len < size) {
@@ -4467,7 +4661,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 						rw += len;
 						size -= len;
 						len = concat_strings(&buf[rw], size,
-							"; ETA=", uint32_to_string(puq->eta),
+							"; ETA=", uint32_to_string(parq_ul_eta(puq)),
 							NULL_PTR);
 						if (len < size) {
 							rw += len;
@@ -4636,7 +4830,7 @@ parq_upload_lookup_position(const struct upload *u)
 	puq = parq_upload_find(u);
 
 	if (puq != NULL) {
-		return puq->relative_position;
+		return parq_ul_rel_position(puq);
 	} else {
 		return (uint) -1;
 	}
@@ -4668,7 +4862,7 @@ parq_upload_lookup_eta(const struct upload *u)
 
 	/* If puq == NULL the current upload isn't queued and ETA is unknown */
 	if (puq != NULL)
-		return puq->eta;
+		return parq_ul_eta(puq);
 	else
 		return (uint) -1;
 }
@@ -4855,139 +5049,40 @@ parq_upload_send_queue_conf(struct upload *u)
 }
 
 /**
- * Saves an individual queued upload to disc.
+ * Persists the changes made to the queues so that they can be restored when
+ * the client starts up again.
  *
- * This is the callback function used by plist_foreach() in function
- * parq_upload_save_queue().
- */
-static inline void
-parq_store(void *data, void *file_ptr)
-{
-	FILE *f = file_ptr;
-	struct parq_ul_queued *puq = data;
-	char last_buf[TIMESTAMP_BUFLEN];
-	char enter_buf[TIMESTAMP_BUFLEN];
-	int expire;
-
-	/* We are not saving uploads which already finished an upload */
-	if (puq->had_slot && !puq->has_slot)
-		return;
-
-	if (puq->has_slot) {
-		/* If we have a slot, puq->expire is meaningless */
-		expire = 0;
-	} else {
-		expire = delta_time(puq->expire, tm_time());
-		if (expire < 0)
-			return;
-	}
-
-	g_assert(NULL != f);
-	if (GNET_PROPERTY(parq_debug) > 5) {
-		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): Saving %s: '%s' - %s '%s'",
-			  puq->queue->num,
-			  ul_parqs_cnt,
-			  puq->position,
-			  puq->relative_position,
-			  puq->queue->by_position_length,
-			  puq->supports_parq ? "PARQ" : "slot",
-			  guid_hex_str(&puq->id),
-			  host_addr_to_string(puq->remote_addr),
-			  puq->name);
-	}
-
-	timestamp_to_string_buf(puq->enter, ARYLEN(enter_buf));
-	timestamp_to_string_buf(puq->last_queue_sent, ARYLEN(last_buf));
-
-	/*
-	 * Save all needed parq information. The ip and port information gathered
-	 * from X-Node is saved as XIP and XPORT
-	 * The lifetime is saved as a relative value.
-	 */
-	fprintf(f,
-		"QUEUE: %d\n"
-		"POS: %d\n"
-		"ENTERED: %s\n"
-		"EXPIRE: %d\n"
-		"ID: %s\n"
-		"SIZE: %s\n"
-		"GOT: %s\n"
-		"IP: %s\n"
-		,
-		puq->queue->num,
-		puq->position,
-		enter_buf,
-		expire,
-		guid_hex_str(&puq->id),
-		uint64_to_string(puq->file_size),
-		uint64_to_string2(puq->downloaded),
-		host_addr_to_string(puq->remote_addr)
-	);
-
-	if (puq->queue_sent) {
-		fprintf(f,
-			"QUEUESSENT: %d\n"
-			"LASTQUEUE: %s\n"
-			,
-			puq->queue_sent,
-			last_buf
-		);
-	}
-
-	if (puq->sha1)
-		fprintf(f, "SHA1: %s\n", sha1_base32(puq->sha1));
-
-	if (puq->supports_parq)
-		fprintf(f, "PARQ:\n");	/* No value needed, tag presence is enough */
-
-	if (
-		!(puq->flags & PARQ_UL_NOQUEUE) &&
-		puq->port != 0 && is_host_addr(puq->addr)
-	) {
-		fprintf(f,
-			"XIP: %s\n"
-			"XPORT: %u\n",
-			host_addr_to_string(puq->addr), (unsigned) puq->port);
-	}
-	fprintf(f, "NAME: %s\n\n", puq->name);
-}
-
-/**
- * Saves all the current queues and their items so it can be restored when the
- * client starts up again.
+ * @param all		if TRUE, refresh all the entries, not only the changed ones
  */
 static void
-parq_upload_save_queue(void)
+parq_upload_save_queue(bool all)
 {
-	FILE *f;
-	file_path_t fp;
-	time_t now = tm_time();
-	plist_t *queues;
-
 	if (GNET_PROPERTY(parq_debug) > 3)
-		g_debug("PARQ UL: trying to save all queue info");
+		g_debug("PARQ UL: trying to save %s queue info",
+			all ? "all" : "changed");
 
-	file_path_set(&fp, settings_config_dir(), file_parq_file);
-	f = file_config_open_write("PARQ upload queue data", &fp);
-	if (!f)
-		return;
+	if (all) {
+		plist_t *queues;
 
-	fputs("# THIS FILE IS AUTOMATICALLY GENERATED -- DO NOT EDIT\n#\n", f);
-	fprintf(f, "# Saved on %s\n", timestamp_to_string(now));
+		PLIST_FOREACH(ul_parqs, queues) {
+			struct parq_ul_queue *queue = queues->data;
+			ostnode_t *n;
 
-	for (
-		queues = plist_last(ul_parqs) ; queues != NULL; queues = queues->prev
-	) {
-		struct parq_ul_queue *queue = queues->data;
+			OSTREE_FOREACH(&queue->by_position, n) {
+				struct parq_ul_queued *puq = parq_ul_by_position(queue, n);
 
-		PLIST_FOREACH_CALL_DATA(queue->by_position, parq_store, f);
+				if (!hash_list_contains(ul_parq_dirty, puq))
+					hash_list_append(ul_parq_dirty, puq);
+			}
+		}
 	}
 
-	file_config_close(f, &fp);
+	parq_upload_flush();
+	dbstore_sync_flush(db_parq);
 
 	if (GNET_PROPERTY(parq_debug) > 3)
-		g_debug("PARQ UL: all saved");
-
+		g_debug("PARQ UL: all saved (%zu entr%s)",
+			dbmw_count(db_parq), plural_y(dbmw_count(db_parq)));
 }
 
 /**
@@ -5015,7 +5110,7 @@ parq_save_timer(void *unused_udata)
 		}
 	}
 
-	parq_upload_save_queue();
+	parq_upload_save_queue(FALSE);
 
 	return TRUE;		/* Keep calling */
 }
@@ -5090,7 +5185,197 @@ typedef struct {
 } parq_entry_t;
 
 /**
- * Loads the saved queue status back into memory.
+ * Restore a queued upload from its persisted state.
+ *
+ * @param id		the PARQ ID of the entry
+ * @param pd		the persisted state
+ *
+ * @return the restored entry, NULL if it could not be restored.
+ */
+static struct parq_ul_queued *
+parq_upload_restore(const struct guid *id, const struct parqdata *pd)
+{
+	struct upload *fake_upload;
+	struct parq_ul_queued *puq = NULL;
+	time_t now = tm_time();
+	time_delta_t remain;
+
+	/* Fill a fake upload structure */
+	fake_upload = upload_alloc();
+	fake_upload->file_size = pd->file_size;
+	fake_upload->downloaded = pd->downloaded;
+	fake_upload->name = deconstify_char(pd->name);
+	fake_upload->addr = pd->remote_addr;
+
+	if (
+		htable_contains(ul_all_parq_by_id, id) ||
+		parq_upload_find(fake_upload) != NULL
+	) {
+		if (GNET_PROPERTY(parq_debug)) {
+			g_warning("[PARQ UL] ignoring duplicate entry ID=%s for %s '%s'",
+				guid_hex_str(id), host_addr_to_string(pd->remote_addr),
+				pd->name);
+		}
+		goto done;
+	}
+
+	/*
+	 * Entries are restored by increasing sequence number: make sure they
+	 * keep their original one so that their relative order is preserved
+	 * with respect to the entries we have not restored yet.
+	 */
+
+	if (pd->seq > parq_ul_seq)
+		parq_ul_seq = pd->seq - 1;
+
+	puq = parq_upload_create(fake_upload);
+	g_assert(puq != NULL);
+
+	/*
+	 * Upon restart, give them time to retry before we expire the
+	 * slot: add MIN_LIFE_TIME to all expiration times.
+	 *		--RAM, 2007-08-18
+	 */
+
+	remain = 0 == pd->expire ? 0 : delta_time(pd->expire, pd->saved);
+	remain = MAX(0, remain);
+
+	puq->supports_parq = pd->supports_parq;
+	puq->enter = pd->enter;
+	puq->expire = time_advance(now, MIN_LIFE_TIME + remain);
+	puq->addr = pd->x_addr;
+	puq->port = pd->x_port;
+	puq->sha1 = pd->has_sha1 ? atom_sha1_get(&pd->sha1) : NULL;
+	puq->last_queue_sent = pd->last_queue_sent;
+	puq->queue_sent = pd->queue_sent;
+	puq->send_next_queue = parq_upload_next_queue(pd->last_queue_sent, puq);
+
+	/* During parq_upload_create already created an ID for us */
+	htable_remove(ul_all_parq_by_id, &puq->id);
+	puq->id = *id;
+	htable_insert(ul_all_parq_by_id, &puq->id, puq);
+
+	if (GNET_PROPERTY(parq_debug) > 2) {
+		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d) ETA: %s "
+			"restored: %s%s '%s'",
+			puq->queue->num,
+			ul_parqs_cnt,
+			parq_ul_position(puq),
+			parq_ul_rel_position(puq),
+			puq->queue->by_position_length,
+			short_time_ascii(parq_upload_lookup_eta(fake_upload)),
+			host_addr_to_string(puq->remote_addr),
+			puq->supports_parq ? " (PARQ)" : "",
+			puq->name);
+	}
+
+	if (host_is_valid(puq->addr, puq->port)) {
+		if (GNET_PROPERTY(max_uploads) > 0)
+			parq_upload_register_send_queue(puq);
+	} else {
+		puq->flags |= PARQ_UL_NOQUEUE;
+	}
+
+done:
+	upload_free(&fake_upload);
+	return puq;
+}
+
+/**
+ * A persisted entry, as loaded from the database.
+ */
+struct parq_loaded {
+	struct guid id;
+	struct parqdata pd;
+};
+
+/**
+ * DBMW foreach iterator to collect the persisted entries.
+ */
+static void
+parq_upload_load_item(void *key, void *value, size_t len, void *data)
+{
+	pslist_t **lp = data;
+	struct parq_loaded *pl;
+
+	g_assert(sizeof pl->pd == len);
+
+	WALLOC(pl);
+	memcpy(&pl->id, key, sizeof pl->id);
+	memcpy(&pl->pd, value, sizeof pl->pd);
+	*lp = pslist_prepend(*lp, pl);
+}
+
+/**
+ * Sort persisted entries by increasing arrival order.
+ */
+static int
+parq_loaded_seq_cmp(const void *a, const void *b)
+{
+	const struct parq_loaded *pa = a, *pb = b;
+
+	return CMP(pa->pd.seq, pb->pd.seq);
+}
+
+/**
+ * Loads the persisted queue state back into memory.
+ *
+ * @return the amount of entries restored.
+ */
+static size_t
+parq_upload_load_db(void)
+{
+	pslist_t *sl, *loaded = NULL;
+	size_t restored = 0, ignored = 0;
+
+	dbmw_foreach(db_parq, parq_upload_load_item, &loaded);
+	loaded = pslist_sort(loaded, parq_loaded_seq_cmp);
+
+	PSLIST_FOREACH(loaded, sl) {
+		struct parq_loaded *pl = sl->data;
+
+		if (
+			pl->pd.version <= PARQ_DATA_VERSION &&
+			parq_upload_restore(&pl->id, &pl->pd) != NULL
+		) {
+			restored++;
+		} else {
+			dbmw_delete(db_parq, &pl->id);
+			ignored++;
+		}
+		WFREE(pl);
+	}
+
+	pslist_free_null(&loaded);
+
+	if (GNET_PROPERTY(parq_debug)) {
+		g_debug("[PARQ UL] restored %zu entr%s from database, ignored %zu",
+			restored, plural_y(restored), ignored);
+	}
+
+	return restored;
+}
+
+/**
+ * Remove the legacy text file, once its content was imported.
+ */
+static void
+parq_upload_unlink_legacy(void)
+{
+	char *path, *orig;
+
+	path = make_pathname(settings_config_dir(), file_parq_file);
+	orig = h_strconcat(path, ".orig", NULL_PTR);
+
+	(void) unlink(path);
+	(void) unlink(orig);
+
+	HFREE_NULL(path);
+	HFREE_NULL(orig);
+}
+
+/**
+ * Loads the queue status saved in the legacy text file back into memory.
  */
 static void
 parq_upload_load_queue(void)
@@ -5350,76 +5635,56 @@ parq_upload_load_queue(void)
 		}
 
 		if (next) {
-			struct upload *fake_upload;
+			struct parqdata pd;
 
 			next = FALSE;
 
 			g_assert(!damaged);
 			g_assert(entry.name != NULL);
 
-			/* Fill a fake upload structure */
-			fake_upload = upload_alloc();
-			fake_upload->file_size = entry.filesize;
-			fake_upload->downloaded = entry.downloaded;
-			fake_upload->name = entry.name;
-			fake_upload->addr = entry.addr;
-
-			puq = parq_upload_create(fake_upload);
-			g_assert(puq != NULL);
-
 			/*
-			 * Upon restart, give them time to retry before we expire the
-			 * slot: add MIN_LIFE_TIME to all expiration times.
-			 *		--RAM, 2007-08-18
+			 * The legacy format saved the remaining lifetime, which we
+			 * express relative to the current time.  Entries are listed in
+			 * queue order, so they get fresh sequence numbers.
 			 */
 
-			puq->supports_parq = entry.supports_parq;
-			puq->enter = entry.entered;
-			puq->expire = time_advance(now, MIN_LIFE_TIME + entry.expire);
-			puq->addr = entry.x_addr;
-			puq->port = entry.xport;
-			puq->sha1 = entry.sha1;
-			puq->last_queue_sent = entry.last_queue_sent;
-			puq->queue_sent = entry.queue_sent;
-			puq->send_next_queue =
-				parq_upload_next_queue(entry.last_queue_sent, puq);
-
-			/* During parq_upload_create already created an ID for us */
-			htable_remove(ul_all_parq_by_id, &puq->id);
-
-			STATIC_ASSERT(sizeof entry.id == sizeof puq->id);
-			memcpy(&puq->id, &entry.id, sizeof puq->id);
-			htable_insert(ul_all_parq_by_id, &puq->id, puq);
-
-			if (GNET_PROPERTY(parq_debug) > 2) {
-				g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d) ETA: %s "
-					"restored: %s%s '%s'",
-					puq->queue->num,
-					ul_parqs_cnt,
-					puq->position,
-				 	puq->relative_position,
-					puq->queue->by_position_length,
-					short_time_ascii(parq_upload_lookup_eta(fake_upload)),
-					host_addr_to_string(puq->remote_addr),
-					puq->supports_parq ? " (PARQ)" : "",
-					puq->name);
-			}
-
-			if (host_is_valid(puq->addr, puq->port)) {
-				if (GNET_PROPERTY(max_uploads) > 0)
-					parq_upload_register_send_queue(puq);
-			} else {
-				puq->flags |= PARQ_UL_NOQUEUE;
-			}
+			pd.seq = 0;
+			pd.enter = entry.entered;
+			pd.saved = now;
+			pd.expire = time_advance(now, entry.expire);
+			pd.last_queue_sent = entry.last_queue_sent;
+			pd.queue_sent = entry.queue_sent;
+			pd.file_size = entry.filesize;
+			pd.downloaded = entry.downloaded;
+			pd.remote_addr = entry.addr;
+			pd.x_addr = entry.x_addr;
+			pd.x_port = entry.xport;
+			pd.supports_parq = entry.supports_parq;
+			pd.has_sha1 = entry.sha1 != NULL;
+			if (pd.has_sha1)
+				pd.sha1 = *entry.sha1;
+			cstr_bcpy(ARYLEN(pd.name), entry.name);
+
+			puq = parq_upload_restore(&entry.id, &pd);
+			if (puq != NULL)
+				parq_upload_dirty(puq);		/* Migrate to the database */
 
 			/* Reset state */
+			atom_sha1_free_null(&entry.sha1);
 			entry = zero_entry;
 			bit_array_clear_range(tag_used, 0, NUM_PARQ_TAGS - 1);
-			upload_free(&fake_upload);
 		}
 	}
 
 	fclose(f);
+
+	/*
+	 * Entries are now persisted in the database: flush them and remove the
+	 * legacy file so that we never import it again.
+	 */
+
+	parq_upload_save_queue(FALSE);
+	parq_upload_unlink_legacy();
 }
 
 /**
@@ -5449,6 +5714,14 @@ parq_is_enabled(void)
 void G_COLD
 parq_init(void)
 {
+	dbstore_kv_t kv = {
+		GUID_RAW_SIZE, NULL, sizeof(struct parqdata),
+		sizeof(struct parqdata)		/* Version byte held in structure */
+	};
+	dbstore_packing_t packing = {
+		serialize_parqdata, deserialize_parqdata, NULL
+	};
+
 	TOKENIZE_CHECK_SORTED(parq_tags);
 
 	header_features_add(FEATURES_UPLOADS,
@@ -5468,6 +5741,7 @@ parq_init(void)
 		offsetof(struct parq_banned, addr),
 		host_addr_hash_func, host_addr_hash_func2, host_addr_eq_func);
 	ul_parq_queue = hash_list_new(NULL, NULL);
+	ul_parq_dirty = hash_list_new(NULL, NULL);
 	ul_queue_sent = aging_make(QUEUE_HOST_DELAY,
 		host_addr_hash_func, host_addr_eq_func, wfree_host_addr);
 
@@ -5479,7 +5753,17 @@ parq_init(void)
 	g_assert(dl_all_parq_by_id != NULL);
 	g_assert(ht_banned_source != NULL);
 
-	parq_upload_load_queue();
+	db_parq = dbstore_open(db_parq_what, settings_gnet_db_dir(),
+		db_parq_base, kv, packing, 1, guid_hash, guid_eq, FALSE);
+
+	/*
+	 * The legacy text file is only imported when the database is empty,
+	 * i.e. the first time we start with a persistent database.
+	 */
+
+	if (0 == parq_upload_load_db())
+		parq_upload_load_queue();
+
 	parq_start = tm_time();
 
 	parq_dead_timer_ev = cq_periodic_main_add(QUEUE_DEAD_SCAN * 1000,
@@ -5495,13 +5779,15 @@ void G_COLD
 parq_close_pre(void)
 {
 	plist_t *dl, *queues;
+	ostnode_t *n;
 	pslist_t *sl, *to_remove = NULL, *to_removeq = NULL;
 
 	parq_shutdown = TRUE;
 
-	parq_upload_save_queue();
+	parq_upload_save_queue(TRUE);
 	cq_periodic_remove(&parq_dead_timer_ev);
 	cq_periodic_remove(&parq_save_timer_ev);
+	cq_cancel(&parq_flush_ev);
 
 	PLIST_FOREACH(parq_banned_sources, dl) {
 		struct parq_banned *banned = dl->data;
@@ -5524,11 +5810,8 @@ parq_close_pre(void)
 	for (queues = ul_parqs; queues != NULL; queues = queues->next) {
 		struct parq_ul_queue *queue = queues->data;
 
-		PLIST_FOREACH(queue->by_position, dl) {
-			struct parq_ul_queued *puq = dl->data;
-
-			if (puq == NULL)
-				break;
+		OSTREE_FOREACH(&queue->by_position, n) {
+			struct parq_ul_queued *puq = parq_ul_by_position(queue, n);
 
 			puq->by_addr->uploading = 0;
 
@@ -5566,7 +5849,11 @@ parq_close_pre(void)
 	plist_free_null(&parq_banned_sources);
 
 	hash_list_free(&ul_parq_queue);
+	hash_list_free(&ul_parq_dirty);
 	aging_destroy(&ul_queue_sent);
+
+	dbstore_close(db_parq, settings_gnet_db_dir(), db_parq_base);
+	db_parq = NULL;
 }
 
 /*
@@ -60,12 +60,16 @@
 #include "lib/getdate.h"
 #include "lib/hashing.h"
 #include "lib/hset.h"
+#include "lib/iovec.h"
+#include "lib/lprobe.h"
 #include "lib/product.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"			/* Must be the last header included */
 
@@ -78,12 +82,61 @@
 #define QHIT_MAX_PROXIES	8		/**< Send out 8 push-proxies at most */
 #define QHIT_MAX_GGEP		512		/**< Allocated room for trailing GGEP */
 #define QHIT_SIZE_THRESHOLD	2016	/**< Flush query hits larger than this */
+#define QHIT_MAX_HASH_GGEP	64		/**< Room for cached GGEP "H" or "TT" */
+#define QHIT_MAX_FILE_GGEP	1024	/**< Room for other cached per-file GGEP */
 
 /*
  * Minimal trailer length is our code NAME, the open flags, and the GUID.
  */
 #define QHIT_MIN_TRAILER_LEN	(4+3+16)	/**< NAME + open flags + GUID */
 
+enum qhit_record_magic { QHIT_RECORD_MAGIC = 0x3a1c52e7 };
+
+/**
+ * Pre-serialized part of a hit entry, for a given SHA1 emission style.
+ *
+ * The data start with the entry body, which follows the file index: the
+ * 32-bit file size, the NUL-terminated name and the optional ASCII URN.
+ * Then come the GGEP extensions which depend on the file only, encoded as
+ * blocks for ggep_stream_append_block(): first the hash block, which is
+ * emitted ahead of the variable-length extensions so that it is never the
+ * one lacking room, then the block holding the other extensions.
+ */
+struct qhit_frag {
+	char *data;					/**< Body followed by GGEP blocks */
+	size_t body_len;			/**< Length of entry body */
+	size_t hash_len;			/**< Length of hash GGEP block, 0 if none */
+	size_t hash_last;			/**< Offset of last extension in hash block */
+	size_t ext_len;				/**< Length of other GGEP block, 0 if none */
+	size_t ext_last;			/**< Offset of last extension in that block */
+};
+
+/**
+ * Query hit record cached on a shared file.
+ *
+ * Popular files match many queries, and most of their hit entry does not
+ * change between two hits, so we only build it once.  The record is
+ * attached to the shared file and goes away with it, hence a library
+ * rescan flushes all the records.  It is rebuilt whenever the attributes
+ * it was built from change.
+ */
+struct qhit_record {
+	enum qhit_record_magic magic;
+	uint32 stamp;				/**< Shared file stamp at build time */
+	filesize_t size;			/**< File size at build time */
+	time_t ctime;				/**< Creation time at build time */
+	const char *rp;				/**< Relative path at build time */
+	bool sha1;					/**< Whether SHA1 was available */
+	struct qhit_frag frag[2];	/**< Indexed by GGEP "H" usage */
+};
+
+static inline void
+qhit_record_check(const struct qhit_record * const rec)
+{
+	g_assert(rec != NULL);
+	g_assert(QHIT_RECORD_MAGIC == rec->magic);
+}
+
 /*
  * Buffer where query hit packet is built.
  *
@@ -222,6 +275,33 @@ found_write(const void *data, size_t length)
 	return TRUE;
 }
 
+static bool
+found_writev(const iovec_t *iov, int iovcnt)
+{
+	struct found_struct *f = found_get();
+	size_t length;
+	int i;
+
+	g_assert(iov != NULL);
+	g_assert(iovcnt > 0);
+	g_assert(!f->open);
+
+	length = iov_calculate_size(iov, iovcnt);
+
+	if (length > sizeof f->data - f->pos)
+		return FALSE;
+
+	for (i = 0; i < iovcnt; i++) {
+		size_t n = iovec_len(&iov[i]);
+
+		memcpy(&f->data[f->pos], iovec_base(&iov[i]), n);
+		f->pos += n;
+	}
+
+	g_assert(f->pos >= length && f->pos <= sizeof f->data);
+	return TRUE;
+}
+
 static void
 found_set_header(void)
 {
@@ -613,6 +693,244 @@ qhit_random_index(void)
 	g_error("%s(): no luck with random number generator", G_STRFUNC);
 }
 
+/**
+ * Build the pre-serialized part of the hit entry for a shared file.
+ *
+ * @param fr			the fragment to fill
+ * @param sf			the shared file
+ * @param sha1			whether the SHA1 of the file is available
+ * @param ggep_h		whether the SHA1 is to be emitted as GGEP "H"
+ */
+static void
+qhit_frag_build(struct qhit_frag *fr, const shared_file_t *sf,
+	bool sha1, bool ggep_h)
+{
+	char hash[QHIT_MAX_HASH_GGEP];
+	char ext[QHIT_MAX_FILE_GGEP];
+	ggep_stream_t gs;
+	uint32 fs32, fs32_le;
+	size_t nlen;
+	bool ok;
+	char *p;
+
+	g_assert(NULL == fr->data);
+
+	/*
+	 * If size is greater than 2^31-1, we store ~0 as the file size and will
+	 * use the "LF" GGEP extension to hold the real size.
+	 */
+
+	fs32 = shared_file_size(sf) >= (1U << 31) ? ~0U : shared_file_size(sf);
+
+	ggep_stream_init(&gs, ARYLEN(hash));
+
+	/*
+	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
+	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
+	 */
+
+	if (sha1 && ggep_h) {
+		const struct sha1 * const sha1p = shared_file_sha1(sf);
+		const struct tth * const tth = shared_file_tth(sf);
+		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
+
+		ok =
+			ggep_stream_begin(&gs, GGEP_NAME(H), GGEP_W_COBS) &&
+			ggep_stream_write(&gs, &type, 1) &&
+			ggep_stream_write(&gs, sha1p->data, SHA1_RAW_SIZE) &&
+			(tth ? ggep_stream_write(&gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
+			ggep_stream_end(&gs);
+
+		if (!ok)
+			qhit_log_ggep_write_failure("H");
+	}
+
+	/*
+	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
+	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
+	 * hash in binary form.
+	 */
+
+	if (sha1 && !ggep_h) {
+		const struct tth * const tth = shared_file_tth(sf);
+
+		if (tth) {
+			ok = ggep_stream_pack(&gs,
+						GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
+			if (!ok)
+				qhit_log_ggep_write_failure("TT");
+		}
+	}
+
+	fr->hash_len = ggep_stream_close_block(&gs, &fr->hash_last);
+
+	ggep_stream_init(&gs, ARYLEN(ext));
+
+	/*
+	 * If the 32-bit size is the magic ~0 escape value, we need to emit
+	 * the real size in the "LF" extension.
+	 */
+
+	if (fs32 == ~0U) {
+		char buf[sizeof(uint64)];
+		int len;
+
+		len = ggept_filesize_encode(shared_file_size(sf), ARYLEN(buf));
+
+		g_assert(len > 0 && UNSIGNED(len) <= sizeof buf);
+
+		ok = ggep_stream_pack(&gs, GGEP_NAME(LF), buf, len, GGEP_W_COBS);
+		if (!ok)
+			qhit_log_ggep_write_failure("LF");
+	}
+
+	{
+		const char *rp = shared_file_relative_path(sf);
+
+		if (rp) {
+			ok = ggep_stream_pack(&gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
+			if (!ok)
+				qhit_log_ggep_write_failure("PATH");
+		}
+	}
+
+	{
+		time_t create_time;
+
+		create_time = shared_file_creation_time(sf);
+		if ((time_t) -1 != create_time) {
+			char buf[sizeof(uint64)];
+			int len;
+
+			/*
+			 * Suppress negative values (if time_t is signed) as this would
+			 * be interpreted as a date far in this future.
+			 */
+			create_time = MAX(0, create_time);
+
+			len = ggept_ct_encode(create_time, ARYLEN(buf));
+			g_assert(UNSIGNED(len) <= sizeof buf);
+
+			ok = ggep_stream_pack(&gs, GGEP_NAME(CT), buf, len, GGEP_W_COBS);
+			if (!ok)
+				qhit_log_ggep_write_failure("CT");
+		}
+	}
+
+	fr->ext_len = ggep_stream_close_block(&gs, &fr->ext_last);
+
+	/*
+	 * The entry body: the 32-bit size, the name and its trailing NUL, then
+	 * the SHA1 as a plain ASCII URN if they don't grok "H".
+	 */
+
+	nlen = shared_file_name_nfc_len(sf);
+	fr->body_len = sizeof fs32_le + nlen + 1;
+	if (sha1 && !ggep_h)
+		fr->body_len += SHA1_URN_LENGTH + 1;
+
+	fr->data = xmalloc(fr->body_len + fr->hash_len + fr->ext_len);
+
+	poke_le32(&fs32_le, fs32);
+	p = mempcpy(fr->data, &fs32_le, sizeof fs32_le);
+	p = mempcpy(p, shared_file_name_nfc(sf), nlen);
+	*p++ = '\0';
+
+	if (sha1 && !ggep_h) {
+		/* Good old way: ASCII URN */
+		p = mempcpy(p, sha1_to_urn_string(shared_file_sha1(sf)),
+				SHA1_URN_LENGTH);
+		*p++ = '\x1c';
+	}
+
+	g_assert(ptr_diff(p, fr->data) == fr->body_len);
+
+	p = mempcpy(p, hash, fr->hash_len);
+	memcpy(p, ext, fr->ext_len);
+}
+
+/**
+ * Discard the fragments of a query hit record.
+ */
+static void
+qhit_record_clear(struct qhit_record *rec)
+{
+	uint i;
+
+	qhit_record_check(rec);
+
+	for (i = 0; i < N_ITEMS(rec->frag); i++) {
+		XFREE_NULL(rec->frag[i].data);
+	}
+}
+
+/**
+ * Free query hit record and nullify its pointer.
+ */
+void
+qhit_record_free_null(struct qhit_record **rec_ptr)
+{
+	struct qhit_record *rec = *rec_ptr;
+
+	if (rec != NULL) {
+		qhit_record_clear(rec);
+		rec->magic = 0;
+		WFREE(rec);
+		*rec_ptr = NULL;
+	}
+}
+
+/**
+ * Get the pre-serialized part of the hit entry for a shared file, building
+ * it if not already cached on the file or if the cached one is stale.
+ *
+ * @param sf			the shared file
+ * @param ggep_h		whether the SHA1 is to be emitted as GGEP "H"
+ *
+ * @return the fragment for the requested SHA1 emission style.
+ */
+static const struct qhit_frag *
+qhit_record_get(const shared_file_t *sf, bool ggep_h)
+{
+	struct qhit_record *rec = shared_file_qhit_record(sf);
+	uint32 stamp = shared_file_qhit_stamp(sf);
+	filesize_t size = shared_file_size(sf);
+	time_t ctime = shared_file_creation_time(sf);
+	const char *rp = shared_file_relative_path(sf);
+	bool sha1 = sha1_hash_available(sf);
+	struct qhit_frag *fr;
+
+	if (NULL == rec) {
+		WALLOC0(rec);
+		rec->magic = QHIT_RECORD_MAGIC;
+		shared_file_set_qhit_record(sf, rec);
+	} else {
+		qhit_record_check(rec);
+
+		if (
+			rec->stamp == stamp && rec->size == size &&
+			rec->ctime == ctime && rec->rp == rp && rec->sha1 == sha1
+		)
+			goto cached;
+
+		qhit_record_clear(rec);
+	}
+
+	rec->stamp = stamp;
+	rec->size = size;
+	rec->ctime = ctime;
+	rec->rp = rp;
+	rec->sha1 = sha1;
+
+cached:
+	fr = &rec->frag[ggep_h ? 1 : 0];
+
+	if G_UNLIKELY(NULL == fr->data)
+		qhit_frag_build(fr, sf, sha1, ggep_h);
+
+	return fr;
+}
+
 /**
  * Add file to current query hit.
  *
@@ -625,7 +943,9 @@ add_file(const shared_file_t *sf)
 	bool sha1_available;
 	gnet_host_t hvec[QHIT_MAX_ALT];
 	int hcnt = 0;
-	uint32 fs32, fs32_le, idx_le;
+	uint32 idx_le;
+	iovec_t iov[2];
+	const struct qhit_frag *fr;
 	int ggep_len;
 	bool ok;
 	ggep_stream_t gs;
@@ -743,44 +1063,20 @@ add_file(const shared_file_t *sf)
 		return FALSE;
 
 	/*
-	 * If size is greater than 2^31-1, we store ~0 as the file size and will
-	 * use the "LF" GGEP extension to hold the real size.
+	 * The entry is assembled from the file index, which varies from hit
+	 * to hit, the cached body and GGEP block of the file, and the GGEP
+	 * extensions which depend on the query or the current file state.
 	 */
 
-	fs32 = shared_file_size(sf) >= (1U << 31) ? ~0U : shared_file_size(sf);
+	fr = qhit_record_get(sf, found_ggep_h());
 
 	poke_le32(&idx_le, file_index);
-	if (!found_write(&idx_le, sizeof idx_le))
-		return FALSE;
-	poke_le32(&fs32_le, fs32);
-	if (!found_write(&fs32_le, sizeof fs32_le))
-		return FALSE;
-	if (!found_write(shared_file_name_nfc(sf), shared_file_name_nfc_len(sf)))
-		return FALSE;
-
-	/* Position equals the next byte to be written to */
+	iovec_set(&iov[0], &idx_le, sizeof idx_le);
+	iovec_set(&iov[1], fr->data, fr->body_len);
 
-	if (!found_write("", 1))
+	if (!found_writev(iov, N_ITEMS(iov)))
 		return FALSE;
 
-	/*
-	 * We're now between the two NULs at the end of the hit entry.
-	 */
-
-	/*
-	 * Emit the SHA1 as a plain ASCII URN if they don't grok "H".
-	 */
-
-	if (sha1_available && !found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
-
-		/* Good old way: ASCII URN */
-		if (!found_write(sha1_to_urn_string(sha1), SHA1_URN_LENGTH))
-			return FALSE;
-		if (!found_write("\x1c", 1))
-			return FALSE;
-	}
-
 	/*
 	 * From now on, we emit GGEP extensions, if we emit at all.
 	 */
@@ -789,6 +1085,16 @@ add_file(const shared_file_t *sf)
 	start = found_open();
 	ggep_stream_init(&gs, start, left);
 
+	/*
+	 * The cached hash extension comes first, so that the variable-length
+	 * extensions that follow cannot prevent it from being emitted.
+	 */
+
+	ok = ggep_stream_append_block(&gs,
+			&fr->data[fr->body_len], fr->hash_len, fr->hash_last);
+	if (!ok)
+		qhit_log_ggep_write_failure(found_ggep_h() ? "H" : "TT");
+
 	/*
 	 * If we matched a partial file, let them know (unless the file is
 	 * being seeded, in which case it is really complete).
@@ -821,62 +1127,6 @@ add_file(const shared_file_t *sf)
 			qhit_log_ggep_write_failure("PRU");
 	}
 
-	/*
-	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
-	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
-	 */
-
-	if (sha1_available && found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
-		const struct tth * const tth = shared_file_tth(sf);
-		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
-
-		ok =
-			ggep_stream_begin(&gs, GGEP_NAME(H), GGEP_W_COBS) &&
-			ggep_stream_write(&gs, &type, 1) &&
-			ggep_stream_write(&gs, sha1->data, SHA1_RAW_SIZE) &&
-			(tth ? ggep_stream_write(&gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
-			ggep_stream_end(&gs);
-
-		if (!ok)
-			qhit_log_ggep_write_failure("H");
-	}
-
-	/*
-	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
-	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
-	 * hash in binary form.
-	 */
-
-	if (sha1_available && !found_ggep_h()) {
-		const struct tth * const tth = shared_file_tth(sf);
-
-		if (tth) {
-			ok = ggep_stream_pack(&gs,
-						GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
-			if (!ok)
-				qhit_log_ggep_write_failure("TT");
-		}
-	}
-
-	/*
-	 * If the 32-bit size is the magic ~0 escape value, we need to emit
-	 * the real size in the "LF" extension.
-	 */
-
-	if (fs32 == ~0U) {
-		char buf[sizeof(uint64)];
-		int len;
-
-		len = ggept_filesize_encode(shared_file_size(sf), ARYLEN(buf));
-
-		g_assert(len > 0 && UNSIGNED(len) <= sizeof buf);
-
-		ok = ggep_stream_pack(&gs, GGEP_NAME(LF), buf, len, GGEP_W_COBS);
-		if (!ok)
-			qhit_log_ggep_write_failure("LF");
-	}
-
 	/*
 	 * If we have known alternate locations, include a few of them for
 	 * this file in the GGEP "ALT" extension.
@@ -891,38 +1141,15 @@ add_file(const shared_file_t *sf)
 			qhit_log_ggep_write_failure("ALT");
 	}
 
-	{
-		const char *rp = shared_file_relative_path(sf);
-
-		if (rp) {
-			ok = ggep_stream_pack(&gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
-			if (!ok)
-				qhit_log_ggep_write_failure("PATH");
-		}
-	}
-
-	{
-		time_t create_time;
-
-		create_time = shared_file_creation_time(sf);
-		if ((time_t) -1 != create_time) {
-			char buf[sizeof(uint64)];
-			int len;
-
-			/*
-			 * Suppress negative values (if time_t is signed) as this would
-			 * be interpreted as a date far in this future.
-			 */
-			create_time = MAX(0, create_time);
-
-			len = ggept_ct_encode(create_time, ARYLEN(buf));
-			g_assert(UNSIGNED(len) <= sizeof buf);
+	/*
+	 * Then the other cached extensions: the large file size, the
+	 * relative path and the creation time.
+	 */
 
-			ok = ggep_stream_pack(&gs, GGEP_NAME(CT), buf, len, GGEP_W_COBS);
-			if (!ok)
-				qhit_log_ggep_write_failure("CT");
-		}
-	}
+	ok = ggep_stream_append_block(&gs,
+			&fr->data[fr->body_len + fr->hash_len], fr->ext_len, fr->ext_last);
+	if (!ok)
+		qhit_log_ggep_write_failure("cached");
 
 	/*
 	 * Because we don't know exactly the size of the GGEP extension
@@ -995,8 +1222,10 @@ void
 qhit_send_results(gnutella_node_t *n, pslist_t *files, int count,
 	const struct guid *muid, unsigned flags)
 {
+	static lprobe_t *probe;
 	pslist_t *sl;
 	int sent = 0;
+	uint64 start = lprobe_start();
 
 	g_assert(!NODE_TALKS_G2(n));
 
@@ -1027,6 +1256,7 @@ qhit_send_results(gnutella_node_t *n, pslist_t *files, int count,
 		g_debug("sent %d/%d hits to %s", sent, count, node_addr(n));
 
 	found_done();
+	lprobe_end(&probe, "query_hit", start);
 }
 
 /**
@@ -64,6 +64,9 @@ struct pslist;
 void qhit_init(void);
 void qhit_close(void);
 
+struct qhit_record;
+void qhit_record_free_null(struct qhit_record **rec_ptr);
+
 void qhit_send_results(struct gnutella_node *n, struct pslist *files, int count,
 	const struct guid *muid, unsigned flags);
 void qhit_build_results(const struct pslist *files,
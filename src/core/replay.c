@@ -0,0 +1,975 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Message replay and load generation.
+ *
+ * A stream of messages, either loaded from a capture file or synthesized,
+ * is fed to a replay pseudo node at a controlled rate, as if the messages
+ * had been received from UDP.  Processing goes through the regular message
+ * handling path (routing, duplicate detection, QRP matching, local search),
+ * but the replies the servent generates end up in a "sink" TX driver, so
+ * that no network traffic is ever generated by the replay.
+ *
+ * Captures are plain concatenations of messages: Gnutella messages with
+ * their header, or G2 packets, one after the other.
+ *
+ * The synthetic stream is a mix of GUESS queries (carrying a valid query
+ * key for the replay node), query hits answering these queries, pings,
+ * pongs and pushes, all referring to hosts in the 198.18.0.0/15 range,
+ * which is reserved for benchmarking.
+ *
+ * For each run we report the throughput, the per-message processing latency
+ * and the amount of memory allocations made whilst the replay was running.
+ * Allocations are counted process-wide, hence they include any other
+ * activity happening concurrently.
+ *
+ * When the stream is replayed several times, the MUID of each Gnutella
+ * message is altered for each new loop so that the messages are not all
+ * considered as duplicates.  G2 packets are replayed unchanged.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "gtk-gnutella.h"	/* For GTA_VENDOR_CODE */
+
+#include "replay.h"
+
+#include "ggep.h"
+#include "ggep_type.h"
+#include "gmsg.h"
+#include "gnutella.h"
+#include "guid.h"
+#include "nodes.h"
+#include "pcache.h"
+#include "pproxy.h"
+#include "search.h"
+#include "sockets.h"
+
+#include "g2/frame.h"
+
+#include "if/gnet_property_priv.h"
+
+#include "lib/array.h"
+#include "lib/atoms.h"
+#include "lib/cq.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/host_addr.h"
+#include "lib/mempcpy.h"
+#include "lib/random.h"
+#include "lib/sectoken.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/tmalloc.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+#include "lib/xsort.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define REPLAY_ADDR			0xc6120001	/**< 198.18.0.1, the replay node */
+#define REPLAY_PORT			6346		/**< Port of the replay node */
+#define REPLAY_PERIOD		100			/**< Pacing period, in ms */
+#define REPLAY_BUDGET		50			/**< Max processing per period, in ms */
+#define REPLAY_BATCH		32			/**< Messages between time checks */
+#define REPLAY_LAT_MAX		(1U << 18)	/**< Latency samples kept */
+#define REPLAY_SYNTH_LEN	512			/**< Max length of synthetic messages */
+#define REPLAY_SYNTH_MUIDS	64			/**< Query MUIDs kept for hits */
+
+enum replay_magic { REPLAY_MAGIC = 0x2a4c93e1 };
+
+/**
+ * A replay run.
+ */
+struct replay {
+	enum replay_magic magic;
+	const char *source;			/**< Capture file, or "synthetic" (atom) */
+	gnutella_node_t *node;		/**< Replay pseudo node, NULL when done */
+	char *base;					/**< Message stream */
+	size_t len;					/**< Length of message stream */
+	size_t alloc;				/**< Allocated length of message stream */
+	size_t pos;					/**< Position of next message in stream */
+	char *buf;					/**< Scratch buffer for processing */
+	size_t buflen;				/**< Length of scratch buffer */
+	cperiodic_t *ev;			/**< Pacing event, NULL when done */
+	uint64 *lat;				/**< Latency samples (reservoir) */
+	size_t lat_count;			/**< Amount of latency samples */
+	tm_nano_t start;			/**< Start of run */
+	tm_nano_t end;				/**< End of run */
+	uint64 stream_msgs;			/**< Messages in stream */
+	uint64 processed;			/**< Messages processed */
+	uint64 invalid;				/**< Messages found invalid */
+	uint64 bytes;				/**< Bytes processed */
+	uint64 busy;				/**< Total processing time, in ns */
+	uint64 max;					/**< Maximum processing time, in ns */
+	uint64 allocations;			/**< Allocation count at start, then delta */
+	uint64 replies;				/**< Replies sent by the servent */
+	uint64 reply_bytes;			/**< Bytes of replies */
+	uint rate;					/**< Target rate, in msg/s, 0 = unlimited */
+	uint loops;					/**< Amount of passes over stream */
+	uint loop;					/**< Current pass */
+	bool g2;					/**< Stream holds G2 packets */
+};
+
+static inline void
+replay_check(const struct replay * const r)
+{
+	g_assert(r != NULL);
+	g_assert(REPLAY_MAGIC == r->magic);
+}
+
+static struct replay *replay_run;	/**< Current or last run */
+
+/**
+ * Words used to build synthetic queries and the file names of hits.
+ */
+static const char * const replay_words[] = {
+	"album", "concert", "demo", "ebook", "flac", "free", "guide", "jazz",
+	"linux", "live", "mp3", "music", "remix", "tutorial", "ubuntu", "video",
+};
+
+/**
+ * @return the current allocation count, across all the allocators.
+ */
+static uint64
+replay_allocations(void)
+{
+	return xmalloc_allocations() + tmalloc_allocations();
+}
+
+/**
+ * Compute the length of the message starting at the specified offset.
+ *
+ * @return the message length, 0 if the message is invalid or truncated.
+ */
+static size_t
+replay_msglen(const struct replay *r, size_t offset)
+{
+	const void *p = const_ptr_add_offset(r->base, offset);
+	size_t avail = r->len - offset;
+	size_t len;
+
+	g_assert(offset < r->len);
+
+	if (r->g2) {
+		len = g2_frame_whole_length(p, avail);
+	} else {
+		uint16 size;
+
+		if (avail < GTA_HEADER_SIZE)
+			return 0;
+
+		switch (gmsg_size_valid(p, &size)) {
+		case GMSG_VALID:
+		case GMSG_VALID_MARKED:
+		case GMSG_VALID_NO_PROCESS:
+			break;
+		case GMSG_INVALID:
+			return 0;
+		}
+
+		len = size + GTA_HEADER_SIZE;
+	}
+
+	return len > avail ? 0 : len;
+}
+
+/**
+ * Scan the message stream to count the messages and size the scratch
+ * buffer.  A trailing invalid or truncated message ends the stream.
+ *
+ * @return the amount of messages found.
+ */
+static size_t
+replay_scan(struct replay *r)
+{
+	size_t offset = 0, count = 0, maxlen = 0;
+
+	while (offset < r->len) {
+		size_t len = replay_msglen(r, offset);
+
+		if (0 == len) {
+			g_warning("%s(): ignoring trailing %zu bytes in %s after %zu %s",
+				G_STRFUNC, r->len - offset, r->source, count,
+				r->g2 ? "packets" : "messages");
+			r->len = offset;
+			break;
+		}
+
+		maxlen = MAX(maxlen, len);
+		offset += len;
+		count++;
+	}
+
+	r->stream_msgs = count;
+	r->buflen = maxlen;
+
+	return count;
+}
+
+/**
+ * Load the capture file in memory.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+static int
+replay_load(struct replay *r, const char *path)
+{
+	filestat_t buf;
+	size_t done = 0;
+	int fd;
+
+	fd = file_open_missing(path, O_RDONLY);
+	if (-1 == fd)
+		return -1;
+
+	if (-1 == fstat(fd, &buf))
+		goto error;
+
+	if (0 == buf.st_size || (filesize_t) buf.st_size > MAX_INT_VAL(uint32)) {
+		errno = 0 == buf.st_size ? ENODATA : EFBIG;
+		goto error;
+	}
+
+	r->len = r->alloc = buf.st_size;
+	r->base = vmm_alloc(r->alloc);
+
+	while (done < r->len) {
+		ssize_t n = read(fd, &r->base[done], r->len - done);
+
+		if (-1 == n) {
+			if (is_temporary_error(errno))
+				continue;
+			goto error;
+		}
+		if (0 == n)
+			break;			/* File shrunk whilst we read it */
+		done += n;
+	}
+
+	r->len = done;
+	fd_close(&fd);
+	return 0;
+
+error:
+	{
+		int saved = errno;
+		fd_close(&fd);
+		errno = saved;
+	}
+	return -1;
+}
+
+/**
+ * Fill the Gnutella header of a synthetic message.
+ */
+static void
+replay_synth_header(void *msg, const guid_t *muid, uint8 function, size_t len)
+{
+	gnutella_header_t *head = msg;
+
+	g_assert(len >= GTA_HEADER_SIZE);
+	g_assert(len <= REPLAY_SYNTH_LEN);
+
+	gnutella_header_set_muid(head, muid);
+	gnutella_header_set_function(head, function);
+	gnutella_header_set_ttl(head, 1);
+	gnutella_header_set_hops(head, 0);
+	gnutella_header_set_size(head, len - GTA_HEADER_SIZE);
+}
+
+/**
+ * @return random IPv4 address in 198.18.0.0/15, past the replay node.
+ */
+static uint32
+replay_synth_ipv4(void)
+{
+	return REPLAY_ADDR + 1 + random_value(0x1fffd);
+}
+
+/**
+ * Append random words from our dictionary, separated by spaces.
+ *
+ * @return the position after the last word written, NUL-terminated.
+ */
+static char *
+replay_synth_words(char *p, uint count)
+{
+	uint i;
+
+	for (i = 0; i < count; i++) {
+		const char *w = replay_words[random_value(N_ITEMS(replay_words) - 1)];
+		size_t len = strlen(w);
+
+		if (i != 0)
+			*p++ = ' ';
+		memcpy(p, w, len);
+		p += len;
+	}
+
+	*p = '\0';
+	return p;
+}
+
+/**
+ * Build a synthetic GUESS query, with a valid query key for the replay node.
+ *
+ * @return length of the message.
+ */
+static size_t
+replay_synth_query(char *msg, const guid_t *muid, const sectoken_t *tok)
+{
+	ggep_stream_t gs;
+	char *p = &msg[GTA_HEADER_SIZE];
+	bool ok;
+
+	poke_be16(p, QUERY_F_MARK | QUERY_F_GGEP_H | QUERY_F_XML);
+	p = replay_synth_words(p + 2, 1 + random_value(2)) + 1;
+
+	ggep_stream_init(&gs, p, REPLAY_SYNTH_LEN - ptr_diff(p, msg));
+	ok = ggep_stream_pack(&gs, GGEP_NAME(QK), ARYLEN(tok->v), 0);
+	ok = ok && ggep_stream_pack(&gs, GGEP_NAME(Z), NULL, 0, 0);
+	g_assert(ok);
+	p += ggep_stream_close(&gs);
+
+	replay_synth_header(msg, muid, GTA_MSG_SEARCH, ptr_diff(p, msg));
+	return ptr_diff(p, msg);
+}
+
+/**
+ * Build a synthetic query hit, with up to 3 records.
+ *
+ * @return length of the message.
+ */
+static size_t
+replay_synth_hit(char *msg, const guid_t *muid)
+{
+	gnutella_msg_search_results_t *m = (void *) msg;
+	uint i, count = 1 + random_value(2);
+	char *p = &msg[sizeof *m];
+	guid_t guid;
+
+	gnutella_msg_search_results_set_num_recs(m, count);
+	gnutella_msg_search_results_set_host_port(m, REPLAY_PORT);
+	gnutella_msg_search_results_set_host_ip(m, replay_synth_ipv4());
+	gnutella_msg_search_results_set_host_speed(m, 0);
+
+	for (i = 0; i < count; i++) {
+		poke_le32(p, i + 1);						/* File index */
+		poke_le32(p + 4, random_value(1U << 30));	/* File size */
+		p = replay_synth_words(p + 8, 2);
+		p = mempcpy(p, ".mp3", CONST_STRLEN(".mp3") + 1);
+		*p++ = '\0';								/* No extensions */
+	}
+
+	/*
+	 * Trailer, as built by qhit.c, then servent GUID.
+	 */
+
+	p = mempcpy(p, GTA_VENDOR_CODE, 4);
+	*p++ = 2;					/* Open data size */
+	*p++ = 0x04 | 0x08;			/* Valid flags we set */
+	*p++ = 0x01;				/* Our flags (valid firewall bit) */
+
+	guid_random_fill(&guid);
+	p = mempcpy(p, &guid, GUID_RAW_SIZE);
+
+	replay_synth_header(msg, muid, GTA_MSG_SEARCH_RESULTS, ptr_diff(p, msg));
+	return ptr_diff(p, msg);
+}
+
+/**
+ * Build a synthetic pong.
+ *
+ * @return length of the message.
+ */
+static size_t
+replay_synth_pong(char *msg, const guid_t *muid)
+{
+	gnutella_msg_init_response_t *m = (void *) msg;
+
+	gnutella_msg_init_response_set_host_port(m, REPLAY_PORT);
+	gnutella_msg_init_response_set_host_ip(m, replay_synth_ipv4());
+	gnutella_msg_init_response_set_files_count(m, random_value(1000));
+	gnutella_msg_init_response_set_kbytes_count(m, random_value(1U << 20));
+
+	replay_synth_header(msg, muid, GTA_MSG_INIT_RESPONSE, sizeof *m);
+	return sizeof *m;
+}
+
+/**
+ * Build the synthetic message stream.
+ */
+static void
+replay_synth(struct replay *r, uint count)
+{
+	guid_t muids[REPLAY_SYNTH_MUIDS];
+	size_t queries = 0;
+	sectoken_t tok;
+	uint i;
+
+	r->alloc = (size_t) count * REPLAY_SYNTH_LEN;
+	r->base = vmm_alloc(r->alloc);
+	r->len = 0;
+
+	search_query_key_generate(&tok,
+		host_addr_get_ipv4(REPLAY_ADDR), REPLAY_PORT);
+
+	for (i = 0; i < count; i++) {
+		char *msg = &r->base[r->len];
+		uint kind = random_value(99);
+		guid_t muid;
+		size_t len;
+
+		guid_random_muid(&muid);
+
+		if (kind < 40 || (kind < 65 && 0 == queries)) {
+			len = replay_synth_query(msg, &muid, &tok);
+			muids[queries++ % N_ITEMS(muids)] = muid;
+		} else if (kind < 65) {
+			size_t n = MIN(queries, N_ITEMS(muids));
+			len = replay_synth_hit(msg, &muids[random_value(n - 1)]);
+		} else if (kind < 80) {
+			uint32 size;
+			const void *m = build_ping_msg(&muid, 1, FALSE, &size);
+			len = size;
+			memcpy(msg, m, len);
+		} else if (kind < 90) {
+			len = replay_synth_pong(msg, &muid);
+		} else {
+			guid_t guid;
+			struct array push;
+
+			guid_random_fill(&guid);
+			push = build_push(1, 0, &guid,
+				host_addr_get_ipv4(replay_synth_ipv4()), zero_host_addr,
+				REPLAY_PORT, random_value(1000), FALSE);
+			len = push.size;
+			memcpy(msg, push.data, len);
+		}
+
+		g_assert(len <= REPLAY_SYNTH_LEN);
+		r->len += len;
+	}
+}
+
+/**
+ * Record processing latency.
+ */
+static void
+replay_latency(struct replay *r, uint64 ns)
+{
+	r->busy += ns;
+	r->max = MAX(r->max, ns);
+
+	/*
+	 * Once the sample array is full, we perform reservoir sampling so that
+	 * all the messages have the same probability of being represented.
+	 */
+
+	if (r->lat_count < REPLAY_LAT_MAX) {
+		r->lat[r->lat_count++] = ns;
+	} else {
+		ulong i = random_ulong_value(r->processed - 1);
+
+		if (i < REPLAY_LAT_MAX)
+			r->lat[i] = ns;
+	}
+}
+
+/**
+ * Process next message from the stream.
+ *
+ * @return FALSE when we reached the end of the last pass.
+ */
+static bool
+replay_next(struct replay *r)
+{
+	tm_nano_t t0, t1, e;
+	size_t len;
+	bool ok;
+
+	if (r->pos >= r->len) {
+		if (++r->loop >= r->loops)
+			return FALSE;
+		r->pos = 0;
+	}
+
+	len = replay_msglen(r, r->pos);
+	g_assert(len != 0 && len <= r->buflen);
+
+	/*
+	 * Processing can alter the message, hence work on a copy.
+	 */
+
+	memcpy(r->buf, &r->base[r->pos], len);
+	r->pos += len;
+
+	if (!r->g2) {
+		/*
+		 * Alter MUID for each new pass, so that the same messages can be
+		 * seen again without being dropped as duplicates.
+		 *
+		 * Also strip the OOB flag from queries: out-of-band hits would
+		 * otherwise be sent to the querying host over the UDP socket.
+		 */
+
+		if (r->loop != 0)
+			poke_le32(r->buf, peek_le32(r->buf) ^ r->loop);
+
+		if (
+			GTA_MSG_SEARCH == gnutella_header_get_function(r->buf) &&
+			len >= GTA_HEADER_SIZE + 2
+		) {
+			char *flags = &r->buf[GTA_HEADER_SIZE];
+			uint16 f = peek_be16(flags);
+
+			if ((f & QUERY_F_MARK) && (f & QUERY_F_OOB_REPLY))
+				poke_be16(flags, f & ~QUERY_F_OOB_REPLY);
+		}
+	}
+
+	tm_precise_time(&t0);
+	ok = node_replay_process(r->node, r->buf, len);
+	tm_precise_time(&t1);
+	tm_precise_elapsed(&e, &t1, &t0);
+
+	r->processed++;
+	r->bytes += len;
+	if (!ok)
+		r->invalid++;
+
+	replay_latency(r, tmn2ns(&e));
+
+	return TRUE;
+}
+
+/**
+ * Latency sample comparison routine.
+ */
+static int
+replay_lat_cmp(const void *a, const void *b)
+{
+	const uint64 *la = a, *lb = b;
+
+	return CMP(*la, *lb);
+}
+
+/**
+ * Fill in statistics about the run.
+ */
+static void
+replay_fill_info(struct replay *r, replay_info_t *info)
+{
+	tm_nano_t e;
+
+	replay_check(r);
+
+	ZERO(info);
+
+	info->source = r->source;
+	info->running = r->ev != NULL;
+	info->g2 = r->g2;
+	info->rate = r->rate;
+	info->loops = r->loops;
+	info->loop = MIN(r->loop, r->loops - 1);
+	info->stream_msgs = r->stream_msgs;
+	info->processed = r->processed;
+	info->invalid = r->invalid;
+	info->bytes = r->bytes;
+	info->busy = r->busy;
+	info->max = r->max;
+
+	if (info->running) {
+		tm_nano_t now;
+
+		tm_precise_time(&now);
+		tm_precise_elapsed(&e, &now, &r->start);
+		info->allocations = replay_allocations() - r->allocations;
+		info->replies = r->node->sent - r->replies;
+		info->reply_bytes = r->node->tx_written - r->reply_bytes;
+	} else {
+		tm_precise_elapsed(&e, &r->end, &r->start);
+		info->allocations = r->allocations;
+		info->replies = r->replies;
+		info->reply_bytes = r->reply_bytes;
+	}
+
+	info->elapsed = tmn2ns(&e);
+
+	if (r->processed != 0)
+		info->mean = r->busy / r->processed;
+
+	if (r->lat_count != 0) {
+		size_t n = r->lat_count;
+
+		/*
+		 * Samples are kept in random order, so we can sort them in place.
+		 */
+
+		xsort(r->lat, n, sizeof r->lat[0], replay_lat_cmp);
+		info->p50 = r->lat[n * 50 / 100];
+		info->p90 = r->lat[n * 90 / 100];
+		info->p99 = r->lat[n * 99 / 100];
+	}
+}
+
+/**
+ * Log statistics about the run.
+ */
+static void
+replay_log(struct replay *r)
+{
+	replay_info_t info;
+	double secs;
+
+	replay_fill_info(r, &info);
+	secs = info.elapsed / 1e9;
+
+	g_info("REPLAY %s: %s %s in %.3f secs (%.0f msg/s), %s invalid, "
+		"%s replies, %.2f allocations/msg, "
+		"latency mean=%.1f p50=%.1f p99=%.1f max=%.1f us",
+		info.source, uint64_to_string(info.processed),
+		info.g2 ? "packets" : "messages", secs,
+		0 == info.elapsed ? 0.0 : info.processed / secs,
+		uint64_to_string2(info.invalid), uint64_to_string3(info.replies),
+		0 == info.processed ? 0.0 :
+			(double) info.allocations / info.processed,
+		info.mean / 1e3, info.p50 / 1e3, info.p99 / 1e3, info.max / 1e3);
+}
+
+/**
+ * Terminate the run, keeping its statistics around.
+ */
+static void
+replay_end(struct replay *r)
+{
+	replay_check(r);
+	g_assert(r->ev != NULL);
+
+	tm_precise_time(&r->end);
+	cq_periodic_remove(&r->ev);
+
+	r->allocations = replay_allocations() - r->allocations;
+	r->replies = r->node->sent - r->replies;
+	r->reply_bytes = r->node->tx_written - r->reply_bytes;
+
+	node_replay_free(&r->node);
+	vmm_free(r->base, r->alloc);
+	r->base = NULL;
+	XFREE_NULL(r->buf);
+
+	replay_log(r);
+}
+
+/**
+ * Check whether replaying traffic is safe.
+ *
+ * Replayed messages are processed as coming from the network, hence we
+ * must be offline to not relay them to our peers.
+ *
+ * G2 queries can request hits to be delivered over UDP to an address
+ * they specify, so we also make sure there is no UDP socket when
+ * replaying G2 traffic.
+ *
+ * @param g2		whether we replay G2 traffic
+ */
+static bool
+replay_allowed(bool g2)
+{
+	return !GNET_PROPERTY(online_mode) && !(g2 && udp_active());
+}
+
+/**
+ * Periodic callback feeding messages to the replay node.
+ *
+ * @return TRUE to keep calling us, FALSE when the run is over.
+ */
+static bool
+replay_feed(void *data)
+{
+	struct replay *r = data;
+	tm_nano_t now, e;
+	uint64 due, budget = REPLAY_BUDGET * UINT64_CONST(1000000);
+	uint i;
+
+	replay_check(r);
+
+	/*
+	 * We could have gone online, or enabled UDP, since the run started.
+	 */
+
+	if (!replay_allowed(r->g2)) {
+		g_warning("REPLAY stopping %s replay: servent no longer isolated",
+			r->source);
+		replay_end(r);
+		return FALSE;
+	}
+
+	tm_precise_time(&now);
+
+	/*
+	 * When pacing, compute how many messages should have been processed
+	 * by now since the beginning of the run.
+	 */
+
+	if (r->rate != 0) {
+		tm_precise_elapsed(&e, &now, &r->start);
+		due = tmn2ns(&e) * r->rate / UINT64_CONST(1000000000);
+		due = due > r->processed ? due - r->processed : 0;
+	} else {
+		due = MAX_INT_VAL(uint64);
+	}
+
+	for (i = 1; due != 0; i++, due--) {
+		if (!replay_next(r)) {
+			replay_end(r);
+			return FALSE;
+		}
+
+		/*
+		 * Do not monopolize the main thread.
+		 */
+
+		if (0 == i % REPLAY_BATCH) {
+			tm_nano_t t;
+
+			tm_precise_time(&t);
+			tm_precise_elapsed(&e, &t, &now);
+			if (tmn2ns(&e) >= budget)
+				break;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Free replay run, stopping it if needed.
+ */
+static void
+replay_free(struct replay *r)
+{
+	replay_check(r);
+
+	if (r->ev != NULL) {
+		cq_periodic_remove(&r->ev);
+		node_replay_free(&r->node);
+	}
+
+	if (r->base != NULL)
+		vmm_free(r->base, r->alloc);
+
+	XFREE_NULL(r->buf);
+	vmm_free(r->lat, REPLAY_LAT_MAX * sizeof r->lat[0]);
+	atom_str_free_null(&r->source);
+	r->magic = 0;
+	WFREE(r);
+}
+
+/**
+ * Allocate a new replay run.
+ *
+ * @return NULL with errno set if replay cannot happen.
+ */
+static struct replay *
+replay_alloc(const char *source, bool g2, uint rate, uint loops)
+{
+	struct replay *r;
+
+	if (!replay_allowed(g2)) {
+		errno = EPERM;
+		return NULL;
+	}
+
+	if (replay_is_running()) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	WALLOC0(r);
+	r->magic = REPLAY_MAGIC;
+	r->source = atom_str_get(source);
+	r->g2 = g2;
+	r->rate = rate;
+	r->loops = MAX(loops, 1);
+
+	return r;
+}
+
+/**
+ * Start the replay run, once the message stream is ready.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+static int
+replay_start(struct replay *r)
+{
+	replay_check(r);
+
+	if (0 == replay_scan(r)) {
+		replay_free(r);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (replay_run != NULL)
+		replay_free(replay_run);
+
+	replay_run = r;
+
+	r->buf = xmalloc(r->buflen);
+	r->lat = vmm_alloc(REPLAY_LAT_MAX * sizeof r->lat[0]);
+	r->node = node_replay_create(r->g2,
+		host_addr_get_ipv4(REPLAY_ADDR), REPLAY_PORT);
+	r->replies = r->node->sent;
+	r->reply_bytes = r->node->tx_written;
+	r->allocations = replay_allocations();
+	r->ev = cq_periodic_main_add(REPLAY_PERIOD, replay_feed, r);
+
+	tm_precise_time(&r->start);
+
+	return 0;
+}
+
+/**
+ * Replay captured messages.
+ *
+ * @param path		the capture file
+ * @param g2		whether file holds G2 packets instead of Gnutella messages
+ * @param rate		target rate in messages per second, 0 for unlimited
+ * @param loops		amount of passes over the capture
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+replay_file(const char *path, bool g2, uint rate, uint loops)
+{
+	struct replay *r;
+
+	r = replay_alloc(path, g2, rate, loops);
+	if (NULL == r)
+		return -1;
+
+	if (-1 == replay_load(r, path)) {
+		int saved = errno;
+		replay_free(r);
+		errno = saved;
+		return -1;
+	}
+
+	return replay_start(r);
+}
+
+/**
+ * Replay synthetic Gnutella traffic.
+ *
+ * @param count		amount of messages to generate
+ * @param rate		target rate in messages per second, 0 for unlimited
+ * @param loops		amount of passes over the generated messages
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+replay_synthetic(uint count, uint rate, uint loops)
+{
+	struct replay *r;
+
+	if (0 == count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	r = replay_alloc("synthetic", FALSE, rate, loops);
+	if (NULL == r)
+		return -1;
+
+	replay_synth(r, count);
+
+	return replay_start(r);
+}
+
+/**
+ * @return whether a replay is in progress.
+ */
+bool
+replay_is_running(void)
+{
+	return replay_run != NULL && replay_run->ev != NULL;
+}
+
+/**
+ * Stop current replay, keeping its statistics.
+ *
+ * @return TRUE if a replay was stopped.
+ */
+bool
+replay_stop(void)
+{
+	if (!replay_is_running())
+		return FALSE;
+
+	replay_end(replay_run);
+	return TRUE;
+}
+
+/**
+ * Fetch statistics about the current or last replay.
+ *
+ * @return FALSE if no replay ever happened.
+ */
+bool
+replay_info(replay_info_t *info)
+{
+	g_assert(info != NULL);
+
+	if (NULL == replay_run)
+		return FALSE;
+
+	replay_fill_info(replay_run, info);
+	return TRUE;
+}
+
+/**
+ * Stop any replay and free all resources.
+ */
+void
+replay_close(void)
+{
+	if (replay_run != NULL) {
+		replay_free(replay_run);
+		replay_run = NULL;
+	}
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Message replay and load generation.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _core_replay_h_
+#define _core_replay_h_
+
+/**
+ * Replay statistics, all durations being in nanoseconds.
+ *
+ * They describe the current run, or the last one when no replay is active.
+ */
+typedef struct replay_info {
+	const char *source;		/**< Capture file, or "synthetic" (atom) */
+	bool running;			/**< Whether replay is still in progress */
+	bool g2;				/**< Whether stream holds G2 packets */
+	uint rate;				/**< Target rate in msg/s, 0 if unlimited */
+	uint loops;				/**< Requested amount of loops */
+	uint loop;				/**< Current loop (0-based) */
+	uint64 stream_msgs;		/**< Messages in one pass over the stream */
+	uint64 processed;		/**< Messages fed to the pseudo node */
+	uint64 invalid;			/**< Messages rejected as invalid */
+	uint64 bytes;			/**< Bytes fed to the pseudo node */
+	uint64 replies;			/**< Messages sent back by the servent */
+	uint64 reply_bytes;		/**< Bytes sent back by the servent */
+	uint64 allocations;		/**< Memory allocations during the run */
+	uint64 elapsed;			/**< Wall-clock time of the run */
+	uint64 busy;			/**< Time spent processing messages */
+	uint64 mean;			/**< Mean processing latency */
+	uint64 p50;				/**< Median latency */
+	uint64 p90;				/**< 90th percentile */
+	uint64 p99;				/**< 99th percentile */
+	uint64 max;				/**< Maximum latency */
+} replay_info_t;
+
+/*
+ * Public interface.
+ */
+
+int replay_file(const char *path, bool g2, uint rate, uint loops);
+int replay_synthetic(uint count, uint rate, uint loops);
+bool replay_is_running(void);
+bool replay_stop(void);
+bool replay_info(replay_info_t *info);
+void replay_close(void);
+
+#endif /* _core_replay_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
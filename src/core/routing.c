@@ -51,8 +51,8 @@
 #include "lib/aging.h"
 #include "lib/atoms.h"
 #include "lib/endian.h"
+#include "lib/guidtab.h"
 #include "lib/halloc.h"
-#include "lib/hashing.h"
 #include "lib/host_addr.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
@@ -180,7 +180,7 @@ static struct {
 	int capacity;				 /**< Capacity in terms of messages */
 	int count;					 /**< Amount really stored */
 	unsigned nchunks;			 /**< Amount of allocated chunks */
-	hset_t *messages_hashed;	 /**< All messages (key = struct message) */
+	guidtab_t *messages_hashed;	 /**< All messages (key = MUID + function) */
 	time_t last_rotation;		 /**< Last time we restarted from idx=0 */
 } routing;
 
@@ -896,7 +896,7 @@ clean_entry(struct message *entry)
 {
 	g_assert(entry != NULL);
 
-	hset_remove(routing.messages_hashed, entry);
+	guidtab_remove(routing.messages_hashed, &entry->muid, entry->function);
 
 	if (entry->routes != NULL)
 		free_route_list(entry);
@@ -1099,7 +1099,7 @@ routing_clear_all(void)
 	routing_clear(0);
 	routing.next_idx = 0;
 	routing.last_rotation = tm_time();
-	hset_clear(routing.messages_hashed);	/* Paranoid */
+	guidtab_clear(routing.messages_hashed);	/* Paranoid */
 }
 
 /**
@@ -1424,40 +1424,6 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	return FALSE;
 }
 
-/**
- * compares two message structures
- */
-static int
-message_compare_func(const void *p, const void *q)
-{
-	const struct message *a = p, *b = q;
-
-	return a->function == b->function && guid_eq(&a->muid, &b->muid);
-}
-
-/**
- * Hashes message structures for storage in a hash table.
- */
-static uint
-message_hash_func(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash_fast(msg->function) ^
-		universal_hash(&msg->muid, GUID_RAW_SIZE);
-}
-
-/**
- * Alternate hashing of message structures for storage in a hash table.
- */
-static uint
-message_hash_func2(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
-}
-
 /**
  * Reset this node's GUID.
  */
@@ -1557,8 +1523,7 @@ routing_init(void)
 	 * need to be deallocated
 	 */
 
-	routing.messages_hashed = hset_create_any(message_hash_func,
-		message_hash_func2, message_compare_func);
+	routing.messages_hashed = guidtab_make(0);
 	routing.last_rotation = tm_time();
 
 	/*
@@ -1800,7 +1765,8 @@ message_add(const struct guid *muid, uint8 function,
 		entry->ttl = GNET_PROPERTY(my_ttl);
 
 	/* insert the new message into the hash table */
-	hset_insert(routing.messages_hashed, entry);
+	guidtab_insert(routing.messages_hashed,
+		&entry->muid, entry->function, entry);
 }
 
 /**
@@ -1891,15 +1857,11 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 static bool
 find_message(const struct guid *muid, uint8 function, struct message **m)
 {
-	struct message dummy;
-	const void *orig_key;
-
-	dummy.muid = *muid;
-	dummy.function = function;
+	struct message *msg;
 
-	if (hset_contains_extended(routing.messages_hashed, &dummy, &orig_key)) {
-		struct message *msg = deconstify_pointer(orig_key);
+	msg = guidtab_lookup(routing.messages_hashed, muid, function);
 
+	if (msg != NULL) {
 		/* wipe out dead references to old nodes */
 		purge_dangling_references(msg);
 
@@ -3194,7 +3156,7 @@ routing_close(void)
 
 	g_assert(routing.messages_hashed != NULL);
 
-	hset_free_null(&routing.messages_hashed);
+	guidtab_free_null(&routing.messages_hashed);
 
 	for (cnt = 0; cnt < MAX_CHUNKS; cnt++) {
 		struct message **chunk = routing.chunks[cnt];
@@ -87,6 +87,7 @@
 #include "xml/xfmt.h"
 
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/array.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
@@ -773,7 +774,9 @@ search_free_record(gnet_record_t *rc)
 	atom_sha1_free_null(&rc->sha1);
 	atom_tth_free_null(&rc->tth);
 	search_free_alt_locs(rc);
-	WFREE(rc);
+
+	if (!(SR_ARENA & rc->flags))
+		WFREE(rc);
 }
 
 static gnet_results_set_t *
@@ -809,14 +812,28 @@ search_free_r_set(gnet_results_set_t *rs)
 }
 
 
+/**
+ * Allocate a new record.
+ *
+ * Whilst a message is being processed, records are taken from the thread
+ * arena: they are freed with their results set before the processing ends,
+ * listeners needing to keep some of the records making their own copy.
+ */
 static gnet_record_t *
 search_record_new(void)
 {
 	static const gnet_record_t zero_record;
+	arena_t *ar = arena_scope();
 	gnet_record_t *rc;
 
-	WALLOC(rc);
-	*rc = zero_record;
+	if (ar != NULL) {
+		rc = arena_alloc(ar, sizeof *rc);
+		*rc = zero_record;
+		rc->flags = SR_ARENA;
+	} else {
+		WALLOC(rc);
+		*rc = zero_record;
+	}
 	rc->create_time = (time_t) -1;
 	return rc;
 }
@@ -2932,8 +2949,12 @@ get_g2_results_record(const g2_tree_t *t, const gnutella_node_t *n,
 			utf8_filename:
 
 				/* Must copy string since it is usually not NUL-terminated */
-				rc->filename = h_strndup(p, paylen);
-				rc->flags |= SR_ALLOC_NAME;
+				if (SR_ARENA & rc->flags) {
+					rc->filename = arena_strndup(arena_scope(), p, paylen);
+				} else {
+					rc->filename = h_strndup(p, paylen);
+					rc->flags |= SR_ALLOC_NAME;
+				}
 
 				/*
 				 * Make sure the filename is not empty.
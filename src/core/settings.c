@@ -59,6 +59,7 @@
 #include "sockets.h"
 #include "tx.h"					/* For tx_debug_set_addrs() */
 #include "udp.h"				/* For udp_received() */
+#include "udp_ingress.h"
 
 #include "upnp/upnp.h"
 
@@ -1822,6 +1823,15 @@ enable_udp_changed(property_t prop)
 	return FALSE;
 }
 
+static bool
+udp_ingress_thread_changed(property_t unused_prop)
+{
+	(void) unused_prop;
+
+	udp_ingress_update();
+	return FALSE;
+}
+
 static bool
 enable_dht_changed(property_t prop)
 {
@@ -3535,6 +3545,11 @@ static prop_map_t property_map[] = {
 		dht_tcache_debug_changed,
 		TRUE,
 	},
+	{
+		PROP_UDP_INGRESS_THREAD,
+		udp_ingress_thread_changed,
+		FALSE,				/* Sockets handled via node_update_udp_socket() */
+	},
 };
 
 /***
@@ -147,6 +147,9 @@ struct shared_file {
 	enum mime_type mime_type;	/**< MIME type of the file */
 	uint media_type;			/**< Media type mask for queries */
 
+	struct qhit_record *qhit_rec;	/**< Cached query hit record */
+	uint32 qhit_stamp;			/**< Bumped when cached record is stale */
+
 	int refcnt;					/**< Reference count */
 	uint32 flags;				/**< See below for definition */
 };
@@ -441,6 +444,7 @@ reinit_sha1_table(void)
 	if G_UNLIKELY(NULL == sha1_to_share) {
 		sha1_to_share = hikset_create(
 			offsetof(shared_file_t, sha1), HASH_KEY_FIXED, SHA1_RAW_SIZE);
+		hikset_grouped(sha1_to_share);		/* Large and lookup-heavy */
 		hikset_thread_safe(sha1_to_share);
 	} else {
 		hikset_clear(sha1_to_share);
@@ -554,6 +558,7 @@ shared_file_free(shared_file_t **sf_ptr)
 		g_assert_log(0 == (sf->flags & SHARE_F_INDEXED),
 			"%s(): invoked on file still indexed", G_STRFUNC);
 
+		qhit_record_free_null(&sf->qhit_rec);
 		atom_sha1_free_null(&sf->sha1);
 		atom_tth_free_null(&sf->tth);
 		atom_str_free_null(&sf->relative_path);
@@ -3319,6 +3324,7 @@ shared_file_set_sha1(shared_file_t *sf, const struct sha1 *sha1)
 	}
 
 	atom_sha1_change(&sf->sha1, sha1);
+	sf->qhit_stamp++;
 
 	/*
 	 * If the file is no longer in the index table, it must not be
@@ -3379,6 +3385,7 @@ shared_file_set_tth(shared_file_t *sf, const struct tth *tth)
 	g_return_if_fail(shared_file_is_finished(sf));	/* Cannot be a partial file */
 
 	atom_tth_change(&sf->tth, tth);
+	sf->qhit_stamp++;
 
 	/*
 	 * If the file is seeded, notify the fileinfo layer that the TTH was
@@ -3396,6 +3403,7 @@ shared_file_set_modification_time(shared_file_t *sf, time_t mtime)
 {
 	shared_file_check(sf);
 	sf->mtime = mtime;
+	sf->qhit_stamp++;
 }
 
 /**
@@ -3474,7 +3482,9 @@ sha1_hash_is_uptodate(shared_file_t *sf)
 			sf->file_index, sf->file_path);
 		sf->flags |= SHARE_F_RECOMPUTING;
 		sf->mtime = buf.st_mtime;
+		sf->ctime = buf.st_ctime;
 		sf->file_size = buf.st_size;
+		sf->qhit_stamp++;
 		request_sha1(sf);
 		return FALSE;
 	}
@@ -3752,6 +3762,44 @@ shared_file_modification_time(const shared_file_t *sf)
 	return NULL == sf->fi ? sf->mtime : sf->fi->modified;
 }
 
+/**
+ * @return the cached query hit record of the shared file, NULL if none.
+ */
+struct qhit_record *
+shared_file_qhit_record(const shared_file_t *sf)
+{
+	shared_file_check(sf);
+	return sf->qhit_rec;
+}
+
+/**
+ * Attach query hit record to the shared file, which becomes its owner.
+ *
+ * The record is a cache derived from the shared file attributes, hence
+ * it can be attached to a read-only shared file.
+ */
+void
+shared_file_set_qhit_record(const shared_file_t *sf, struct qhit_record *rec)
+{
+	shared_file_t *wsf = deconstify_pointer(sf);
+
+	shared_file_check(sf);
+	g_assert(NULL == sf->qhit_rec || rec == sf->qhit_rec);
+
+	wsf->qhit_rec = rec;
+}
+
+/**
+ * @return the stamp of the shared file attributes cached in query hits,
+ * which changes each time the file SHA1, TTH, path or timestamps are updated.
+ */
+uint32
+shared_file_qhit_stamp(const shared_file_t *sf)
+{
+	shared_file_check(sf);
+	return sf->qhit_stamp;
+}
+
 /**
  * @return the creation time of the shared file.
  */
@@ -3828,6 +3876,7 @@ shared_file_set_path(shared_file_t *sf, const char *pathname)
 {
 	shared_file_check(sf);
 	atom_str_change(&sf->file_path, pathname);
+	sf->qhit_stamp++;
 }
 
 void
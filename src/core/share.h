@@ -151,6 +151,12 @@ void shared_file_from_fileinfo(fileinfo_t *fi);
 bool shared_file_has_media_type(const shared_file_t *sf, unsigned m)
 	G_PURE;
 
+struct qhit_record;
+struct qhit_record *shared_file_qhit_record(const shared_file_t *sf) G_PURE;
+void shared_file_set_qhit_record(const shared_file_t *sf,
+	struct qhit_record *rec);
+uint32 shared_file_qhit_stamp(const shared_file_t *sf) G_PURE;
+
 struct pslist;
 
 void shared_file_slist_free_null(struct pslist **l_ptr);
@@ -61,6 +61,7 @@
 #include "pproxy.h"
 #include "settings.h"
 #include "udp.h"
+#include "udp_ingress.h"
 #include "uploads.h"
 
 #include "shell/shell.h"
@@ -94,11 +95,16 @@
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #ifdef HAS_SOCKER_GET
 #include <socker.h>
 #endif /* HAS_SOCKER_GET */
 
+#ifdef MSG_WAITFORONE
+#include <netinet/udp.h>		/* For UDP_SEGMENT */
+#endif
+
 #include "lib/override.h"		/* Must be the last header included */
 
 #ifndef SHUT_WR
@@ -115,6 +121,23 @@
 #define UDP_QUEUED_GUESS	65536	/**< Guess amount of pending RX input */
 #define UDP_QUEUE_DELAY_MS	250		/**< RX queue processing delay */
 #define TLS_BAN_FREQ		300		/**< Avoid TLS for 5 minutes */
+#define UDP_BATCH_MAX		64		/**< Max datagrams per batched I/O */
+#define UDP_CMSG_SIZE		128		/**< Control data room per datagram */
+#define UDP_GSO_MAX			64		/**< Max segments per offloaded send */
+#define UDP_GSO_BYTES		65000	/**< Max bytes per offloaded send */
+
+/*
+ * Batched datagram I/O with recvmmsg() and sendmmsg(), when available.
+ *
+ * On top of that, UDP segmentation offload lets the kernel split a train
+ * of equally-sized datagrams to the same host, given in a single message.
+ */
+#if defined(HAS_RECVMSG) && defined(MSG_WAITFORONE)
+#define USE_UDP_MMSG
+#if defined(UDP_SEGMENT) && defined(SOL_UDP) && defined(CMSG_SPACE)
+#define USE_UDP_GSO
+#endif
+#endif	/* HAS_RECVMSG && MSG_WAITFORONE */
 
 enum {
 	SOCK_ADNS_PENDING	= 1 << 0,	/**< Don't free() the socket too early */
@@ -379,6 +402,7 @@ static pslist_t *sl_incoming = NULL;	/**< To spot inactive sockets */
 static void guess_local_addr(const struct gnutella_socket *s);
 static void socket_connected(void *data, int source, inputevt_cond_t cond);
 static void socket_wio_link(struct gnutella_socket *s);
+static void socket_udp_rxbatch_free(struct udp_rxbatch **rx_ptr);
 
 /*
  * SOL_TCP and SOL_IP aren't standards. Some platforms define them, on
@@ -1559,7 +1583,10 @@ socket_free(struct gnutella_socket *s)
 	if (s->flags & SOCK_F_UDP) {
 		struct udpctx *uctx = s->resource.udp;
 		if (uctx != NULL) {
+			if (uctx->ingress)
+				udp_ingress_detach(s);
 			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
+			socket_udp_rxbatch_free(&uctx->rx);
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
 			WFREE(s->resource.udp);
@@ -2739,9 +2766,10 @@ socket_udp_extract_dst_addr(const struct msghdr *msg, host_addr_t *dst_addr)
  * Note: for the Gnutella datagram socket this is udp_received().
  */
 static inline void
-socket_udp_process(gnutella_socket_t *s, bool truncated)
+socket_udp_process(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
-	(*s->resource.udp->data_ind)(s, s->buf, s->pos, truncated);
+	(*s->resource.udp->data_ind)(s, data, len, truncated);
 }
 
 /**
@@ -2808,32 +2836,87 @@ socket_udp_is_old(const gnutella_socket_t *s)
 }
 
 /**
- * Someone is sending us a datagram.  Read it into the socket's buffer.
+ * Record origin of received datagram and account for it.
+ *
+ * @param s				the socket which received the datagram
+ * @param from			the address of the sender
+ * @param port			the port of the sender
+ * @param len			length of the datagram
+ * @param truncated		whether datagram was truncated
+ * @param dst_addr		if non-NULL, the destination address of the datagram
+ *
+ * @return FALSE if the sender address is bogus, in which case the datagram
+ * must be ignored.
+ */
+static bool
+socket_udp_received(gnutella_socket_t *s, host_addr_t from, uint16 port,
+	size_t len, bool truncated, const host_addr_t *dst_addr)
+{
+	/*
+	 * Record remote address.
+	 */
+
+	s->addr = from;
+	s->port = port;
+
+	if (!is_host_addr(s->addr)) {
+		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
+		bws_udp_count_read(len, FALSE);	/* Assume not from DHT */
+		return FALSE;
+	}
+
+	if (dst_addr != NULL) {
+		static host_addr_t last_addr;
+
+		settings_addr_changed(*dst_addr, s->addr);
+
+		/*
+		 * Show the destination address only when it differs from
+		 * the last seen or if the debug level is higher than 1.
+		 */
+
+		if (
+			GNET_PROPERTY(socket_debug) > 1 ||
+			!host_addr_equiv(last_addr, *dst_addr)
+		) {
+			last_addr = *dst_addr;
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): dst_addr=%s",
+					G_STRFUNC, host_addr_to_string(*dst_addr));
+			}
+		}
+	}
+
+	if (truncated)
+		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+
+	return TRUE;
+}
+
+/**
+ * Read a datagram from the UDP socket.
  *
  * @param s				the socket which receives a datagram
+ * @param buf			where the datagram is read
+ * @param size			size of buffer
+ * @param from_addr		written with the address of the sender
  * @param truncation	written with whether datagram was truncated
+ * @param dst_addr		written with the destination address, if known
+ * @param has_dst_addr	written with whether ``dst_addr'' is known
  *
  * @return -1 on error, the size of the datagram otherwise.
  */
 static ssize_t
-socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+socket_udp_recv(const struct gnutella_socket *s, void *buf, size_t size,
+	socket_addr_t *from_addr, bool *truncation,
+	host_addr_t *dst_addr, bool *has_dst_addr)
 {
-	socket_addr_t *from_addr;
 	struct sockaddr *from;
 	socklen_t from_len;
 	ssize_t r;
-	bool truncated = FALSE, has_dst_addr = FALSE;
-	host_addr_t dst_addr;
-
-	socket_check(s);
-	g_assert(s->flags & SOCK_F_UDP);
-	g_assert(s->type == SOCK_TYPE_UDP);
 
-	/*
-	 * Receive the datagram in the socket's buffer.
-	 */
-
-	from_addr = s->resource.udp->socket_addr;
+	*truncation = FALSE;
+	*has_dst_addr = FALSE;
 
 	/* Initialize from_addr so that it matches the socket's network type. */
 	from_len = socket_addr_init(from_addr, s->net);
@@ -2856,7 +2939,7 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		struct msghdr msg;
 		iovec_t iov;
 
-		iovec_set(&iov, s->buf, s->buf_size);
+		iovec_set(&iov, buf, size);
 
 		msg = zero_msg;
 		msg.msg_name = cast_to_pointer(from);
@@ -2885,23 +2968,54 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 		/* msg_flags is missing at least in some versions of IRIX. */
 #if defined(HAS_MSGHDR_MSG_FLAGS)
-		truncated = 0 != (MSG_TRUNC & msg.msg_flags);
+		*truncation = 0 != (MSG_TRUNC & msg.msg_flags);
 #endif
 
 		if ((ssize_t) -1 != r && !GNET_PROPERTY(force_local_ip)) {
-			has_dst_addr = socket_udp_extract_dst_addr(&msg, &dst_addr);
+			*has_dst_addr = socket_udp_extract_dst_addr(&msg, dst_addr);
 		}
 	}
 #else	/* !HAS_RECVMSG */
-	r = recvfrom(s->file_desc, s->buf, s->buf_size, 0,
-			cast_to_pointer(from), &from_len);
+	r = recvfrom(s->file_desc, buf, size, 0, cast_to_pointer(from), &from_len);
 #endif	/* HAS_RECVMSG */
 
+	g_assert((ssize_t) -1 == r || (size_t) r <= size);
+
+	return r;
+}
+
+/**
+ * Someone is sending us a datagram.  Read it into the socket's buffer.
+ *
+ * @param s				the socket which receives a datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+{
+	socket_addr_t *from_addr;
+	ssize_t r;
+	bool truncated, has_dst_addr;
+	host_addr_t dst_addr;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(s->type == SOCK_TYPE_UDP);
+
+	/*
+	 * Receive the datagram in the socket's buffer.
+	 */
+
+	from_addr = s->resource.udp->socket_addr;
+
+	r = socket_udp_recv(s, s->buf, s->buf_size, from_addr, &truncated,
+			&dst_addr, &has_dst_addr);
+
 	if ((ssize_t) -1 == r)
 		return (ssize_t) -1;
 
-	g_assert((size_t) r <= s->buf_size);
-
 	/*
 	 * We're too low level to account for the proper bandwidth here as we
 	 * want to distinguish between UDP Gnutella traffic and DHT traffic.
@@ -2911,54 +3025,93 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 	s->pos = r;
 
-	/*
-	 * Record remote address.
-	 */
-
-	s->addr = socket_addr_get_addr(from_addr);
-	s->port = socket_addr_get_port(from_addr);
-
-	if (!is_host_addr(s->addr)) {
-		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
-		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
+	if (
+		!socket_udp_received(s,
+			socket_addr_get_addr(from_addr), socket_addr_get_port(from_addr),
+			r, truncated, has_dst_addr ? &dst_addr : NULL)
+	) {
 		errno = EINVAL;
 		return (ssize_t) -1;
 	}
 
-	if (has_dst_addr) {
-		static host_addr_t last_addr;
+	*truncation = truncated;
+	return r;
+}
 
-		settings_addr_changed(dst_addr, s->addr);
+/**
+ * Read a datagram from the UDP socket into the supplied buffer.
+ *
+ * Contrary to the other UDP reception routines, this does not update the
+ * socket, hence it can be called from a thread other than the main thread,
+ * provided the socket is not concurrently freed.  The origin of the datagram
+ * must then be recorded with socket_udp_set_origin() by the main thread,
+ * before the datagram is processed.
+ *
+ * @param s				the socket which receives a datagram
+ * @param buf			where the datagram is read
+ * @param size			size of buffer
+ * @param origin		written with the origin of the datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+ssize_t
+socket_udp_read(const gnutella_socket_t *s, void *buf, size_t size,
+	socket_udp_origin_t *origin, bool *truncation)
+{
+	socket_addr_t from_addr;
+	ssize_t r;
+	bool has_dst_addr;
 
-		/*
-		 * Show the destination address only when it differs from
-		 * the last seen or if the debug level is higher than 1.
-		 */
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(buf != NULL);
+	g_assert(origin != NULL);
+	g_assert(truncation != NULL);
 
-		if (
-			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
-		) {
-			last_addr = dst_addr;
-			if (GNET_PROPERTY(socket_debug)) {
-				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
-			}
-		}
-	}
+	ZERO(origin);
 
-	if (truncated)
-		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+	r = socket_udp_recv(s, buf, size, &from_addr, truncation,
+			&origin->dst, &has_dst_addr);
+
+	if ((ssize_t) -1 != r) {
+		origin->addr = socket_addr_get_addr(&from_addr);
+		origin->port = socket_addr_get_port(&from_addr);
+		origin->has_dst = booleanize(has_dst_addr);
+	}
 
-	*truncation = truncated;
 	return r;
 }
 
+/**
+ * Record origin of datagram read by socket_udp_read(), before processing.
+ *
+ * @param s				the socket which received the datagram
+ * @param origin		the origin of the datagram
+ * @param len			length of the datagram
+ * @param truncated		whether datagram was truncated
+ *
+ * @return FALSE if the sender address is bogus, in which case the datagram
+ * must be ignored.
+ */
+bool
+socket_udp_set_origin(gnutella_socket_t *s, const socket_udp_origin_t *origin,
+	size_t len, bool truncated)
+{
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(origin != NULL);
+
+	return socket_udp_received(s, origin->addr, origin->port, len, truncated,
+		origin->has_dst ? &origin->dst : NULL);
+}
+
 /**
  * Enqueue UDP datagram for deferred processing.
  */
 static void
-socket_udp_queue(gnutella_socket_t *s, bool truncated)
+socket_udp_queue(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
 	struct udpctx *uctx;
 	struct udpq *uq;
@@ -2968,8 +3121,8 @@ socket_udp_queue(gnutella_socket_t *s, bool truncated)
 	uctx = s->resource.udp;
 
 	WALLOC0(uq);
-	uq->buf = wcopy(s->buf, s->pos);
-	uq->len = s->pos;
+	uq->buf = wcopy(data, len);
+	uq->len = len;
 	uq->queued = tm_time();
 	uq->truncated = booleanize(truncated);
 	uq->addr = s->addr;
@@ -2980,6 +3133,258 @@ socket_udp_queue(gnutella_socket_t *s, bool truncated)
 		size_saturate_add(s->resource.udp->queued, uq->len);
 }
 
+/**
+ * Batched UDP reception.
+ *
+ * Datagrams are read with recvmmsg() into a ring of slots, which are then
+ * handed out one at a time by socket_udp_next().  The slot buffers are
+ * allocated once, as large as the socket buffer since we cannot know in
+ * advance how large the datagrams will be.  Only the pages actually written
+ * to by the kernel are going to be backed by physical memory.
+ */
+struct udp_rxbatch {
+	int count;					/**< Amount of slots */
+	int filled;					/**< Slots filled by last read */
+	int next;					/**< Next slot to hand out */
+	size_t bufsize;				/**< Size of each slot buffer */
+	size_t arena;				/**< Size of buffer arena */
+	char *bufs;					/**< Slot buffers */
+	char *cmsg;					/**< Slot control buffers */
+#ifdef USE_UDP_MMSG
+	struct mmsghdr *msgs;		/**< Slot message headers */
+#endif
+	iovec_t *iov;				/**< Slot I/O vectors */
+	socket_addr_t *from;		/**< Slot sender addresses */
+};
+
+/**
+ * Free batched reception context.
+ */
+static void
+socket_udp_rxbatch_free(struct udp_rxbatch **rx_ptr)
+{
+	struct udp_rxbatch *rx = *rx_ptr;
+
+	if (rx != NULL) {
+		vmm_free(rx->bufs, rx->arena);
+		XFREE_NULL(rx->cmsg);
+#ifdef USE_UDP_MMSG
+		XFREE_NULL(rx->msgs);
+#endif
+		XFREE_NULL(rx->iov);
+		XFREE_NULL(rx->from);
+		XFREE_NULL(*rx_ptr);
+	}
+}
+
+/**
+ * Allocate batched reception context.
+ *
+ * @param count		amount of datagrams to read at once
+ * @param bufsize	size of each datagram buffer
+ */
+static struct udp_rxbatch *
+socket_udp_rxbatch_alloc(int count, size_t bufsize)
+{
+	struct udp_rxbatch *rx;
+
+	g_assert(count > 1 && count <= UDP_BATCH_MAX);
+
+	XMALLOC0(rx);
+	rx->count = count;
+	rx->bufsize = bufsize;
+	rx->arena = round_pagesize(count * bufsize);
+	rx->bufs = vmm_alloc(rx->arena);
+	rx->cmsg = xmalloc0(count * UDP_CMSG_SIZE);
+#ifdef USE_UDP_MMSG
+	XMALLOC0_ARRAY(rx->msgs, count);
+#endif
+	XMALLOC0_ARRAY(rx->iov, count);
+	XMALLOC0_ARRAY(rx->from, count);
+
+	return rx;
+}
+
+/**
+ * Make sure the batched reception context of the socket follows the
+ * configured batch size.
+ *
+ * This must only be called when there are no buffered datagrams.
+ */
+static void
+socket_udp_rxbatch_sync(gnutella_socket_t *s)
+{
+#ifdef USE_UDP_MMSG
+	struct udpctx *uctx = s->resource.udp;
+	int count = MIN(GNET_PROPERTY(udp_batch_size), UDP_BATCH_MAX);
+
+	g_assert(NULL == uctx->rx || uctx->rx->next >= uctx->rx->filled);
+
+	if (s->flags & SOCK_F_SINGLE)
+		count = 1;
+
+	if (uctx->rx != NULL && uctx->rx->count == count)
+		return;
+
+	socket_udp_rxbatch_free(&uctx->rx);
+
+	if (count > 1)
+		uctx->rx = socket_udp_rxbatch_alloc(count, s->buf_size);
+#else
+	(void) s;
+#endif	/* USE_UDP_MMSG */
+}
+
+/**
+ * Read a new batch of datagrams from the socket.
+ *
+ * @return -1 on error, the amount of datagrams read otherwise.
+ */
+static int
+socket_udp_rxbatch_read(gnutella_socket_t *s, struct udp_rxbatch *rx)
+#ifdef USE_UDP_MMSG
+{
+	int i, r;
+
+	g_assert(rx->next >= rx->filled);
+
+	for (i = 0; i < rx->count; i++) {
+		struct msghdr *msg = &rx->msgs[i].msg_hdr;
+		socket_addr_t *from = &rx->from[i];
+
+		iovec_set(&rx->iov[i], &rx->bufs[i * rx->bufsize], rx->bufsize);
+
+		ZERO(msg);
+		msg->msg_namelen = socket_addr_init(from, s->net);
+		msg->msg_name = socket_addr_get_sockaddr(from);
+		msg->msg_iov = &rx->iov[i];
+		msg->msg_iovlen = 1;
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+		msg->msg_control = &rx->cmsg[i * UDP_CMSG_SIZE];
+		msg->msg_controllen = UDP_CMSG_SIZE;
+#endif
+	}
+
+	r = recvmmsg(s->file_desc, rx->msgs, rx->count, 0, NULL);
+
+	if (r <= 0) {
+		rx->filled = rx->next = 0;
+		if (0 == r)
+			errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	rx->filled = r;
+	rx->next = 0;
+
+	gnet_stats_inc_general(GNR_UDP_RX_BATCHES);
+	gnet_stats_count_general(GNR_UDP_RX_BATCHED, r);
+
+	return r;
+}
+#else	/* !USE_UDP_MMSG */
+{
+	(void) s;
+	(void) rx;
+
+	g_assert_not_reached();
+	errno = ENOSYS;
+	return -1;
+}
+#endif	/* USE_UDP_MMSG */
+
+/**
+ * Hand out next datagram held in the batched reception ring.
+ *
+ * @param s				the socket which received the datagrams
+ * @param rx			the batched reception context
+ * @param data			written with the address of the datagram payload
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return the size of the datagram, -1 with errno set to EAGAIN when the
+ * ring is empty.
+ */
+static ssize_t
+socket_udp_rxbatch_next(gnutella_socket_t *s, struct udp_rxbatch *rx,
+	const void **data, bool *truncation)
+#ifdef USE_UDP_MMSG
+{
+	while (rx->next < rx->filled) {
+		int i = rx->next++;
+		struct msghdr *msg = &rx->msgs[i].msg_hdr;
+		size_t len = rx->msgs[i].msg_len;
+		bool truncated = FALSE, has_dst_addr = FALSE;
+		host_addr_t dst_addr;
+
+		g_assert(len <= rx->bufsize);
+
+#if defined(HAS_MSGHDR_MSG_FLAGS)
+		truncated = 0 != (MSG_TRUNC & msg->msg_flags);
+#endif
+
+		if (!GNET_PROPERTY(force_local_ip))
+			has_dst_addr = socket_udp_extract_dst_addr(msg, &dst_addr);
+
+		if (
+			socket_udp_received(s,
+				socket_addr_get_addr(&rx->from[i]),
+				socket_addr_get_port(&rx->from[i]),
+				len, truncated, has_dst_addr ? &dst_addr : NULL)
+		) {
+			*data = &rx->bufs[i * rx->bufsize];
+			*truncation = truncated;
+			return len;
+		}
+
+		/* Bogus sender, already accounted for: skip datagram */
+	}
+
+	errno = VAL_EAGAIN;
+	return -1;
+}
+#else	/* !USE_UDP_MMSG */
+{
+	(void) s;
+	(void) rx;
+	(void) data;
+	(void) truncation;
+
+	errno = VAL_EAGAIN;
+	return -1;
+}
+#endif	/* USE_UDP_MMSG */
+
+/**
+ * Get next datagram from the socket, reading a new batch when needed.
+ *
+ * @param s				the socket which receives datagrams
+ * @param data			written with the address of the datagram payload
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_next(gnutella_socket_t *s, const void **data, bool *truncation)
+{
+	struct udp_rxbatch *rx = s->resource.udp->rx;
+	ssize_t r;
+
+	if (NULL == rx) {
+		r = socket_udp_accept(s, truncation);
+		*data = s->buf;
+		return r;
+	}
+
+	r = socket_udp_rxbatch_next(s, rx, data, truncation);
+	if ((ssize_t) -1 != r)
+		return r;
+
+	if (-1 == socket_udp_rxbatch_read(s, rx))
+		return (ssize_t) -1;
+
+	return socket_udp_rxbatch_next(s, rx, data, truncation);
+}
+
 static void socket_udp_flush_queue(gnutella_socket_t *s, time_delta_t maxtime);
 
 /**
@@ -3107,8 +3512,9 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	}
 
 	/*
-	 * It might be useful to call socket_udp_accept() several times
-	 * as there are often several packets queued.
+	 * It might be useful to read several datagrams at once as there are
+	 * often several packets queued.  When supported, these are read in
+	 * batches with a single system call, see socket_udp_next().
 	 *
 	 * When the RX queue is full, the kernel will start dropping new
 	 * incoming UDP datagrams, and we want to avoid that because this may
@@ -3128,14 +3534,17 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	uctx = s->resource.udp;
 	enqueue = 0 != eslist_count(&uctx->queue);
 
+	socket_udp_rxbatch_sync(s);
+
 	i = 0;
 	rd = qd = qn = 0;
 
 	for(;;) {
 		ssize_t r;
+		const void *data;
 
 		i++;
-		r = socket_udp_accept(s, &truncated);		/* Read datagram */
+		r = socket_udp_next(s, &data, &truncated);	/* Read datagram */
 
 		if ((ssize_t) -1 == r) {
 			/* ECONNRESET is meaningless with UDP but happens on Windows */
@@ -3162,11 +3571,11 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		 */
 
 		if (enqueue) {
-			socket_udp_queue(s, truncated);				/* Enqueue it */
+			socket_udp_queue(s, data, r, truncated);	/* Enqueue it */
 			qd += r;
 			qn++;
 		} else {
-			socket_udp_process(s, truncated);			/* Process it */
+			socket_udp_process(s, data, r, truncated);	/* Process it */
 		}
 
 		avail = size_saturate_sub(avail, r);
@@ -3202,6 +3611,29 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		}
 	}
 
+	/*
+	 * Datagrams from the last batch read that we did not handle yet are
+	 * moved to the read-ahead queue: we may not be called again before
+	 * new traffic comes in.
+	 */
+
+	if (uctx->rx != NULL) {
+		ssize_t r;
+		const void *data;
+
+		while (
+			(ssize_t) -1 !=
+				(r = socket_udp_rxbatch_next(s, uctx->rx, &data, &truncated))
+		) {
+			if G_UNLIKELY(0 == r)
+				continue;
+			socket_udp_queue(s, data, r, truncated);
+			rd += r;
+			qd += r;
+			qn++;
+		}
+	}
+
 	if ((i > 16 || enqueue) && GNET_PROPERTY(socket_debug)) {
 		tm_now_exact(&end);
 		if (!enqueue)
@@ -4321,6 +4753,38 @@ socket_set_single(struct gnutella_socket *s, bool on)
 	}
 }
 
+/**
+ * Hand over (or take back) the reading of datagrams on the UDP socket to
+ * another thread.
+ *
+ * When ``on'' is TRUE, the socket is no longer monitored for reading by
+ * the main thread.  The thread to which reading is delegated must stop
+ * using the socket before it is freed: socket_free() will invoke
+ * udp_ingress_detach() to that effect.
+ */
+void
+socket_udp_set_ingress(gnutella_socket_t *s, bool on)
+{
+	struct udpctx *uctx;
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+
+	uctx = s->resource.udp;
+
+	if (!uctx->ingress == !on)
+		return;
+
+	if (on) {
+		socket_evt_clear(s);
+		socket_udp_rxbatch_free(&uctx->rx);
+	} else {
+		socket_evt_set(s, INPUT_EVENT_R, socket_udp_event, s);
+	}
+
+	uctx->ingress = booleanize(on);
+}
+
 /**
  * Creates a non-blocking listening UDP socket.
  *
@@ -4361,6 +4825,21 @@ socket_udp_listen(host_addr_t bind_addr, uint16 port,
 	WALLOC0(s->resource.udp);
 	s->resource.udp->data_ind = data_ind;
 
+#ifdef USE_UDP_GSO
+	/*
+	 * Probe for UDP segmentation offload support, used when sending trains
+	 * of equally-sized datagrams to the same host in socket_plain_sendmmsg().
+	 */
+
+	{
+		int gso;
+		socklen_t gso_len = sizeof gso;
+
+		s->resource.udp->gso =
+			0 == getsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso, &gso_len);
+	}
+#endif	/* USE_UDP_GSO */
+
 	/*
 	 * The queue is there to read-ahead datagrams in socket_udp_event() when
 	 * we have to stop processing them: emptying the kernel RX queue is needed
@@ -4720,6 +5199,180 @@ socket_plain_sendto(
 	return ret;
 }
 
+/**
+ * Send several datagrams with a single system call.
+ *
+ * When the socket supports UDP segmentation offload, consecutive datagrams
+ * of the same size to the same host are sent as a single message which the
+ * kernel will split.
+ *
+ * @return the amount of leading datagrams sent, -1 with errno set if the
+ * first one could not be sent.
+ */
+static int
+socket_plain_sendmmsg(struct wrap_io *wio, wrap_dgram_t *dg, int cnt)
+#ifdef USE_UDP_MMSG
+{
+	struct gnutella_socket *s = wio->ctx;
+	struct mmsghdr msgs[UDP_BATCH_MAX];
+	iovec_t iov[UDP_BATCH_MAX];
+	socket_addr_t addr[UDP_BATCH_MAX];
+	int first[UDP_BATCH_MAX + 1];
+#ifdef USE_UDP_GSO
+	union {
+		struct cmsghdr hdr;
+		char bytes[CMSG_SPACE(sizeof(uint16))];
+	} gso[UDP_BATCH_MAX];
+	bool gso_used;
+#endif
+	int i, m, r, n;
+
+	socket_check(s);
+	g_assert(!socket_uses_tls(s));
+	g_assert(cnt > 0);
+
+	cnt = MIN(cnt, UDP_BATCH_MAX);
+
+#ifdef USE_UDP_GSO
+retry:
+	gso_used = FALSE;
+#endif
+
+	for (i = m = 0; i < cnt; m++) {
+		struct msghdr *msg = &msgs[m].msg_hdr;
+		host_addr_t ha;
+		int j, k = 1;
+
+		if (!host_addr_convert(gnet_host_get_addr(dg[i].to), &ha, s->net)) {
+			if (0 != m)
+				break;		/* Will be reported at next call */
+			if (GNET_PROPERTY(udp_debug)) {
+				g_carp("%s(): cannot convert %s to %s",
+					G_STRFUNC, host_addr_to_string(gnet_host_get_addr(dg[i].to)),
+					net_type_to_string(s->net));
+			}
+			errno = EINVAL;
+			return -1;
+		}
+
+		ZERO(msg);
+		msg->msg_namelen =
+			socket_addr_set(&addr[m], ha, gnet_host_get_port(dg[i].to));
+		msg->msg_name = socket_addr_get_sockaddr(&addr[m]);
+		msg->msg_iov = &iov[i];
+		first[m] = i;
+
+#ifdef USE_UDP_GSO
+		if (s->resource.udp->gso) {
+			size_t total = dg[i].len;
+
+			while (
+				i + k < cnt && k < UDP_GSO_MAX &&
+				dg[i + k].len == dg[i].len &&
+				total + dg[i].len <= UDP_GSO_BYTES &&
+				gnet_host_equal(dg[i + k].to, dg[i].to)
+			) {
+				total += dg[i].len;
+				k++;
+			}
+
+			if (k > 1) {
+				struct cmsghdr *cm;
+				uint16 segsize = dg[i].len;
+
+				msg->msg_control = gso[m].bytes;
+				msg->msg_controllen = sizeof gso[m].bytes;
+				cm = CMSG_FIRSTHDR(msg);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof segsize);
+				memcpy(CMSG_DATA(cm), &segsize, sizeof segsize);
+				gso_used = TRUE;
+			}
+		}
+#endif	/* USE_UDP_GSO */
+
+		for (j = 0; j < k; j++) {
+			iovec_set(&iov[i + j],
+				deconstify_pointer(dg[i + j].data), dg[i + j].len);
+		}
+
+		msg->msg_iovlen = k;
+		i += k;
+	}
+
+	first[m] = i;
+	r = sendmmsg(s->file_desc, msgs, m, 0);
+
+	if (-1 == r) {
+		int e = errno;
+
+#ifdef USE_UDP_GSO
+		/*
+		 * The kernel reports EIO when the device cannot checksum segments,
+		 * and EINVAL when the segment size does not fit the path MTU.
+		 * Disable segmentation offload on the socket and retry.
+		 */
+
+		if (gso_used && (EIO == e || EINVAL == e)) {
+			g_info("%s(): disabling UDP segmentation offload on port %u: %m",
+				G_STRFUNC, s->local_port);
+			s->resource.udp->gso = FALSE;
+			goto retry;
+		}
+#endif	/* USE_UDP_GSO */
+
+		if (GNET_PROPERTY(udp_debug))
+			g_warning("sendmmsg() failed: %m");
+
+		errno = e;
+		return -1;
+	}
+
+	/*
+	 * Count the datagrams sent.
+	 */
+
+	for (i = n = 0; i < r; i++) {
+		int k = first[i + 1] - first[i];
+
+		if (k > 1)
+			gnet_stats_count_general(GNR_UDP_TX_GSO_SEGMENTS, k);
+		n += k;
+	}
+
+	return n;
+}
+#else	/* !USE_UDP_MMSG */
+{
+	int i;
+
+	/*
+	 * Emulate through individual sendto() calls.
+	 */
+
+	for (i = 0; i < cnt; i++) {
+		ssize_t r = socket_plain_sendto(wio, dg[i].to, dg[i].data, dg[i].len);
+
+		if ((ssize_t) -1 == r)
+			return 0 == i ? -1 : i;
+	}
+
+	return cnt;
+}
+#endif	/* USE_UDP_MMSG */
+
+static int
+socket_no_sendmmsg(struct wrap_io *unused_wio, wrap_dgram_t *unused_dg,
+	int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 static ssize_t
 socket_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	const void *unused_buf, size_t unused_size)
@@ -4800,12 +5453,14 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_plain_sendto;
+		s->wio.sendmmsg = socket_plain_sendmmsg;
 	} else if (SOCK_CONN_LISTENING == s->direction) {
 		s->wio.write = socket_no_write;
 		s->wio.read = socket_no_read;
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_no_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	} else if (socket_uses_tls(s)) {
 		tls_wio_link(s);
 	} else {
@@ -4815,6 +5470,7 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_plain_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	}
 }
 
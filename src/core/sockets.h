@@ -175,8 +175,21 @@ struct udpctx {
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct udp_rxbatch *rx;				/**< Batched reception, if enabled */
+	unsigned gso:1;						/**< Segmentation offload usable */
+	unsigned ingress:1;					/**< Read by the UDP ingress thread */
 };
 
+/**
+ * Origin of a datagram read by socket_udp_read().
+ */
+typedef struct socket_udp_origin {
+	host_addr_t addr;		/**< Address of the sender */
+	host_addr_t dst;		/**< Destination address, if known */
+	uint16 port;			/**< Port of the sender */
+	unsigned has_dst:1;		/**< Whether destination address is known */
+} socket_udp_origin_t;
+
 static inline void
 socket_check(const struct gnutella_socket * const s)
 {
@@ -265,6 +278,11 @@ struct gnutella_socket *socket_udp_listen(const host_addr_t, uint16,
 	socket_udp_data_ind_t data_ind);
 struct gnutella_socket *socket_local_listen(const char *pathname);
 void socket_set_single(struct gnutella_socket *s, bool on);
+void socket_udp_set_ingress(struct gnutella_socket *s, bool on);
+ssize_t socket_udp_read(const struct gnutella_socket *s, void *buf,
+	size_t size, socket_udp_origin_t *origin, bool *truncation);
+bool socket_udp_set_origin(struct gnutella_socket *s,
+	const socket_udp_origin_t *origin, size_t len, bool truncated);
 
 void socket_attach_ops(gnutella_socket_t *s,
 	enum socket_type, struct socket_ops *ops, void *owner);
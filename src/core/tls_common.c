@@ -1395,6 +1395,17 @@ tls_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	return -1;
 }
 
+static int
+tls_no_sendmmsg(struct wrap_io *unused_wio, wrap_dgram_t *unused_dg,
+	int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 void
 tls_wio_link(struct gnutella_socket *s)
 {
@@ -1405,6 +1416,7 @@ tls_wio_link(struct gnutella_socket *s)
 	s->wio.writev = tls_writev;
 	s->wio.readv = tls_readv;
 	s->wio.sendto = tls_no_sendto;
+	s->wio.sendmmsg = tls_no_sendmmsg;
 	s->wio.flush = tls_flush;
 }
 
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Network driver -- sink layer.
+ *
+ * This driver sits at the bottom of a datagram TX stack and discards all
+ * the messages it is given, after having accounted for them as if they had
+ * been sent.  It never flow-controls the upper layer.
+ *
+ * It is used by pseudo nodes which must be able to reply to the messages
+ * they process without any network traffic being generated.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "tx.h"
+#include "tx_sink.h"
+
+#include "lib/pmsg.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/*
+ * Private attributes for the layer.
+ */
+struct attr {
+	const struct tx_dgram_cb *cb;	/**< Layer-specific callbacks */
+};
+
+/***
+ *** Polymorphic routines.
+ ***/
+
+/**
+ * Initialize the driver.
+ *
+ * Always succeeds, so never returns NULL.
+ */
+static void *
+tx_sink_init(txdrv_t *tx, void *args)
+{
+	struct attr *attr;
+	struct tx_sink_args *targs = args;
+
+	g_assert(tx);
+	g_assert(targs->cb != NULL);
+
+	WALLOC(attr);
+	attr->cb = targs->cb;
+	tx->opaque = attr;
+
+	return tx;		/* OK */
+}
+
+/**
+ * Get rid of the driver's private data.
+ */
+static void
+tx_sink_destroy(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
+	WFREE(attr);
+}
+
+/**
+ * Account for the datagram and discard it.
+ *
+ * @return amount of bytes "written".
+ */
+static ssize_t
+tx_sink_sendto(txdrv_t *tx, pmsg_t *mb, const gnet_host_t *unused_to)
+{
+	struct attr *attr = tx->opaque;
+	int len = pmsg_size(mb);
+
+	(void) unused_to;
+
+	pmsg_mark_sent(mb);
+	(*attr->cb->msg_account)(tx->owner, mb);
+
+	return len;
+}
+
+/**
+ * Nothing to do, since we never flow-control the upper layer.
+ */
+static void
+tx_sink_enable(txdrv_t *unused_tx)
+{
+	(void) unused_tx;
+}
+
+/**
+ * Nothing to do.
+ */
+static void
+tx_sink_disable(txdrv_t *unused_tx)
+{
+	(void) unused_tx;
+}
+
+/**
+ * @return the amount of data buffered locally, always 0.
+ */
+static size_t
+tx_sink_pending(txdrv_t *unused_tx)
+{
+	(void) unused_tx;
+	return 0;
+}
+
+/**
+ * Nothing to do.
+ */
+static void
+tx_sink_flush(txdrv_t *unused_tx)
+{
+	(void) unused_tx;
+}
+
+/**
+ * Nothing to do.
+ */
+static void
+tx_sink_shutdown(txdrv_t *unused_tx)
+{
+	(void) unused_tx;
+}
+
+static const struct txdrv_ops tx_sink_ops = {
+	"sink",					/**< name */
+	tx_sink_init,			/**< init */
+	tx_sink_destroy,		/**< destroy */
+	tx_no_write,			/**< write */
+	tx_no_writev,			/**< writev */
+	tx_sink_sendto,			/**< sendto */
+	tx_sink_enable,			/**< enable */
+	tx_sink_disable,		/**< disable */
+	tx_sink_pending,		/**< pending */
+	tx_sink_flush,			/**< flush */
+	tx_sink_shutdown,		/**< shutdown */
+	tx_close_noop,			/**< close */
+	tx_no_source,			/**< bio_source */
+};
+
+const struct txdrv_ops *
+tx_sink_get_ops(void)
+{
+	return &tx_sink_ops;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -323,11 +323,11 @@ log:
 		 * hostile anyway so that we know.
 		 */
 
-		flags = hostiles_check(s->addr);
+		flags = hostiles_check(NULL == s ? n->addr : s->addr);
 
 		g_warning("UDP got invalid %sGnutella packet (%zu byte%s) "
 			"\"%s\" %sfrom %s%s: %s",
-			socket_udp_is_old(s) ? "OLD " : "",
+			s != NULL && socket_udp_is_old(s) ? "OLD " : "",
 			len, plural(len),
 			len >= GTA_HEADER_SIZE ?
 				gmsg_infostr_full_split(header, payload, len - GTA_HEADER_SIZE)
@@ -941,6 +941,97 @@ udp_intuit_traffic_type(const gnutella_socket_t *s,
 	return utp;
 }
 
+/**
+ * @return string name of UDP traffic class.
+ */
+const char *
+udp_class_to_string(enum udp_class uc)
+{
+	switch (uc) {
+	case UDP_CLASS_ANY:				return "any";
+	case UDP_CLASS_GNUTELLA:		return "Gnutella";
+	case UDP_CLASS_DHT:				return "DHT";
+	case UDP_CLASS_RUDP:			return "RUDP";
+	case UDP_CLASS_SEMI_RELIABLE:	return "semi-reliable";
+	case UDP_CLASS_COUNT:			break;
+	}
+
+	g_assert_not_reached();
+	return NULL;
+}
+
+/**
+ * Classify incoming datagram.
+ *
+ * This only performs the stateless part of udp_intuit_traffic_type(): when
+ * the message could be ambiguous, or when it was truncated, it is left
+ * unclassified and will be fully inspected by udp_received_class().
+ *
+ * This routine is thread-safe.
+ *
+ * @param data			start of received data
+ * @param len			length of received data
+ * @param truncated		whether received datagram was truncated
+ *
+ * @return the class of the traffic, UDP_CLASS_ANY if it could not be
+ * determined without further inspection.
+ */
+enum udp_class
+udp_classify(const void *data, size_t len, bool truncated)
+{
+	enum udp_traffic utp;
+
+	if (truncated)
+		return UDP_CLASS_ANY;
+
+	utp = udp_check_semi_reliable(data, len);
+
+	if (len >= GTA_HEADER_SIZE) {
+		uint16 size;
+		gmsg_valid_t valid;
+
+		valid = gmsg_size_valid(data, &size);
+
+		if (
+			(GMSG_VALID == valid || GMSG_VALID_MARKED == valid) &&
+			(size_t) size + GTA_HEADER_SIZE == len
+		) {
+			uint8 function;
+
+			if (utp != UNKNOWN)
+				return UDP_CLASS_ANY;		/* Ambiguous */
+
+			function = gnutella_header_get_function(data);
+
+			return GTA_MSG_DHT == function ?
+				UDP_CLASS_DHT : GTA_MSG_RUDP == function ?
+				UDP_CLASS_RUDP : UDP_CLASS_GNUTELLA;
+		}
+	}
+
+	return UNKNOWN == utp ? UDP_CLASS_ANY : UDP_CLASS_SEMI_RELIABLE;
+}
+
+/**
+ * Identify the traffic type of a datagram, given its class.
+ */
+static enum udp_traffic
+udp_class_traffic_type(const gnutella_socket_t *s,
+	const void *data, size_t len, enum udp_class uc)
+{
+	switch (uc) {
+	case UDP_CLASS_GNUTELLA:		return GNUTELLA;
+	case UDP_CLASS_DHT:				return DHT;
+	case UDP_CLASS_RUDP:			return RUDP;
+	case UDP_CLASS_SEMI_RELIABLE:	return udp_check_semi_reliable(data, len);
+	case UDP_CLASS_ANY:				return udp_intuit_traffic_type(s, data, len);
+	case UDP_CLASS_COUNT:			break;
+	}
+
+	g_assert_not_reached();
+	return UNKNOWN;
+}
+
 /**
  * Notification from the socket layer that we got a new datagram.
  *
@@ -955,6 +1046,22 @@ udp_intuit_traffic_type(const gnutella_socket_t *s,
 void
 udp_received(const gnutella_socket_t *s,
 	const void *data, size_t len, bool truncated)
+{
+	udp_received_class(s, data, len, truncated, UDP_CLASS_ANY);
+}
+
+/**
+ * Process a new datagram whose traffic class was already determined.
+ *
+ * @param s				the receiving socket (with s->addr and s->port set)
+ * @param data			start of received data
+ * @param len			length of received data
+ * @param truncated		whether received datagram was truncated
+ * @param uc			the traffic class, as returned by udp_classify()
+ */
+void
+udp_received_class(const gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated, enum udp_class uc)
 {
 	gnutella_node_t *n;
 	bool bogus = FALSE, dht = FALSE, rudp = FALSE, g2 = FALSE;
@@ -984,7 +1091,7 @@ udp_received(const gnutella_socket_t *s,
 		enum udp_traffic utp;
 		rxdrv_t *rx;
 
-		utp = udp_intuit_traffic_type(s, data, len);
+		utp = udp_class_traffic_type(s, data, len, uc);
 
 		switch (utp) {
 		case GNUTELLA:
@@ -66,6 +66,19 @@ struct gnutella_node;
 typedef void (*udp_ping_cb_t)(enum udp_ping_ret type,
 	const struct gnutella_node *n, void *data);
 
+/**
+ * Classes of incoming UDP traffic, as determined by udp_classify().
+ */
+enum udp_class {
+	UDP_CLASS_ANY = 0,			/**< Unclassified, needs full inspection */
+	UDP_CLASS_GNUTELLA,			/**< Gnutella message */
+	UDP_CLASS_DHT,				/**< DHT message */
+	UDP_CLASS_RUDP,				/**< RUDP traffic */
+	UDP_CLASS_SEMI_RELIABLE,	/**< Semi-reliable UDP fragment */
+
+	UDP_CLASS_COUNT
+};
+
 /**
  * Known semi-reliable UDP protocol types.
  */
@@ -87,6 +100,10 @@ struct rxdriver;
 
 void udp_received(const struct gnutella_socket *s,
 	const void *data, size_t len, bool truncated);
+void udp_received_class(const struct gnutella_socket *s,
+	const void *data, size_t len, bool truncated, enum udp_class uc);
+enum udp_class udp_classify(const void *data, size_t len, bool truncated);
+const char *udp_class_to_string(enum udp_class uc);
 void udp_connect_back(const host_addr_t addr, uint16 port,
 	const struct guid *muid);
 void udp_send_msg(const struct gnutella_node *n, const void *buf, int len);
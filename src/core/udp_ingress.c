@@ -0,0 +1,625 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * UDP ingress thread.
+ *
+ * When enabled, the listening UDP sockets are no longer read by the main
+ * thread: a dedicated thread waits for incoming datagrams, reads them,
+ * classifies the traffic (Gnutella, DHT, semi-reliable UDP, RUDP) and drops
+ * byte-identical duplicates of Gnutella datagrams before handing them over
+ * through lock-free queues, one per traffic class.
+ *
+ * The main thread is notified through a waiter and drains the queues within
+ * a time budget, processing each datagram as if it had read it itself, the
+ * protocol handlers being main-thread only for now.  Having one queue per
+ * class means a given class of traffic can later be consumed by another
+ * thread without changing the ingress side.
+ *
+ * Filtering against the bogons and hostile addresses, as well as the
+ * Gnutella-level duplicate detection, rely on data structures owned by the
+ * main thread and therefore remain done when the datagram is processed.
+ *
+ * Sockets are registered under a mutex, which the ingress thread holds
+ * whilst reading from a socket: once udp_ingress_detach() returns, the
+ * socket is no longer accessed by the ingress thread and can be freed.
+ * Each registration bumps a generation number recorded in the queued
+ * datagrams so that stale ones can be discarded.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "udp_ingress.h"
+
+#include "gnet_stats.h"
+#include "sockets.h"
+#include "udp.h"
+
+#include "if/gnet_property_priv.h"
+
+#include "lib/atomic.h"
+#include "lib/compat_poll.h"
+#include "lib/hashing.h"
+#include "lib/inputevt.h"
+#include "lib/mpmc.h"
+#include "lib/mutex.h"
+#include "lib/thread.h"
+#include "lib/tm.h"
+#include "lib/vmm.h"
+#include "lib/waiter.h"
+#include "lib/xmalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define UDP_INGRESS_SOCKETS		2		/**< IPv4 and IPv6 */
+#define UDP_INGRESS_QSIZE		4096	/**< Capacity of each queue */
+#define UDP_INGRESS_READ_MAX	64		/**< Max datagrams read per wakeup */
+#define UDP_INGRESS_POLL_MS		1000	/**< Poll timeout */
+#define UDP_INGRESS_LOOP_MS		37		/**< Main thread processing budget */
+#define UDP_INGRESS_VEC			32		/**< Datagrams dequeued at once */
+#define UDP_INGRESS_DUP_SLOTS	4096	/**< Duplicate detection slots */
+#define UDP_INGRESS_DUP_DELAY	2		/**< Seconds during which dups caught */
+#define UDP_INGRESS_STACK		THREAD_STACK_MIN
+
+/**
+ * The ingress queues, by order of processing.
+ *
+ * Semi-reliable UDP traffic comes first since acknowledgments are latency
+ * sensitive.
+ */
+enum udp_ingress_queue {
+	UDP_INGRESS_Q_SR = 0,		/**< Semi-reliable UDP */
+	UDP_INGRESS_Q_GNET,			/**< Gnutella, RUDP and unclassified */
+	UDP_INGRESS_Q_DHT,			/**< DHT */
+
+	UDP_INGRESS_Q_COUNT
+};
+
+static const char *udp_ingress_qname[UDP_INGRESS_Q_COUNT] = {
+	"UDP ingress SR",			/* UDP_INGRESS_Q_SR */
+	"UDP ingress Gnutella",		/* UDP_INGRESS_Q_GNET */
+	"UDP ingress DHT",			/* UDP_INGRESS_Q_DHT */
+};
+
+/**
+ * A datagram read by the ingress thread.
+ */
+struct udp_ingress_dgram {
+	gnutella_socket_t *s;			/**< Receiving socket */
+	uint gen;						/**< Socket registration generation */
+	uint slot;						/**< Socket registration slot */
+	socket_udp_origin_t origin;		/**< Origin of the datagram */
+	size_t len;						/**< Length of the datagram */
+	enum udp_class uc;				/**< Traffic class */
+	bool truncated;					/**< Whether datagram was truncated */
+	char data[1];					/**< Start of datagram (embedded) */
+};
+
+/**
+ * Duplicate detection slot.
+ */
+struct udp_ingress_dup {
+	uint32 hash;					/**< Hash of origin and payload */
+	time_t stamp;					/**< When it was last seen */
+};
+
+static mutex_t udp_ingress_lock = MUTEX_INIT;
+static gnutella_socket_t *udp_ingress_sockets[UDP_INGRESS_SOCKETS];
+static uint udp_ingress_gen[UDP_INGRESS_SOCKETS];
+static mpmc_t *udp_ingress_q[UDP_INGRESS_Q_COUNT];
+static waiter_t *udp_ingress_wakeup;	/**< To wake up the ingress thread */
+static waiter_t *udp_ingress_ready;		/**< To notify the main thread */
+static uint udp_ingress_ready_id;		/**< I/O callback for notifications */
+static int udp_ingress_id = -1;			/**< Ingress thread ID */
+static bool udp_ingress_exiting;		/**< Signals thread it must exit */
+
+/* Only accessed by the ingress thread */
+static struct udp_ingress_dup udp_ingress_dups[UDP_INGRESS_DUP_SLOTS];
+
+/**
+ * @return the queue to use for given traffic class.
+ */
+static enum udp_ingress_queue
+udp_ingress_class_queue(enum udp_class uc)
+{
+	switch (uc) {
+	case UDP_CLASS_SEMI_RELIABLE:	return UDP_INGRESS_Q_SR;
+	case UDP_CLASS_DHT:				return UDP_INGRESS_Q_DHT;
+	case UDP_CLASS_GNUTELLA:
+	case UDP_CLASS_RUDP:
+	case UDP_CLASS_ANY:				return UDP_INGRESS_Q_GNET;
+	case UDP_CLASS_COUNT:			break;
+	}
+
+	g_assert_not_reached();
+	return UDP_INGRESS_Q_GNET;
+}
+
+/**
+ * Check whether a datagram is a byte-identical copy of another received from
+ * the same origin recently.
+ *
+ * This is a lossy check: slots are overwritten as new datagrams come in.
+ * It must only be called by the ingress thread.
+ */
+static bool
+udp_ingress_is_dup(const socket_udp_origin_t *origin,
+	const void *data, size_t len)
+{
+	struct udp_ingress_dup *d;
+	uint32 h;
+	time_t now = tm_time();
+
+	h = binary_hash(data, len) ^ host_addr_hash(origin->addr) ^
+		integer_hash_fast(origin->port);
+	d = &udp_ingress_dups[h & (UDP_INGRESS_DUP_SLOTS - 1)];
+
+	if (d->hash == h && delta_time(now, d->stamp) < UDP_INGRESS_DUP_DELAY)
+		return TRUE;
+
+	d->hash = h;
+	d->stamp = now;
+
+	return FALSE;
+}
+
+/**
+ * Read pending datagrams from socket registered at given slot, enqueuing
+ * them for the main thread.
+ *
+ * @return TRUE if we enqueued datagrams.
+ */
+static bool
+udp_ingress_read(uint slot, gnutella_socket_t *s, char *buf, size_t size)
+{
+	bool queued = FALSE;
+	uint i, gen;
+
+	mutex_lock(&udp_ingress_lock);
+
+	/*
+	 * The socket could have been detached since we polled it.
+	 */
+
+	if (udp_ingress_sockets[slot] != s)
+		goto done;
+
+	gen = udp_ingress_gen[slot];
+
+	for (i = 0; i < UDP_INGRESS_READ_MAX; i++) {
+		struct udp_ingress_dgram *d;
+		socket_udp_origin_t origin;
+		enum udp_class uc;
+		bool truncated;
+		ssize_t r;
+
+		r = socket_udp_read(s, buf, size, &origin, &truncated);
+
+		if ((ssize_t) -1 == r) {
+			/* ECONNRESET is meaningless with UDP but happens on Windows */
+			if (!is_temporary_error(errno) && errno != ECONNRESET) {
+				s_warning("%s(): ignoring datagram reception error: %m",
+					G_STRFUNC);
+			}
+			break;
+		}
+
+		if G_UNLIKELY(0 == r) {
+			gnet_stats_inc_general(GNR_UDP_UNPROCESSED_MESSAGE);
+			continue;
+		}
+
+		gnet_stats_inc_general(GNR_UDP_INGRESS_RECEIVED);
+
+		uc = udp_classify(buf, r, truncated);
+
+		if (UDP_CLASS_GNUTELLA == uc && udp_ingress_is_dup(&origin, buf, r)) {
+			gnet_stats_inc_general(GNR_UDP_INGRESS_DUPLICATE);
+			continue;
+		}
+
+		d = xmalloc(offsetof(struct udp_ingress_dgram, data) + r);
+		d->s = s;
+		d->gen = gen;
+		d->slot = slot;
+		d->origin = origin;
+		d->len = r;
+		d->uc = uc;
+		d->truncated = truncated;
+		memcpy(d->data, buf, r);
+
+		if (!mpmc_put(udp_ingress_q[udp_ingress_class_queue(uc)], d)) {
+			gnet_stats_inc_general(GNR_UDP_INGRESS_QUEUE_FULL);
+			xfree(d);
+			continue;
+		}
+
+		queued = TRUE;
+	}
+
+done:
+	mutex_unlock(&udp_ingress_lock);
+
+	return queued;
+}
+
+/**
+ * The UDP ingress thread.
+ */
+static void *
+udp_ingress_main(void *unused_arg)
+{
+	size_t size = round_pagesize(SOCK_LBUFSZ);
+	char *buf = vmm_alloc(size);
+
+	(void) unused_arg;
+
+	thread_set_name("UDP ingress");
+
+	while (!atomic_bool_get(&udp_ingress_exiting)) {
+		struct pollfd fds[UDP_INGRESS_SOCKETS + 1];
+		gnutella_socket_t *sockets[UDP_INGRESS_SOCKETS];
+		uint slots[UDP_INGRESS_SOCKETS];
+		uint i, n = 0;
+		bool queued = FALSE;
+		int r;
+
+		fds[0].fd = waiter_fd(udp_ingress_wakeup);
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+
+		mutex_lock(&udp_ingress_lock);
+		for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+			gnutella_socket_t *s = udp_ingress_sockets[i];
+
+			if (s != NULL) {
+				sockets[n] = s;
+				slots[n] = i;
+				n++;
+				fds[n].fd = s->file_desc;
+				fds[n].events = POLLIN;
+				fds[n].revents = 0;
+			}
+		}
+		mutex_unlock(&udp_ingress_lock);
+
+		r = compat_poll(fds, n + 1, UDP_INGRESS_POLL_MS);
+
+		if (r <= 0)
+			continue;		/* Timeout or signal */
+
+		if (fds[0].revents != 0)
+			waiter_ack(udp_ingress_wakeup);
+
+		for (i = 0; i < n; i++) {
+			if (fds[i + 1].revents != 0)
+				queued |= udp_ingress_read(slots[i], sockets[i], buf, size);
+		}
+
+		if (queued)
+			waiter_signal(udp_ingress_ready);
+	}
+
+	vmm_free(buf, size);
+	return NULL;
+}
+
+/**
+ * Process datagram handed over by the ingress thread.
+ */
+static void
+udp_ingress_deliver(struct udp_ingress_dgram *d)
+{
+	gnutella_socket_t *s = d->s;
+
+	/*
+	 * Discard datagrams from sockets detached since they were read.
+	 */
+
+	if (
+		udp_ingress_sockets[d->slot] == s &&
+		udp_ingress_gen[d->slot] == d->gen &&
+		socket_udp_set_origin(s, &d->origin, d->len, d->truncated)
+	) {
+		udp_received_class(s, d->data, d->len, d->truncated, d->uc);
+	}
+
+	xfree(d);
+}
+
+/**
+ * Process datagrams handed over by the ingress thread, within our time
+ * budget.
+ */
+static void
+udp_ingress_dispatch(void)
+{
+	tm_t start, end;
+	bool more;
+
+	tm_now_exact(&start);
+
+	do {
+		uint i;
+
+		more = FALSE;
+
+		for (i = 0; i < N_ITEMS(udp_ingress_q); i++) {
+			void *vec[UDP_INGRESS_VEC];
+			size_t j, n;
+
+			n = mpmc_get_vec(udp_ingress_q[i], vec, N_ITEMS(vec));
+
+			for (j = 0; j < n; j++)
+				udp_ingress_deliver(vec[j]);
+
+			if (N_ITEMS(vec) == n)
+				more = TRUE;
+		}
+
+		tm_now_exact(&end);
+	} while (more && tm_elapsed_ms(&end, &start) < UDP_INGRESS_LOOP_MS);
+
+	/*
+	 * If we exhausted our budget, come back later, letting the main thread
+	 * process other events meanwhile.
+	 */
+
+	if (more)
+		waiter_signal(udp_ingress_ready);
+}
+
+/**
+ * I/O callback invoked when the ingress thread signals us.
+ */
+static void
+udp_ingress_ready_callback(void *data, int source, inputevt_cond_t cond)
+{
+	waiter_t *w = data;
+
+	(void) source;
+	g_assert(cond & INPUT_EVENT_RX);
+
+	waiter_ack(w);
+	udp_ingress_dispatch();
+}
+
+static void udp_ingress_stop(void);
+
+/**
+ * Launch the ingress thread, if not already running.
+ */
+static void
+udp_ingress_start(void)
+{
+	uint i;
+
+	if (udp_ingress_ready != NULL)
+		return;		/* Already running */
+
+	for (i = 0; i < N_ITEMS(udp_ingress_q); i++)
+		udp_ingress_q[i] = mpmc_make(udp_ingress_qname[i], UDP_INGRESS_QSIZE);
+
+	udp_ingress_wakeup = waiter_make(NULL);
+	udp_ingress_ready = waiter_make(NULL);
+	udp_ingress_ready_id = inputevt_add(waiter_fd(udp_ingress_ready),
+		INPUT_EVENT_RX, udp_ingress_ready_callback, udp_ingress_ready);
+
+	atomic_bool_set(&udp_ingress_exiting, FALSE);
+
+	udp_ingress_id = thread_create(udp_ingress_main, NULL,
+		THREAD_F_NO_CANCEL | THREAD_F_NO_POOL | THREAD_F_WARN,
+		UDP_INGRESS_STACK);
+
+	if (-1 == udp_ingress_id) {
+		g_warning("%s(): cannot create UDP ingress thread: %m", G_STRFUNC);
+		udp_ingress_stop();
+	}
+}
+
+/**
+ * Free datagram held in queue (mpmc_free_null() callback).
+ */
+static void
+udp_ingress_dgram_free(void *p)
+{
+	xfree(p);
+}
+
+/**
+ * Stop the ingress thread, if running.
+ *
+ * All the sockets must have been detached already.
+ */
+static void
+udp_ingress_stop(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++)
+		g_assert(NULL == udp_ingress_sockets[i]);
+
+	if (udp_ingress_id != -1) {
+		atomic_bool_set(&udp_ingress_exiting, TRUE);
+		waiter_signal(udp_ingress_wakeup);
+		if (-1 == thread_join(udp_ingress_id, NULL))
+			g_warning("%s(): cannot join UDP ingress thread: %m", G_STRFUNC);
+		udp_ingress_id = -1;
+	}
+
+	inputevt_remove(&udp_ingress_ready_id);
+	waiter_destroy_null(&udp_ingress_wakeup);
+	waiter_destroy_null(&udp_ingress_ready);
+
+	for (i = 0; i < N_ITEMS(udp_ingress_q); i++)
+		mpmc_free_null(&udp_ingress_q[i], udp_ingress_dgram_free);
+}
+
+/**
+ * Hand over reading of the socket to the ingress thread.
+ */
+static void
+udp_ingress_attach(gnutella_socket_t *s)
+{
+	uint i;
+
+	socket_check(s);
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+		if (NULL == udp_ingress_sockets[i])
+			break;
+	}
+
+	g_assert(i < N_ITEMS(udp_ingress_sockets));
+
+	socket_udp_set_ingress(s, TRUE);
+
+	mutex_lock(&udp_ingress_lock);
+	udp_ingress_sockets[i] = s;
+	udp_ingress_gen[i]++;
+	mutex_unlock(&udp_ingress_lock);
+
+	waiter_signal(udp_ingress_wakeup);
+
+	if (GNET_PROPERTY(udp_debug)) {
+		g_debug("%s(): UDP port %u now read by ingress thread",
+			G_STRFUNC, s->local_port);
+	}
+}
+
+/**
+ * Stop reading from socket in the ingress thread.
+ *
+ * Upon return, the socket is no longer accessed by the ingress thread.
+ * Datagrams already queued for the socket will be discarded.
+ */
+void
+udp_ingress_detach(gnutella_socket_t *s)
+{
+	uint i;
+
+	socket_check(s);
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+		if (s == udp_ingress_sockets[i]) {
+			mutex_lock(&udp_ingress_lock);
+			udp_ingress_sockets[i] = NULL;
+			mutex_unlock(&udp_ingress_lock);
+			waiter_signal(udp_ingress_wakeup);
+			return;
+		}
+	}
+}
+
+/**
+ * Is socket handled by the ingress thread?
+ */
+static bool
+udp_ingress_has(const gnutella_socket_t *s)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+		if (s == udp_ingress_sockets[i])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Update the set of sockets read by the ingress thread.
+ *
+ * This must be called each time the listening UDP sockets are recreated
+ * and when the "udp_ingress_thread" property changes.
+ */
+void
+udp_ingress_update(void)
+{
+	gnutella_socket_t *wanted[UDP_INGRESS_SOCKETS];
+	bool enabled = GNET_PROPERTY(udp_ingress_thread);
+	uint i;
+
+	STATIC_ASSERT(N_ITEMS(wanted) == N_ITEMS(udp_ingress_sockets));
+
+	wanted[0] = enabled ? s_udp_listen : NULL;
+	wanted[1] = enabled ? s_udp_listen6 : NULL;
+
+	/*
+	 * Detach sockets we no longer want, giving reading back to the main
+	 * thread if the socket is still alive.
+	 */
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+		gnutella_socket_t *s = udp_ingress_sockets[i];
+
+		if (s != NULL && s != wanted[0] && s != wanted[1]) {
+			udp_ingress_detach(s);
+			socket_udp_set_ingress(s, FALSE);
+		}
+	}
+
+	if (NULL == wanted[0] && NULL == wanted[1]) {
+		udp_ingress_stop();
+		return;
+	}
+
+	udp_ingress_start();
+
+	if (-1 == udp_ingress_id)
+		return;			/* Could not create thread, main thread reads */
+
+	for (i = 0; i < N_ITEMS(wanted); i++) {
+		if (wanted[i] != NULL && !udp_ingress_has(wanted[i]))
+			udp_ingress_attach(wanted[i]);
+	}
+}
+
+/**
+ * Final shutdown: give sockets back to the main thread and stop the
+ * ingress thread.
+ */
+void
+udp_ingress_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(udp_ingress_sockets); i++) {
+		gnutella_socket_t *s = udp_ingress_sockets[i];
+
+		if (s != NULL) {
+			udp_ingress_detach(s);
+			socket_udp_set_ingress(s, FALSE);
+		}
+	}
+
+	udp_ingress_stop();
+}
+
+/* vi: set ts=4 sw=4 cindent: */
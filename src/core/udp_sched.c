@@ -79,6 +79,7 @@
 #include "lib/log.h"
 #include "lib/palloc.h"
 #include "lib/pmsg.h"
+#include "lib/stringify.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/walloc.h"
@@ -89,6 +90,7 @@
 
 #define UDP_SCHED_EXPIRE	5	/**< Seconds before expiring unsent messages */
 #define UDP_SCHED_FACTOR	3	/**< Stop when that many times the b/w queued */
+#define UDP_SCHED_BATCH_MAX	64	/**< Maximum amount of datagrams per batch */
 
 #define udp_sched_log(lvl, fmt, ...)						\
 G_STMT_START {												\
@@ -433,7 +435,26 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
 }
 
 /**
- * Send message block to IP:port.
+ * @return the network slot to use to send to specified host.
+ */
+static enum udp_sched_net
+udp_sched_net(const gnet_host_t *to)
+{
+	switch (gnet_host_get_net(to)) {
+	case NET_TYPE_IPV4:
+		return UDP_SCHED_IPv4;
+	case NET_TYPE_IPV6:
+		return UDP_SCHED_IPv6;
+	case NET_TYPE_NONE:
+	case NET_TYPE_LOCAL:
+		break;
+	}
+	g_assert_not_reached();
+}
+
+/**
+ * Check whether message block can be sent to IP:port and select the I/O
+ * source to use, dropping the message when it cannot be sent.
  *
  * @param us		the UDP scheduler
  * @param mb		the message to send
@@ -441,20 +462,17 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
  * @param tx		the TX stack sending the message
  * @param cb		callback actions on the datagram
  *
- * @return TRUE if message was sent or dropped, FALSE if there is no more
- * bandwidth to send anything.
+ * @return the I/O source to use, NULL if the message was dropped.
  */
-static bool
-udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+static bio_source_t *
+udp_sched_mb_bio(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	const txdrv_t *tx, const struct tx_dgram_cb *cb)
 {
-	ssize_t r;
-	int len = pmsg_size(mb);
-	bio_source_t *bio = NULL;
+	bio_source_t *bio;
 
 	if (0 == gnet_host_get_port(to)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_ZERO_PORT);
-		return TRUE;
+		return NULL;
 	}
 
 	/*
@@ -463,24 +481,14 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 	if (!pmsg_can_transmit(mb)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_LONGER_NEEDED);
-		return TRUE;			/* Dropped */
+		return NULL;			/* Dropped */
 	}
 
 	/*
 	 * Select the proper I/O source depending on the network address type.
 	 */
 
-	switch (gnet_host_get_net(to)) {
-	case NET_TYPE_IPV4:
-		bio = us->bio[UDP_SCHED_IPv4];
-		break;
-	case NET_TYPE_IPV6:
-		bio = us->bio[UDP_SCHED_IPv6];
-		break;
-	case NET_TYPE_NONE:
-	case NET_TYPE_LOCAL:
-		g_assert_not_reached();
-	}
+	bio = us->bio[udp_sched_net(to)];
 
 	/*
 	 * If there is no I/O source, then the socket to send that type of traffic
@@ -491,9 +499,75 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 		udp_sched_log(4, "%p: discarding mb=%p (%d bytes) to %s",
 			us, mb, pmsg_written_size(mb), gnet_host_to_string(to));
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_SOCKET);
-		return udp_tx_drop(tx, cb);		/* TRUE, for "sent" */
+		udp_tx_drop(tx, cb);
 	}
 
+	return bio;
+}
+
+/**
+ * Account for message block successfully sent to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message sent
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ */
+static void
+udp_sched_mb_sent(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	static gnr_stats_t s[] = {
+		GNR_UDP_SCHED_FINALLY_SENT_PRIO_DATA,
+		GNR_UDP_SCHED_FINALLY_SENT_PRIO_CONTROL,
+		GNR_UDP_SCHED_FINALLY_SENT_PRIO_URGENT,
+		GNR_UDP_SCHED_FINALLY_SENT_PRIO_HIGHEST,
+	};
+	uint prio = pmsg_prio(mb);
+
+	STATIC_ASSERT(PMSG_P_COUNT == N_ITEMS(s));
+
+	g_assert_log(prio < PMSG_P_COUNT,
+		"%s(): prio=%u", G_STRFUNC, prio);
+
+	udp_sched_log(5, "%p: sent mb=%p (%d bytes) prio=%u",
+		us, mb, pmsg_size(mb), prio);
+
+	pmsg_mark_sent(mb);
+	gnet_stats_inc_general(s[prio]);
+
+	if (cb->msg_account != NULL)
+		(*cb->msg_account)(tx->owner, mb);
+
+	inet_udp_record_sent(gnet_host_get_addr(to));
+}
+
+/**
+ * Send message block to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message to send
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ *
+ * @return TRUE if message was sent or dropped, FALSE if there is no more
+ * bandwidth to send anything.
+ */
+static bool
+udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	ssize_t r;
+	int len = pmsg_size(mb);
+	bio_source_t *bio;
+
+	bio = udp_sched_mb_bio(us, mb, to, tx, cb);
+
+	if (NULL == bio)
+		return TRUE;		/* Dropped, for "sent" */
+
 	/*
 	 * OK, proceed if we have bandwidth.
 	 */
@@ -519,29 +593,7 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 			"for %d-byte datagram",
 			G_STRFUNC, r, gnet_host_to_string(to), len);
 	} else {
-		static gnr_stats_t s[] = {
-			GNR_UDP_SCHED_FINALLY_SENT_PRIO_DATA,
-			GNR_UDP_SCHED_FINALLY_SENT_PRIO_CONTROL,
-			GNR_UDP_SCHED_FINALLY_SENT_PRIO_URGENT,
-			GNR_UDP_SCHED_FINALLY_SENT_PRIO_HIGHEST,
-		};
-		uint prio = pmsg_prio(mb);
-
-		STATIC_ASSERT(PMSG_P_COUNT == N_ITEMS(s));
-
-		g_assert_log(prio < PMSG_P_COUNT,
-			"%s(): prio=%u", G_STRFUNC, prio);
-
-		udp_sched_log(5, "%p: sent mb=%p (%d bytes) prio=%u",
-			us, mb, pmsg_size(mb), prio);
-
-		pmsg_mark_sent(mb);
-		gnet_stats_inc_general(s[prio]);
-
-		if (cb->msg_account != NULL)
-			(*cb->msg_account)(tx->owner, mb);
-
-		inet_udp_record_sent(gnet_host_get_addr(to));
+		udp_sched_mb_sent(us, mb, to, tx, cb);
 	}
 
 	return TRUE;		/* Message sent */
@@ -598,6 +650,183 @@ udp_tx_desc_send(void *data, void *udata)
 	return TRUE;
 }
 
+/**
+ * A batch of datagrams to send through the same I/O source.
+ */
+struct udp_tx_batch {
+	bio_source_t *bio;							/**< I/O source to use */
+	int count;									/**< Amount of datagrams */
+	struct udp_tx_desc *txd[UDP_SCHED_BATCH_MAX];	/**< Batched descriptors */
+	wrap_dgram_t dg[UDP_SCHED_BATCH_MAX];		/**< Datagrams to send */
+};
+
+/**
+ * Context for batched LIFO processing.
+ */
+struct udp_tx_batch_ctx {
+	udp_sched_t *us;							/**< The UDP scheduler */
+	eslist_t unsent;							/**< Batched but unsent */
+	int size;									/**< Batch size */
+	struct udp_tx_batch batch[UDP_SCHED_NET_CNT];	/**< Batches, by network */
+};
+
+/**
+ * Flush batched datagrams.
+ *
+ * Datagrams that could not be sent for lack of bandwidth are moved to the
+ * list of unsent descriptors, for re-insertion into the LIFO.
+ */
+static void
+udp_sched_batch_flush(struct udp_tx_batch_ctx *ctx, struct udp_tx_batch *b)
+{
+	udp_sched_t *us = ctx->us;
+	int i = 0;
+
+	while (i < b->count) {
+		struct udp_tx_desc *txd = b->txd[i];
+		int j, r;
+
+		if (us->used_all) {
+			for (j = i; j < b->count; j++)
+				eslist_append(&ctx->unsent, b->txd[j]);
+			break;
+		}
+
+		r = bio_sendmmsg(b->bio, &b->dg[i], b->count - i);
+
+		if (r <= 0) {		/* Error, or no bandwidth */
+			if (
+				r < 0 &&
+				udp_sched_write_error(us, txd->to, txd->mb, G_STRFUNC)
+			) {
+				udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
+					us, txd->mb, pmsg_written_size(txd->mb));
+				gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
+				udp_tx_drop(txd->tx, txd->cb);
+				us->buffered = size_saturate_sub(us->buffered,
+					pmsg_size(txd->mb));
+				udp_tx_desc_flag_release(txd, us);
+				i++;
+			} else {
+				udp_sched_log(3, "%p: no bandwidth for %d datagram%s",
+					us, PLURAL(b->count - i));
+				us->used_all = TRUE;
+			}
+			continue;
+		}
+
+		gnet_stats_inc_general(GNR_UDP_TX_BATCHES);
+		gnet_stats_count_general(GNR_UDP_TX_BATCHED, r);
+
+		for (j = i; j < i + r; j++) {
+			txd = b->txd[j];
+			udp_sched_mb_sent(us, txd->mb, txd->to, txd->tx, txd->cb);
+			us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+			udp_tx_desc_flag_release(txd, us);
+		}
+
+		i += r;
+	}
+
+	b->count = 0;
+}
+
+/**
+ * Is TX descriptor continuing the fragment train ending the batch?
+ *
+ * Fragments of a large message are enqueued together to the same host with
+ * the same size (save the last one), so we let them flow together, which
+ * allows the kernel to segment them at once when it can.
+ */
+static bool
+udp_sched_batch_train(const struct udp_tx_batch *b,
+	const struct udp_tx_desc *txd)
+{
+	const struct udp_tx_desc *last;
+
+	if (0 == b->count)
+		return FALSE;
+
+	last = b->txd[b->count - 1];
+
+	return last->tx == txd->tx &&
+		pmsg_size(last->mb) == pmsg_size(txd->mb) &&
+		gnet_host_equal(last->to, txd->to);
+}
+
+/**
+ * Batch message for sending (eslist iterator callback).
+ *
+ * @return TRUE if message was batched or dropped, removing it from the list.
+ */
+static bool
+udp_tx_desc_batch(void *data, void *udata)
+{
+	struct udp_tx_desc *txd = data;
+	struct udp_tx_batch_ctx *ctx = udata;
+	udp_sched_t *us = ctx->us;
+	struct udp_tx_batch *b;
+	bio_source_t *bio;
+	wrap_dgram_t *dg;
+	unsigned prio;
+
+	udp_sched_check(us);
+	udp_tx_desc_check(txd);
+
+	if (us->used_all)
+		return FALSE;
+
+	/*
+	 * Same rule as udp_tx_desc_send() to avoid flushing consecutive messages
+	 * to the same destination, unless they belong to the same fragment train.
+	 */
+
+	prio = pmsg_prio(txd->mb);
+	b = &ctx->batch[udp_sched_net(txd->to)];
+
+	if (
+		PMSG_P_DATA == prio && hset_contains(us->seen, txd->to) &&
+		!udp_sched_batch_train(b, txd)
+	) {
+		udp_sched_log(2, "%p: skipping mb=%p (%d bytes) to %s",
+			us, txd->mb, pmsg_size(txd->mb), gnet_host_to_string(txd->to));
+		return FALSE;
+	}
+
+	bio = udp_sched_mb_bio(us, txd->mb, txd->to, txd->tx, txd->cb);
+
+	if (NULL == bio) {
+		us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+		udp_tx_desc_flag_release(txd, us);
+		return TRUE;
+	}
+
+	if (PMSG_P_DATA == prio && !hset_contains(us->seen, txd->to))
+		hset_insert(us->seen, atom_host_get(txd->to));
+
+	/*
+	 * The descriptor will be removed from the list by the iterator, hence
+	 * it can be linked to another list later on, when the batch is flushed.
+	 */
+
+	eslist_mark_removed(&ctx->unsent, txd);
+
+	g_assert(b->count < ctx->size);
+	g_assert(NULL == b->bio || bio == b->bio);
+
+	b->bio = bio;
+	b->txd[b->count] = txd;
+	dg = &b->dg[b->count];
+	dg->to = txd->to;
+	dg->data = pmsg_phys_base(txd->mb);
+	dg->len = pmsg_size(txd->mb);
+
+	if (++b->count >= ctx->size)
+		udp_sched_batch_flush(ctx, b);
+
+	return TRUE;
+}
+
 /**
  * @return b/w per second configured for the attached b/w scheduler.
  */
@@ -746,13 +975,39 @@ udp_sched_send(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 /**
  * Process LIFO queue, sending out messages until we have no more bandwidth.
+ *
+ * When configured to, messages are sent by batches to limit the amount of
+ * system calls, each batch being flushed with a single sendmmsg().
  */
 static void
 udp_sched_process(udp_sched_t *us, eslist_t *list)
 {
+	struct udp_tx_batch_ctx ctx;
+	uint i;
+
 	udp_sched_check(us);
 
-	eslist_foreach_remove(list, udp_tx_desc_send, us);
+	if (GNET_PROPERTY(udp_batch_size) <= 1) {
+		eslist_foreach_remove(list, udp_tx_desc_send, us);
+		return;
+	}
+
+	ZERO(&ctx);
+	ctx.us = us;
+	ctx.size = MIN(GNET_PROPERTY(udp_batch_size), UDP_SCHED_BATCH_MAX);
+	eslist_init(&ctx.unsent, offsetof(struct udp_tx_desc, lnk));
+
+	eslist_foreach_remove(list, udp_tx_desc_batch, &ctx);
+
+	for (i = 0; i < N_ITEMS(ctx.batch); i++)
+		udp_sched_batch_flush(&ctx, &ctx.batch[i]);
+
+	/*
+	 * Put back what we could not send at the top of the LIFO, keeping the
+	 * original ordering.
+	 */
+
+	eslist_prepend_list(list, &ctx.unsent);
 }
 
 /**
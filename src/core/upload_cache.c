@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Upload block cache, shared among uploads of the same file.
+ *
+ * When a popular file is requested by many hosts at once, each upload reads
+ * the same data from its own file descriptor.  This cache keeps recently
+ * read blocks of shared files, keyed by the file SHA1 and the block offset,
+ * so that concurrent uploads of the same file hit the disk only once.
+ *
+ * The cache is bounded: least recently used blocks are evicted when it is
+ * full.  Reads are always done on aligned blocks of UCACHE_BLOCK_SIZE bytes.
+ *
+ * Sequential accesses also trigger a read-ahead of the next blocks through
+ * posix_fadvise().  The read-ahead window is tracked per file, not per
+ * upload, so that the kernel is told only once about a given region, however
+ * many uploads are streaming it.  This is also used when uploads are served
+ * through sendfile(), which bypasses the block cache since the kernel page
+ * cache is already shared in that case.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "upload_cache.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/compat_misc.h"
+#include "lib/elist.h"
+#include "lib/file_object.h"
+#include "lib/hashing.h"
+#include "lib/hevset.h"
+#include "lib/hikset.h"
+#include "lib/misc.h"
+#include "lib/stringify.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+#define UCACHE_BLOCK_SIZE	(64 * 1024)	/**< Size of cached blocks */
+#define UCACHE_MAX_BLOCKS	512			/**< Cache at most 32 MiB */
+#define UCACHE_RA_BLOCKS	4			/**< Read-ahead window, in blocks */
+
+enum ucache_file_magic { UCACHE_FILE_MAGIC = 0x0e6d1a27 };
+
+/**
+ * A file known to the cache.
+ *
+ * The structure is kept as long as uploads reference it or some of its
+ * blocks are cached.
+ */
+struct ucache_file {
+	enum ucache_file_magic magic;
+	const struct sha1 *sha1;	/**< File SHA1 (atom) */
+	filesize_t size;			/**< File size */
+	filesize_t ra_start;		/**< Start of last read-ahead window */
+	filesize_t ra_end;			/**< End of last read-ahead window */
+	size_t blocks;				/**< Amount of cached blocks */
+	int refcnt;					/**< Amount of uploads using this file */
+};
+
+static inline void
+ucache_file_check(const struct ucache_file * const uf)
+{
+	g_assert(uf != NULL);
+	g_assert(UCACHE_FILE_MAGIC == uf->magic);
+	g_assert(uf->refcnt >= 0);
+}
+
+/**
+ * A cached block is identified by its file and its (aligned) offset.
+ *
+ * There is only one ucache_file structure per SHA1, hence using the file
+ * structure instead of the SHA1 atom is equivalent and cheaper to hash.
+ */
+struct ucache_key {
+	const struct ucache_file *uf;
+	filesize_t offset;
+};
+
+enum ucache_block_magic { UCACHE_BLOCK_MAGIC = 0x7a45c913 };
+
+struct ucache_block {
+	enum ucache_block_magic magic;
+	struct ucache_key key;		/**< Block key (embedded) */
+	char *data;					/**< Block data, UCACHE_BLOCK_SIZE bytes */
+	size_t len;					/**< Amount of valid data */
+	link_t lru;					/**< Embedded LRU list link */
+};
+
+static inline void
+ucache_block_check(const struct ucache_block * const b)
+{
+	g_assert(b != NULL);
+	g_assert(UCACHE_BLOCK_MAGIC == b->magic);
+	g_assert(b->data != NULL);
+}
+
+static hikset_t *ucache_files;		/**< SHA1 -> ucache_file */
+static hevset_t *ucache_blocks;		/**< ucache_key -> ucache_block */
+static elist_t ucache_lru;			/**< Blocks, least recently used first */
+
+static struct {
+	uint64 hits;
+	uint64 misses;
+	uint64 readahead;
+} ucache_stats;
+
+static uint
+ucache_key_hash(const void *key)
+{
+	const struct ucache_key *k = key;
+
+	return pointer_hash(k->uf) ^ integer_hash(k->offset / UCACHE_BLOCK_SIZE);
+}
+
+static uint
+ucache_key_hash2(const void *key)
+{
+	const struct ucache_key *k = key;
+
+	return pointer_hash2(k->uf) ^ integer_hash(k->offset);
+}
+
+static bool
+ucache_key_eq(const void *a, const void *b)
+{
+	const struct ucache_key *ka = a, *kb = b;
+
+	return ka->uf == kb->uf && ka->offset == kb->offset;
+}
+
+/**
+ * Free file structure.
+ */
+static void
+upload_cache_file_free(struct ucache_file *uf)
+{
+	ucache_file_check(uf);
+	g_assert(0 == uf->refcnt);
+	g_assert(0 == uf->blocks);
+
+	hikset_remove(ucache_files, uf->sha1);
+	atom_sha1_free_null(&uf->sha1);
+	uf->magic = 0;
+	WFREE(uf);
+}
+
+/**
+ * Free cached block, disposing of its file if no longer needed.
+ */
+static void
+upload_cache_block_free(struct ucache_block *b)
+{
+	struct ucache_file *uf;
+
+	ucache_block_check(b);
+
+	uf = deconstify_pointer(b->key.uf);
+	ucache_file_check(uf);
+	g_assert(uf->blocks != 0);
+
+	hevset_remove(ucache_blocks, &b->key);
+	elist_remove(&ucache_lru, b);
+	vmm_free(b->data, UCACHE_BLOCK_SIZE);
+	b->magic = 0;
+	WFREE(b);
+
+	if (0 == --uf->blocks && 0 == uf->refcnt)
+		upload_cache_file_free(uf);
+}
+
+/**
+ * Evict least recently used blocks until the cache is within its limits.
+ */
+static void
+upload_cache_trim(void)
+{
+	while (elist_count(&ucache_lru) > UCACHE_MAX_BLOCKS)
+		upload_cache_block_free(elist_head(&ucache_lru));
+}
+
+/**
+ * Discard all the cached blocks of a file.
+ */
+static void
+upload_cache_file_purge(struct ucache_file *uf)
+{
+	ucache_file_check(uf);
+	g_assert(uf->refcnt > 0);		/* Caller keeps the file alive */
+
+	if (uf->blocks != 0) {
+		struct ucache_block *b, *next;
+
+		for (b = elist_head(&ucache_lru); b != NULL; b = next) {
+			next = elist_next_data(&ucache_lru, b);
+			if (b->key.uf == uf)
+				upload_cache_block_free(b);
+		}
+	}
+
+	g_assert(0 == uf->blocks);
+
+	uf->ra_start = uf->ra_end = 0;
+}
+
+/**
+ * Get a reference on the cache entry for a shared file.
+ *
+ * @param sha1		the SHA1 of the file
+ * @param size		the file size
+ *
+ * @return the cache entry, to be released with upload_cache_file_release().
+ */
+ucache_file_t *
+upload_cache_file_get(const struct sha1 *sha1, filesize_t size)
+{
+	struct ucache_file *uf;
+
+	g_assert(sha1 != NULL);
+
+	uf = hikset_lookup(ucache_files, sha1);
+
+	if (NULL == uf) {
+		WALLOC0(uf);
+		uf->magic = UCACHE_FILE_MAGIC;
+		uf->sha1 = atom_sha1_get(sha1);
+		uf->size = size;
+		hikset_insert(ucache_files, uf);
+	}
+
+	ucache_file_check(uf);
+	uf->refcnt++;
+
+	/*
+	 * A file with the same SHA1 but a different size was rehashed to the
+	 * same SHA1, which is quite unexpected.  Be safe and flush what we have.
+	 */
+
+	if G_UNLIKELY(uf->size != size) {
+		if (GNET_PROPERTY(upload_debug)) {
+			g_warning("%s(): size of %s changed from %s to %s",
+				G_STRFUNC, sha1_base32(sha1),
+				filesize_to_string(uf->size), filesize_to_string2(size));
+		}
+		upload_cache_file_purge(uf);
+		uf->size = size;
+	}
+
+	return uf;
+}
+
+/**
+ * Release reference on the cache entry for a file, nullifying its pointer.
+ *
+ * Cached blocks for the file remain available for subsequent uploads, until
+ * they are evicted.
+ */
+void
+upload_cache_file_release(ucache_file_t **uf_ptr)
+{
+	struct ucache_file *uf = *uf_ptr;
+
+	if (uf != NULL) {
+		ucache_file_check(uf);
+		g_assert(uf->refcnt > 0);
+
+		if (0 == --uf->refcnt && 0 == uf->blocks)
+			upload_cache_file_free(uf);
+
+		*uf_ptr = NULL;
+	}
+}
+
+/**
+ * Advise the kernel that the blocks following the one holding `offset' will
+ * be needed soon, when accesses are sequential.
+ *
+ * The read-ahead window is shared by all the uploads of the file, so we only
+ * advise about the part of the window that was not already requested.
+ *
+ * @param uf			the cache entry for the file
+ * @param fo			the file object we're reading from
+ * @param offset		the offset being read
+ * @param sequential	whether the read is part of a sequential access
+ */
+void
+upload_cache_readahead(ucache_file_t *uf, file_object_t *fo,
+	filesize_t offset, bool sequential)
+{
+	filesize_t start, end, from;
+
+	ucache_file_check(uf);
+	g_assert(fo != NULL);
+
+	if (!sequential)
+		return;
+
+	start = offset - offset % UCACHE_BLOCK_SIZE + UCACHE_BLOCK_SIZE;
+	if (start >= uf->size)
+		return;
+
+	end = start + UCACHE_RA_BLOCKS * UCACHE_BLOCK_SIZE;
+	end = MIN(end, uf->size);
+
+	if (start >= uf->ra_start && end <= uf->ra_end)
+		return;				/* Already advised by another upload */
+
+	if (start >= uf->ra_start && start < uf->ra_end) {
+		from = uf->ra_end;	/* Extend current window */
+	} else {
+		from = start;		/* New window */
+		uf->ra_start = start;
+	}
+	uf->ra_end = end;
+
+	g_assert(end > from);
+
+	compat_fadvise_willneed(file_object_fd(fo), from, end - from);
+	ucache_stats.readahead++;
+}
+
+/**
+ * Read data from a shared file, through the cache.
+ *
+ * At most one block is accessed, so less than `len' bytes may be returned
+ * even when not reaching the end of the file.
+ *
+ * @param uf			the cache entry for the file
+ * @param fo			the file object to read from on cache misses
+ * @param dest			where data is copied
+ * @param len			length of the `dest' buffer
+ * @param offset		offset in file where reading starts
+ * @param sequential	whether the read is part of a sequential access
+ *
+ * @return the amount of bytes copied, 0 on EOF or -1 on error with errno set.
+ */
+ssize_t
+upload_cache_read(ucache_file_t *uf, file_object_t *fo,
+	void *dest, size_t len, filesize_t offset, bool sequential)
+{
+	struct ucache_block *b;
+	struct ucache_key key;
+	size_t n, delta;
+
+	ucache_file_check(uf);
+	g_assert(uf->refcnt > 0);
+	g_assert(fo != NULL);
+	g_assert(dest != NULL);
+
+	if (offset >= uf->size || 0 == len)
+		return 0;
+
+	key.uf = uf;
+	key.offset = offset - offset % UCACHE_BLOCK_SIZE;
+
+	b = hevset_lookup(ucache_blocks, &key);
+
+	if (b != NULL) {
+		ucache_block_check(b);
+		elist_moveto_tail(&ucache_lru, b);
+		ucache_stats.hits++;
+	} else {
+		char *data;
+		size_t amount;
+		ssize_t r;
+
+		amount = MIN(UCACHE_BLOCK_SIZE, uf->size - key.offset);
+		data = vmm_alloc(UCACHE_BLOCK_SIZE);
+		r = file_object_pread(fo, data, amount, key.offset);
+
+		if (r <= 0) {
+			int e = errno;
+			vmm_free(data, UCACHE_BLOCK_SIZE);
+			errno = e;
+			return r;
+		}
+
+		WALLOC0(b);
+		b->magic = UCACHE_BLOCK_MAGIC;
+		b->key = key;
+		b->data = data;
+		b->len = r;
+		hevset_insert(ucache_blocks, b);
+		elist_append(&ucache_lru, b);
+		uf->blocks++;
+		ucache_stats.misses++;
+
+		upload_cache_trim();	/* Never evicts `b', the most recent block */
+	}
+
+	delta = offset - key.offset;
+	if (delta >= b->len)
+		return 0;				/* File was truncated since it was hashed */
+
+	n = MIN(len, b->len - delta);
+	memcpy(dest, &b->data[delta], n);
+
+	upload_cache_readahead(uf, fo, offset, sequential);
+
+	return n;
+}
+
+/**
+ * Initialize the upload cache.
+ */
+void G_COLD
+upload_cache_init(void)
+{
+	ucache_files = hikset_create_any(offsetof(struct ucache_file, sha1),
+		sha1_hash, sha1_eq);
+	ucache_blocks = hevset_create_any(offsetof(struct ucache_block, key),
+		ucache_key_hash, ucache_key_hash2, ucache_key_eq);
+	elist_init(&ucache_lru, offsetof(struct ucache_block, lru));
+}
+
+static void
+upload_cache_file_free_kv(void *value, void *unused_data)
+{
+	struct ucache_file *uf = value;
+
+	(void) unused_data;
+	ucache_file_check(uf);
+
+	atom_sha1_free_null(&uf->sha1);
+	uf->magic = 0;
+	WFREE(uf);
+}
+
+/**
+ * Final cleanup at shutdown time.
+ */
+void G_COLD
+upload_cache_close(void)
+{
+	struct ucache_block *b;
+
+	if (GNET_PROPERTY(upload_debug)) {
+		g_debug("UCACHE %zu block%s cached, %s hit%s, %s miss%s, "
+			"%s read-ahead%s",
+			PLURAL(elist_count(&ucache_lru)),
+			uint64_to_string(ucache_stats.hits), plural(ucache_stats.hits),
+			uint64_to_string2(ucache_stats.misses),
+			plural_es(ucache_stats.misses),
+			uint64_to_string3(ucache_stats.readahead),
+			plural(ucache_stats.readahead));
+	}
+
+	while (NULL != (b = elist_head(&ucache_lru)))
+		upload_cache_block_free(b);
+
+	/*
+	 * Files still referenced by uploads (there should be none since
+	 * uploads are closed before) are freed now.
+	 */
+
+	hikset_foreach(ucache_files, upload_cache_file_free_kv, NULL);
+	hikset_free_null(&ucache_files);
+	hevset_free_null(&ucache_blocks);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
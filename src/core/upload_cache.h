@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Upload block cache, shared among uploads of the same file.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _core_upload_cache_h_
+#define _core_upload_cache_h_
+
+#include "common.h"
+
+struct sha1;
+struct file_object;
+
+typedef struct ucache_file ucache_file_t;
+
+/*
+ * Public interface.
+ */
+
+void upload_cache_init(void);
+void upload_cache_close(void);
+
+ucache_file_t *upload_cache_file_get(const struct sha1 *sha1, filesize_t size);
+void upload_cache_file_release(ucache_file_t **uf_ptr);
+
+ssize_t upload_cache_read(ucache_file_t *uf, struct file_object *fo,
+	void *dest, size_t len, filesize_t offset, bool sequential);
+void upload_cache_readahead(ucache_file_t *uf, struct file_object *fo,
+	filesize_t offset, bool sequential);
+
+#endif /* _core_upload_cache_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
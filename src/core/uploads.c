@@ -65,6 +65,7 @@
 #include "ipp_cache.h"
 #include "tx_deflate.h"
 #include "tx_link.h"		/* for callback structures */
+#include "upload_cache.h"
 #include "upload_stats.h"
 #include "uploads.h"
 #include "verify_tth.h"
@@ -1393,6 +1394,7 @@ upload_free_resources(struct upload *u)
 
 	atom_str_free_null(&u->name);
 	file_object_release(&u->file);
+	upload_cache_file_release(&u->ucache);
 
 #ifdef HAS_MMAP
 	if (u->sendfile_ctx.map) {
@@ -1475,6 +1477,7 @@ upload_clone(struct upload *u)
 	cu->bio = NULL;						/* Recreated on each transfer */
 	cu->sf = NULL;						/* File re-opened each time */
 	cu->file = NULL;					/* File re-opened each time */
+	cu->ucache = NULL;					/* Attached with file */
 	cu->sendfile_ctx.map = NULL;		/* File re-opened each time */
 	cu->accounted = FALSE;
 	cu->browse_host = FALSE;
@@ -2693,6 +2696,7 @@ upload_wait_new_request(struct upload *u)
 	 */
 
 	file_object_release(&u->file);	/* expect_http_header() expects this */
+	upload_cache_file_release(&u->ucache);
  	socket_tos_normal(u->socket);
 	expect_http_header(u, GTA_UL_EXPECTING);
 }
@@ -4836,6 +4840,19 @@ upload_request_for_shared_file(struct upload *u, const header_t *header)
 		return FALSE;
 	}
 
+	/*
+	 * Complete files with a known SHA1 are read through the shared upload
+	 * cache, so that concurrent uploads of popular files do not each hit
+	 * the disk.  Partial files are still being written to, hence bypass it.
+	 */
+
+	g_assert(NULL == u->ucache);
+
+	if (!shared_file_is_partial(u->sf) && sha1_hash_available(u->sf)) {
+		u->ucache = upload_cache_file_get(shared_file_sha1(u->sf),
+			shared_file_size(u->sf));
+	}
+
 	if (!u->head_only)
 		parq_upload_busy(u, u->parq_ul);
 
@@ -6095,6 +6112,10 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		written = bio_sendfile(&u->sendfile_ctx, u->bio,
 					file_object_fd(u->file), &pos, available);
 
+		if (u->ucache != NULL && written > 0)
+			upload_cache_readahead(u->ucache, u->file, before,
+				(filesize_t) before != u->skip);
+
 		g_assert((ssize_t) -1 == written ||
 			(fileoffset_t) written == pos - before);
 		u->pos = pos;
@@ -6119,7 +6140,13 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 
 			g_assert(u->buffer != NULL);
 			g_assert(u->buf_size > 0);
-			ret = file_object_pread(u->file, u->buffer, u->buf_size, u->pos);
+			if (u->ucache != NULL) {
+				ret = upload_cache_read(u->ucache, u->file,
+					u->buffer, u->buf_size, u->pos, u->pos != u->skip);
+			} else {
+				ret = file_object_pread(u->file, u->buffer, u->buf_size,
+					u->pos);
+			}
 			if ((ssize_t) -1 == ret) {
 				upload_remove(u, N_("File read error: %s"), g_strerror(errno));
 				return;
@@ -6436,6 +6463,8 @@ upload_init(void)
 
 	stall_wd = wd_make("upload stalling",
 		IO_STALL_WATCH, upload_no_more_stalling, NULL, FALSE);
+
+	upload_cache_init();
 }
 
 /**
@@ -6451,6 +6480,8 @@ upload_close(void)
 		upload_free_resources(u);
 	}
 
+	upload_cache_close();
+
     idtable_destroy(upload_handle_map);
     upload_handle_map = NULL;
 
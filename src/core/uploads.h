@@ -73,6 +73,7 @@ struct upload {
 	struct gnutella_socket *socket;
 	struct shared_file *sf;			/**< File we're uploading */
 	struct file_object *file;		/**< uploaded file */
+	struct ucache_file *ucache;		/**< Shared block cache for file */
 	struct dl_file_info *file_info;	/**< For PFSP: only set when partial file */
 	struct special_upload *special;	/**< For special ops like browsing */
 	const char *name;
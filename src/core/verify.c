@@ -72,6 +72,7 @@
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hashlist.h"
+#include "lib/lprobe.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For short_time_ascii() */
 #include "lib/teq.h"
@@ -819,11 +820,17 @@ verify_update(struct verify *ctx)
 	} else if (0 == r) {
 		verify_final(ctx);
 	} else {
+		static lprobe_t *probe;
+		uint64 start = lprobe_start();
 		time_t now;
+		int failed;
 
 		ctx->offset += (size_t) r;
 
-		if (verify_hash_update(ctx, ctx->buffer, r)) {
+		failed = verify_hash_update(ctx, ctx->buffer, r);
+		lprobe_end(&probe, "verify", start);
+
+		if (failed) {
 			g_warning("%s computation error for \"%s\"",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
 			goto error;
@@ -145,6 +145,7 @@ typedef struct gnet_results_set {
  * Result record flags
  */
 enum {
+	SR_ARENA		= (1 << 12),	/* Set if record lies in thread arena */
 	SR_ALLOC_NAME	= (1 << 11),	/* Set if filename was halloc()'ed */
 	SR_MEDIA		= (1 << 10),	/* Media type filter mismatch */
 	SR_PARTIAL_HIT	= (1 << 9),		/* Got a hit for a partial file */
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 15:12:43 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -121,6 +121,14 @@ static const char *stats_symbols[] = {
 	"udp_read_ahead_count_max",
 	"udp_read_ahead_bytes_max",
 	"udp_read_ahead_delay_max",
+	"udp_rx_batches",
+	"udp_rx_batched",
+	"udp_tx_batches",
+	"udp_tx_batched",
+	"udp_tx_gso_segments",
+	"udp_ingress_received",
+	"udp_ingress_queue_full",
+	"udp_ingress_duplicate",
 	"udp_fw2fw_pushes",
 	"udp_fw2fw_pushes_to_self",
 	"udp_fw2fw_pushes_patched",
@@ -557,6 +565,14 @@ static const char *stats_text[] = {
 	N_("UDP read-ahead datagram max count"),
 	N_("UDP read-ahead datagram max bytes"),
 	N_("UDP read-ahead datagram max delay"),
+	N_("UDP batched reads returning datagrams"),
+	N_("UDP datagrams received through batched reads"),
+	N_("UDP batched writes"),
+	N_("UDP datagrams sent through batched writes"),
+	N_("UDP datagrams sent via segmentation offload"),
+	N_("UDP datagrams read by the ingress thread"),
+	N_("UDP datagrams dropped by ingress (queue full)"),
+	N_("UDP duplicate datagrams dropped by ingress"),
 	N_("UDP push messages received for FW<->FW connections"),
 	N_("UDP push messages requesting FW<->FW connection with ourselves"),
 	N_("UDP push messages patched for FW<->FW connections"),
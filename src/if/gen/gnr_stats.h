@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 15:12:43 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 415
+ * Enum count: 423
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -117,6 +117,14 @@ typedef enum {
 	GNR_UDP_READ_AHEAD_COUNT_MAX,
 	GNR_UDP_READ_AHEAD_BYTES_MAX,
 	GNR_UDP_READ_AHEAD_DELAY_MAX,
+	GNR_UDP_RX_BATCHES,
+	GNR_UDP_RX_BATCHED,
+	GNR_UDP_TX_BATCHES,
+	GNR_UDP_TX_BATCHED,
+	GNR_UDP_TX_GSO_SEGMENTS,
+	GNR_UDP_INGRESS_RECEIVED,
+	GNR_UDP_INGRESS_QUEUE_FULL,
+	GNR_UDP_INGRESS_DUPLICATE,
 	GNR_UDP_FW2FW_PUSHES,
 	GNR_UDP_FW2FW_PUSHES_TO_SELF,
 	GNR_UDP_FW2FW_PUSHES_PATCHED,
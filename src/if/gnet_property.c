@@ -1134,6 +1134,10 @@ gboolean gnet_property_variable_running_topless     = FALSE;
 static const gboolean gnet_property_variable_running_topless_default = FALSE;
 gboolean gnet_property_variable_send_oob_ind_reliably     = TRUE;
 static const gboolean gnet_property_variable_send_oob_ind_reliably_default = TRUE;
+guint32  gnet_property_variable_udp_batch_size     = 32;
+static const guint32  gnet_property_variable_udp_batch_size_default = 32;
+gboolean gnet_property_variable_udp_ingress_thread     = FALSE;
+static const gboolean gnet_property_variable_udp_ingress_thread_default = FALSE;
 
 static prop_set_t *gnet_property;
 
@@ -11418,6 +11422,47 @@ gnet_prop_init(void) {
     gnet_property->props[488].data.boolean.def   = (void *) &gnet_property_variable_send_oob_ind_reliably_default;
     gnet_property->props[488].data.boolean.value = (void *) &gnet_property_variable_send_oob_ind_reliably;
 
+
+    /*
+     * PROP_UDP_BATCH_SIZE:
+     *
+     * General data:
+     */
+    gnet_property->props[489].name = "udp_batch_size";
+    gnet_property->props[489].desc = _("Maximum amount of UDP datagrams read or written with a single system call, when the system supports it.  Set to 1 to disable batching.");
+    gnet_property->props[489].ev_changed = event_new("udp_batch_size_changed");
+    gnet_property->props[489].save = TRUE;
+    gnet_property->props[489].internal = FALSE;
+    gnet_property->props[489].vector_size = 1;
+	mutex_init(&gnet_property->props[489].lock);
+
+    /* Type specific data: */
+    gnet_property->props[489].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[489].data.guint32.def   = (void *) &gnet_property_variable_udp_batch_size_default;
+    gnet_property->props[489].data.guint32.value = (void *) &gnet_property_variable_udp_batch_size;
+    gnet_property->props[489].data.guint32.choices = NULL;
+    gnet_property->props[489].data.guint32.max   = 64;
+    gnet_property->props[489].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_UDP_INGRESS_THREAD:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "udp_ingress_thread";
+    gnet_property->props[490].desc = _("Whether incoming UDP datagrams should be read and classified by a dedicated thread, which hands them to the protocol handlers through lock-free queues.  This keeps UDP bursts, such as DHT traffic, from delaying the processing of TCP connections by the main thread.");
+    gnet_property->props[490].ev_changed = event_new("udp_ingress_thread_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_udp_ingress_thread_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_udp_ingress_thread;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
@@ -525,6 +525,8 @@ typedef enum {
     PROP_LOCK_SLEEP_TRACE,
     PROP_RUNNING_TOPLESS,
     PROP_SEND_OOB_IND_RELIABLY,
+    PROP_UDP_BATCH_SIZE,
+    PROP_UDP_INGRESS_THREAD,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -540,6 +540,8 @@ extern const gboolean gnet_property_variable_lock_sleep_trace;
 extern const gboolean gnet_property_variable_running_topless;
 extern const gboolean gnet_property_variable_send_oob_ind_reliably;
 
+extern const guint32  gnet_property_variable_udp_batch_size;
+extern const gboolean gnet_property_variable_udp_ingress_thread;
 
 prop_set_t *gnet_prop_init(void);
 void gnet_prop_shutdown(void);
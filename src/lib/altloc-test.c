@@ -0,0 +1,579 @@
+/*
+ * altloc-test -- compact alternate location codec tests and benchmarking.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/altloc.h"
+#include "lib/ascii.h"
+#include "lib/host_addr.h"
+#include "lib/misc.h"
+#include "lib/parse.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_PORT		6346	/* Default port, omitted in lists */
+#define TEST_ITEMS		100		/* Default amount of items per list */
+#define TEST_LOOPS		1000	/* Default amount of loops when timing */
+
+static bool silent_mode, verbose_mode;
+static unsigned initial_seed;
+
+struct item {
+	host_addr_t addr;
+	uint16 port;
+	bool tls;
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-h6tSV] [-c items] [-n loops] [-R seed]\n"
+		"  -c : sets amount of items per list\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of loops when timing\n"
+		"  -t : time parsing and formatting\n"
+		"  -6 : include IPv6 addresses\n"
+		"  -R : seed for repeatable random key sequence\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print generated lists\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, const char *s)
+{
+	printf("%s FAILED on \"%s\"\n", what, s);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Generate random items, a quarter of them using a non-default port.
+ */
+static void
+generate_items(struct item *items, size_t cnt, bool ipv6)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		struct item *it = &items[i];
+
+		if (ipv6 && 0 == rand31_value(3)) {
+			uint8 buf[16];
+			uint j;
+
+			for (j = 0; j < N_ITEMS(buf); j++) {
+				buf[j] = rand31_value(255);
+			}
+			buf[0] = 0x20;				/* Avoid mapped / compatible forms */
+			buf[2 + rand31_value(6)] = 0;	/* Allow for some "::" */
+			buf[3 + rand31_value(6)] = 0;
+			it->addr = host_addr_peek_ipv6(buf);
+		} else {
+			it->addr = host_addr_get_ipv4(rand31_u32());
+		}
+
+		it->port = 0 == rand31_value(3) ? 1 + rand31_value(65534) : TEST_PORT;
+		it->tls = 0 == rand31_value(7);
+	}
+}
+
+/**
+ * Format items using the codec.
+ */
+static void
+format_list(str_t *s, const struct item *items, size_t cnt)
+{
+	size_t i;
+	bool tls[TEST_ITEMS];
+	char hex[ALTLOC_TLS_BUFLEN(TEST_ITEMS)];
+
+	str_reset(s);
+
+	if (cnt <= N_ITEMS(tls)) {
+		for (i = 0; i < cnt; i++) {
+			tls[i] = items[i].tls;
+		}
+		str_cat_len(s, hex, altloc_format_tls(tls, cnt, ARYLEN(hex)));
+	}
+
+	for (i = 0; i < cnt; i++) {
+		char buf[ALTLOC_BUFLEN];
+		size_t n;
+
+		n = altloc_format(items[i].addr, items[i].port, TEST_PORT, ARYLEN(buf));
+		g_assert((size_t) -1 != n);
+
+		if (i != 0 || 0 != str_len(s))
+			STR_CAT(s, ", ");
+		str_cat_len(s, buf, n);
+	}
+}
+
+/**
+ * Format items using the generic routines.
+ */
+static void
+format_list_generic(str_t *s, const struct item *items, size_t cnt)
+{
+	size_t i;
+
+	str_reset(s);
+	str_cat(s, "tls=");
+
+	for (i = 0; i < cnt; i += 4) {
+		uint nibble = 0, j;
+
+		for (j = 0; j < 4 && i + j < cnt; j++) {
+			if (items[i + j].tls)
+				nibble |= 0x8 >> j;
+		}
+		str_catf(s, "%X", nibble);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		const struct item *it = &items[i];
+
+		STR_CAT(s, ", ");
+		str_cat(s, it->port == TEST_PORT
+			? host_addr_to_string(it->addr)
+			: host_addr_port_to_string(it->addr, it->port));
+	}
+}
+
+struct check_ctx {
+	const struct item *items;
+	size_t cnt;
+	size_t idx;
+	const char *list;
+	bool tls;				/* Whether to check TLS flags */
+};
+
+static void
+check_item(host_addr_t addr, uint16 port, bool tls, void *udata)
+{
+	struct check_ctx *ctx = udata;
+	const struct item *it;
+
+	if (ctx->idx >= ctx->cnt)
+		test_abort("parsing (too many items)", ctx->list);
+
+	it = &ctx->items[ctx->idx++];
+
+	if (!host_addr_equiv(addr, it->addr) || port != it->port)
+		test_abort("parsing", ctx->list);
+
+	if (ctx->tls && tls != it->tls)
+		test_abort("TLS flag parsing", ctx->list);
+}
+
+static void
+count_item(host_addr_t addr, uint16 port, bool tls, void *udata)
+{
+	size_t *cnt = udata;
+
+	(void) addr;
+	(void) port;
+	(void) tls;
+	(*cnt)++;
+}
+
+struct tls_ctx {
+	char flags[16];
+	size_t idx;
+};
+
+static void
+tls_item(host_addr_t addr, uint16 port, bool tls, void *udata)
+{
+	struct tls_ctx *ctx = udata;
+
+	(void) addr;
+	(void) port;
+	if (ctx->idx < N_ITEMS(ctx->flags) - 1)
+		ctx->flags[ctx->idx++] = tls ? '1' : '0';
+}
+
+/**
+ * Parse list using the generic routines, the way we used to.
+ *
+ * @return amount of items parsed.
+ */
+static size_t
+parse_list_generic(const char *value, altloc_cb_t cb, void *udata)
+{
+	const char *p, *next;
+	size_t cnt = 0;
+	bool tls_seen = FALSE;
+
+	for (next = value; NULL != (p = next); /* empty */) {
+		const char *start, *endptr;
+		host_addr_t addr;
+		uint16 port;
+		bool ok;
+
+		start = skip_ascii_blanks(p);
+		if ('\0' == *start)
+			break;
+
+		next = strpbrk(start, ",;");
+		if (next != NULL)
+			next++;
+
+		if (!tls_seen && NULL != is_strcaseprefix(start, "tls=")) {
+			tls_seen = TRUE;
+			continue;
+		}
+
+		ok = string_to_host_addr(start, &endptr, &addr);
+		if (ok && ':' == *endptr) {
+			int error;
+
+			port = parse_uint16(&endptr[1], &endptr, 10, &error);
+			ok = !error && port > 0;
+		} else {
+			port = TEST_PORT;
+		}
+
+		if (ok) {
+			cnt++;
+			(*cb)(addr, port, FALSE, udata);
+		}
+	}
+
+	return cnt;
+}
+
+/**
+ * Check parsing of invalid items.
+ */
+static void
+check_invalid(void)
+{
+	static const struct {
+		const char *list;
+		size_t valid;
+		size_t invalid;
+	} tests[] = {
+		{ "",										0, 0 },
+		{ "tls=8",									0, 0 },
+		{ "tls=8, 1.2.3.4",							1, 0 },
+		{ "1.2.3.4, 1.2.3.4:0",						1, 1 },
+		{ "1.2.3.4:65535, 1.2.3.4:65536",			1, 1 },
+		{ "1.2.3.256, 1.2.3, 1.2.3.4.5",			0, 3 },
+		{ "1234.2.3.4; 1.2.3.4 ; ",					1, 1 },
+		{ "::1, [::1]:80, [::1, ::1::2",			2, 2 },
+		{ "2001:db8::1:6347, 2001:db8:0:0:0:0:0:1",	2, 0 },
+		{ "::ffff:1.2.3.4, [::ffff:1.2.3.4]:80",		2, 0 },
+		{ "foo, bar:80, 1.2.3.4",					1, 2 },
+	};
+	uint i;
+
+	for (i = 0; i < N_ITEMS(tests); i++) {
+		size_t valid, invalid, cnt = 0;
+
+		valid = altloc_parse(tests[i].list, TEST_PORT,
+			count_item, &cnt, &invalid);
+
+		if (valid != cnt || valid != tests[i].valid)
+			test_abort("valid item count", tests[i].list);
+
+		if (invalid != tests[i].invalid)
+			test_abort("invalid item count", tests[i].list);
+	}
+
+	if (!silent_mode)
+		printf("invalid item checks: OK\n");
+}
+
+/**
+ * Check parsing and formatting of the "tls=<hex>" item.
+ */
+static void
+check_tls(void)
+{
+	static const struct {
+		const char *list;
+		const char *flags;		/* TLS flag of each valid item */
+	} tests[] = {
+		{ "1.1.1.1, 1.1.1.2",								"00" },
+		{ "tls=8, 1.1.1.1, 1.1.1.2",						"10" },
+		{ "TLS=a, 1.1.1.1, 1.1.1.2, 1.1.1.3, 1.1.1.4",		"1010" },
+		{ "tls=08, 1.1.1.1, 1.1.1.2, 1.1.1.3, 1.1.1.4, ::1",	"00001" },
+		{ "tls=f; foo, 1.1.1.1, 1.1.1.2",					"11" },
+		{ "1.1.1.1, tls=4, 1.1.1.2",						"01" },
+		{ "tls=, 1.1.1.1",									"0" },
+		{ "tls=zz, 1.1.1.1",								"0" },
+	};
+	static const struct {
+		const char *flags;
+		const char *str;
+	} fmt[] = {
+		{ "",			"" },
+		{ "000",		"" },
+		{ "1",			"tls=8" },
+		{ "1010",		"tls=a" },
+		{ "00001",		"tls=08" },
+		{ "0111100",	"tls=78" },
+	};
+	uint i;
+
+	for (i = 0; i < N_ITEMS(tests); i++) {
+		struct tls_ctx ctx;
+
+		ZERO(&ctx);
+		altloc_parse(tests[i].list, TEST_PORT, tls_item, &ctx, NULL);
+
+		if (0 != strcmp(ctx.flags, tests[i].flags))
+			test_abort("TLS flags", tests[i].list);
+	}
+
+	for (i = 0; i < N_ITEMS(fmt); i++) {
+		bool tls[16];
+		char buf[ALTLOC_TLS_BUFLEN(N_ITEMS(tls))];
+		size_t j, cnt = vstrlen(fmt[i].flags), n;
+
+		for (j = 0; j < cnt; j++) {
+			tls[j] = '1' == fmt[i].flags[j];
+		}
+
+		n = altloc_format_tls(tls, cnt, ARYLEN(buf));
+
+		if (n != vstrlen(fmt[i].str) || 0 != strcmp(buf, fmt[i].str))
+			test_abort("TLS formatting", fmt[i].flags);
+
+		if (n != 0 && (size_t) -1 != altloc_format_tls(tls, cnt, buf, n))
+			test_abort("TLS formatting overflow", fmt[i].flags);
+	}
+
+	if (!silent_mode)
+		printf("TLS flag checks: OK\n");
+}
+
+static double
+timeit(void (*f)(void *), void *arg, size_t loops)
+{
+	tm_t start, end;
+	size_t i;
+
+	tm_now_exact(&start);
+	for (i = 0; i < loops; i++) {
+		(*f)(arg);
+	}
+	tm_now_exact(&end);
+
+	return tm_elapsed_f(&end, &start);
+}
+
+struct bench {
+	str_t *s;
+	const struct item *items;
+	size_t cnt;
+};
+
+static void
+bench_parse(void *arg)
+{
+	struct bench *b = arg;
+	size_t cnt = 0;
+
+	altloc_parse(str_2c(b->s), TEST_PORT, count_item, &cnt, NULL);
+	g_assert(cnt == b->cnt);
+}
+
+static void
+bench_parse_generic(void *arg)
+{
+	struct bench *b = arg;
+	size_t cnt = 0;
+
+	parse_list_generic(str_2c(b->s), count_item, &cnt);
+	g_assert(cnt == b->cnt);
+}
+
+static void
+bench_format(void *arg)
+{
+	struct bench *b = arg;
+
+	format_list(b->s, b->items, b->cnt);
+}
+
+static void
+bench_format_generic(void *arg)
+{
+	struct bench *b = arg;
+
+	format_list_generic(b->s, b->items, b->cnt);
+}
+
+static void
+report(const char *what, double ours, double generic, size_t loops, size_t cnt)
+{
+	double n = (double) loops * cnt;
+
+	printf("%-6s: altloc %.3f ns/item, generic %.3f ns/item (x%.2f)\n",
+		what, ours * 1e9 / n, generic * 1e9 / n,
+		0.0 == ours ? 0.0 : generic / ours);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE, ipv6 = FALSE;
+	size_t count = TEST_ITEMS;
+	size_t loops = TEST_LOOPS;
+	unsigned rseed = 0;
+	struct item *items;
+	struct check_ctx ctx;
+	struct bench b;
+	size_t parsed, invalid;
+	str_t *s;
+	int c;
+	const char options[] = "c:hn:tR:SV6";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of items per list */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag = TRUE;
+			break;
+		case '6':			/* include IPv6 addresses */
+			ipv6 = TRUE;
+			break;
+		case 'R':			/* random seed */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count || 0 == loops)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	check_invalid();
+	check_tls();
+
+	XMALLOC_ARRAY(items, count);
+	generate_items(items, count, ipv6);
+	s = str_new(count * 16);
+
+	/*
+	 * Round trip: what we format must be parsed back identically, and
+	 * what the generic routines format must be parsed by the codec.
+	 */
+
+	format_list(s, items, count);
+
+	if (verbose_mode)
+		printf("%s\n", str_2c(s));
+
+	ctx.items = items;
+	ctx.cnt = count;
+	ctx.idx = 0;
+	ctx.list = str_2c(s);
+	ctx.tls = count <= TEST_ITEMS;		/* See format_list() */
+
+	parsed = altloc_parse(str_2c(s), TEST_PORT, check_item, &ctx, &invalid);
+	if (parsed != count || invalid != 0 || ctx.idx != count)
+		test_abort("round trip", str_2c(s));
+
+	ctx.idx = 0;
+	ctx.tls = FALSE;
+	if (parse_list_generic(str_2c(s), check_item, &ctx) != count)
+		test_abort("generic parsing", str_2c(s));
+
+	format_list_generic(s, items, count);
+
+	ctx.idx = 0;
+	ctx.list = str_2c(s);
+	ctx.tls = TRUE;
+
+	parsed = altloc_parse(str_2c(s), TEST_PORT, check_item, &ctx, &invalid);
+	if (parsed != count || invalid != 0 || ctx.idx != count)
+		test_abort("generic round trip", str_2c(s));
+
+	if (!silent_mode)
+		printf("round trip checks on %zu item%s: OK\n", count, plural(count));
+
+	if (tflag) {
+		double ours, generic;
+
+		b.s = s;
+		b.items = items;
+		b.cnt = count;
+
+		ours = timeit(bench_format, &b, loops);
+		generic = timeit(bench_format_generic, &b, loops);
+		report("format", ours, generic, loops, count);
+
+		ours = timeit(bench_parse, &b, loops);
+		generic = timeit(bench_parse_generic, &b, loops);
+		report("parse", ours, generic, loops, count);
+	}
+
+	str_destroy_null(&s);
+	XFREE_NULL(items);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
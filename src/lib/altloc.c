@@ -0,0 +1,664 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Compact alternate location list codec.
+ *
+ * Alternate locations are exchanged in the "X-Alt" and "X-Nalt" headers as
+ * comma-separated lists of "addr[:port]" items, the port being omitted when
+ * it is the default Gnutella port.  A leading "tls=<hex>" item can flag the
+ * hosts supporting TLS, each hexadecimal digit standing for the next 4 items
+ * in the list, the most significant bit for the first one.  IPv6 addresses
+ * are written within brackets when followed by a port.
+ *
+ * These lists are parsed and generated for each HTTP request and reply, so
+ * this codec is a dedicated, table-driven implementation: a single pass over
+ * the input classifies characters through a lookup table and accumulates
+ * numerical values directly, without going through the generic number
+ * parsing routines.  Formatting of IPv4 addresses uses pre-rendered octet
+ * strings.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "altloc.h"
+#include "ascii.h"
+#include "endian.h"
+#include "host_addr.h"
+#include "misc.h"			/* For is_strcaseprefix(), hex_digit() */
+#include "once.h"
+
+#include "override.h"		/* Must be the last header included */
+
+/**
+ * Character classes.
+ */
+enum altloc_class {
+	ALC_OTHER = 0,		/**< Anything else */
+	ALC_DIGIT,			/**< Decimal digit */
+	ALC_HEX,			/**< Hexadecimal letter */
+	ALC_DOT,			/**< Dot, separating IPv4 octets */
+	ALC_COLON,			/**< Colon, separating IPv6 groups or the port */
+	ALC_LBRACKET,		/**< Opening bracket, before an IPv6 address */
+	ALC_RBRACKET,		/**< Closing bracket, after an IPv6 address */
+	ALC_SEP,			/**< List item separator */
+	ALC_BLANK,			/**< Blank character, skipped between items */
+	ALC_END				/**< End of string */
+};
+
+static uint8 altloc_class[256];			/**< Character classes */
+static int8 altloc_digit[256];			/**< Hexadecimal value, -1 if none */
+
+/**
+ * Pre-rendered decimal representation of all the possible IPv4 octets.
+ */
+static struct altloc_octet {
+	char str[3];
+	uint8 len;
+} altloc_octet[256];
+
+static once_flag_t altloc_inited;
+
+/**
+ * Initialize the lookup tables, once.
+ */
+static void
+altloc_init_once(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(altloc_digit); i++) {
+		altloc_digit[i] = -1;
+	}
+
+	for (i = '0'; i <= '9'; i++) {
+		altloc_class[i] = ALC_DIGIT;
+		altloc_digit[i] = i - '0';
+	}
+
+	for (i = 'a'; i <= 'f'; i++) {
+		altloc_class[i] = ALC_HEX;
+		altloc_class[ascii_toupper(i)] = ALC_HEX;
+		altloc_digit[i] = i - 'a' + 10;
+		altloc_digit[ascii_toupper(i)] = i - 'a' + 10;
+	}
+
+	altloc_class['.'] = ALC_DOT;
+	altloc_class[':'] = ALC_COLON;
+	altloc_class['['] = ALC_LBRACKET;
+	altloc_class[']'] = ALC_RBRACKET;
+	altloc_class[','] = ALC_SEP;
+	altloc_class[';'] = ALC_SEP;
+	altloc_class[' '] = ALC_BLANK;
+	altloc_class['\t'] = ALC_BLANK;
+	altloc_class['\r'] = ALC_BLANK;
+	altloc_class['\n'] = ALC_BLANK;
+	altloc_class['\0'] = ALC_END;
+
+	for (i = 0; i < N_ITEMS(altloc_octet); i++) {
+		struct altloc_octet *o = &altloc_octet[i];
+		uint n = 0;
+
+		if (i >= 100)
+			o->str[n++] = '0' + i / 100;
+		if (i >= 10)
+			o->str[n++] = '0' + (i / 10) % 10;
+		o->str[n++] = '0' + i % 10;
+		o->len = n;
+	}
+}
+
+#define ALTLOC_INIT		ONCE_FLAG_RUN(altloc_inited, altloc_init_once)
+
+#define ALC(c)			(altloc_class[(uchar) (c)])
+#define ALC_DIGIT_OF(c)	(altloc_digit[(uchar) (c)])
+#define ALC_DEC(c)		((uint) ALC_DIGIT_OF(c))	/* >= 10 if not decimal */
+
+/**
+ * Parse a dotted-quad IPv4 address.
+ *
+ * Each octet can have at most 3 digits and must not exceed 255.  The address
+ * must not be followed by a dot, to reject things like "192.0.2.17.example".
+ *
+ * @param s			the string to parse
+ * @param ip		where the parsed address is written, in host byte order
+ * @param endptr	where the first character after the address is written
+ *
+ * @return whether we successfully parsed an IPv4 address.
+ */
+static bool
+altloc_parse_ipv4(const char *s, uint32 *ip, const char **endptr)
+{
+	const char *p = s;
+	uint32 a = 0;
+	uint i;
+
+	for (i = 0; i < 4; i++) {
+		uint v, d;
+
+		if (i != 0) {
+			if ('.' != *p)
+				return FALSE;
+			p++;
+		}
+
+		/* Unrolled: an octet is made of 1 to 3 digits */
+
+		if ((v = ALC_DEC(p[0])) >= 10)
+			return FALSE;
+		if ((d = ALC_DEC(p[1])) < 10) {
+			v = v * 10 + d;
+			if ((d = ALC_DEC(p[2])) < 10) {
+				v = v * 10 + d;
+				if (v > 255 || ALC_DEC(p[3]) < 10)
+					return FALSE;
+				p++;
+			}
+			p++;
+		}
+		p++;
+
+		a = (a << 8) | v;
+	}
+
+	if ('.' == *p)
+		return FALSE;
+
+	*ip = a;
+	*endptr = p;
+	return TRUE;
+}
+
+/**
+ * Parse an IPv6 address, brackets excluded.
+ *
+ * The address is made of at most 8 groups of 1 to 4 hexadecimal digits,
+ * separated by colons, with at most one "::" standing for a run of zero
+ * groups.  The last 32 bits can be given as an IPv4 dotted-quad.
+ *
+ * Parsing stops at the first character that cannot extend the address,
+ * or after the 8th group has been read, which leaves any following ":port"
+ * for the caller to process.
+ *
+ * @param s			the string to parse
+ * @param dst		where the 16 bytes of the address are written
+ * @param endptr	where the first character after the address is written
+ *
+ * @return whether we successfully parsed an IPv6 address.
+ */
+static bool
+altloc_parse_ipv6(const char *s, uint8 *dst, const char **endptr)
+{
+	uint16 grp[8];
+	int n = 0, dc = -1, i;
+	const char *p = s;
+
+	if (':' == *p) {
+		if (':' != p[1])
+			return FALSE;
+		dc = 0;
+		p += 2;
+	}
+
+	while (n < 8) {
+		const char *start = p;
+		uint v, k;
+		int d;
+
+		for (v = k = 0; k < 4 && -1 != (d = ALC_DIGIT_OF(*p)); k++, p++) {
+			v = (v << 4) | d;
+		}
+
+		if (0 == k)
+			break;
+
+		if ('.' == *p) {
+			uint32 ip;
+
+			/* Embedded IPv4 address for the trailing 32 bits */
+
+			if (n > 6 || !altloc_parse_ipv4(start, &ip, &p))
+				return FALSE;
+
+			grp[n++] = ip >> 16;
+			grp[n++] = ip & 0xffff;
+			break;
+		}
+
+		if (-1 != ALC_DIGIT_OF(*p))
+			return FALSE;		/* More than 4 digits in group */
+
+		grp[n++] = v;
+
+		if (8 == n || ':' != *p)
+			break;
+
+		if (':' == p[1]) {
+			if (dc >= 0)
+				return FALSE;	/* Second "::" */
+			dc = n;
+			p += 2;
+		} else {
+			p++;
+			if (-1 == ALC_DIGIT_OF(*p))
+				return FALSE;	/* Single colon not followed by a group */
+		}
+	}
+
+	if (dc >= 0) {
+		int z = 8 - n;			/* Amount of zero groups in the "::" */
+
+		if (0 == z)
+			return FALSE;
+
+		for (i = n - 1; i >= dc; i--) {
+			grp[i + z] = grp[i];
+		}
+		for (i = dc; i < dc + z; i++) {
+			grp[i] = 0;
+		}
+	} else if (n != 8) {
+		return FALSE;
+	}
+
+	for (i = 0; i < 8; i++) {
+		poke_be16(&dst[2 * i], grp[i]);
+	}
+
+	*endptr = p;
+	return TRUE;
+}
+
+/**
+ * Parse an IPv4 or IPv6 address, the latter being possibly within brackets.
+ *
+ * @param s			the string to parse
+ * @param addr		where the parsed address is written
+ * @param endptr	if non-NULL, written with first character after address
+ *
+ * @return whether we successfully parsed an address.
+ */
+bool
+altloc_parse_addr(const char *s, host_addr_t *addr, const char **endptr)
+{
+	const char *end = s;
+	uint32 ip;
+	uint8 ipv6[16];
+	bool ok = FALSE;
+
+	g_assert(s != NULL);
+	g_assert(addr != NULL);
+
+	ALTLOC_INIT;
+
+	switch (ALC(*s)) {
+	case ALC_DIGIT:
+		if (altloc_parse_ipv4(s, &ip, &end)) {
+			*addr = host_addr_get_ipv4(ip);
+			ok = TRUE;
+			break;
+		}
+		/* FALL THROUGH */
+	case ALC_HEX:
+	case ALC_COLON:
+		if (altloc_parse_ipv6(s, ipv6, &end)) {
+			*addr = host_addr_peek_ipv6(ipv6);
+			ok = TRUE;
+		}
+		break;
+	case ALC_LBRACKET:
+		if (altloc_parse_ipv6(s + 1, ipv6, &end) && ']' == *end) {
+			*addr = host_addr_peek_ipv6(ipv6);
+			end++;
+			ok = TRUE;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!ok)
+		*addr = zero_host_addr;
+
+	if (endptr != NULL)
+		*endptr = end;
+
+	return ok;
+}
+
+/**
+ * Parse a port number, which must be non-zero.
+ *
+ * @return whether we successfully parsed a port.
+ */
+static bool
+altloc_parse_port(const char *s, uint16 *port, const char **endptr)
+{
+	const char *p = s;
+	uint32 v = 0;
+	uint n;
+
+	for (n = 0; n < 5; n++, p++) {
+		uint d = ALC_DEC(*p);
+		if (d >= 10)
+			break;
+		v = v * 10 + d;
+	}
+
+	if (v > 65535 || ALC_DEC(*p) < 10)
+		return FALSE;
+
+	if (0 == n || 0 == v)
+		return FALSE;
+
+	*port = v;
+	*endptr = p;
+	return TRUE;
+}
+
+/**
+ * @return pointer to the character following the next separator in `s',
+ * NULL if there are no more separators.  Since we call this routine after
+ * having parsed the item, we only usually have to skip trailing blanks.
+ */
+static inline const char *
+altloc_next_item(const char *s)
+{
+	const char *p = s;
+
+	for (;;) {
+		switch (ALC(*p)) {
+		case ALC_SEP:
+			return p + 1;
+		case ALC_END:
+			return NULL;
+		default:
+			p++;
+		}
+	}
+}
+
+/**
+ * Check whether the item at index `idx' is flagged in the "tls=<hex>" bitmap.
+ *
+ * @param hex		the hexadecimal digits following "tls=", NULL if none
+ * @param len		amount of hexadecimal digits
+ * @param idx		the index of the item in the list, 0 being the first
+ */
+static inline bool
+altloc_tls_flag(const char *hex, size_t len, size_t idx)
+{
+	if (idx / 4 >= len)
+		return FALSE;
+
+	return 0 != (ALC_DIGIT_OF(hex[idx / 4]) & (0x8 >> (idx % 4)));
+}
+
+/**
+ * Parse a list of addr[:port] items, such as typically found in "X-Alt" or
+ * "X-Nalt" headers.  Items are separated by "," or ";" and can be surrounded
+ * by blanks.  The first "tls=<hex>" item flags the hosts supporting TLS, by
+ * their position in the list, invalid items included.  Trailing characters
+ * after an item, up to the next separator, are ignored.
+ *
+ * For each valid item, invoke the supplied callback `cb' as:
+ *
+ *		cb(addr, port, tls, udata);
+ *
+ * @param value		the string to parse
+ * @param defport	the port to use when none is specified
+ * @param cb		the callback to invoke on each parsed item
+ * @param udata		opaque user-supplied data
+ * @param invalid	if non-NULL, written with the amount of invalid items
+ *
+ * @return the amount of items successfully parsed.
+ */
+size_t
+altloc_parse(const char *value, uint16 defport,
+	altloc_cb_t cb, void *udata, size_t *invalid)
+{
+	const char *p, *next, *tls_hex = NULL;
+	size_t parsed = 0, bad = 0, tls_len = 0, idx;
+
+	g_assert(value != NULL);
+	g_assert(cb != NULL);
+
+	ALTLOC_INIT;
+
+	for (next = value, idx = 0; NULL != (p = next); /* empty */) {
+		const char *end;
+		host_addr_t addr;
+		uint16 port = defport;
+		bool ok;
+
+		while (ALC_BLANK == ALC(*p))
+			p++;
+
+		if ('\0' == *p)
+			break;
+
+		if (
+			NULL == tls_hex && 't' == ascii_tolower(*p) &&
+			NULL != (tls_hex = is_strcaseprefix(p, "tls="))
+		) {
+			while (-1 != ALC_DIGIT_OF(tls_hex[tls_len]))
+				tls_len++;
+			next = altloc_next_item(tls_hex + tls_len);
+			continue;
+		}
+
+		ok = altloc_parse_addr(p, &addr, &end);
+
+		if (ok && ':' == *end)
+			ok = altloc_parse_port(end + 1, &port, &end);
+
+		next = altloc_next_item(ok ? end : p);
+
+		if (ok) {
+			parsed++;
+			(*cb)(addr, port, altloc_tls_flag(tls_hex, tls_len, idx), udata);
+		} else {
+			bad++;
+		}
+
+		idx++;
+	}
+
+	if (invalid != NULL)
+		*invalid = bad;
+
+	return parsed;
+}
+
+/**
+ * Format port number into buffer, which must be large enough.
+ *
+ * @return amount of characters written (no trailing NUL is written).
+ */
+static inline size_t
+altloc_port_to_buf(uint16 port, char *dst)
+{
+	char tmp[5];
+	size_t n = 0, i;
+
+	do {
+		tmp[n++] = '0' + port % 10;
+		port /= 10;
+	} while (port != 0);
+
+	for (i = 0; i < n; i++) {
+		dst[i] = tmp[n - 1 - i];
+	}
+
+	return n;
+}
+
+/**
+ * Format an IPv4 address and port in compact alt-loc form, i.e. omitting the
+ * port if it is the default one.
+ *
+ * @param ip		the IPv4 address, in host byte order
+ * @param port		the port
+ * @param defport	the default port, which is not emitted
+ * @param dst		the destination buffer
+ * @param size		size of the destination buffer
+ *
+ * @return the length of the generated string, (size_t) -1 if the buffer
+ * was too small, in which case an empty string is written, if possible.
+ */
+size_t
+altloc_format_ipv4(uint32 ip, uint16 port, uint16 defport,
+	char *dst, size_t size)
+{
+	char buf[ALTLOC_IPV4_BUFLEN];
+	char *p = buf;
+	int i;
+	size_t n;
+
+	ALTLOC_INIT;
+
+	for (i = 24; i >= 0; i -= 8) {
+		const struct altloc_octet *o = &altloc_octet[(ip >> i) & 0xff];
+
+		if (i != 24)
+			*p++ = '.';
+		memcpy(p, o->str, 3);	/* Always copy 3, we'll overwrite extra */
+		p += o->len;
+	}
+
+	if (port != defport) {
+		*p++ = ':';
+		p += altloc_port_to_buf(port, p);
+	}
+
+	n = p - buf;
+	g_assert(n < sizeof buf);
+
+	if (n >= size) {
+		if (size != 0)
+			dst[0] = '\0';
+		return (size_t) -1;
+	}
+
+	memcpy(dst, buf, n);
+	dst[n] = '\0';
+
+	return n;
+}
+
+/**
+ * Format an address and port in compact alt-loc form, i.e. omitting the
+ * port if it is the default one.  IPv6 addresses are enclosed within
+ * brackets only when followed by a port.
+ *
+ * @param addr		the address
+ * @param port		the port
+ * @param defport	the default port, which is not emitted
+ * @param dst		the destination buffer
+ * @param size		size of the destination buffer
+ *
+ * @return the length of the generated string, (size_t) -1 if the buffer
+ * was too small.
+ */
+size_t
+altloc_format(const host_addr_t addr, uint16 port, uint16 defport,
+	char *dst, size_t size)
+{
+	size_t n;
+
+	if (host_addr_is_ipv4(addr))
+		return altloc_format_ipv4(host_addr_ipv4(addr), port, defport,
+			dst, size);
+
+	if (port == defport) {
+		n = host_addr_to_string_buf(addr, dst, size);
+	} else {
+		n = host_addr_port_to_string_buf(addr, port, dst, size);
+	}
+
+	return n < size ? n : (size_t) -1;
+}
+
+/**
+ * Format the "tls=<hex>" item flagging the hosts supporting TLS, to be
+ * emitted before the list of items it refers to.  Trailing zero digits
+ * are omitted.
+ *
+ * @param tls		array of flags, one per item in the list, in order
+ * @param cnt		amount of items in the list
+ * @param dst		the destination buffer
+ * @param size		size of the destination buffer
+ *
+ * @return the length of the generated string, 0 if no host supports TLS
+ * (an empty string being written), (size_t) -1 if the buffer was too small.
+ */
+size_t
+altloc_format_tls(const bool *tls, size_t cnt, char *dst, size_t size)
+{
+	size_t i, digits = 0, n;
+	char *p;
+
+	g_assert(tls != NULL || 0 == cnt);
+
+	for (i = 0; i < cnt; i++) {
+		if (tls[i])
+			digits = i / 4 + 1;
+	}
+
+	n = 0 == digits ? 0 : CONST_STRLEN("tls=") + digits;
+
+	if (n >= size) {
+		if (size != 0)
+			dst[0] = '\0';
+		return (size_t) -1;
+	}
+
+	if (0 == n) {
+		dst[0] = '\0';
+		return 0;
+	}
+
+	memcpy(dst, "tls=", CONST_STRLEN("tls="));
+	p = dst + CONST_STRLEN("tls=");
+
+	for (i = 0; i < digits; i++) {
+		uint nibble = 0, j;
+
+		for (j = 0; j < 4 && 4 * i + j < cnt; j++) {
+			if (tls[4 * i + j])
+				nibble |= 0x8 >> j;
+		}
+		*p++ = hex_digit(nibble);
+	}
+
+	*p = '\0';
+	return n;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
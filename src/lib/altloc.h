@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Compact alternate location list codec.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _altloc_h_
+#define _altloc_h_
+
+#include "common.h"
+
+#include "host_addr.h"
+#include "stringify.h"		/* For HOST_ADDR_PORT_BUFLEN */
+
+/**
+ * Buffer size required to format an IPv4 address with its port.
+ */
+#define ALTLOC_IPV4_BUFLEN	(sizeof "255.255.255.255:65535")
+
+/**
+ * Buffer size required to format any address with its port.
+ */
+#define ALTLOC_BUFLEN		HOST_ADDR_PORT_BUFLEN
+
+/**
+ * Buffer size required to format the "tls=<hex>" item flagging `n' hosts.
+ */
+#define ALTLOC_TLS_BUFLEN(n)	(sizeof "tls=" + ((n) + 3) / 4)
+
+/**
+ * Callback invoked for each address parsed by altloc_parse(), `tls' telling
+ * whether the host was flagged as supporting TLS.
+ */
+typedef void (*altloc_cb_t)(host_addr_t addr, uint16 port, bool tls,
+	void *udata);
+
+/*
+ * Public interface.
+ */
+
+size_t altloc_parse(const char *value, uint16 defport,
+	altloc_cb_t cb, void *udata, size_t *invalid);
+
+bool altloc_parse_addr(const char *s, host_addr_t *addr, const char **endptr);
+
+size_t altloc_format(const host_addr_t addr, uint16 port, uint16 defport,
+	char *dst, size_t size);
+size_t altloc_format_ipv4(uint32 ip, uint16 port, uint16 defport,
+	char *dst, size_t size);
+size_t altloc_format_tls(const bool *tls, size_t cnt, char *dst, size_t size);
+
+#endif	/* _altloc_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
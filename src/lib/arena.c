@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bump allocator for transient objects, released all at once.
+ *
+ * An arena hands out memory by moving a pointer forward in a chunk, and
+ * nothing is ever freed individually: arena_reset() discards everything
+ * that was allocated since the previous reset.  This is meant for the
+ * many small objects created whilst processing one message and which
+ * are all dead once the message has been handled.
+ *
+ * When the objects allocated between two resets do not fit in the base
+ * chunk, additional chunks are chained.  At reset time, these are freed
+ * and the base chunk is resized to hold the whole high-water mark, so that
+ * a steady workload ends up being served by a single chunk.
+ *
+ * Each thread can also use its own arena through a "scope": the outermost
+ * arena_scope_leave() resets the thread arena.  Code wishing to allocate
+ * transient objects calls arena_scope(), which returns NULL when no scope
+ * is active, in which case regular allocators must be used.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "arena.h"
+
+#include "atomic.h"
+#include "dump_options.h"
+#include "log.h"
+#include "misc.h"
+#include "once.h"
+#include "stringify.h"
+#include "thread.h"
+#include "unsigned.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define ARENA_CHUNK_DEFAULT	16384		/* Default base chunk size */
+#define ARENA_CHUNK_MAX		262144		/* Maximum base chunk size */
+#define ARENA_SCOPE_CHUNK	16384		/* Base chunk size for thread arenas */
+
+/**
+ * A memory chunk.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;	/* Next (older) chunk */
+	size_t size;				/* Size of the data area */
+	char *data;					/* Start of data area, suitably aligned */
+};
+
+enum arena_magic { ARENA_MAGIC = 0x1a7c4e93 };
+
+/**
+ * An arena.
+ */
+struct arena {
+	enum arena_magic magic;
+	const char *name;			/* Arena name, for logging */
+	struct arena_chunk *chunk;	/* Current chunk, heads the chunk list */
+	char *avail;				/* First available byte in current chunk */
+	char *end;					/* First byte past current chunk */
+	size_t chunksize;			/* Base chunk size */
+	size_t used;				/* Bytes allocated since last reset */
+	uint depth;					/* Scope nesting depth (thread arenas) */
+};
+
+static inline void
+arena_check(const struct arena * const ar)
+{
+	g_assert(ar != NULL);
+	g_assert(ARENA_MAGIC == ar->magic);
+}
+
+/**
+ * Internal statistics collected.
+ */
+static struct arena_stats {
+	AU64(allocations);			/* Objects allocated from arenas */
+	AU64(allocations_bytes);	/* Bytes allocated from arenas */
+	AU64(resets);				/* Arena resets */
+	AU64(chunks_allocated);		/* Chunks allocated */
+	AU64(chunks_freed);			/* Chunks freed */
+	AU64(base_resized);			/* Base chunk resizing at reset time */
+	AU64(scopes);				/* Outermost thread scopes entered */
+	AU64(thread_arenas);		/* Thread arenas created */
+} arena_stats;
+
+#define ARENA_STATS_INCX(x)		AU64_INC(&arena_stats.x)
+#define ARENA_STATS_ADDX(x,n)	AU64_ADD(&arena_stats.x, n)
+
+static thread_key_t arena_key = THREAD_KEY_INIT;
+static once_flag_t arena_key_inited;
+
+/**
+ * Allocate a new chunk able to hold at least ``size'' bytes.
+ */
+static struct arena_chunk *
+arena_chunk_alloc(size_t size)
+{
+	struct arena_chunk *c;
+	size_t header = round_size(MEM_ALIGNBYTES, sizeof *c);
+
+	c = xmalloc(header + size);
+	c->next = NULL;
+	c->size = size;
+	c->data = ptr_add_offset(c, header);
+
+	ARENA_STATS_INCX(chunks_allocated);
+
+	return c;
+}
+
+/**
+ * Free chunk list.
+ */
+static void
+arena_chunk_free_list(struct arena_chunk *c)
+{
+	while (c != NULL) {
+		struct arena_chunk *next = c->next;
+
+		xfree(c);
+		ARENA_STATS_INCX(chunks_freed);
+		c = next;
+	}
+}
+
+/**
+ * Make chunk the current chunk of the arena.
+ */
+static inline void
+arena_chunk_use(arena_t *ar, struct arena_chunk *c)
+{
+	c->next = ar->chunk;
+	ar->chunk = c;
+	ar->avail = c->data;
+	ar->end = c->data + c->size;
+}
+
+/**
+ * Create a new arena.
+ *
+ * @param name		the arena name, for logging (static string)
+ * @param chunksize	initial base chunk size, 0 for the default
+ *
+ * @return a new arena.
+ */
+arena_t *
+arena_make(const char *name, size_t chunksize)
+{
+	arena_t *ar;
+
+	g_assert(name != NULL);
+
+	if (0 == chunksize)
+		chunksize = ARENA_CHUNK_DEFAULT;
+
+	XMALLOC0(ar);
+	ar->magic = ARENA_MAGIC;
+	ar->name = name;
+	ar->chunksize = round_size(MEM_ALIGNBYTES, chunksize);
+	arena_chunk_use(ar, arena_chunk_alloc(ar->chunksize));
+
+	return ar;
+}
+
+/**
+ * Free arena and all the memory it allocated, then nullify its pointer.
+ */
+void
+arena_free_null(arena_t **ar_ptr)
+{
+	arena_t *ar = *ar_ptr;
+
+	if (ar != NULL) {
+		arena_check(ar);
+
+		arena_chunk_free_list(ar->chunk);
+		ar->magic = 0;
+		xfree(ar);
+		*ar_ptr = NULL;
+	}
+}
+
+/**
+ * Slow path of arena_alloc(): chain a new chunk.
+ */
+static void * G_COLD
+arena_alloc_chunk(arena_t *ar, size_t size)
+{
+	size_t len = MAX(size, ar->chunksize);
+	void *p;
+
+	arena_chunk_use(ar, arena_chunk_alloc(len));
+
+	p = ar->avail;
+	ar->avail += size;
+
+	return p;
+}
+
+/**
+ * Allocate memory from the arena.
+ *
+ * The memory cannot be freed individually, it is released when the arena
+ * is reset.
+ *
+ * @param ar		the arena
+ * @param size		amount of bytes needed
+ *
+ * @return pointer to allocated memory, suitably aligned.
+ */
+void *
+arena_alloc(arena_t *ar, size_t size)
+{
+	void *p;
+
+	arena_check(ar);
+	g_assert(size_is_non_negative(size));
+
+	size = round_size_fast(MEM_ALIGNBYTES, MAX(size, 1));
+	ar->used += size;
+
+	ARENA_STATS_INCX(allocations);
+	ARENA_STATS_ADDX(allocations_bytes, size);
+
+	if G_UNLIKELY(size > UNSIGNED(ar->end - ar->avail))
+		return arena_alloc_chunk(ar, size);
+
+	p = ar->avail;
+	ar->avail += size;
+
+	return p;
+}
+
+/**
+ * Allocate zeroed memory from the arena.
+ */
+void *
+arena_alloc0(arena_t *ar, size_t size)
+{
+	void *p = arena_alloc(ar, size);
+
+	memset(p, 0, size);
+	return p;
+}
+
+/**
+ * Copy data into the arena.
+ */
+void *
+arena_copy(arena_t *ar, const void *p, size_t size)
+{
+	void *cp = arena_alloc(ar, size);
+
+	memcpy(cp, p, size);
+	return cp;
+}
+
+/**
+ * Copy at most ``n'' bytes of string into the arena, NUL-terminating it.
+ */
+char *
+arena_strndup(arena_t *ar, const char *s, size_t n)
+{
+	size_t len = clamp_strlen(s, n);
+	char *cp = arena_alloc(ar, len + 1);
+
+	memcpy(cp, s, len);
+	cp[len] = '\0';
+	return cp;
+}
+
+/**
+ * @return amount of bytes allocated since last reset.
+ */
+size_t
+arena_used(const arena_t *ar)
+{
+	arena_check(ar);
+
+	return ar->used;
+}
+
+/**
+ * Reset the arena, discarding all the objects allocated so far.
+ *
+ * If more than the base chunk was needed, the base chunk is enlarged to the
+ * high-water mark, within limits.
+ */
+void
+arena_reset(arena_t *ar)
+{
+	struct arena_chunk *c;
+
+	arena_check(ar);
+
+	ARENA_STATS_INCX(resets);
+
+	c = ar->chunk;
+
+	if G_UNLIKELY(c->next != NULL) {
+		size_t wanted = MIN(ar->used, ARENA_CHUNK_MAX);
+		struct arena_chunk *prev = c, *base;
+
+		/*
+		 * Several chunks were used, free them all and start again from
+		 * a single base chunk, larger if we know we need more room.
+		 * The base chunk is the last one in the list.
+		 */
+
+		while (prev->next->next != NULL)
+			prev = prev->next;
+
+		base = prev->next;
+		prev->next = NULL;			/* Detach base chunk from list */
+
+		arena_chunk_free_list(c);
+		ar->chunk = NULL;
+
+		if (wanted > ar->chunksize) {
+			ar->chunksize = round_size(MEM_ALIGNBYTES, wanted);
+			ARENA_STATS_INCX(base_resized);
+			xfree(base);
+			ARENA_STATS_INCX(chunks_freed);
+			base = arena_chunk_alloc(ar->chunksize);
+		}
+
+		arena_chunk_use(ar, base);
+	} else {
+		ar->avail = c->data;
+	}
+
+	ar->used = 0;
+}
+
+/**
+ * Free thread arena when the thread exits.
+ */
+static void
+arena_thread_free(void *data)
+{
+	arena_t *ar = data;
+
+	arena_free_null(&ar);
+}
+
+/**
+ * Create the thread-local arena key, once.
+ */
+static void
+arena_key_init(void)
+{
+	if (-1 == thread_local_key_create(&arena_key, arena_thread_free))
+		s_warning("cannot initialize thread arena key: %m");
+}
+
+/**
+ * Get the arena of the current thread, creating it if needed.
+ *
+ * @return the thread arena, NULL if we cannot have one.
+ */
+static arena_t *
+arena_thread_get(void)
+{
+	arena_t *ar;
+
+	ONCE_FLAG_RUN(arena_key_inited, arena_key_init);
+
+	if G_UNLIKELY(THREAD_KEY_INIT == arena_key)
+		return NULL;
+
+	ar = thread_local_get(arena_key);
+
+	if G_UNLIKELY(NULL == ar) {
+		ar = arena_make("thread", ARENA_SCOPE_CHUNK);
+		thread_local_set(arena_key, ar);
+		ARENA_STATS_INCX(thread_arenas);
+	}
+
+	return ar;
+}
+
+/**
+ * Enter a transient allocation scope in the current thread.
+ *
+ * Scopes can be nested, the thread arena being reset only when leaving the
+ * outermost scope.  Objects obtained from arena_scope() must not be kept
+ * past the scope.
+ */
+void
+arena_scope_enter(void)
+{
+	arena_t *ar = arena_thread_get();
+
+	if G_UNLIKELY(NULL == ar)
+		return;
+
+	if (0 == ar->depth++)
+		ARENA_STATS_INCX(scopes);
+}
+
+/**
+ * Leave transient allocation scope, resetting the thread arena when leaving
+ * the outermost scope.
+ */
+void
+arena_scope_leave(void)
+{
+	arena_t *ar;
+
+	if G_UNLIKELY(THREAD_KEY_INIT == arena_key)
+		return;
+
+	ar = thread_local_get(arena_key);
+
+	if G_UNLIKELY(NULL == ar)
+		return;
+
+	arena_check(ar);
+	g_assert(ar->depth != 0);
+
+	if (0 == --ar->depth)
+		arena_reset(ar);
+}
+
+/**
+ * @return the thread arena if a scope is active, NULL otherwise.
+ */
+arena_t *
+arena_scope(void)
+{
+	arena_t *ar;
+
+	if G_UNLIKELY(THREAD_KEY_INIT == arena_key)
+		return NULL;
+
+	ar = thread_local_get(arena_key);
+
+	if (NULL == ar || 0 == ar->depth)
+		return NULL;
+
+	return ar;
+}
+
+/**
+ * Dump arena statistics to specified log agent.
+ */
+void G_COLD
+arena_dump_stats_log(logagent_t *la, unsigned options)
+{
+	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
+
+#define DUMP(x) G_STMT_START {							\
+	uint64 v = AU64_VALUE(&arena_stats.x);					\
+	log_info(la, "ARENA %s = %s", #x,						\
+		uint64_to_string_grp(v, groupped));					\
+} G_STMT_END
+
+	DUMP(allocations);
+	DUMP(allocations_bytes);
+	DUMP(resets);
+	DUMP(chunks_allocated);
+	DUMP(chunks_freed);
+	DUMP(base_resized);
+	DUMP(scopes);
+	DUMP(thread_arenas);
+
+#undef DUMP
+}
+
+/* vi: set ts=4 sw=4 cindent: */
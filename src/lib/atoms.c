@@ -31,6 +31,16 @@
  * and which is therefore only allocated once: all other instances point
  * to the common object.
  *
+ * Atoms of a given type are spread among several tables, each protected by
+ * its own lock, the table being selected by the hashed value of the atom.
+ * This limits lock contention when atoms are requested concurrently.
+ *
+ * Furthermore, each thread keeps a small cache of recently requested atoms
+ * whose reference count changes are batched: getting or freeing a cached
+ * atom is done without taking any lock.  The cache holds extra references
+ * on each of its atoms (a "pin") until it is flushed, which happens
+ * periodically and when the thread exits.
+ *
  * @author Raphael Manfredi
  * @date 2002-2003
  */
@@ -39,8 +49,11 @@
 #include "common.h"
 
 #include "atoms.h"
+#include "atomic.h"
 #include "buf.h"
 #include "constants.h"
+#include "dump_options.h"
+#include "elist.h"
 #include "endian.h"
 #include "hashing.h"
 #include "htable.h"
@@ -51,6 +64,7 @@
 #include "spinlock.h"
 #include "str.h"
 #include "stringify.h"
+#include "thread.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -531,21 +545,75 @@ atom_dealloc(atom_t *a, size_t size)
 typedef size_t (*len_func_t)(const void *v);
 typedef const char *(*str_func_t)(const void *v);
 
+#define ATOM_STRIPE_BITS	4
+#define ATOM_STRIPES		(1U << ATOM_STRIPE_BITS)
+
+/**
+ * A table holding part of the atoms of a given type.
+ */
+struct atom_stripe {
+	spinlock_t lock;			/**< Lock protecting the hash table */
+	htable_t *table;			/**< Table of atoms: "atom value" -> size */
+};
+
 /**
  * Description of atom types.
  */
 typedef struct atom_desc {
-	spinlock_t lock;			/**< Lock protecting the hash table */
 	const char *type;			/**< Type of atoms */
-	htable_t *table;			/**< Table of atoms: "atom value" -> size */
 	hash_fn_t hash_func;		/**< Hashing function for atoms */
 	eq_fn_t eq_func;			/**< Atom equality function */
 	len_func_t len_func;		/**< Atom length function */
 	str_func_t str_func;		/**< Atom to human-readable string */
+	struct atom_stripe stripe[ATOM_STRIPES];	/**< Atom tables */
 } atom_desc_t;
 
-#define ATOM_TABLE_LOCK(t)		spinlock(&(t)->lock)
-#define ATOM_TABLE_UNLOCK(t)	spinunlock(&(t)->lock)
+#define ATOM_STRIPE_UNLOCK(s)	spinunlock(&(s)->lock)
+
+/**
+ * Atom statistics, per type.
+ *
+ * The AU64() fields are atomically updated.
+ */
+static struct atom_stats {
+	AU64(gets);					/**< Calls to atom_get() */
+	AU64(frees);				/**< Calls to atom_free() */
+	AU64(batched);				/**< Operations done in the thread cache */
+	AU64(flushed);				/**< Cache slots flushed */
+	AU64(contended);			/**< Table lock was busy */
+} atom_stats[NUM_ATOM_TYPES];
+
+#define ATOM_STATS_INC(t, x)	AU64_INC(&atom_stats[t].x)
+
+/*
+ * Per-thread atom cache.
+ *
+ * Each cached atom holds ATOM_PIN references on the atom, which ensures the
+ * atom cannot be disposed of whilst it is cached, even if other threads free
+ * the references they got through our cache.  Changes to the reference count
+ * are accumulated in the slot and applied when the slot is flushed.
+ *
+ * All the caches are linked together so that atoms_close() can flush them,
+ * after which flushing becomes a no-op since the atom tables are gone.
+ */
+#define ATOM_CACHE_BITS		6
+#define ATOM_CACHE_SLOTS	(1U << ATOM_CACHE_BITS)
+#define ATOM_CACHE_OPS		4096		/* Operations between cache flushes */
+#define ATOM_PIN			(1 << 24)	/* References held by a cached atom */
+
+struct atom_cache_slot {
+	const void *atom;			/**< Cached atom, NULL if slot is free */
+	enum atom_type type;		/**< Atom type */
+	int delta;					/**< Pending reference count change */
+};
+
+struct atom_cache {
+	struct atom_cache_slot slot[ATOM_CACHE_SLOTS];
+	uint ops;					/**< Operations since last flush */
+	link_t lk;					/**< Embedded link to list all caches */
+};
+
+static bool atom_caches_closed;	/**< Set by atoms_close() */
 
 static size_t str_xlen(const void *v);
 static const char *str_str(const void *v);
@@ -579,22 +647,22 @@ static const char *packed_host_addr_str(const void *v);
 #define pha_eq		packed_host_addr_equal
 #define pha_len		packed_host_addr_len
 #define pha_str		packed_host_addr_str
-#define S			SPINLOCK_INIT
-#define N			NULL
 
 /**
  * The set of all atom types we know about.
+ *
+ * The stripes are initialized by atoms_init().
  */
 static atom_desc_t atoms[] = {
-	{ S, "String", N, str_hash,    str_eq,     str_xlen,   str_str  }, /* 0 */
-	{ S, "GUID",   N, guid_hash,   guid_eq,    guid_len,   guid_str }, /* 1 */
-	{ S, "SHA1",   N, sha1_hash,   sha1_eq,	   sha1_len,   sha1_str }, /* 2 */
-	{ S, "TTH",    N, tth_hash,    tth_eq,	   tth_len,    tth_str },  /* 3 */
-	{ S, "uint64", N, uint64_hash, uint64_eq,  uint64_len, uint64_str},/* 4 */
-	{ S, "filesize", N, fs_hash,   fs_eq,      fs_len,     fs_str },   /* 5 */
-	{ S, "uint32", N, uint32_hash, uint32_eq,  uint32_len, uint32_str},/* 6 */
-	{ S, "host",   N, gnh_hash,    gnh_eq,     gnh_len,    gnh_str },  /* 7 */
-	{ S, "addr",   N, pha_hash,    pha_eq,     pha_len,    pha_str },  /* 8 */
+	{ "String",   str_hash,    str_eq,     str_xlen,   str_str  },	/* 0 */
+	{ "GUID",     guid_hash,   guid_eq,    guid_len,   guid_str },	/* 1 */
+	{ "SHA1",     sha1_hash,   sha1_eq,	   sha1_len,   sha1_str },	/* 2 */
+	{ "TTH",      tth_hash,    tth_eq,	   tth_len,    tth_str },	/* 3 */
+	{ "uint64",   uint64_hash, uint64_eq,  uint64_len, uint64_str},	/* 4 */
+	{ "filesize", fs_hash,     fs_eq,      fs_len,     fs_str },	/* 5 */
+	{ "uint32",   uint32_hash, uint32_eq,  uint32_len, uint32_str},	/* 6 */
+	{ "host",     gnh_hash,    gnh_eq,     gnh_len,    gnh_str },	/* 7 */
+	{ "addr",     pha_hash,    pha_eq,     pha_len,    pha_str },	/* 8 */
 };
 
 #undef str_hash
@@ -611,8 +679,6 @@ static atom_desc_t atoms[] = {
 #undef pha_eq
 #undef pha_len
 #undef pha_str
-#undef S
-#undef N
 
 /**
  * @return length of string + trailing NUL.
@@ -980,8 +1046,14 @@ atoms_init_once(void)
 
 	for (i = 0; i < N_ITEMS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		uint j;
 
-		ad->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		for (j = 0; j < N_ITEMS(ad->stripe); j++) {
+			struct atom_stripe *as = &ad->stripe[j];
+
+			spinlock_init(&as->lock);
+			as->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		}
 	}
 
 	/*
@@ -1020,6 +1092,26 @@ atoms_init(void)
 	once_flag_run(&atoms_inited, atoms_init_once);
 }
 
+/**
+ * Lock the table holding atoms of the given type whose hashed value is ``hv''.
+ *
+ * @return the locked stripe.
+ */
+static inline struct atom_stripe *
+atom_stripe_lock(enum atom_type type, unsigned hv)
+{
+	struct atom_stripe *as;
+
+	as = &atoms[type].stripe[hashing_fold(hv, ATOM_STRIPE_BITS)];
+
+	if G_UNLIKELY(!spinlock_try(&as->lock)) {
+		ATOM_STATS_INC(type, contended);
+		spinlock(&as->lock);
+	}
+
+	return as;
+}
+
 /**
  * Check whether atom exists.
  *
@@ -1028,12 +1120,19 @@ atoms_init(void)
 bool
 atom_exists(enum atom_type type, const void *key)
 {
+	struct atom_stripe *as;
+	bool found;
+
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_contains(atoms[type].table, key);
+	as = atom_stripe_lock(type, (*atoms[type].hash_func)(key));
+	found = htable_contains(as->table, key);
+	ATOM_STRIPE_UNLOCK(as);
+
+	return found;
 }
 
 /**
@@ -1044,26 +1143,31 @@ atom_exists(enum atom_type type, const void *key)
 bool
 atom_is_atom(enum atom_type type, const void *key)
 {
+	struct atom_stripe *as;
 	const void *atom;
+	bool found;
 
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_lookup_extended(atoms[type].table, key, &atom, NULL)
-		&& key == atom;
+	as = atom_stripe_lock(type, (*atoms[type].hash_func)(key));
+	found = htable_lookup_extended(as->table, key, &atom, NULL);
+	ATOM_STRIPE_UNLOCK(as);
+
+	return found && key == atom;
 }
 
 /**
  * Increment / decrement the atom reference count.
  *
- * Must be called with the table description locked.
+ * Must be called with the stripe holding the atom locked.
  *
  * @return new reference count.
  */
 static inline size_t
-atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
+atom_refcnt_add(struct atom_stripe *as, const void *key, void *value, int delta)
 {
 	if (4 == sizeof(void *)) {
 		/* 32-bit machine, we can directly update the atom_info structure */
@@ -1077,11 +1181,194 @@ atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
 			v += delta;
 		else
 			v -= -delta;	/* Necessary since int may be smaller than long */
-		htable_insert(ad->table, key, ulong_to_pointer(v));
+		htable_insert(as->table, key, ulong_to_pointer(v));
 		return ATOM_REFCNT(v);
 	}
 }
 
+/**
+ * Dispose of atom, whose reference count dropped to zero.
+ *
+ * Must be called with the stripe holding the atom locked.
+ */
+static void
+atom_dispose(struct atom_stripe *as, const void *key, void *value)
+{
+	size_t size = atom_info_length(value);
+	atom_t *a = atom_from_arena(key);
+
+	/* Prevent gcc warning if ARENA_OFFSET == 0 */
+	g_assert(size == ARENA_OFFSET || size > ARENA_OFFSET);
+
+	htable_remove(as->table, key);
+	if (4 == sizeof(void *)) {
+		/* 32-bit machine */
+		struct atom_info *ai = value;
+		WFREE(ai);
+	}
+	atom_unprotect(a, size);
+	atom_dealloc(a, size);
+}
+
+/**
+ * Apply pending reference count changes from a cache slot and release the
+ * references held by the cache on the atom.
+ */
+static void
+atom_cache_flush_slot(struct atom_cache_slot *slot)
+{
+	const atom_desc_t *ad = &atoms[slot->type];
+	struct atom_stripe *as;
+	const void *key = slot->atom, *orig_key;
+	void *value;
+	bool found;
+
+	as = atom_stripe_lock(slot->type, (*ad->hash_func)(key));
+
+	found = htable_lookup_extended(as->table, key, &orig_key, &value);
+
+	g_assert_log(found && key == orig_key,
+		"cached %s atom %p no longer present", ad->type, key);
+	g_assert(atom_info_refcnt(value) > ATOM_PIN / 2);
+
+	if (0 == atom_info_refcnt(value) + slot->delta - ATOM_PIN)
+		atom_dispose(as, key, value);
+	else
+		atom_refcnt_add(as, key, value, slot->delta - ATOM_PIN);
+
+	ATOM_STRIPE_UNLOCK(as);
+	ATOM_STATS_INC(slot->type, flushed);
+
+	slot->atom = NULL;
+	slot->delta = 0;
+}
+
+/**
+ * Flush all the atoms held in the cache.
+ */
+static void
+atom_cache_flush(struct atom_cache *ac)
+{
+	uint i;
+
+	if G_UNLIKELY(atom_caches_closed)
+		return;
+
+	for (i = 0; i < N_ITEMS(ac->slot); i++) {
+		if (ac->slot[i].atom != NULL)
+			atom_cache_flush_slot(&ac->slot[i]);
+	}
+
+	ac->ops = 0;
+}
+
+#ifdef TRACK_ATOMS
+#define atom_cache_get()	NULL		/* Reference counts must be exact */
+#define atom_caches_close()
+#else	/* !TRACK_ATOMS */
+
+static once_flag_t atom_cache_key_inited;
+static thread_key_t atom_cache_key = THREAD_KEY_INIT;
+static elist_t atom_caches = ELIST_INIT(offsetof(struct atom_cache, lk));
+static spinlock_t atom_caches_slk = SPINLOCK_INIT;
+
+#define ATOM_CACHES_LOCK	spinlock(&atom_caches_slk)
+#define ATOM_CACHES_UNLOCK	spinunlock(&atom_caches_slk)
+
+/**
+ * Thread-local cache destructor, invoked when thread exits.
+ */
+static void
+atom_cache_free(void *p)
+{
+	struct atom_cache *ac = p;
+
+	ATOM_CACHES_LOCK;
+	elist_remove(&atom_caches, ac);
+	atom_cache_flush(ac);
+	ATOM_CACHES_UNLOCK;
+
+	xfree(ac);
+}
+
+/**
+ * Flush the caches of all the threads and disable further flushing.
+ *
+ * This is only called at shutdown time by atoms_close(), when the other
+ * threads no longer use atoms.
+ */
+static void
+atom_caches_close(void)
+{
+	struct atom_cache *ac;
+
+	ATOM_CACHES_LOCK;
+	ELIST_FOREACH_DATA(&atom_caches, ac) {
+		atom_cache_flush(ac);
+	}
+	atom_caches_closed = TRUE;
+	ATOM_CACHES_UNLOCK;
+}
+
+/**
+ * Create the thread-local cache key, once.
+ */
+static void
+atom_cache_key_init(void)
+{
+	if (-1 == thread_local_key_create(&atom_cache_key, atom_cache_free))
+		s_warning("cannot initialize atom cache key: %m");
+}
+
+/**
+ * Get the atom cache for the current thread.
+ *
+ * @return the atom cache, NULL if atoms cannot be cached.
+ */
+static struct atom_cache *
+atom_cache_get(void)
+{
+	struct atom_cache *ac;
+
+	ONCE_FLAG_RUN(atom_cache_key_inited, atom_cache_key_init);
+
+	if G_UNLIKELY(THREAD_KEY_INIT == atom_cache_key || atom_caches_closed)
+		return NULL;
+
+	ac = thread_local_get(atom_cache_key);
+
+	if G_UNLIKELY(NULL == ac) {
+		XMALLOC0(ac);
+		thread_local_set(atom_cache_key, ac);
+		ATOM_CACHES_LOCK;
+		elist_append(&atom_caches, ac);
+		ATOM_CACHES_UNLOCK;
+	}
+
+	return ac;
+}
+#endif	/* TRACK_ATOMS */
+
+/**
+ * @return the cache slot for atoms of given type and hashed value.
+ */
+static inline struct atom_cache_slot *
+atom_cache_slot(struct atom_cache *ac, enum atom_type type, unsigned hv)
+{
+	return &ac->slot[hashing_fold(hv + type, ATOM_CACHE_BITS)];
+}
+
+/**
+ * Record an operation done through the cache, flushing the cache
+ * periodically so that atoms no longer in use can be disposed of.
+ */
+static inline void
+atom_cache_tick(struct atom_cache *ac)
+{
+	if G_UNLIKELY(++ac->ops >= ATOM_CACHE_OPS)
+		atom_cache_flush(ac);
+}
+
 /**
  * Get atom of given `type', whose value is `key'.
  * If the atom does not exist yet, `key' is cloned and makes up the new atom.
@@ -1092,9 +1379,14 @@ const void *
 atom_get(enum atom_type type, const void *key)
 {
 	atom_desc_t *ad;
+	struct atom_stripe *as;
+	struct atom_cache *ac;
+	struct atom_cache_slot *slot = NULL;
 	const void *orig_key;
 	void *value;
 	size_t size;
+	unsigned hv;
+	int pin = 0;
 	atom_t *a;
 
 	STATIC_ASSERT(0 == ARENA_OFFSET % MEM_ALIGNBYTES);
@@ -1108,9 +1400,37 @@ atom_get(enum atom_type type, const void *key)
 		atoms_init();
 
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	hv = (*ad->hash_func)(key);
+	ac = atom_cache_get();
 
-	if (htable_lookup_extended(ad->table, key, &orig_key, &value)) {
+	ATOM_STATS_INC(type, gets);
+
+	/*
+	 * If the atom is cached, we only need to record the new reference.
+	 * Otherwise, we'll cache the atom if its slot is free.
+	 */
+
+	if G_LIKELY(ac != NULL) {
+		slot = atom_cache_slot(ac, type, hv);
+
+		if (slot->atom != NULL) {
+			if (slot->type == type && (*ad->eq_func)(slot->atom, key)) {
+				const void *atom = slot->atom;
+
+				slot->delta++;
+				ATOM_STATS_INC(type, batched);
+				atom_cache_tick(ac);
+				return atom;
+			}
+			slot = NULL;		/* Slot busy, don't cache */
+		} else {
+			pin = ATOM_PIN;
+		}
+	}
+
+	as = atom_stripe_lock(type, hv);
+
+	if (htable_lookup_extended(as->table, key, &orig_key, &value)) {
 		size_t refcnt;
 
 		size = atom_info_length(value);
@@ -1123,11 +1443,8 @@ atom_get(enum atom_type type, const void *key)
 
 		g_assert(atom_info_refcnt(value) > 0);
 
-		refcnt = atom_refcnt_add(ad, orig_key, value, +1);
+		refcnt = atom_refcnt_add(as, orig_key, value, 1 + pin);
 		ATOM_TRACK_REFCNT(orig_key, +1, refcnt);
-		ATOM_TABLE_UNLOCK(ad);
-
-		return orig_key;
 	} else {
 		size_t len;
 
@@ -1155,17 +1472,29 @@ atom_get(enum atom_type type, const void *key)
 
 			WALLOC(ai);
 			ai->len = size;
-			ai->refcnt = 1;
-			htable_insert(ad->table, atom_arena(a), ai);
+			ai->refcnt = 1 + pin;
+			htable_insert(as->table, atom_arena(a), ai);
 		} else {
-			ulong v = ATOM_INFO(size) + 1;	/* +1 means refcnt is 1 */
-			htable_insert(ad->table, atom_arena(a), ulong_to_pointer(v));
+			/* +1 means refcnt is 1 */
+			ulong v = ATOM_INFO(size) + 1 + pin;
+			htable_insert(as->table, atom_arena(a), ulong_to_pointer(v));
 		}
 
-		ATOM_TABLE_UNLOCK(ad);
+		orig_key = atom_arena(a);
+	}
+
+	ATOM_STRIPE_UNLOCK(as);
+
+	if (pin != 0) {
+		g_assert(slot != NULL);
 
-		return atom_arena(a);
+		slot->atom = orig_key;
+		slot->type = type;
+		slot->delta = 0;
+		atom_cache_tick(ac);
 	}
+
+	return orig_key;
 }
 
 /**
@@ -1175,11 +1504,12 @@ atom_get(enum atom_type type, const void *key)
 void
 atom_free(enum atom_type type, const void *key)
 {
-	atom_desc_t *ad;
-	size_t size;
-	atom_t *a;
+	const atom_desc_t *ad;
+	struct atom_stripe *as;
+	struct atom_cache *ac;
 	bool found;
 	int refcnt;
+	unsigned hv;
 	void *value;
 	const void *orig_key;
 
@@ -1188,9 +1518,32 @@ atom_free(enum atom_type type, const void *key)
 	ATOM_TRACK_IS_LOCKED();
 
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	hv = (*ad->hash_func)(key);
+	ac = atom_cache_get();
+
+	ATOM_STATS_INC(type, frees);
+
+	/*
+	 * If the atom is cached, the reference is dropped in the cache and the
+	 * atom will be disposed of, if needed, when the slot is flushed.
+	 */
+
+	if G_LIKELY(ac != NULL) {
+		struct atom_cache_slot *slot = atom_cache_slot(ac, type, hv);
 
-	found = htable_lookup_extended(ad->table, key, &orig_key, &value);
+		if (key == slot->atom) {
+			g_assert(slot->type == type);
+
+			slot->delta--;
+			ATOM_STATS_INC(type, batched);
+			atom_cache_tick(ac);
+			return;
+		}
+	}
+
+	as = atom_stripe_lock(type, hv);
+
+	found = htable_lookup_extended(as->table, key, &orig_key, &value);
 
 	g_assert_log(found,
 		"attempting to free unknown %s atom at %p", ad->type, key);
@@ -1198,12 +1551,6 @@ atom_free(enum atom_type type, const void *key)
 		"attempt to free %s atom copy at %p, atom was at %p",
 			ad->type, key, orig_key);
 
-	size = atom_info_length(value);
-
-	/* Prevent gcc warning if ARENA_OFFSET == 0 */
-	g_assert(size == ARENA_OFFSET || size > ARENA_OFFSET);
-
-	a = atom_from_arena(key);
 	refcnt = atom_info_refcnt(value);
 
 	/*
@@ -1211,20 +1558,13 @@ atom_free(enum atom_type type, const void *key)
 	 */
 
 	if (1 == refcnt) {
-		htable_remove(ad->table, key);
-		if (4 == sizeof(void *)) {
-			/* 32-bit machine */
-			struct atom_info *ai = value;
-			WFREE(ai);
-		}
-		atom_unprotect(a, size);
-		atom_dealloc(a, size);
+		atom_dispose(as, key, value);
 	} else {
-		size_t rcnt = atom_refcnt_add(ad, key, value, -1);
+		size_t rcnt = atom_refcnt_add(as, key, value, -1);
 		ATOM_TRACK_REFCNT(key, -1, rcnt);
 	}
 
-	ATOM_TABLE_UNLOCK(ad);
+	ATOM_STRIPE_UNLOCK(as);
 }
 
 #ifdef TRACK_ATOMS
@@ -1469,13 +1809,66 @@ atoms_close(void)
 {
 	uint i;
 
+	/*
+	 * Apply the pending reference changes recorded by all the threads
+	 * so that only leaked atoms remain.
+	 */
+
+	atom_caches_close();
+
+	for (i = 0; i < N_ITEMS(atoms); i++) {
+		atom_desc_t *ad = &atoms[i];
+		uint j;
+
+		for (j = 0; j < N_ITEMS(ad->stripe); j++) {
+			struct atom_stripe *as = &ad->stripe[j];
+
+			spinlock(&as->lock);
+			htable_foreach(as->table, atom_warn_free, ad);
+			htable_free_null(&as->table);
+			spinunlock(&as->lock);
+		}
+	}
+}
+
+/**
+ * Dump atom statistics to specified log agent.
+ */
+void G_COLD
+atoms_dump_stats_log(logagent_t *la, unsigned options)
+{
+	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
+	uint i;
+
+	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
+		return;
+
 	for (i = 0; i < N_ITEMS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		struct atom_stats *st = &atom_stats[i];
+		size_t count = 0;
+		uint j;
+
+		for (j = 0; j < N_ITEMS(ad->stripe); j++) {
+			struct atom_stripe *as = &ad->stripe[j];
+
+			spinlock(&as->lock);
+			count += htable_count(as->table);
+			spinunlock(&as->lock);
+		}
+
+#define DUMP(x)	log_info(la, "ATOM %s %s = %s", ad->type, #x,	\
+	uint64_to_string_grp(AU64_VALUE(&st->x), groupped))
+
+		log_info(la, "ATOM %s count = %s",
+			ad->type, size_t_to_string_grp(count, groupped));
+		DUMP(gets);
+		DUMP(frees);
+		DUMP(batched);
+		DUMP(flushed);
+		DUMP(contended);
 
-		ATOM_TABLE_LOCK(ad);
-		htable_foreach(ad->table, atom_warn_free, ad);
-		htable_free_null(&ad->table);
-		ATOM_TABLE_UNLOCK(ad);
+#undef DUMP
 	}
 }
 
@@ -219,8 +219,11 @@ atom_addr_free(const struct packed_host_addr *k)
  * Public interface.
  */
 
+struct logagent;
+
 void atoms_init(void);
 void atoms_close(void);
+void atoms_dump_stats_log(struct logagent *la, unsigned options);
 
 static inline bool
 atom_is_str(const char *k)
@@ -230,6 +230,9 @@ compat_fadvise(int fd, fileoffset_t offset, fileoffset_t size, int hint)
 #ifndef POSIX_FADV_DONTNEED
 #define POSIX_FADV_DONTNEED 0
 #endif
+#ifndef POSIX_FADV_WILLNEED
+#define POSIX_FADV_WILLNEED 0
+#endif
 #endif	/* HAS_POSIX_FADVISE */
 
 void
@@ -256,4 +259,10 @@ compat_fadvise_dontneed(int fd, fileoffset_t offset, fileoffset_t size)
 	compat_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
 }
 
+void
+compat_fadvise_willneed(int fd, fileoffset_t offset, fileoffset_t size)
+{
+	compat_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
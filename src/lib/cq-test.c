@@ -0,0 +1,366 @@
+/*
+ * cq-test -- callout queue tests and benchmarking.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/compat_sleep_ms.h"
+#include "lib/cq.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_TIMERS		100000	/* Default amount of armed timers */
+#define TEST_OPS		1000000	/* Default amount of operations */
+#define TEST_PERIOD		50		/* Default heartbeat period, in ms */
+#define TEST_CHECK		64		/* Operations between clock checks */
+#define TEST_ORDER		1000	/* Events used to check firing order */
+#define TEST_ORDER_MAX	800		/* Max delay of these events, in ms */
+
+static bool silent_mode;
+static unsigned initial_seed;
+
+/*
+ * Our timer mix, modelled after the application usage.
+ */
+enum timer_class {
+	TIMER_ACTIVITY = 0,		/* Inactivity timeouts, rescheduled on traffic */
+	TIMER_RPC,				/* RPC timeouts, cancelled when reply comes */
+	TIMER_AGING,			/* Long-lived expiration timers */
+	TIMER_SHORT,			/* Short delays, which fire */
+};
+
+struct timer {
+	cevent_t *ev;
+	enum timer_class class;
+	size_t fired;
+};
+
+struct run {
+	const char *name;
+	enum cq_backend backend;
+	double elapsed;
+	size_t fired;
+	size_t heartbeats;
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hS] [-c timers] [-n ops] [-p period] [-R seed]\n"
+		"  -c : sets amount of armed timers\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of operations on timers\n"
+		"  -p : sets heartbeat period, in ms\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -S : silent mode -- only print the timing summary\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static int
+timer_delay(enum timer_class class)
+{
+	switch (class) {
+	case TIMER_ACTIVITY:	return 10000 + rand31_value(50000);
+	case TIMER_RPC:			return 1000 + rand31_value(29000);
+	case TIMER_AGING:		return 60000 + rand31_value(7200000);
+	case TIMER_SHORT:		return 100 + rand31_value(900);
+	}
+	g_assert_not_reached();
+}
+
+static enum timer_class
+timer_class_pick(void)
+{
+	uint v = rand31_value(99);
+
+	if (v < 50)
+		return TIMER_ACTIVITY;
+	else if (v < 75)
+		return TIMER_RPC;
+	else if (v < 95)
+		return TIMER_AGING;
+	else
+		return TIMER_SHORT;
+}
+
+static void
+timer_fire(cqueue_t *cq, void *data)
+{
+	struct timer *t = data;
+
+	cq_zero(cq, &t->ev);
+	t->fired++;
+}
+
+static void
+timer_arm(cqueue_t *cq, struct timer *t)
+{
+	g_assert(NULL == t->ev);
+
+	t->ev = cq_insert(cq, timer_delay(t->class), timer_fire, t);
+}
+
+/**
+ * Perform a random operation on a random timer, according to its class.
+ */
+static void
+timer_operate(cqueue_t *cq, struct timer *timers, size_t cnt)
+{
+	struct timer *t = &timers[rand31_value(cnt - 1)];
+
+	if (NULL == t->ev) {
+		timer_arm(cq, t);
+		return;
+	}
+
+	switch (t->class) {
+	case TIMER_ACTIVITY:
+		cq_resched(t->ev, timer_delay(t->class));
+		break;
+	case TIMER_RPC:
+		cq_cancel(&t->ev);
+		timer_arm(cq, t);
+		break;
+	case TIMER_AGING:
+		if (0 == rand31_value(9))
+			cq_resched(t->ev, timer_delay(t->class));
+		break;
+	case TIMER_SHORT:
+		break;
+	}
+}
+
+struct order {
+	int delay;
+	size_t seq;
+};
+
+static struct order **order_fired;		/* Next slot for fired events */
+
+static void
+order_fire(cqueue_t *cq, void *data)
+{
+	(void) cq;
+	*order_fired++ = data;
+}
+
+/**
+ * Check that events firing during the same heartbeat are triggered by
+ * increasing trigger time, in insertion order for the same trigger time.
+ */
+static void
+check_order(const char *name, enum cq_backend backend)
+{
+	struct order *orders, **fired;
+	cqueue_t *cq;
+	size_t i, n;
+
+	cq = cq_make_full(name, 0, TEST_ORDER_MAX / 8, backend);
+	cq_heartbeat(cq);			/* Binds queue to our thread */
+
+	XMALLOC_ARRAY(orders, TEST_ORDER);
+	XMALLOC0_ARRAY(fired, TEST_ORDER);
+	order_fired = fired;
+
+	for (i = 0; i < TEST_ORDER; i++) {
+		struct order *o = &orders[i];
+
+		o->delay = 1 + rand31_value(TEST_ORDER_MAX - 1);
+		o->seq = i;
+		cq_insert(cq, o->delay, order_fire, o);
+	}
+
+	compat_sleep_ms(TEST_ORDER_MAX + 100);
+	cq_heartbeat(cq);
+
+	n = order_fired - fired;
+	if (n != TEST_ORDER) {
+		printf("%s: only %zu event%s fired out of %d\n",
+			name, PLURAL(n), TEST_ORDER);
+		printf("use '-R %u' to reproduce problem.\n", initial_seed);
+		abort();
+	}
+
+	for (i = 1; i < n; i++) {
+		const struct order *a = fired[i - 1], *b = fired[i];
+
+		if (a->delay > b->delay || (a->delay == b->delay && a->seq > b->seq)) {
+			printf("%s: event #%zu (delay %d) fired before #%zu (delay %d)\n",
+				name, a->seq, a->delay, b->seq, b->delay);
+			printf("use '-R %u' to reproduce problem.\n", initial_seed);
+			abort();
+		}
+	}
+
+	g_assert(0 == cq_count(cq));
+
+	cq_free_null(&cq);
+	XFREE_NULL(orders);
+	XFREE_NULL(fired);
+
+	if (!silent_mode)
+		printf("%s: firing order of %d events: OK\n", name, TEST_ORDER);
+}
+
+/**
+ * Run the timer mix on the specified callout queue backend.
+ *
+ * The queue is given heartbeats in real time, as the application does, so
+ * the amount of events that fire depends on the speed of the backend.
+ */
+static void
+run_backend(struct run *r, size_t cnt, size_t ops, int period)
+{
+	struct timer *timers;
+	cqueue_t *cq;
+	tm_t start, end, last;
+	size_t i;
+
+	rand31_set_seed(initial_seed);
+
+	cq = cq_make_full(r->name, 0, period, r->backend);
+	cq_heartbeat(cq);			/* Binds queue to our thread */
+
+	XMALLOC0_ARRAY(timers, cnt);
+
+	for (i = 0; i < cnt; i++) {
+		timers[i].class = timer_class_pick();
+		timer_arm(cq, &timers[i]);
+	}
+
+	tm_now_exact(&start);
+	last = start;
+
+	for (i = 0; i < ops; i++) {
+		timer_operate(cq, timers, cnt);
+
+		if (0 == (i + 1) % TEST_CHECK) {
+			tm_t now;
+
+			tm_now_exact(&now);
+			if (tm_elapsed_ms(&now, &last) >= period) {
+				cq_heartbeat(cq);
+				r->heartbeats++;
+				last = now;
+			}
+		}
+	}
+
+	tm_now_exact(&end);
+	r->elapsed = tm_elapsed_f(&end, &start);
+
+	for (i = 0; i < cnt; i++) {
+		r->fired += timers[i].fired;
+		cq_cancel(&timers[i].ev);
+	}
+
+	g_assert(0 == cq_count(cq));
+
+	cq_free_null(&cq);
+	XFREE_NULL(timers);
+
+	if (!silent_mode) {
+		printf("%s: %zu operation%s on %zu timer%s, "
+			"%zu heartbeat%s, %zu event%s fired\n",
+			r->name, PLURAL(ops), PLURAL(cnt),
+			PLURAL(r->heartbeats), PLURAL(r->fired));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = TEST_TIMERS;
+	size_t ops = TEST_OPS;
+	int period = TEST_PERIOD;
+	unsigned rseed = 0;
+	struct run hash = { "hash", CQ_BACKEND_HASH, 0.0, 0, 0 };
+	struct run wheel = { "wheel", CQ_BACKEND_WHEEL, 0.0, 0, 0 };
+	int c;
+	const char options[] = "c:hn:p:R:S";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of timers */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of operations */
+			ops = atol(optarg);
+			break;
+		case 'p':			/* heartbeat period */
+			period = atoi(optarg);
+			break;
+		case 'R':			/* random seed */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count || period <= 0)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	check_order("hash", CQ_BACKEND_HASH);
+	check_order("wheel", CQ_BACKEND_WHEEL);
+
+	run_backend(&hash, count, ops, period);
+	run_backend(&wheel, count, ops, period);
+
+	printf("hash %.3f ns/op, wheel %.3f ns/op (x%.2f)\n",
+		hash.elapsed * 1e9 / MAX(ops, 1), wheel.elapsed * 1e9 / MAX(ops, 1),
+		0.0 == wheel.elapsed ? 0.0 : hash.elapsed / wheel.elapsed);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
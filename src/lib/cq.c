@@ -43,6 +43,7 @@
 #include "hashing.h"		/* For integer_hash_fast() */
 #include "hset.h"
 #include "log.h"
+#include "lprobe.h"
 #include "mutex.h"
 #include "once.h"
 #include "pow2.h"
@@ -53,6 +54,7 @@
 #include "thread.h"
 #include "tm.h"
 #include "tsig.h"
+#include "vmm.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -62,6 +64,7 @@
 #define CQ_IDLE_PERIOD	1	/* Minimal period in seconds for idle callbacks */
 
 static size_t cq_run_idle(cqueue_t *cq);
+static void cq_expire_internal(cqueue_t *cq, cevent_t *ev);
 
 static uint32 cq_debug_ptr_default;
 static const uint32 *cq_debug_ptr = &cq_debug_ptr_default;
@@ -82,6 +85,7 @@ struct cevent {
 	cq_time_t ce_time;			/**< Absolute trigger time (virtual cq time) */
 	struct cevent *ce_bnext;	/**< Next item in hash bucket */
 	struct cevent *ce_bprev;	/**< Prev item in hash bucket */
+	struct chash *ce_bucket;	/**< Timing wheel slot holding event */
 	cqueue_t *ce_cq;			/**< Callout queue where event is registered */
 	cq_service_t ce_fn;			/**< Callback routine */
 	void *ce_arg;				/**< Argument to pass to said callback */
@@ -154,6 +158,12 @@ cevent_is_extended(const cevent_t *ce)
  * yet-to-come messages, or whatever. We don't care, and we don't want to care.
  * The notion of "current time" is simply given by calling cq_clock() at
  * regular intervals and giving it the "elasped time" since the last call.
+ *
+ * Alternatively, a callout queue can use a hierarchical timing wheel to
+ * index its events (see the "Timing wheel" section below), which makes
+ * insertion, cancellation and rescheduling O(1) regardless of the amount of
+ * events held.  This is better suited to queues holding a large amount of
+ * timeouts that are mostly cancelled or rescheduled before they fire.
  */
 
 struct chash {
@@ -172,6 +182,7 @@ struct cqueue {
 	cq_time_t cq_time;			/**< "current time" */
 	const char *cq_name;		/**< Queue name, for logging */
 	struct chash *cq_hash;		/**< Array of buckets for hash list */
+	struct cwheel *cq_wheel;	/**< Timing wheel, when not using cq_hash */
 	struct chash *cq_current;	/**< Current bucket scanned in cq_clock() */
 	elist_t cq_periodic;		/**< Periodic events registered */
 	hset_t *cq_idle;			/**< Idle events registered */
@@ -210,6 +221,41 @@ cqueue_check(const struct cqueue * const cq)
 #define EV_HASH(x) (((x) >> 5) & HASH_MASK)
 #define EV_OVER(x) (((x) >> 5) & ~HASH_MASK)
 
+/*
+ * Timing wheel parameters.
+ *
+ * The wheel ticks at the same resolution as the hash list above (32 units of
+ * virtual time).  Each level has 256 slots, each slot of a given level
+ * spanning the whole range of the level below.  With 4 levels, we can index
+ * up to 2^32 ticks ahead, which is more than what the "int" delay can express.
+ */
+#define WHEEL_SHIFT		5			/**< Tick resolution is 2^5 time units */
+#define WHEEL_BITS		8
+#define WHEEL_SIZE		(1 << WHEEL_BITS)	/**< Slots per level */
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+/**
+ * A hierarchical timing wheel.
+ *
+ * Events are kept unsorted in their slot, the slot being determined by the
+ * tick at which they must fire: level 0 holds events due within the next 256
+ * ticks, level 1 those due within the next 256 * 256 ticks, etc...  Expired
+ * events are moved to the list of due events, which is kept sorted by
+ * increasing trigger time so that events fire in the same order as with the
+ * hash list, those with the same trigger time firing in insertion order.
+ *
+ * When the level-0 wheel completes a turn, the events held in the next slot
+ * of level 1 are redistributed ("cascaded") into level 0, and so on for the
+ * upper levels.  Cascading is lazy: events are only moved down when their
+ * slot is reached, and most events are cancelled before that happens.
+ */
+struct cwheel {
+	struct chash *cw_slot[WHEEL_LEVELS];	/**< Slots of each level */
+	struct chash cw_due;		/**< Expired events, being dispatched */
+	cq_time_t cw_tick;			/**< Next tick to process */
+};
+
 /**
  * Locking of the callout queue for short period of time, in sections that
  * do not encompass memory allocation or do not call other routines that may
@@ -291,19 +337,51 @@ cq_main_thread_id(void)
  * @param name		queue name, for logging
  * @param now		virtual current time -- use 0 if not important
  * @param period	period between heartbeats, in ms
+ * @param backend	how events are indexed
  *
  * @return the initialized object
  */
 static cqueue_t *
-cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
+cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period,
+	enum cq_backend backend)
 {
 	/*
-	 * The cq_hash hash list is used to speed up insert/delete operations.
+	 * The cq_hash hash list (or the cq_wheel timing wheel) is used to speed
+	 * up insert/delete operations.
 	 */
 
 	cq->cq_magic = CQUEUE_MAGIC;
 	cq->cq_name = atom_str_get(name);
-	XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+
+	switch (backend) {
+	case CQ_BACKEND_HASH:
+		XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+		break;
+	case CQ_BACKEND_WHEEL:
+		{
+			struct cwheel *w;
+			struct chash *slots;
+			int i;
+
+			/*
+			 * The slots are allocated as a single array taken from the
+			 * VMM layer: the EVQ creates its queue during auto-initialization
+			 * of the memory allocators, so we cannot use xmalloc() for blocks
+			 * that are small enough to be carved from its page pool.
+			 */
+
+			WALLOC0(w);
+			slots = vmm_alloc0(WHEEL_LEVELS * WHEEL_SIZE * sizeof slots[0]);
+			for (i = 0; i < WHEEL_LEVELS; i++)
+				w->cw_slot[i] = &slots[i * WHEEL_SIZE];
+			w->cw_tick = now >> WHEEL_SHIFT;
+			cq->cq_wheel = w;
+		}
+		break;
+	}
+
+	g_assert(cq->cq_hash != NULL || cq->cq_wheel != NULL);
+
 	cq->cq_time = now;
 	cq->cq_last_bucket = EV_HASH(now);
 	cq->cq_period = period;
@@ -318,26 +396,43 @@ cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
 }
 
 /**
- * Create a new callout queue object.
+ * Create a new callout queue object, specifying how events are indexed.
  *
  * @param name		queue name, for logging
  * @param now		virtual current time -- use 0 if not important
  * @param period	period between heartbeats, in ms
+ * @param backend	how events are indexed
  *
  * @return a new callout queue
  */
 cqueue_t *
-cq_make(const char *name, cq_time_t now, int period)
+cq_make_full(const char *name, cq_time_t now, int period,
+	enum cq_backend backend)
 {
 	cqueue_t *cq;
 
 	WALLOC0(cq);
-	cq_initialize(cq, name, now, period);
+	cq_initialize(cq, name, now, period, backend);
 	cq_vars_add(cq);
 
 	return cq;
 }
 
+/**
+ * Create a new callout queue object.
+ *
+ * @param name		queue name, for logging
+ * @param now		virtual current time -- use 0 if not important
+ * @param period	period between heartbeats, in ms
+ *
+ * @return a new callout queue
+ */
+cqueue_t *
+cq_make(const char *name, cq_time_t now, int period)
+{
+	return cq_make_full(name, now, period, CQ_BACKEND_HASH);
+}
+
 /**
  * @return the amount of items held in the callout queue.
  */
@@ -451,6 +546,334 @@ ev_free(cevent_t *ev)
 	}
 }
 
+/***
+ *** Timing wheel.
+ ***/
+
+/**
+ * Append event at the tail of a timing wheel slot.
+ */
+static inline void
+ev_slot_append(struct chash *ch, cevent_t *ev)
+{
+	ev->ce_bnext = NULL;
+	ev->ce_bprev = ch->ch_tail;
+	ev->ce_bucket = ch;
+
+	if (NULL == ch->ch_tail) {
+		g_assert(NULL == ch->ch_head);
+		ch->ch_head = ev;
+	} else {
+		ch->ch_tail->ce_bnext = ev;
+	}
+
+	ch->ch_tail = ev;
+}
+
+/**
+ * Insert event in a timing wheel slot sorted by increasing trigger time,
+ * after all the events bearing the same trigger time.
+ *
+ * The slot is scanned backwards since expired events are usually moved
+ * in their trigger order.
+ */
+static inline void
+ev_slot_insert_sorted(struct chash *ch, cevent_t *ev)
+{
+	cevent_t *prev;
+
+	for (
+		prev = ch->ch_tail;
+		prev != NULL && prev->ce_time > ev->ce_time;
+		prev = prev->ce_bprev
+	)
+		/* empty */;
+
+	if (NULL == prev) {
+		ev->ce_bprev = NULL;
+		ev->ce_bnext = ch->ch_head;
+		if (NULL == ch->ch_head) {
+			ch->ch_tail = ev;
+		} else {
+			ch->ch_head->ce_bprev = ev;
+		}
+		ch->ch_head = ev;
+	} else {
+		ev->ce_bprev = prev;
+		ev->ce_bnext = prev->ce_bnext;
+		if (NULL == prev->ce_bnext) {
+			ch->ch_tail = ev;
+		} else {
+			prev->ce_bnext->ce_bprev = ev;
+		}
+		prev->ce_bnext = ev;
+	}
+
+	ev->ce_bucket = ch;
+}
+
+/**
+ * Remove event from the timing wheel slot holding it.
+ */
+static inline void
+ev_slot_remove(cevent_t *ev)
+{
+	struct chash *ch = ev->ce_bucket;
+
+	g_assert(ch != NULL);
+
+	if (ch->ch_head == ev)
+		ch->ch_head = ev->ce_bnext;
+	if (ch->ch_tail == ev)
+		ch->ch_tail = ev->ce_bprev;
+
+	if (ev->ce_bprev)
+		ev->ce_bprev->ce_bnext = ev->ce_bnext;
+	if (ev->ce_bnext)
+		ev->ce_bnext->ce_bprev = ev->ce_bprev;
+
+	ev->ce_bucket = NULL;
+}
+
+/**
+ * Compute the timing wheel slot where an event triggering at the specified
+ * time must be held.
+ */
+static struct chash *
+cq_wheel_slot(struct cwheel *w, cq_time_t trigger)
+{
+	cq_time_t tick = trigger >> WHEEL_SHIFT, delta;
+	int level;
+
+	/*
+	 * An event due before the next tick to process goes to that tick:
+	 * it will be triggered at the next clock run.
+	 */
+
+	if G_UNLIKELY(tick < w->cw_tick)
+		tick = w->cw_tick;
+
+	delta = tick - w->cw_tick;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < ((cq_time_t) 1 << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	g_assert(delta < ((cq_time_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)));
+
+	return &w->cw_slot[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+}
+
+/**
+ * Link event into the timing wheel of the callout queue.
+ */
+static void
+ev_wheel_link(cqueue_t *cq, cevent_t *ev)
+{
+	struct cwheel *w = cq->cq_wheel;
+
+	/*
+	 * When we are within cq_clock(), an event scheduled before the current
+	 * time must be triggered during the current run.
+	 */
+
+	if (cq->cq_current != NULL && ev->ce_time <= cq->cq_time)
+		ev_slot_insert_sorted(&w->cw_due, ev);
+	else
+		ev_slot_append(cq_wheel_slot(w, ev->ce_time), ev);
+}
+
+/**
+ * Redistribute events held in upper levels of the timing wheel after the
+ * level-0 wheel completed a turn.
+ */
+static void
+cq_wheel_cascade(cqueue_t *cq)
+{
+	struct cwheel *w = cq->cq_wheel;
+	int level;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		struct chash *ch;
+		cevent_t *ev;
+		size_t idx;
+
+		/*
+		 * We cascade level `n' only when level `n - 1' completed its turn.
+		 */
+
+		if (0 != ((w->cw_tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK))
+			break;
+
+		idx = (w->cw_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		ch = &w->cw_slot[level][idx];
+
+		while (NULL != (ev = ch->ch_head)) {
+			ev_slot_remove(ev);
+			ev_slot_append(cq_wheel_slot(w, ev->ce_time), ev);
+		}
+	}
+}
+
+/**
+ * Heartbeat of the timing wheel: trigger all the events that have expired.
+ *
+ * @return the amount of triggered events.
+ */
+static size_t
+cq_wheel_clock(cqueue_t *cq)
+{
+	struct cwheel *w = cq->cq_wheel;
+	cq_time_t now = cq->cq_time;
+	cq_time_t last = now >> WHEEL_SHIFT;
+	size_t processed = 0;
+
+	assert_mutex_is_owned(&cq->cq_lock);
+
+	cq->cq_current = &w->cw_due;
+
+	for (;;) {
+		struct chash *ch = &w->cw_slot[0][w->cw_tick & WHEEL_MASK];
+		cevent_t *ev, *next;
+
+		/*
+		 * Move expired events of the slot to the list of due events
+		 * before triggering them, since callbacks can alter the slot.
+		 * The slot is unsorted, hence the sorted insertion in the list.
+		 *
+		 * Only the slot of the current tick can contain events that are
+		 * not expired yet, all the events of previous ticks are.
+		 */
+
+		for (ev = ch->ch_head; ev != NULL; ev = next) {
+			next = ev->ce_bnext;
+			if (ev->ce_time <= now) {
+				ev_slot_remove(ev);
+				ev_slot_insert_sorted(&w->cw_due, ev);
+			}
+		}
+
+		while (NULL != (ev = w->cw_due.ch_head)) {
+			cq_expire_internal(cq, ev);
+			processed++;
+		}
+
+		/*
+		 * We never move past the current tick, since it can still receive
+		 * events triggering before the end of the tick.
+		 */
+
+		if (w->cw_tick >= last)
+			break;
+
+		w->cw_tick++;
+
+		if (0 == (w->cw_tick & WHEEL_MASK))
+			cq_wheel_cascade(cq);
+	}
+
+	return processed;
+}
+
+/**
+ * Compute the earliest trigger time of events held in a wheel slot.
+ */
+static cq_time_t
+cq_wheel_slot_min(const struct chash *ch)
+{
+	const cevent_t *ev;
+	cq_time_t min = MAX_INT_VAL(cq_time_t);
+
+	for (ev = ch->ch_head; ev != NULL; ev = ev->ce_bnext) {
+		if (ev->ce_time < min)
+			min = ev->ce_time;
+	}
+
+	return min;
+}
+
+/**
+ * Compute delay until the next event registered in the timing wheel.
+ *
+ * Within a level, slots are ordered by increasing trigger time from the
+ * current position, but a higher level can hold events that are due sooner
+ * than events of a lower level, until they are cascaded.  Hence we need to
+ * look at the first non-empty slot of each level.
+ */
+static int
+cq_wheel_delay(const cqueue_t *cq)
+{
+	const struct cwheel *w = cq->cq_wheel;
+	cq_time_t min = MAX_INT_VAL(cq_time_t);
+	int level;
+
+	if (w->cw_due.ch_head != NULL)
+		return 0;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		size_t base = (w->cw_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		size_t i, first, end;
+
+		/*
+		 * In upper levels, the current slot was already cascaded and can only
+		 * hold events due one full turn later, hence is the last one to look.
+		 */
+
+		first = 0 == level ? 0 : 1;
+		end = first + WHEEL_SIZE;
+
+		for (i = first; i < end; i++) {
+			const struct chash *ch = &w->cw_slot[level][(base + i) & WHEEL_MASK];
+
+			if (ch->ch_head != NULL) {
+				cq_time_t t = cq_wheel_slot_min(ch);
+				min = MIN(min, t);
+				break;
+			}
+		}
+	}
+
+	if (MAX_INT_VAL(cq_time_t) == min)
+		return MAX_INT_VAL(int);
+
+	if (min <= cq->cq_time)
+		return 0;
+
+	min -= cq->cq_time;
+
+	return min > MAX_INT_VAL(int) ? MAX_INT_VAL(int) : (int) min;
+}
+
+/**
+ * Free all the events held in the timing wheel.
+ */
+static void
+cq_wheel_free(cqueue_t *cq)
+{
+	struct cwheel *w = cq->cq_wheel;
+	cevent_t *ev;
+	int level, i;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (i = 0; i < WHEEL_SIZE; i++) {
+			while (NULL != (ev = w->cw_slot[level][i].ch_head)) {
+				ev_slot_remove(ev);
+				ev_free(ev);
+			}
+		}
+	}
+
+	while (NULL != (ev = w->cw_due.ch_head)) {
+		ev_slot_remove(ev);
+		ev_free(ev);
+	}
+
+	vmm_free(w->cw_slot[0], WHEEL_LEVELS * WHEEL_SIZE * sizeof w->cw_slot[0][0]);
+	WFREE(w);
+	cq->cq_wheel = NULL;
+}
+
 /**
  * Link event into the callout queue.
  */
@@ -472,6 +895,11 @@ ev_link(cevent_t *ev)
 	trigger = ev->ce_time;
 	cq->cq_items++;
 
+	if (cq->cq_wheel != NULL) {
+		ev_wheel_link(cq, ev);
+		return;
+	}
+
 	/*
 	 * Important corner case: we may be rescheduling an event BEFORE
 	 * the current clock time, in which case we must insert the event
@@ -562,9 +990,15 @@ ev_unlink(cevent_t *ev)
 	cqueue_check(cq);
 	assert_mutex_is_owned(&cq->cq_lock);
 
-	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
 	cq->cq_items--;
 
+	if (cq->cq_wheel != NULL) {
+		ev_slot_remove(ev);
+		return;
+	}
+
+	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
+
 	/*
 	 * Unlinking the item is straigthforward, unlike insertion!
 	 */
@@ -1044,7 +1478,13 @@ cq_expire_internal(cqueue_t *cq, cevent_t *ev)
 	g_assert(fn != NULL);
 
 	CQ_UNLOCK(cq);
-	(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+	{
+		static lprobe_t *probe;
+		uint64 start = lprobe_start();
+
+		(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+		lprobe_end(&probe, "callout", start);
+	}
 	CQ_LOCK(cq);
 
 	/*
@@ -1180,6 +1620,11 @@ cq_clock(cqueue_t *cq, int elapsed)
 	cq->cq_time += elapsed;
 	now = cq->cq_time;
 
+	if (cq->cq_wheel != NULL) {
+		processed = cq_wheel_clock(cq);
+		goto done;
+	}
+
 	bucket = cq->cq_last_bucket;		/* Bucket we traversed last time */
 	ch = &cq->cq_hash[bucket];
 	last_bucket = EV_HASH(now);			/* Last bucket to traverse now */
@@ -1315,33 +1760,38 @@ cq_delay(const cqueue_t *cq)
 	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
 	now = cq->cq_time;
 
-	for (i = 0; i < HASH_SIZE; i++) {
-		int b = (last_bucket + i) & HASH_MASK;
-		struct chash *ch = &cq->cq_hash[b];
-		cevent_t *ev = ch->ch_head;
-		int edelay;
-
-		/*
-		 * If the delay we have so far is not too large (does not overflow
-		 * the size of the hashing array) and we have moved away from the
-		 * last scanned bucket by an amount that is large-enough, we know
-		 * we cannot find a smaller delay ahead in the buckets.
-		 */
-
-		if (!EV_OVER(delay) && i > EV_HASH(delay))
-			break;
-
-		if (NULL == ev)
-			continue;
-
-		edelay = ev->ce_time - now;
+	if (cq->cq_wheel != NULL) {
+		delay = cq_wheel_delay(cq);
+		i = 0;
+	} else {
+		for (i = 0; i < HASH_SIZE; i++) {
+			int b = (last_bucket + i) & HASH_MASK;
+			struct chash *ch = &cq->cq_hash[b];
+			cevent_t *ev = ch->ch_head;
+			int edelay;
+
+			/*
+			 * If the delay we have so far is not too large (does not overflow
+			 * the size of the hashing array) and we have moved away from the
+			 * last scanned bucket by an amount that is large-enough, we know
+			 * we cannot find a smaller delay ahead in the buckets.
+			 */
+
+			if (!EV_OVER(delay) && i > EV_HASH(delay))
+				break;
+
+			if (NULL == ev)
+				continue;
+
+			edelay = ev->ce_time - now;
+
+			if G_UNLIKELY(edelay <= 0) {
+				delay = 0;
+				break;
+			}
 
-		if G_UNLIKELY(edelay <= 0) {
-			delay = 0;
-			break;
+			delay = MIN(delay, edelay);
 		}
-
-		delay = MIN(delay, edelay);
 	}
 
 	/*
@@ -1802,21 +2252,24 @@ csubqueue_check(const struct csubqueue * const csq)
 }
 
 /**
- * Create a new callout queue subordinate to another.
+ * Create a new callout queue subordinate to another, specifying how events
+ * are indexed.
  *
  * @param name		the name of the subqueue
  * @param parent	the parent callout queue
  * @param period	period between heartbeats, in ms
+ * @param backend	how events are indexed
  *
  * @return a new callout queue
  */
 cqueue_t *
-cq_submake(const char *name, cqueue_t *parent, int period)
+cq_submake_full(const char *name, cqueue_t *parent, int period,
+	enum cq_backend backend)
 {
 	struct csubqueue *csq;
 
 	WALLOC0(csq);
-	cq_initialize(&csq->sub_cq, name, parent->cq_time, period);
+	cq_initialize(&csq->sub_cq, name, parent->cq_time, period, backend);
 	csq->sub_cq.cq_magic = CSUBQUEUE_MAGIC;
 	csq->sub_cq.cq_stid = parent->cq_stid;	/* Runs out of same thread */
 
@@ -1831,6 +2284,21 @@ cq_submake(const char *name, cqueue_t *parent, int period)
 	return &csq->sub_cq;
 }
 
+/**
+ * Create a new callout queue subordinate to another.
+ *
+ * @param name		the name of the subqueue
+ * @param parent	the parent callout queue
+ * @param period	period between heartbeats, in ms
+ *
+ * @return a new callout queue
+ */
+cqueue_t *
+cq_submake(const char *name, cqueue_t *parent, int period)
+{
+	return cq_submake_full(name, parent, period, CQ_BACKEND_HASH);
+}
+
 /**
  * Convenience routine: insert event in the main callout queue.
  *
@@ -2127,7 +2595,14 @@ cq_global_init(void)
 	(void) tm_now_exact(NULL);
 
 	cq_debug_ptr = &zero;
-	callout_queue = cq_make("main", 0, CALLOUT_PERIOD);
+
+	/*
+	 * The main callout queue holds most of the timeouts of the application,
+	 * the vast majority of which are cancelled or rescheduled before they
+	 * fire: use a timing wheel to make these operations O(1).
+	 */
+
+	callout_queue = cq_make_full("main", 0, CALLOUT_PERIOD, CQ_BACKEND_WHEEL);
 
 	/*
 	 * If the main thread is blockable, instantiate the callout queue in
@@ -2274,10 +2749,14 @@ cq_free(cqueue_t *cq)
 
 	mutex_lock(&cq->cq_lock);
 
-	for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
-		for (ev = ch->ch_head; ev; ev = ev_next) {
-			ev_next = ev->ce_bnext;
-			ev_free(ev);
+	if (cq->cq_wheel != NULL) {
+		cq_wheel_free(cq);
+	} else {
+		for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
+			for (ev = ch->ch_head; ev; ev = ev_next) {
+				ev_next = ev->ce_bnext;
+				ev_free(ev);
+			}
 		}
 	}
 
@@ -60,6 +60,14 @@ typedef bool (*cq_invoke_t)(void *udata);
 
 typedef uint64 cq_time_t;		/**< Virtual time for callout queue */
 
+/**
+ * Event indexing structure used by a callout queue, chosen at creation time.
+ */
+enum cq_backend {
+	CQ_BACKEND_HASH = 0,		/**< Hash list of sorted buckets */
+	CQ_BACKEND_WHEEL			/**< Hierarchical timing wheel */
+};
+
 enum cq_info_magic { CQ_INFO_MAGIC = 0x12c867d4 };
 
 /**
@@ -99,7 +107,11 @@ void cq_close(void);
 
 cqueue_t *cq_main(void);
 cqueue_t *cq_make(const char *name, cq_time_t now, int period);
+cqueue_t *cq_make_full(const char *name, cq_time_t now, int period,
+	enum cq_backend backend);
 cqueue_t *cq_submake(const char *name, cqueue_t *parent, int period);
+cqueue_t *cq_submake_full(const char *name, cqueue_t *parent, int period,
+	enum cq_backend backend);
 cqueue_t *cq_main_submake(const char *name, int period);
 void cq_free_null(cqueue_t **cq_ptr);
 cevent_t *cq_insert(cqueue_t *cq, int delay, cq_service_t fn, void *arg);
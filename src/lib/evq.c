@@ -286,7 +286,7 @@ evq_init_once(void)
 	 * first call cq_heartbeat() on it.
 	 */
 
-	ev_queue = cq_make("evq", 0, EVQ_PERIOD);
+	ev_queue = cq_make_full("evq", 0, EVQ_PERIOD, CQ_BACKEND_WHEEL);
 	atomic_bool_set(&evq_run, TRUE);
 
 	/*
@@ -0,0 +1,362 @@
+/*
+ * guidtab-test -- GUID table tests and benchmarking.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/ascii.h"
+#include "lib/atoms.h"
+#include "lib/guidtab.h"
+#include "lib/hashing.h"
+#include "lib/hset.h"
+#include "lib/misc.h"
+#include "lib/parse.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#include "if/core/guid.h"
+
+#define TEST_WINDOW		(64 * 16384)	/* Default amount of messages kept */
+#define TEST_MESSAGES	8000000			/* Default synthetic stream length */
+#define TEST_DUPS		30				/* Default percentage of duplicates */
+
+static bool silent_mode;
+
+/**
+ * A message from the replayed stream.
+ */
+struct msg {
+	struct guid muid;
+	uint8 function;
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hS] [-c window] [-d dups] [-n msgs] [-R seed] [file]\n"
+		"  -c : sets amount of messages remembered (routing table size)\n"
+		"  -d : sets percentage of duplicates in synthetic stream\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of messages in synthetic stream\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -S : silent mode -- only print the timing summary\n"
+		"The file holds a recorded stream, one message per line: the MUID\n"
+		"in hexadecimal followed by the message function in hexadecimal.\n"
+		"Without a file, a synthetic stream is generated.\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Load recorded stream of messages from file.
+ *
+ * @return the array of messages, with the amount loaded in ``cnt''.
+ */
+static struct msg *
+stream_load(const char *path, size_t *cnt)
+{
+	struct msg *stream = NULL;
+	size_t n = 0, size = 0, line = 0;
+	char buf[256];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (NULL == f)
+		s_fatal_exit(EXIT_FAILURE, "can't open %s: %m", path);
+
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		const char *p = buf, *end;
+		uint32 function;
+		int error;
+
+		line++;
+
+		while (is_ascii_space(*p))
+			p++;
+
+		if ('\0' == *p || '#' == *p)
+			continue;
+
+		if (n == size) {
+			size = MAX(size * 2, 1024);
+			XREALLOC_ARRAY(stream, size);
+		}
+
+		if (!hex_to_guid(p, &stream[n].muid))
+			s_fatal_exit(EXIT_FAILURE, "%s:%zu: bad MUID", path, line);
+
+		p = skip_ascii_spaces(p + GUID_HEX_SIZE);
+		function = parse_uint32(p, &end, 16, &error);
+
+		if (error || function > MAX_INT_VAL(uint8))
+			s_fatal_exit(EXIT_FAILURE, "%s:%zu: bad function", path, line);
+
+		stream[n++].function = function;
+	}
+
+	fclose(f);
+	*cnt = n;
+	return stream;
+}
+
+/**
+ * Generate synthetic stream of messages, with a percentage of duplicates
+ * picked among the recent messages.
+ *
+ * @return the array of messages.
+ */
+static struct msg *
+stream_generate(size_t cnt, uint dups, size_t window)
+{
+	static const uint8 functions[] = { 0x00, 0x80, 0x81, 0x40, 0x01 };
+	struct msg *stream;
+	size_t i;
+
+	XMALLOC_ARRAY(stream, cnt);
+
+	for (i = 0; i < cnt; i++) {
+		struct msg *m = &stream[i];
+
+		if (i != 0 && rand31_value(99) < dups) {
+			size_t back = 1 + rand31_value(MIN(i, window) - 1);
+			*m = stream[i - back];
+		} else {
+			rand31_bytes(&m->muid, sizeof m->muid);
+			m->function = functions[rand31_value(N_ITEMS(functions) - 1)];
+		}
+	}
+
+	return stream;
+}
+
+/*
+ * Both runs below mimic the routing table: messages are remembered in
+ * a ring of ``window'' entries and forgotten when their slot is recycled.
+ */
+
+static uint
+msg_hash(const void *key)
+{
+	const struct msg *m = key;
+
+	return integer_hash_fast(m->function) ^
+		universal_hash(&m->muid, GUID_RAW_SIZE);
+}
+
+static uint
+msg_hash2(const void *key)
+{
+	const struct msg *m = key;
+
+	return integer_hash2(m->function) ^ binary_hash2(&m->muid, GUID_RAW_SIZE);
+}
+
+static int
+msg_eq(const void *p, const void *q)
+{
+	const struct msg *a = p, *b = q;
+
+	return a->function == b->function && guid_eq(&a->muid, &b->muid);
+}
+
+/**
+ * Replay stream through a grouped hash set of messages.
+ *
+ * @return amount of duplicates seen.
+ */
+static size_t
+replay_hset(const struct msg *stream, size_t cnt, size_t window,
+	double *elapsed)
+{
+	struct msg *ring;
+	hset_t *hs;
+	tm_t start, end;
+	size_t i, pos = 0, dups = 0;
+
+	XMALLOC0_ARRAY(ring, window);
+	hs = hset_create_any(msg_hash, msg_hash2, msg_eq);
+	hset_grouped(hs);
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < cnt; i++) {
+		const struct msg *m = &stream[i];
+		struct msg *slot;
+
+		if (hset_contains(hs, m)) {
+			dups++;
+			continue;
+		}
+
+		slot = &ring[pos];
+		hset_remove(hs, slot);
+		*slot = *m;
+		hset_insert(hs, slot);
+		pos = (pos + 1) % window;
+	}
+
+	tm_now_exact(&end);
+	*elapsed = tm_elapsed_f(&end, &start);
+
+	hset_free_null(&hs);
+	XFREE_NULL(ring);
+
+	return dups;
+}
+
+/**
+ * Replay stream through a GUID table.
+ *
+ * @return amount of duplicates seen.
+ */
+static size_t
+replay_guidtab(const struct msg *stream, size_t cnt, size_t window,
+	double *elapsed)
+{
+	struct msg *ring;
+	guidtab_t *gt;
+	tm_t start, end;
+	size_t i, pos = 0, dups = 0;
+
+	XMALLOC0_ARRAY(ring, window);
+	gt = guidtab_make(0);
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < cnt; i++) {
+		const struct msg *m = &stream[i];
+		struct msg *slot;
+
+		if (guidtab_lookup(gt, &m->muid, m->function) != NULL) {
+			dups++;
+			continue;
+		}
+
+		slot = &ring[pos];
+		guidtab_remove(gt, &slot->muid, slot->function);
+		*slot = *m;
+		guidtab_insert(gt, &slot->muid, slot->function, slot);
+		pos = (pos + 1) % window;
+	}
+
+	tm_now_exact(&end);
+	*elapsed = tm_elapsed_f(&end, &start);
+
+	if (guidtab_count(gt) > window)
+		s_error("guidtab: holding %zu items, window is %zu",
+			guidtab_count(gt), window);
+
+	guidtab_free_null(&gt);
+	XFREE_NULL(ring);
+
+	return dups;
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t window = TEST_WINDOW;
+	size_t count = TEST_MESSAGES;
+	uint dups = TEST_DUPS;
+	unsigned rseed = 0;
+	struct msg *stream;
+	double e_hset, e_guidtab;
+	size_t d_hset, d_guidtab;
+	int c;
+	const char options[] = "c:d:hn:R:S";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of messages remembered */
+			window = atol(optarg);
+			break;
+		case 'd':			/* percentage of duplicates */
+			dups = atoi(optarg);
+			break;
+		case 'n':			/* amount of messages */
+			count = atol(optarg);
+			break;
+		case 'R':			/* random seed */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1 || 0 == window || dups > 100)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	if (1 == argc)
+		stream = stream_load(argv[0], &count);
+	else
+		stream = stream_generate(count, dups, window);
+
+	d_hset = replay_hset(stream, count, window, &e_hset);
+	d_guidtab = replay_guidtab(stream, count, window, &e_guidtab);
+
+	if (d_hset != d_guidtab)
+		s_error("duplicate mismatch: hset saw %zu, guidtab saw %zu",
+			d_hset, d_guidtab);
+
+	if (!silent_mode) {
+		printf("replayed %zu message%s, %zu duplicate%s, window of %zu\n",
+			PLURAL(count), PLURAL(d_hset), window);
+	}
+
+	printf("hset %.3f ns/msg, guidtab %.3f ns/msg (x%.2f)\n",
+		e_hset * 1e9 / MAX(count, 1),
+		e_guidtab * 1e9 / MAX(count, 1),
+		0.0 == e_guidtab ? 0.0 : e_hset / e_guidtab);
+
+	XFREE_NULL(stream);
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Open-addressed table of GUIDs.
+ *
+ * This is a specialized hash table mapping a GUID and a "kind" byte (for
+ * instance the Gnutella function of the message bearing the GUID) to an
+ * opaque value.  It is meant for large, lookup-heavy tables like the one
+ * used for message routing, where every incoming message is looked up.
+ *
+ * Unlike generic hash tables, which only store a pointer to the key, the
+ * 16-byte GUID and the kind byte are stored inline in the slot, along with
+ * the hashed value and the associated value, filling 32 bytes on 64-bit
+ * machines: checking a candidate slot therefore never requires touching
+ * the memory where the caller keeps its own data.
+ *
+ * The layout is the same as the "grouped" one of hash tables, and relies
+ * on the same probing routines from hgroup.h: one control byte per slot
+ * holds the 7 leading bits of the hashed value of the GUID (the tag) or
+ * flags the slot as free.  Lookups probe the table linearly, a whole group
+ * of control bytes at a time.  The first group holding a free slot ends
+ * the lookup.
+ *
+ * Deletions do not erect tombstones: entries following the hole in the probe
+ * sequence are moved back when possible, so a table where items are
+ * constantly inserted and removed does not degrade over time.
+ *
+ * The table has no aging policy of its own: the caller removes the entries
+ * when it recycles the data they refer to.
+ *
+ * The table is not thread-safe.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "guidtab.h"
+
+#include "endian.h"
+#include "hgroup.h"
+#include "pow2.h"
+#include "rand31.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "if/core/guid.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define GUIDTAB_MIN_BITS	5		/**< Minimum table size: 32 slots */
+
+/*
+ * Multipliers for hashing GUIDs.
+ */
+#define GUIDTAB_MUL1	UINT64_CONST(0x9E3779B97F4A7C15)
+#define GUIDTAB_MUL2	UINT64_CONST(0xC2B2AE3D27D4EB4F)
+
+/**
+ * A table slot, which is meaningful only when its control byte holds a tag.
+ */
+struct guidtab_slot {
+	struct guid guid;			/**< The GUID */
+	const void *value;			/**< Associated value */
+	uint32 hv;					/**< Hashed value of GUID and kind */
+	uint8 kind;					/**< Kind of GUID */
+};
+
+enum guidtab_magic { GUIDTAB_MAGIC = 0x3c6a91d5 };
+
+/**
+ * A GUID table.
+ */
+struct guidtab {
+	enum guidtab_magic magic;	/**< Magic number */
+	size_t bits;				/**< Table size is 2^bits slots */
+	size_t items;				/**< Amount of items held */
+	size_t arena;				/**< Size of the allocated arena */
+	struct guidtab_slot *slots;	/**< The slots */
+	uint8 *ctrl;				/**< Control bytes, first group cloned at end */
+	uint64 seed[2];				/**< Random hashing perturbation */
+};
+
+static inline void
+guidtab_check(const struct guidtab * const gt)
+{
+	g_assert(gt != NULL);
+	g_assert(GUIDTAB_MAGIC == gt->magic);
+}
+
+/**
+ * Hash GUID and kind.
+ *
+ * GUIDs come from the network and are therefore under the control of remote
+ * parties: the random seeds of the table prevent complexity attacks.
+ */
+static inline ALWAYS_INLINE uint32
+guidtab_hash(const guidtab_t *gt, const struct guid *g, uint8 kind)
+{
+	uint64 h;
+
+	h = (peek_le64(&g->v[0]) ^ gt->seed[0]) * GUIDTAB_MUL1;
+	h ^= (peek_le64(&g->v[8]) ^ gt->seed[1]) + kind;
+	h ^= h >> 32;
+	h *= GUIDTAB_MUL2;
+
+	return h >> 32;
+}
+
+/**
+ * @return table size, in slots.
+ */
+static inline size_t
+guidtab_size(const guidtab_t *gt)
+{
+	return (size_t) 1 << gt->bits;
+}
+
+/**
+ * Set control byte for given slot, updating the cloned first group.
+ */
+static inline void
+guidtab_ctrl_set(guidtab_t *gt, size_t idx, uint8 c)
+{
+	hgroup_ctrl_set(gt->ctrl, guidtab_size(gt), idx, c);
+}
+
+/**
+ * Allocate an empty arena for a table of 2^bits slots.
+ */
+static void
+guidtab_arena_alloc(guidtab_t *gt, size_t bits)
+{
+	size_t size = (size_t) 1 << bits;
+
+	gt->bits = bits;
+	gt->arena = round_pagesize(size * sizeof gt->slots[0] +
+		size + HGROUP_SIZE - 1);
+	gt->slots = vmm_alloc(gt->arena);
+	gt->ctrl = (uint8 *) &gt->slots[size];
+	memset(gt->ctrl, HGROUP_CTRL_EMPTY, size + HGROUP_SIZE - 1);
+}
+
+/**
+ * Locate GUID in the table.
+ *
+ * @param gt		the GUID table
+ * @param g			the GUID we are looking for
+ * @param kind		the kind of GUID
+ * @param hv		the hashed value of GUID and kind
+ * @param idx		where the GUID was found or can be inserted
+ *
+ * @return TRUE if found with idx holding the index of the slot, FALSE
+ * otherwise with idx holding the insertion index.
+ */
+static bool G_HOT
+guidtab_find(const guidtab_t *gt, const struct guid *g, uint8 kind,
+	uint32 hv, size_t *idx)
+{
+	const uint8 tag = HGROUP_CTRL_TAG(hv);
+	size_t i, mask, probed;
+
+	mask = guidtab_size(gt) - 1;
+	i = hv & mask;
+
+	/*
+	 * The table is never full, hence we will always find a free slot,
+	 * and since deletions leave no hole in the probing sequences, the
+	 * first group holding a free slot ends the search.
+	 */
+
+	for (probed = 0; probed <= mask; probed += HGROUP_SIZE) {
+		const uint8 *c = &gt->ctrl[i];
+		hgroup_mask_t m;
+
+		for (m = hgroup_match(c, tag); m != 0; m &= m - 1) {
+			size_t j = (i + hgroup_first(m)) & mask;
+			const struct guidtab_slot *s = &gt->slots[j];
+
+			if (
+				s->hv == hv && s->kind == kind &&
+				0 == memcmp(&s->guid, g, sizeof s->guid)
+			) {
+				*idx = j;
+				return TRUE;
+			}
+		}
+
+		m = hgroup_available(c);		/* No tombstones: all are free */
+		if (m != 0) {
+			*idx = (i + hgroup_first(m)) & mask;
+			return FALSE;
+		}
+
+		i = (i + HGROUP_SIZE) & mask;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Resize table to 2^bits slots, re-inserting all the items.
+ */
+static void
+guidtab_resize(guidtab_t *gt, size_t bits)
+{
+	struct guidtab_slot *old_slots = gt->slots;
+	const uint8 *old_ctrl = gt->ctrl;
+	size_t old_size = guidtab_size(gt), old_arena = gt->arena;
+	size_t i, mask;
+
+	g_assert(bits >= GUIDTAB_MIN_BITS);
+	g_assert(((size_t) 1 << bits) > gt->items);
+
+	guidtab_arena_alloc(gt, bits);
+	mask = guidtab_size(gt) - 1;
+
+	/*
+	 * Since we know all the keys are distinct, we only need to find the
+	 * first free slot after the home slot of each item.
+	 */
+
+	for (i = 0; i < old_size; i++) {
+		const struct guidtab_slot *s = &old_slots[i];
+		size_t j;
+
+		if (old_ctrl[i] & HGROUP_CTRL_EMPTY)
+			continue;
+
+		for (j = s->hv & mask; 0 == (gt->ctrl[j] & HGROUP_CTRL_EMPTY); /**/)
+			j = (j + 1) & mask;
+
+		gt->slots[j] = *s;
+		guidtab_ctrl_set(gt, j, old_ctrl[i]);
+	}
+
+	vmm_free(old_slots, old_arena);
+}
+
+/**
+ * Create a new GUID table.
+ *
+ * @param hint		expected amount of items, 0 if unknown
+ *
+ * @return a new table, to be freed with guidtab_free_null().
+ */
+guidtab_t *
+guidtab_make(size_t hint)
+{
+	guidtab_t *gt;
+	size_t bits = GUIDTAB_MIN_BITS;
+
+	/*
+	 * Tables are resized when they are 3/4 full.
+	 */
+
+	while (((size_t) 3 << bits) / 4 < hint)
+		bits++;
+
+	WALLOC0(gt);
+	gt->magic = GUIDTAB_MAGIC;
+	rand31_bytes(gt->seed, sizeof gt->seed);
+	guidtab_arena_alloc(gt, bits);
+
+	return gt;
+}
+
+/**
+ * Free GUID table and nullify its pointer.
+ */
+void
+guidtab_free_null(guidtab_t **gt_ptr)
+{
+	guidtab_t *gt = *gt_ptr;
+
+	if (gt != NULL) {
+		guidtab_check(gt);
+		vmm_free(gt->slots, gt->arena);
+		gt->magic = 0;
+		WFREE(gt);
+		*gt_ptr = NULL;
+	}
+}
+
+/**
+ * Lookup GUID in the table.
+ *
+ * @param gt		the GUID table
+ * @param g			the GUID to look for
+ * @param kind		the kind of GUID
+ *
+ * @return the value associated with the GUID, NULL if not found.
+ */
+void *
+guidtab_lookup(const guidtab_t *gt, const struct guid *g, uint8 kind)
+{
+	size_t idx;
+
+	guidtab_check(gt);
+	g_assert(g != NULL);
+
+	if (guidtab_find(gt, g, kind, guidtab_hash(gt, g, kind), &idx))
+		return deconstify_pointer(gt->slots[idx].value);
+
+	return NULL;
+}
+
+/**
+ * Insert GUID in the table, replacing the value of an existing entry.
+ *
+ * @param gt		the GUID table
+ * @param g			the GUID to insert (copied)
+ * @param kind		the kind of GUID
+ * @param value		the associated value, must not be NULL
+ */
+void
+guidtab_insert(guidtab_t *gt,
+	const struct guid *g, uint8 kind, const void *value)
+{
+	struct guidtab_slot *s;
+	uint32 hv;
+	size_t idx;
+
+	guidtab_check(gt);
+	g_assert(g != NULL);
+	g_assert(value != NULL);
+
+	hv = guidtab_hash(gt, g, kind);
+
+	if (guidtab_find(gt, g, kind, hv, &idx)) {
+		gt->slots[idx].value = value;
+		return;
+	}
+
+	if G_UNLIKELY(gt->items + 1 > (guidtab_size(gt) / 4) * 3) {
+		guidtab_resize(gt, gt->bits + 1);
+		guidtab_find(gt, g, kind, hv, &idx);
+	}
+
+	s = &gt->slots[idx];
+	s->guid = *g;
+	s->value = value;
+	s->hv = hv;
+	s->kind = kind;
+	guidtab_ctrl_set(gt, idx, HGROUP_CTRL_TAG(hv));
+	gt->items++;
+}
+
+/**
+ * hgroup_shift_back() callback: home slot of the item at given index.
+ */
+static size_t
+guidtab_home(const void *data, size_t idx)
+{
+	const guidtab_t *gt = data;
+
+	if (gt->ctrl[idx] & HGROUP_CTRL_EMPTY)
+		return (size_t) -1;
+
+	return gt->slots[idx].hv & (guidtab_size(gt) - 1);
+}
+
+/**
+ * hgroup_shift_back() callback: move item to the free slot at "to".
+ */
+static void
+guidtab_move(void *data, size_t to, size_t from)
+{
+	guidtab_t *gt = data;
+
+	gt->slots[to] = gt->slots[from];
+	guidtab_ctrl_set(gt, to, gt->ctrl[from]);
+	guidtab_ctrl_set(gt, from, HGROUP_CTRL_EMPTY);
+}
+
+/**
+ * Remove GUID from the table.
+ *
+ * The items following the freed slot in the probing sequence are moved
+ * back when the hole lies between their home slot and their position.
+ *
+ * @param gt		the GUID table
+ * @param g			the GUID to remove
+ * @param kind		the kind of GUID
+ *
+ * @return TRUE if the GUID was found and removed.
+ */
+bool
+guidtab_remove(guidtab_t *gt, const struct guid *g, uint8 kind)
+{
+	size_t idx;
+
+	guidtab_check(gt);
+	g_assert(g != NULL);
+
+	if (!guidtab_find(gt, g, kind, guidtab_hash(gt, g, kind), &idx))
+		return FALSE;
+
+	guidtab_ctrl_set(gt, idx, HGROUP_CTRL_EMPTY);
+	gt->items--;
+	hgroup_shift_back(idx, guidtab_size(gt) - 1,
+		guidtab_home, guidtab_move, gt);
+
+	/*
+	 * Shrink table when it becomes mostly empty.
+	 */
+
+	if G_UNLIKELY(
+		gt->bits > GUIDTAB_MIN_BITS && gt->items < guidtab_size(gt) / 8
+	)
+		guidtab_resize(gt, gt->bits - 1);
+
+	return TRUE;
+}
+
+/**
+ * Remove all the items from the table, shrinking it to its minimum size.
+ */
+void
+guidtab_clear(guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	vmm_free(gt->slots, gt->arena);
+	gt->items = 0;
+	guidtab_arena_alloc(gt, GUIDTAB_MIN_BITS);
+}
+
+/**
+ * @return amount of items held in the table.
+ */
+size_t
+guidtab_count(const guidtab_t *gt)
+{
+	guidtab_check(gt);
+
+	return gt->items;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
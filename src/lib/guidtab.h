@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Open-addressed table of GUIDs.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _guidtab_h_
+#define _guidtab_h_
+
+typedef struct guidtab guidtab_t;
+
+struct guid;
+
+/*
+ * Public interface.
+ */
+
+guidtab_t *guidtab_make(size_t hint);
+void guidtab_free_null(guidtab_t **gt_ptr);
+
+void *guidtab_lookup(const guidtab_t *gt, const struct guid *g, uint8 kind);
+void guidtab_insert(guidtab_t *gt,
+	const struct guid *g, uint8 kind, const void *value);
+bool guidtab_remove(guidtab_t *gt, const struct guid *g, uint8 kind);
+void guidtab_clear(guidtab_t *gt);
+size_t guidtab_count(const guidtab_t *gt);
+
+#endif /* _guidtab_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,259 @@
+/*
+ * hash-test -- hash set layout tests and benchmarking.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/hset.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/sha1.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_ITEMS		100000	/* Default amount of items in set */
+#define TEST_OPS		4000000	/* Default amount of operations */
+
+static bool silent_mode;
+static unsigned initial_seed;
+
+struct run {
+	const char *name;
+	bool grouped;
+	double elapsed;
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hS] [-c items] [-n ops] [-R seed]\n"
+		"  -c : sets amount of items held in the set\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of operations on the set\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -S : silent mode -- only print the timing summary\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Run a mix of successful lookups, failed lookups and replacements on
+ * a set holding half of the supplied keys.
+ *
+ * Keys at even indices are inserted initially, keys at odd indices are
+ * missing: this lets us check the outcome of each lookup.  Replacements
+ * remove a present key and insert its missing neighbour, swapping them.
+ */
+static void
+run_set(struct run *r, hset_t *hs, const void **keys, size_t cnt, size_t ops)
+{
+	bool *present;
+	tm_t start, end;
+	size_t i, n = 2 * cnt;
+
+	rand31_set_seed(initial_seed);
+
+	if (r->grouped)
+		hset_grouped(hs);
+
+	XMALLOC0_ARRAY(present, n);
+
+	for (i = 0; i < n; i += 2) {
+		hset_insert(hs, keys[i]);
+		present[i] = TRUE;
+	}
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < ops; i++) {
+		size_t k = rand31_value(n - 1);
+		uint op = rand31_value(9);
+
+		if (op < 8) {
+			if (hset_contains(hs, keys[k]) != present[k])
+				s_error("%s: wrong lookup outcome for key #%zu", r->name, k);
+		} else {
+			size_t o = k ^ 1;		/* Neighbour */
+
+			if (present[k]) {
+				hset_remove(hs, keys[k]);
+				hset_insert(hs, keys[o]);
+			} else {
+				hset_remove(hs, keys[o]);
+				hset_insert(hs, keys[k]);
+			}
+			present[k] = !present[k];
+			present[o] = !present[o];
+		}
+	}
+
+	tm_now_exact(&end);
+	r->elapsed = tm_elapsed_f(&end, &start);
+
+	if (hset_count(hs) != cnt)
+		s_error("%s: holding %zu items, expected %zu",
+			r->name, hset_count(hs), cnt);
+
+	hset_free_null(&hs);
+	XFREE_NULL(present);
+}
+
+static void
+report(const char *what, const struct run *linear, const struct run *grouped,
+	size_t cnt, size_t ops)
+{
+	if (!silent_mode) {
+		printf("%s: %zu operation%s on %zu item%s\n",
+			what, PLURAL(ops), PLURAL(cnt));
+	}
+
+	printf("%s: linear %.3f ns/op, grouped %.3f ns/op (x%.2f)\n",
+		what,
+		linear->elapsed * 1e9 / MAX(ops, 1),
+		grouped->elapsed * 1e9 / MAX(ops, 1),
+		0.0 == grouped->elapsed ? 0.0 : linear->elapsed / grouped->elapsed);
+}
+
+/**
+ * Benchmark sets of pointers.
+ */
+static void
+test_pointers(size_t cnt, size_t ops)
+{
+	struct run linear = { "pointer/linear", FALSE, 0.0 };
+	struct run grouped = { "pointer/grouped", TRUE, 0.0 };
+	const void **keys;
+	char *base;
+	size_t i;
+
+	/*
+	 * Use addresses of distinct bytes, as objects allocated in a row.
+	 */
+
+	base = xmalloc(2 * cnt * 32);
+	XMALLOC_ARRAY(keys, 2 * cnt);
+
+	for (i = 0; i < 2 * cnt; i++)
+		keys[i] = &base[i * 32];
+
+	run_set(&linear, hset_create(HASH_KEY_SELF, 0), keys, cnt, ops);
+	run_set(&grouped, hset_create(HASH_KEY_SELF, 0), keys, cnt, ops);
+	report("pointer", &linear, &grouped, cnt, ops);
+
+	XFREE_NULL(keys);
+	xfree(base);
+}
+
+/**
+ * Benchmark sets of SHA1 digests, as fixed-length keys.
+ */
+static void
+test_sha1(size_t cnt, size_t ops)
+{
+	struct run linear = { "sha1/linear", FALSE, 0.0 };
+	struct run grouped = { "sha1/grouped", TRUE, 0.0 };
+	const void **keys;
+	struct sha1 *digests;
+	size_t i;
+
+	XMALLOC_ARRAY(digests, 2 * cnt);
+	XMALLOC_ARRAY(keys, 2 * cnt);
+
+	rand31_set_seed(initial_seed);
+
+	for (i = 0; i < 2 * cnt; i++) {
+		rand31_bytes(&digests[i], sizeof digests[i]);
+		keys[i] = &digests[i];
+	}
+
+	run_set(&linear, hset_create(HASH_KEY_FIXED, SHA1_RAW_SIZE),
+		keys, cnt, ops);
+	run_set(&grouped, hset_create(HASH_KEY_FIXED, SHA1_RAW_SIZE),
+		keys, cnt, ops);
+	report("sha1", &linear, &grouped, cnt, ops);
+
+	XFREE_NULL(keys);
+	XFREE_NULL(digests);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = TEST_ITEMS;
+	size_t ops = TEST_OPS;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hn:R:S";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of items */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of operations */
+			ops = atol(optarg);
+			break;
+		case 'R':			/* random seed */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == count)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	test_pointers(count, ops);
+	test_sha1(count, ops);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
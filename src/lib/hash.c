@@ -97,6 +97,26 @@
  * different given that there is no value associated with a key within a set,
  * and the vocabulary is different (we speak of set "items", not "keys").
  *
+ * Tables can also be switched, right after creation, to a "grouped" layout
+ * where an additional array of control bytes is kept, one byte per slot.
+ * A control byte holds the 7 leading bits of the hashed value of the key
+ * stored in the slot, or flags the slot as free.  Lookups then probe the
+ * table linearly, a whole group of slots at a time: the control bytes of
+ * the group are compared in parallel against the searched tag (with SSE2
+ * instructions when available, via SWAR arithmetic otherwise) and only the
+ * matching slots need their hash and key to be compared.  As soon as a group
+ * contains a free slot, the lookup can stop.
+ *
+ * Because probing is linear, deletion does not need to erect a tombstone:
+ * the entries following the deleted one in the probe sequence are shifted
+ * back to fill the hole.  Tombstones are only used when items are removed
+ * whilst iterating, since we cannot relocate keys then, and they are purged
+ * as soon as the iteration ends.
+ *
+ * The grouped layout is worth it on large or lookup-heavy tables, where the
+ * key comparisons and the probing of the hashes array dominate.  The group
+ * probing routines are shared with GUID tables, in hgroup.h.
+ *
  * @author Raphael Manfredi
  * @date 2012
  */
@@ -109,6 +129,8 @@
 
 #include "endian.h"
 #include "hashing.h"
+#include "hgroup.h"
+#include "pow2.h"
 #include "rand31.h"
 #include "random.h"
 #include "unsigned.h"
@@ -216,11 +238,25 @@ hash_hops_max(const struct hkeys *hk)
 	return HASH_HOPS_MIN + (hk->bits - HASH_MIN_BITS) / 2;
 }
 
+/**
+ * @return minimum size of table, in bits.
+ */
+static inline size_t
+hash_min_bits(const struct hkeys *hk)
+{
+	/*
+	 * Grouped tables must be able to hold at least one group, so that
+	 * a group probe never sees the same slot twice.
+	 */
+
+	return hk->grouped ? HGROUP_BITS : HASH_MIN_BITS;
+}
+
 /**
  * Compute the total size of the arena required for given amount of items.
  */
 static size_t
-hash_arena_size(size_t items, bool has_values)
+hash_arena_size(size_t items, bool has_values, bool grouped)
 {
 	size_t size;
 
@@ -238,6 +274,10 @@ hash_arena_size(size_t items, bool has_values)
 	 *
 	 * This allows the hashes array to be correctly aligned since the size
 	 * of a pointer is always larger or equal to the size of an unsigned value.
+	 *
+	 * Grouped tables have their control bytes appended after the hashes
+	 * array.  The first group of control bytes is cloned at the end, so
+	 * that a group starting near the end of the table can be read at once.
 	 */
 
 	STATIC_ASSERT(sizeof(void *) >= sizeof(unsigned));
@@ -247,6 +287,8 @@ hash_arena_size(size_t items, bool has_values)
 	if (has_values)
 		size *= 2;
 	size += items * sizeof(unsigned);
+	if (grouped)
+		size += items + HGROUP_SIZE;
 
 	return size;
 }
@@ -268,6 +310,12 @@ hash_update_arena_pointers(struct hash *h, void *arena)
 		arena = ptr_add_offset(arena, hk->size * sizeof(void *));
 	}
 	hk->hashes = arena;
+	if (hk->grouped) {
+		arena = ptr_add_offset(arena, hk->size * sizeof(unsigned));
+		hk->ctrl = arena;
+	} else {
+		hk->ctrl = NULL;
+	}
 
 	hk->relocate = 0;
 }
@@ -302,7 +350,7 @@ hash_arena_allocate(struct hash *h, size_t bits)
 	 * For structures in "raw" mode, avoid walloc() and use the VMM layer.
 	 */
 
-	size = hash_arena_size(hk->size, hk->has_values);
+	size = hash_arena_size(hk->size, hk->has_values, hk->grouped);
 
 	if (size >= compat_pagesize() || hk->raw_memory)
 		arena = vmm_alloc(size);
@@ -311,6 +359,8 @@ hash_arena_allocate(struct hash *h, size_t bits)
 
 	hash_update_arena_pointers(h, arena);
 	memset(hk->hashes, 0, hk->size * sizeof(unsigned));
+	if (hk->grouped)
+		memset(hk->ctrl, HGROUP_CTRL_EMPTY, hk->size + HGROUP_SIZE);
 }
 
 /**
@@ -344,7 +394,7 @@ hash_arena_relocate(struct hash *h)
 	if G_LIKELY(0 != ++hk->relocate)
 		return;
 
-	size = hash_arena_size(hk->size, hk->has_values);
+	size = hash_arena_size(hk->size, hk->has_values, hk->grouped);
 
 	if (size < compat_pagesize() && !hk->raw_memory)
 		return;		/* Not allocated via VMM */
@@ -384,7 +434,7 @@ hash_arena_kset_free(struct hash *h)
 	struct hkeys *hk = &h->kset;
 	size_t size;
 
-	size = hash_arena_size(hk->size, hk->has_values);
+	size = hash_arena_size(hk->size, hk->has_values, hk->grouped);
 	hash_arena_size_free(hk->keys, size, hk->raw_memory);
 }
 
@@ -556,6 +606,107 @@ hash_keyset_equals(const struct hkeys *hk, const void *k1, const void *k2)
 	g_assert_not_reached();
 }
 
+/**
+ * Record hashed value at given index, updating the control byte as well
+ * for grouped tables.
+ */
+static inline void
+hash_slot_set(struct hkeys *hk, size_t idx, unsigned hv)
+{
+	hk->hashes[idx] = hv;
+
+	if (hk->grouped) {
+		uint8 c;
+
+		if G_LIKELY(HASH_IS_REAL(hv))
+			c = HGROUP_CTRL_TAG(hv);
+		else
+			c = HASH_IS_TOMB(hv) ? HGROUP_CTRL_DELETED : HGROUP_CTRL_EMPTY;
+
+		hgroup_ctrl_set(hk->ctrl, hk->size, idx, c);
+	}
+}
+
+/**
+ * Lookup key in a grouped key set.
+ *
+ * @param hk		the keyset structure
+ * @param key		the key we are looking for
+ * @param hv		the hashed value for the key (primary hash)
+ * @param kidx		where the key was found or can be inserted
+ * @param tombidx	index of the tomb where key can be inserted, -1 if none
+ *
+ * @return TRUE if key was found with kidx now holding the index of the key,
+ * FALSE otherwise with kidx now holding the insertion index for the key.
+ */
+static bool G_HOT
+hash_keyset_group_lookup(struct hkeys *hk, const void *key, unsigned hv,
+	size_t *kidx, size_t *tombidx)
+{
+	const uint8 tag = HGROUP_CTRL_TAG(hv);
+	size_t idx, mask, probed, avail = (size_t) -1;
+
+	mask = hk->size - 1;		/* Size is power of two */
+	idx = hashing_keep(hv, hk->bits);
+
+	/*
+	 * Keys are located after their home slot, with no free slot in-between,
+	 * since we never leave holes when deleting.  We can therefore stop at
+	 * the first group holding a free slot.
+	 *
+	 * The insertion index is the first available slot after the home slot,
+	 * which can be a tombstone, erected when deleting during iterations.
+	 */
+
+	for (probed = 0; probed < hk->size; probed += HGROUP_SIZE) {
+		const uint8 *g = &hk->ctrl[idx];
+		hgroup_mask_t m;
+
+		for (m = hgroup_match(g, tag); m != 0; m &= m - 1) {
+			size_t i = (idx + hgroup_first(m)) & mask;
+
+			/*
+			 * Self-representing keys are compared directly, sparing the
+			 * access to the hashes array.
+			 */
+
+			if (
+				HASH_KEY_SELF == hk->type ? hk->keys[i] == key :
+				hk->hashes[i] == hv && hash_keyset_equals(hk, hk->keys[i], key)
+			) {
+				*kidx = i;
+				if (tombidx != NULL)
+					*tombidx = (size_t) -1;
+				return TRUE;
+			}
+		}
+
+		if ((size_t) -1 == avail) {
+			m = hgroup_available(g);
+			if (m != 0)
+				avail = (idx + hgroup_first(m)) & mask;
+		}
+
+		if (0 != hgroup_empty(g))
+			goto not_found;
+
+		idx = (idx + HGROUP_SIZE) & mask;
+	}
+
+	hk->resize = TRUE;			/* Went through the whole table */
+
+	/* FALL THROUGH */
+
+not_found:
+	*kidx = avail;
+	if (tombidx != NULL) {
+		*tombidx = ((size_t) -1 != avail && HASH_IS_TOMB(hk->hashes[avail])) ?
+			avail : (size_t) -1;
+	}
+
+	return FALSE;
+}
+
 /**
  * Lookup key in the key set.
  *
@@ -582,6 +733,9 @@ hash_keyset_lookup(struct hkeys *hk, const void *key, unsigned hv,
 	size_t first_tomb, mask, hops;
 	bool found;
 
+	if (hk->grouped)
+		return hash_keyset_group_lookup(hk, key, hv, kidx, tombidx);
+
 	idx = hashing_keep(hv, hk->bits);
 	ih = hk->hashes[idx];
 
@@ -722,11 +876,80 @@ hash_erect_tombstone(struct hash *h, size_t idx)
 	if G_UNLIKELY(HASH_TOMB == hk->hashes[idx])
 		return FALSE;
 
-	hk->hashes[idx] = HASH_TOMB;
+	hash_slot_set(hk, idx, HASH_TOMB);
 	hk->tombs++;
+
+	/*
+	 * Grouped tables only get tombstones when items are removed whilst
+	 * iterating: make sure they are purged at the next opportunity.
+	 */
+
+	if (hk->grouped)
+		hk->resize = TRUE;
+
 	return TRUE;
 }
 
+/**
+ * Context for moving keys back in a grouped table.
+ */
+struct hash_group_shift {
+	struct hkeys *hk;
+	const void **values;		/* NULL for sets */
+};
+
+/**
+ * hgroup_shift_back() callback: home slot of the key at given index.
+ */
+static size_t
+hash_group_home(const void *data, size_t idx)
+{
+	const struct hash_group_shift *ctx = data;
+	unsigned hv = ctx->hk->hashes[idx];
+
+	return HASH_IS_FREE(hv) ? (size_t) -1 : hashing_keep(hv, ctx->hk->bits);
+}
+
+/**
+ * hgroup_shift_back() callback: move key to the free slot at "to".
+ */
+static void
+hash_group_move(void *data, size_t to, size_t from)
+{
+	struct hash_group_shift *ctx = data;
+	struct hkeys *hk = ctx->hk;
+
+	hk->keys[to] = hk->keys[from];
+	if (ctx->values != NULL)
+		ctx->values[to] = ctx->values[from];
+	hash_slot_set(hk, to, hk->hashes[from]);
+	hash_slot_set(hk, from, HASH_FREE);
+}
+
+/**
+ * Delete key at the specified index of a grouped table.
+ *
+ * Instead of erecting a tombstone, the keys located after the hole in the
+ * probe sequence are moved back when the hole lies between their home slot
+ * and their current position.
+ */
+static void
+hash_group_remove(struct hash *h, size_t idx)
+{
+	struct hash_group_shift ctx;
+
+	g_assert(h->kset.grouped);
+	g_assert(0 == h->kset.tombs);
+	g_assert(0 == h->refcnt);
+
+	ctx.hk = &h->kset;
+	ctx.values = h->kset.has_values ? (*h->ops->get_values)(h) : NULL;
+
+	hash_slot_set(ctx.hk, idx, HASH_FREE);
+	hgroup_shift_back(idx, ctx.hk->size - 1,
+		hash_group_home, hash_group_move, &ctx);
+}
+
 /**
  * Resize empty table to its minimal state.
  *
@@ -737,16 +960,17 @@ hash_resize_min(struct hash *h)
 {
 	assert_hash_locked(h);
 
-	if G_UNLIKELY(HASH_MIN_BITS == h->kset.bits) {
-		memset(h->kset.hashes, 0,
-			(1U << HASH_MIN_BITS) * sizeof h->kset.hashes[0]);
+	if G_UNLIKELY(hash_min_bits(&h->kset) == h->kset.bits) {
+		memset(h->kset.hashes, 0, h->kset.size * sizeof h->kset.hashes[0]);
+		if (h->kset.grouped)
+			memset(h->kset.ctrl, HGROUP_CTRL_EMPTY, h->kset.size + HGROUP_SIZE);
 		h->kset.tombs = 0;
 		h->kset.relocate = 0;
 		h->kset.resize = FALSE;
 		return FALSE;
 	} else {
 		hash_arena_kset_free(h);
-		hash_arena_allocate(h, HASH_MIN_BITS);
+		hash_arena_allocate(h, hash_min_bits(&h->kset));
 		return TRUE;
 	}
 }
@@ -775,7 +999,8 @@ hash_resize(struct hash *h, enum hash_resize_mode mode)
 	if (h->kset.has_values)
 		old_values = (*h->ops->get_values)(h);
 	old_size = h->kset.size;
-	old_arena_size = hash_arena_size(old_size, h->kset.has_values);
+	old_arena_size =
+		hash_arena_size(old_size, h->kset.has_values, h->kset.grouped);
 
 	switch (mode) {
 	case HASH_RESIZE_SAME:
@@ -792,7 +1017,8 @@ hash_resize(struct hash *h, enum hash_resize_mode mode)
 			h->kset.bits--;
 			h->kset.size = 1UL << h->kset.bits;
 		} while
-			(h->kset.items < h->kset.size / 4 && h->kset.bits > HASH_MIN_BITS);
+			(h->kset.items < h->kset.size / 4 &&
+			 h->kset.bits > hash_min_bits(&h->kset));
 		goto size_computed;
 	case HASH_RESIZE_CACHELINE:
 		g_assert(size_is_positive(h->kset.bits));
@@ -802,7 +1028,8 @@ hash_resize(struct hash *h, enum hash_resize_mode mode)
 			h->kset.bits--;
 			h->kset.size = 1UL << h->kset.bits;
 		} while
-			(h->kset.items < h->kset.size / 2 && h->kset.bits > HASH_MIN_BITS);
+			(h->kset.items < h->kset.size / 2 &&
+			 h->kset.bits > hash_min_bits(&h->kset));
 		goto size_computed;
 	case HASH_RESIZE_MAXMODE:
 		break;
@@ -828,7 +1055,7 @@ size_computed:
 
 			keys++;
 			h->kset.keys[idx] = *hk;
-			h->kset.hashes[idx] = *hp;
+			hash_slot_set(&h->kset, idx, *hp);
 			if (old_values != NULL)
 				new_values[idx] = old_values[i];
 		}
@@ -862,6 +1089,16 @@ hash_resize_as_needed(struct hash *h)
 	if G_UNLIKELY(0 != h->refcnt)
 		return FALSE;
 
+	/*
+	 * Grouped tables only get tombstones when items were removed during an
+	 * iteration, which is now over: rebuild the table to get rid of them.
+	 */
+
+	if G_UNLIKELY(h->kset.grouped && 0 != h->kset.tombs && 0 != h->kset.items) {
+		hash_resize(h, HASH_RESIZE_SAME);
+		return TRUE;
+	}
+
 	if (h->kset.items <= HASH_LINE_ITEMS) {
 		/*
 		 * An empty table is immediately brought back to its minimal state.
@@ -880,7 +1117,7 @@ hash_resize_as_needed(struct hash *h)
 
 		if (
 			h->kset.items + 1 < h->kset.size / 2 &&	/* Note the hysteresis */
-			h->kset.bits > HASH_MIN_BITS
+			h->kset.bits > hash_min_bits(&h->kset)
 		) {
 			hash_resize(h, HASH_RESIZE_CACHELINE);	/* Table is oversized */
 			return TRUE;
@@ -918,7 +1155,7 @@ hash_resize_as_needed(struct hash *h)
 	}
 
 	if (h->kset.items < h->kset.size / 4) {
-		if (h->kset.bits > HASH_MIN_BITS) {
+		if (h->kset.bits > hash_min_bits(&h->kset)) {
 			hash_resize(h, HASH_RESIZE_SHRINK);		/* Table is oversized */
 			return TRUE;
 		}
@@ -1020,7 +1257,7 @@ hash_insert_key(struct hash *h, const void *key)
 			h->kset.tombs--;
 		}
 		h->kset.items++;
-		h->kset.hashes[idx] = hv;
+		hash_slot_set(&h->kset, idx, hv);
 	}
 
 	h->kset.keys[idx] = key;	/* Could be a new pointer, so always update */
@@ -1127,12 +1364,14 @@ hash_delete_key(struct hash *h, const void *key)
 	found = hash_keyset_lookup(&h->kset, key, hv, &idx, NULL);
 
 	if (found) {
-		bool erected;
-
 		g_assert(size_is_positive(h->kset.items));
 
-		erected = hash_erect_tombstone(h, idx);
-		g_assert(erected);
+		if (h->kset.grouped && 0 == h->refcnt && 0 == h->kset.tombs) {
+			hash_group_remove(h, idx);
+		} else {
+			bool erected = hash_erect_tombstone(h, idx);
+			g_assert(erected);
+		}
 		h->kset.items--;
 		hash_resize_as_needed(h);
 		return TRUE;
@@ -1331,4 +1570,26 @@ hash_thread_safe(struct hash *h)
 	mutex_init(h->lock);
 }
 
+/**
+ * Switch the hash to the grouped layout, where lookups probe a group of
+ * slots at a time through their control bytes.
+ *
+ * This needs to be done right after creating the hash table, whilst it
+ * is still empty.
+ */
+void
+hash_grouped(struct hash *h)
+{
+	hash_check(h);
+	g_assert(0 == h->kset.items);
+	g_assert(0 == h->refcnt);
+
+	if (h->kset.grouped)
+		return;
+
+	hash_arena_kset_free(h);
+	h->kset.grouped = TRUE;
+	hash_arena_allocate(h, HGROUP_BITS);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
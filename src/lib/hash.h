@@ -77,6 +77,7 @@ struct hkeys {
 	size_t tombs;				/* Amount of deleted items (tombstones) */
 	const void **keys;			/* Array of keys */
 	unsigned *hashes;			/* Array of hashed keys */
+	uint8 *ctrl;				/* Control bytes (grouped probing only) */
 	union {
 		struct {
 			hash_fn_t hash;			/* Primary key hashing function */
@@ -96,6 +97,7 @@ struct hkeys {
 	unsigned resize:1;			/* Too many hops, rebuild or resize */
 	unsigned has_values:1;		/* Whether keys have associated values */
 	unsigned raw_memory:1;		/* Don't use walloc(), use VMM and xpmalloc() */
+	unsigned grouped:1;			/* Group probing through control bytes */
 	unsigned relocate:10;		/* Attempts for arena relocation */
 };
 
@@ -152,6 +154,7 @@ struct hash {
  */
 
 void hash_thread_safe(struct hash *h);
+void hash_grouped(struct hash *h);
 
 #define hash_synchronize(h) G_STMT_START {			\
 	if G_UNLIKELY((h)->lock != NULL) 				\
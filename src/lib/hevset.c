@@ -297,6 +297,19 @@ hevset_thread_safe(hevset_t *ht)
 	hash_thread_safe(HASH(ht));
 }
 
+/**
+ * Switch hash set to grouped probing.
+ *
+ * This must be done right after creation, whilst the set is still empty.
+ */
+void
+hevset_grouped(hevset_t *ht)
+{
+	hevset_check(ht);
+
+	hash_grouped(HASH(ht));
+}
+
 /**
  * Lock the hash set to allow a sequence of operations to be atomically
  * conducted.
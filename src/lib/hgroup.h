@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Group probing of open-addressed tables through control bytes.
+ *
+ * This is the machinery shared by the tables using the "grouped" layout,
+ * namely hash tables switched to it and GUID tables: one control byte per
+ * slot holds the 7 leading bits of the hashed value of the key (the tag)
+ * or flags the slot as free.  Slots are probed linearly, a whole group of
+ * control bytes at a time, compared in parallel with SSE2 instructions when
+ * available, via SWAR arithmetic otherwise.
+ *
+ * The control bytes of the first group are cloned after the last slot, so
+ * that a group starting near the end of the table can be loaded at once.
+ *
+ * This is an internal header, only meant to be included by the table
+ * implementations.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _hgroup_h_
+#define _hgroup_h_
+
+#include "endian.h"
+#include "pow2.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * A slot holding a key has its control byte set to the tag, hence the
+ * leading bit of the control byte is clear.  The other control values have
+ * their leading bit set.
+ */
+#define HGROUP_CTRL_EMPTY	0x80	/* Free slot */
+#define HGROUP_CTRL_DELETED	0xfe	/* Tombstone */
+#define HGROUP_CTRL_TAG(h)	((uint8) ((h) >> 25))
+
+/*
+ * A group is the amount of control bytes we can inspect at once.
+ *
+ * With SSE2, we handle 16 bytes per group and each byte of the group maps
+ * to one bit in the match masks.  Otherwise, we handle 8 bytes at a time
+ * within a 64-bit word and each byte maps to its own leading bit.
+ */
+#ifdef __SSE2__
+#define HGROUP_BITS			4
+#define HGROUP_MASK_SHIFT	0		/* Byte N of group is bit N of mask */
+typedef uint32 hgroup_mask_t;
+#else
+#define HGROUP_BITS			3
+#define HGROUP_MASK_SHIFT	3		/* Byte N of group is bit 8*N+7 of mask */
+typedef uint64 hgroup_mask_t;
+#define HGROUP_LSB			0x0101010101010101ULL
+#define HGROUP_MSB			0x8080808080808080ULL
+#endif
+
+#define HGROUP_SIZE			(1U << HGROUP_BITS)
+
+/**
+ * Compute mask of the control bytes in the group matching the given tag.
+ *
+ * Without SSE2, the mask can contain false positives, which is harmless
+ * since the hashes of the flagged slots are compared afterwards.
+ */
+static inline ALWAYS_INLINE hgroup_mask_t
+hgroup_match(const uint8 *g, uint8 tag)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *) g);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(tag)));
+#else
+	uint64 v = peek_le64(g) ^ (HGROUP_LSB * tag);
+	return (v - HGROUP_LSB) & ~v & HGROUP_MSB;
+#endif
+}
+
+/**
+ * Compute mask of the free slots in the group.
+ */
+static inline ALWAYS_INLINE hgroup_mask_t
+hgroup_empty(const uint8 *g)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *) g);
+	return _mm_movemask_epi8(
+		_mm_cmpeq_epi8(v, _mm_set1_epi8((char) HGROUP_CTRL_EMPTY)));
+#else
+	uint64 v = peek_le64(g);
+	return v & ~(v << 6) & HGROUP_MSB;	/* 0x80 but not 0xfe */
+#endif
+}
+
+/**
+ * Compute mask of the slots in the group that can receive a new key,
+ * i.e. free slots and tombstones.
+ */
+static inline ALWAYS_INLINE hgroup_mask_t
+hgroup_available(const uint8 *g)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) g));
+#else
+	return peek_le64(g) & HGROUP_MSB;
+#endif
+}
+
+/**
+ * @return offset within the group of the first slot flagged in the mask.
+ */
+static inline ALWAYS_INLINE size_t
+hgroup_first(hgroup_mask_t m)
+{
+#ifdef __SSE2__
+	return ctz(m);
+#else
+	return ctz64(m) >> HGROUP_MASK_SHIFT;
+#endif
+}
+
+/**
+ * Set control byte of a slot, updating the cloned first group.
+ *
+ * @param ctrl		the control bytes
+ * @param size		the table size, in slots
+ * @param idx		the slot index
+ * @param c			the new control byte
+ */
+static inline void
+hgroup_ctrl_set(uint8 *ctrl, size_t size, size_t idx, uint8 c)
+{
+	ctrl[idx] = c;
+	if (idx < HGROUP_SIZE - 1)
+		ctrl[size + idx] = c;
+}
+
+/**
+ * Get the home slot of the key held at a given index.
+ *
+ * @return the home slot index, (size_t) -1 if the slot is free.
+ */
+typedef size_t (*hgroup_home_fn_t)(const void *data, size_t idx);
+
+/**
+ * Move the key held at index "from" to the free slot at index "to",
+ * freeing the slot at "from".
+ */
+typedef void (*hgroup_move_fn_t)(void *data, size_t to, size_t from);
+
+/**
+ * Fill the hole left by a deleted key, so that deletions never need to
+ * erect tombstones.
+ *
+ * The keys following the hole in the probe sequence are moved back when
+ * the hole lies between their home slot and their current position, until
+ * we reach a free slot.
+ *
+ * @param idx		index of the slot that was just freed
+ * @param mask		the table size minus 1 (size is a power of 2)
+ * @param home		computes the home slot of keys
+ * @param move		moves keys
+ * @param data		the table, passed to the callbacks
+ */
+static inline ALWAYS_INLINE void
+hgroup_shift_back(size_t idx, size_t mask,
+	hgroup_home_fn_t home, hgroup_move_fn_t move, void *data)
+{
+	size_t i, j;
+
+	for (i = j = idx; /* empty */; /* empty */) {
+		size_t h;
+
+		j = (j + 1) & mask;
+		h = (*home)(data, j);
+
+		if ((size_t) -1 == h)
+			break;
+
+		/*
+		 * The key at "j" can fill the hole at "i" unless its home slot
+		 * lies cyclically within ]i, j].
+		 */
+
+		if (i <= j ? (h <= i || h > j) : (h <= i && h > j)) {
+			(*move)(data, i, j);
+			i = j;
+		}
+	}
+}
+
+#endif /* _hgroup_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
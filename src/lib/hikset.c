@@ -414,6 +414,19 @@ hikset_thread_safe(hikset_t *hx)
 	hash_thread_safe(HASH(hx));
 }
 
+/**
+ * Switch hash set to grouped probing.
+ *
+ * This must be done right after creation, whilst the set is still empty.
+ */
+void
+hikset_grouped(hikset_t *hx)
+{
+	hikset_check(hx);
+
+	hash_grouped(HASH(hx));
+}
+
 /**
  * Lock the hash set to allow a sequence of operations to be atomically
  * conducted.
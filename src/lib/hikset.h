@@ -81,6 +81,7 @@ hikset_t *hikset_create_any_real(size_t offset, hash_fn_t primary, eq_fn_t eq);
 void hikset_free_null(hikset_t **);
 void hikset_clear(hikset_t *);
 void hikset_thread_safe(hikset_t *);
+void hikset_grouped(hikset_t *);
 void hikset_lock(hikset_t *);
 void hikset_unlock(hikset_t *);
 
@@ -116,6 +116,7 @@ typedef struct {
 #include "hashlist.h"
 #include "htable.h"
 #include "log.h"			/* For s_error() */
+#include "lprobe.h"
 #include "misc.h"
 #include "mutex.h"
 #include "plist.h"
@@ -1072,9 +1073,12 @@ inputevt_timer(struct poll_ctx *ctx)
 		CTX_UNLOCK(ctx);
 
 		PSLIST_FOREACH(evlist, es) {
+			static lprobe_t *probe;
 			struct event *event = es->data;
+			uint64 start = lprobe_start();
 
 			inputevt_handle(ctx, event->fd, event->condition);
+			lprobe_end(&probe, "inputevt", start);
 			WFREE(event);
 		}
 
@@ -0,0 +1,568 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency probes.
+ *
+ * A probe measures the duration of an operation on a hot path and records
+ * it into a histogram, so that we can see the whole latency distribution
+ * and not just an average.  Probes are identified by their name and are
+ * created on first use:
+ *
+ *     static lprobe_t *probe;
+ *     uint64 start = lprobe_start();
+ *     ... operation ...
+ *     lprobe_end(&probe, "operation name", start);
+ *
+ * Probes are disabled by default, and when they are the cost is a single
+ * test of a global flag.  When enabled, each measure costs two clock reads
+ * and a few increments in a histogram private to the calling thread, hence
+ * no locking or atomic operation is required.
+ *
+ * Histograms use log-linear buckets: values are grouped by power of 2, each
+ * power being split into 16 linear sub-buckets, which bounds the relative
+ * error on the reported percentiles to 1/16th whilst covering values from
+ * 1 ns up to about 18 minutes with less than 600 buckets.
+ *
+ * The per-thread histograms are periodically aggregated, which lets us report
+ * the distribution over the last period in addition to the one accumulated
+ * since probes were last reset.  The aggregated figures can also be dumped
+ * to a file in a machine-readable format, either on request or after each
+ * aggregation.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "lprobe.h"
+
+#include "atomic.h"
+#include "cq.h"
+#include "file.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "mutex.h"
+#include "omalloc.h"
+#include "path.h"
+#include "pow2.h"
+#include "pslist.h"
+#include "spinlock.h"
+#include "stringify.h"
+#include "thread.h"
+#include "timestamp.h"
+#include "tm.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define LPROBE_MAX			64		/**< Maximum amount of probes */
+#define LPROBE_PERIOD		10000	/**< Aggregation period (ms) */
+#define LPROBE_SUB_BITS		4		/**< Linear sub-buckets per power of 2 */
+#define LPROBE_SUB			(1U << LPROBE_SUB_BITS)
+#define LPROBE_MAX_BITS		40		/**< Values clamped below 2^40 ns */
+#define LPROBE_MAXVAL		((((uint64) 1) << LPROBE_MAX_BITS) - 1)
+#define LPROBE_BUCKETS		((LPROBE_MAX_BITS - LPROBE_SUB_BITS + 1) * LPROBE_SUB)
+
+/**
+ * A latency histogram.
+ */
+struct lprobe_hist {
+	uint64 count;					/**< Amount of measures */
+	uint64 sum;						/**< Sum of measures */
+	uint64 bucket[LPROBE_BUCKETS];	/**< Measures per bucket */
+};
+
+enum lprobe_magic { LPROBE_MAGIC = 0x4be0127d };
+
+/**
+ * A probe.
+ *
+ * Each thread records measures in its own histogram, which is only written
+ * by that thread.  The other histograms are only handled by the aggregation
+ * logic, under the aggregation lock.
+ */
+struct lprobe {
+	enum lprobe_magic magic;
+	const char *name;						/**< Probe name */
+	struct lprobe_hist *hist[THREAD_MAX];	/**< Per-thread histograms */
+	struct lprobe_hist base;				/**< Snapshot at last reset */
+	struct lprobe_hist last;				/**< Snapshot at last period */
+	struct lprobe_hist recent;				/**< Measures over last period */
+};
+
+static inline void
+lprobe_check(const struct lprobe * const p)
+{
+	g_assert(p != NULL);
+	g_assert(LPROBE_MAGIC == p->magic);
+}
+
+bool lprobe_on;
+
+static lprobe_t *lprobe_list[LPROBE_MAX];
+static uint lprobe_count;
+static spinlock_t lprobe_list_slk = SPINLOCK_INIT;
+static mutex_t lprobe_agg_mtx = MUTEX_INIT;
+static cperiodic_t *lprobe_ev;
+static char *lprobe_dump_path;
+
+#define LPROBE_AGG_LOCK		mutex_lock(&lprobe_agg_mtx)
+#define LPROBE_AGG_UNLOCK	mutex_unlock(&lprobe_agg_mtx)
+
+/**
+ * @return current time, in nanoseconds.
+ */
+uint64
+lprobe_now(void)
+{
+	tm_nano_t now;
+
+	tm_precise_time(&now);
+	return tmn2ns(&now);
+}
+
+/**
+ * @return histogram bucket index for value.
+ */
+static inline uint
+lprobe_bucket(uint64 v)
+{
+	int e;
+
+	if (v < LPROBE_SUB)
+		return v;
+
+	v = MIN(v, LPROBE_MAXVAL);
+	e = highest_bit_set64(v);
+
+	return (e - LPROBE_SUB_BITS + 1) * LPROBE_SUB +
+		((v >> (e - LPROBE_SUB_BITS)) & (LPROBE_SUB - 1));
+}
+
+/**
+ * @return highest value falling in histogram bucket.
+ */
+static uint64
+lprobe_bucket_value(uint idx)
+{
+	uint shift;
+
+	if (idx < LPROBE_SUB)
+		return idx;
+
+	shift = idx / LPROBE_SUB - 1;
+
+	return ((((uint64) LPROBE_SUB + idx % LPROBE_SUB) + 1) << shift) - 1;
+}
+
+/**
+ * Find probe by name, creating it if needed.
+ *
+ * @return the probe, NULL if we reached the maximum amount of probes.
+ */
+static lprobe_t *
+lprobe_get(const char *name)
+{
+	lprobe_t *p = NULL;
+	uint i;
+
+	spinlock(&lprobe_list_slk);
+
+	for (i = 0; i < lprobe_count; i++) {
+		if (0 == strcmp(lprobe_list[i]->name, name)) {
+			p = lprobe_list[i];
+			goto done;
+		}
+	}
+
+	if G_UNLIKELY(lprobe_count >= LPROBE_MAX)
+		goto done;
+
+	OMALLOC0(p);
+	p->magic = LPROBE_MAGIC;
+	p->name = name;
+	atomic_mb();
+	lprobe_list[lprobe_count++] = p;
+
+done:
+	spinunlock(&lprobe_list_slk);
+
+	if G_UNLIKELY(NULL == p)
+		s_carp_once("%s(): too many latency probes, ignoring \"%s\"",
+			G_STRFUNC, name);
+
+	return p;
+}
+
+/**
+ * Record measure started at ``start'' in the probe.
+ *
+ * This is the slow path of lprobe_end(), only taken when probes are enabled.
+ */
+void
+lprobe_record(lprobe_t **probe, const char *name, uint64 start)
+{
+	uint64 now = lprobe_now(), v;
+	struct lprobe_hist *h;
+	lprobe_t *p = *probe;
+	uint stid;
+
+	if G_UNLIKELY(NULL == p) {
+		p = *probe = lprobe_get(name);
+		if (NULL == p)
+			return;
+	}
+
+	v = now > start ? now - start : 0;
+	stid = thread_small_id();
+	h = p->hist[stid];
+
+	if G_UNLIKELY(NULL == h) {
+		XMALLOC0(h);
+		atomic_mb();
+		p->hist[stid] = h;
+	}
+
+	h->count++;
+	h->sum += v;
+	h->bucket[lprobe_bucket(v)]++;
+}
+
+/**
+ * Sum all the per-thread histograms of the probe.
+ */
+static void
+lprobe_collect(const lprobe_t *p, struct lprobe_hist *total)
+{
+	uint i, b;
+
+	ZERO(total);
+
+	for (i = 0; i < THREAD_MAX; i++) {
+		const struct lprobe_hist *h = p->hist[i];
+
+		if (NULL == h)
+			continue;
+
+		total->count += h->count;
+		total->sum += h->sum;
+		for (b = 0; b < LPROBE_BUCKETS; b++)
+			total->bucket[b] += h->bucket[b];
+	}
+}
+
+/**
+ * Compute r = a - b.
+ */
+static void
+lprobe_diff(struct lprobe_hist *r,
+	const struct lprobe_hist *a, const struct lprobe_hist *b)
+{
+	uint i;
+
+	r->count = a->count - b->count;
+	r->sum = a->sum - b->sum;
+	for (i = 0; i < LPROBE_BUCKETS; i++)
+		r->bucket[i] = a->bucket[i] - b->bucket[i];
+}
+
+/**
+ * @return the value below which the fraction ``q'' of the measures fall.
+ */
+static uint64
+lprobe_percentile(const struct lprobe_hist *h, double q)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	if (0 == h->count)
+		return 0;
+
+	target = MAX(1, (uint64) (q * h->count + 0.5));
+
+	for (i = 0; i < LPROBE_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target)
+			return lprobe_bucket_value(i);
+	}
+
+	return lprobe_bucket_value(LPROBE_BUCKETS - 1);
+}
+
+/**
+ * @return the upper bound of the highest non-empty bucket.
+ */
+static uint64
+lprobe_max(const struct lprobe_hist *h)
+{
+	uint i;
+
+	for (i = LPROBE_BUCKETS; i != 0; i--) {
+		if (h->bucket[i - 1] != 0)
+			return lprobe_bucket_value(i - 1);
+	}
+
+	return 0;
+}
+
+/**
+ * @return snapshot of the amount of registered probes.
+ */
+static uint
+lprobe_registered(void)
+{
+	uint n;
+
+	spinlock(&lprobe_list_slk);
+	n = lprobe_count;
+	spinunlock(&lprobe_list_slk);
+
+	return n;
+}
+
+/**
+ * Periodic aggregation of the per-thread histograms.
+ */
+static bool
+lprobe_periodic(void *unused_data)
+{
+	struct lprobe_hist *cur;
+	uint i, n = lprobe_registered();
+
+	(void) unused_data;
+
+	XMALLOC(cur);
+	LPROBE_AGG_LOCK;
+
+	for (i = 0; i < n; i++) {
+		lprobe_t *p = lprobe_list[i];
+
+		lprobe_check(p);
+		lprobe_collect(p, cur);
+		lprobe_diff(&p->recent, cur, &p->last);
+		p->last = *cur;
+	}
+
+	LPROBE_AGG_UNLOCK;
+	XFREE_NULL(cur);
+
+	if (lprobe_dump_path != NULL)
+		lprobe_dump_file(lprobe_dump_path);
+
+	return TRUE;		/* Keep calling */
+}
+
+/**
+ * Enable or disable latency probes.
+ *
+ * This must be called from the main thread, which is where aggregation
+ * takes place.
+ */
+void
+lprobe_enable(bool on)
+{
+	if (on && NULL == lprobe_ev)
+		lprobe_ev = cq_periodic_main_add(LPROBE_PERIOD, lprobe_periodic, NULL);
+	else if (!on)
+		cq_periodic_remove(&lprobe_ev);
+
+	lprobe_on = on;
+	atomic_mb();
+}
+
+/**
+ * Reset statistics of all the probes.
+ */
+void
+lprobe_reset(void)
+{
+	uint i, n = lprobe_registered();
+
+	LPROBE_AGG_LOCK;
+
+	for (i = 0; i < n; i++) {
+		lprobe_t *p = lprobe_list[i];
+
+		lprobe_check(p);
+		lprobe_collect(p, &p->base);
+		p->last = p->base;
+		ZERO(&p->recent);
+	}
+
+	LPROBE_AGG_UNLOCK;
+}
+
+/**
+ * Retrieve latency probe information.
+ *
+ * @return list of lprobe_info_t that must be freed by calling the
+ * lprobe_info_list_free_null() routine.
+ */
+pslist_t *
+lprobe_info_list(void)
+{
+	struct lprobe_hist *cur, *total;
+	pslist_t *sl = NULL;
+	uint i, n = lprobe_registered();
+
+	XMALLOC(cur);
+	XMALLOC(total);
+	LPROBE_AGG_LOCK;
+
+	for (i = 0; i < n; i++) {
+		lprobe_t *p = lprobe_list[i];
+		lprobe_info_t *pi;
+
+		lprobe_check(p);
+		lprobe_collect(p, cur);
+		lprobe_diff(total, cur, &p->base);
+
+		WALLOC0(pi);
+		pi->name    = p->name;
+		pi->count   = total->count;
+		pi->mean    = 0 == total->count ? 0 : total->sum / total->count;
+		pi->p50     = lprobe_percentile(total, 0.50);
+		pi->p90     = lprobe_percentile(total, 0.90);
+		pi->p99     = lprobe_percentile(total, 0.99);
+		pi->p999    = lprobe_percentile(total, 0.999);
+		pi->max     = lprobe_max(total);
+		pi->r_count = p->recent.count;
+		pi->r_p50   = lprobe_percentile(&p->recent, 0.50);
+		pi->r_p99   = lprobe_percentile(&p->recent, 0.99);
+		pi->r_max   = lprobe_max(&p->recent);
+
+		sl = pslist_prepend(sl, pi);
+	}
+
+	LPROBE_AGG_UNLOCK;
+	XFREE_NULL(cur);
+	XFREE_NULL(total);
+
+	return pslist_reverse(sl);
+}
+
+static void
+lprobe_info_free(void *data, void *udata)
+{
+	lprobe_info_t *pi = data;
+
+	(void) udata;
+	WFREE(pi);
+}
+
+/**
+ * Free list created by lprobe_info_list() and nullify pointer.
+ */
+void
+lprobe_info_list_free_null(pslist_t **sl_ptr)
+{
+	pslist_t *sl = *sl_ptr;
+
+	pslist_foreach(sl, lprobe_info_free, NULL);
+	pslist_free_null(sl_ptr);
+}
+
+/**
+ * Dump aggregated probe statistics to the specified file.
+ *
+ * There is one line per probe, with space-separated fields listed in the
+ * leading comment, all durations being in nanoseconds.  The file is written
+ * under a temporary name and then renamed, so that readers never see a
+ * partially written file.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+lprobe_dump_file(const char *path)
+{
+	file_path_t fp;
+	pslist_t *info, *sl;
+	char *dir;
+	FILE *f;
+	int ret = -1;
+
+	g_assert(path != NULL);
+
+	dir = filepath_directory(path);
+	if (NULL == dir)
+		return -1;
+
+	file_path_set(&fp, dir, filepath_basename(path));
+	f = file_config_open_write("latency probes", &fp);
+	if (NULL == f)
+		goto done;
+
+	fprintf(f, "# Updated %s\n", timestamp_to_string(tm_time()));
+	fputs("# name count mean p50 p90 p99 p99.9 max "
+		"recent_count recent_p50 recent_p99 recent_max\n", f);
+
+	info = lprobe_info_list();
+
+	PSLIST_FOREACH(info, sl) {
+		const lprobe_info_t *pi = sl->data;
+		const uint64 v[] = {
+			pi->count, pi->mean, pi->p50, pi->p90, pi->p99, pi->p999,
+			pi->max, pi->r_count, pi->r_p50, pi->r_p99, pi->r_max,
+		};
+		uint i;
+
+		fputs(pi->name, f);
+		for (i = 0; i < N_ITEMS(v); i++)
+			fprintf(f, " %s", uint64_to_string(v[i]));
+		fputc('\n', f);
+	}
+
+	lprobe_info_list_free_null(&info);
+
+	if (file_config_close(f, &fp))
+		ret = 0;
+
+done:
+	HFREE_NULL(dir);
+	return ret;
+}
+
+/**
+ * Set file where probe statistics are dumped after each aggregation.
+ *
+ * This must be called from the main thread, which is where aggregation
+ * takes place.
+ *
+ * @param path		the file path, NULL to stop periodic dumps.
+ */
+void
+lprobe_set_dump_file(const char *path)
+{
+	HFREE_NULL(lprobe_dump_path);
+
+	if (path != NULL)
+		lprobe_dump_path = h_strdup(path);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency probes.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _lprobe_h_
+#define _lprobe_h_
+
+typedef struct lprobe lprobe_t;
+
+/**
+ * Latency probe statistics, all durations being in nanoseconds.
+ *
+ * The "recent" figures cover the last aggregation period only.
+ */
+typedef struct lprobe_info {
+	const char *name;		/**< Probe name (static string) */
+	uint64 count;			/**< Measures since last reset */
+	uint64 mean;			/**< Mean duration */
+	uint64 p50;				/**< Median */
+	uint64 p90;				/**< 90th percentile */
+	uint64 p99;				/**< 99th percentile */
+	uint64 p999;			/**< 99.9th percentile */
+	uint64 max;				/**< Maximum (within histogram precision) */
+	uint64 r_count;			/**< Recent measures */
+	uint64 r_p50;			/**< Recent median */
+	uint64 r_p99;			/**< Recent 99th percentile */
+	uint64 r_max;			/**< Recent maximum */
+} lprobe_info_t;
+
+extern bool lprobe_on;
+
+uint64 lprobe_now(void);
+void lprobe_record(lprobe_t **probe, const char *name, uint64 start);
+
+/**
+ * Start timing an operation.
+ *
+ * @return an opaque value to hand to lprobe_end(), 0 if probes are disabled.
+ */
+static inline uint64
+lprobe_start(void)
+{
+	return G_UNLIKELY(lprobe_on) ? lprobe_now() : 0;
+}
+
+/**
+ * Record the duration of an operation in the named probe.
+ *
+ * @param probe		where the probe is cached, initially NULL (static)
+ * @param name		probe name (static string)
+ * @param start		the value returned by lprobe_start()
+ */
+static inline void
+lprobe_end(lprobe_t **probe, const char *name, uint64 start)
+{
+	if G_UNLIKELY(start != 0)
+		lprobe_record(probe, name, start);
+}
+
+/*
+ * Public interface.
+ */
+
+struct pslist;
+
+void lprobe_enable(bool on);
+void lprobe_reset(void);
+
+struct pslist *lprobe_info_list(void);
+void lprobe_info_list_free_null(struct pslist **sl_ptr);
+
+int lprobe_dump_file(const char *path);
+void lprobe_set_dump_file(const char *path);
+
+#endif /* _lprobe_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,320 @@
+/*
+ * mpmc-test -- multi-producer / multi-consumer queue tests.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/atomic.h"
+#include "lib/misc.h"
+#include "lib/mpmc.h"
+#include "lib/progname.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/xmalloc.h"
+
+#define TEST_ITEMS		200000	/* Default amount of items per producer */
+#define TEST_THREADS	2		/* Default amount of producers / consumers */
+#define TEST_CAPACITY	64		/* Queue capacity for concurrent tests */
+#define TEST_LOWAT		16		/* Low watermark for concurrent tests */
+#define TEST_HIWAT		48		/* High watermark for concurrent tests */
+#define TEST_VEC		16		/* Max items dequeued at once */
+
+static bool silent_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hS] [-c items] [-t threads]\n"
+		"  -c : sets amount of items per producer\n"
+		"  -h : prints this help message\n"
+		"  -t : sets amount of producer and consumer threads\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s FAILED\n", what);
+	fflush(stdout);
+	abort();
+}
+
+#define TEST_CHECK(x, what)	G_STMT_START {	\
+	if (!(x))								\
+		test_abort(what);					\
+} G_STMT_END
+
+struct flowc_count {
+	int entered;
+	int left;
+};
+
+static void
+flowc_cb(mpmc_t *q, bool flowc, void *arg)
+{
+	struct flowc_count *fc = arg;
+
+	(void) q;
+
+	if (flowc)
+		atomic_int_inc(&fc->entered);
+	else
+		atomic_int_inc(&fc->left);
+}
+
+/**
+ * Single-threaded checks of queue ordering, fullness and flow-control.
+ */
+static void
+check_sequential(void)
+{
+	struct flowc_count fc;
+	mpmc_t *q;
+	void *vec[8];
+	size_t i, n;
+
+	ZERO(&fc);
+	q = mpmc_make("test", 8);
+	mpmc_set_watermarks(q, 2, 6);
+	mpmc_set_flowc(q, flowc_cb, &fc);
+
+	TEST_CHECK(8 == mpmc_capacity(q), "capacity");
+	TEST_CHECK(NULL == mpmc_get(q), "get on empty queue");
+	TEST_CHECK(MPMC_S_EMPTY == mpmc_status(q), "empty status");
+
+	for (i = 1; i <= 5; i++)
+		TEST_CHECK(mpmc_put(q, ulong_to_pointer(i)), "put");
+
+	TEST_CHECK(!mpmc_is_flow_controlled(q), "below high watermark");
+	TEST_CHECK(mpmc_would_flow_control(q, 1), "would flow-control");
+	TEST_CHECK(MPMC_S_WARNZONE == mpmc_status(q), "warnzone status");
+
+	TEST_CHECK(mpmc_put(q, ulong_to_pointer(6)), "put");
+	TEST_CHECK(mpmc_is_flow_controlled(q), "at high watermark");
+	TEST_CHECK(1 == fc.entered && 0 == fc.left, "flow-control entry");
+
+	TEST_CHECK(mpmc_put(q, ulong_to_pointer(7)), "put");
+	TEST_CHECK(mpmc_put(q, ulong_to_pointer(8)), "put");
+	TEST_CHECK(!mpmc_put(q, ulong_to_pointer(9)), "put on full queue");
+	TEST_CHECK(1 == fc.entered, "single flow-control entry");
+
+	n = mpmc_get_vec(q, vec, 3);
+	TEST_CHECK(3 == n, "vector get");
+	for (i = 0; i < n; i++)
+		TEST_CHECK(ulong_to_pointer(i + 1) == vec[i], "FIFO order");
+	TEST_CHECK(mpmc_is_flow_controlled(q), "above low watermark");
+
+	n = mpmc_get_vec(q, vec, 3);
+	TEST_CHECK(3 == n, "vector get");
+	TEST_CHECK(!mpmc_is_flow_controlled(q), "at low watermark");
+	TEST_CHECK(1 == fc.left, "flow-control exit");
+
+	n = mpmc_get_vec(q, vec, N_ITEMS(vec));
+	TEST_CHECK(2 == n, "vector get of remaining items");
+	TEST_CHECK(ulong_to_pointer(8) == vec[1], "FIFO order");
+	TEST_CHECK(0 == mpmc_count(q), "empty count");
+
+	mpmc_free_null(&q, NULL);
+	TEST_CHECK(NULL == q, "nullified queue");
+
+	if (!silent_mode)
+		printf("sequential checks: OK\n");
+}
+
+struct concurrent {
+	mpmc_t *q;
+	size_t items;			/* Items per producer */
+	size_t total;			/* Total items to consume */
+	uint8 *seen;			/* Times each item was consumed */
+	int consumed;			/* Items consumed so far */
+	int full;				/* Failed enqueues */
+};
+
+struct producer {
+	struct concurrent *c;
+	size_t base;			/* First item number (items start at 1) */
+};
+
+static void *
+producer_main(void *arg)
+{
+	struct producer *p = arg;
+	struct concurrent *c = p->c;
+	size_t i;
+
+	for (i = 0; i < c->items; i++) {
+		void *item = ulong_to_pointer(p->base + i);
+
+		while (!mpmc_put(c->q, item)) {
+			atomic_int_inc(&c->full);
+			thread_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void *
+consumer_main(void *arg)
+{
+	struct concurrent *c = arg;
+	void *vec[TEST_VEC];
+	uint k = 0;
+
+	while ((size_t) ATOMIC_GET(&c->consumed) < c->total) {
+		size_t i, n;
+
+		n = mpmc_get_vec(c->q, vec, 1 + k++ % N_ITEMS(vec));
+
+		if (0 == n) {
+			thread_yield();
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			size_t id = pointer_to_ulong(vec[i]);
+
+			TEST_CHECK(id >= 1 && id <= c->total, "dequeued item");
+			c->seen[id - 1]++;
+		}
+
+		ATOMIC_ADD(&c->consumed, n);
+	}
+
+	return NULL;
+}
+
+/**
+ * Concurrent producers and consumers on a small queue, so that it keeps
+ * entering and leaving flow-control.
+ */
+static void
+check_concurrent(size_t items, uint threads)
+{
+	struct concurrent c;
+	struct flowc_count fc;
+	struct producer *pv;
+	int *tid;
+	size_t i;
+
+	ZERO(&c);
+	ZERO(&fc);
+	c.q = mpmc_make("concurrent", TEST_CAPACITY);
+	c.items = items;
+	c.total = items * threads;
+	XMALLOC0_ARRAY(c.seen, c.total);
+	XMALLOC_ARRAY(pv, threads);
+	XMALLOC_ARRAY(tid, 2 * threads);
+
+	mpmc_set_watermarks(c.q, TEST_LOWAT, TEST_HIWAT);
+	mpmc_set_flowc(c.q, flowc_cb, &fc);
+
+	for (i = 0; i < threads; i++) {
+		tid[i] = thread_create(consumer_main, &c, 0, 0);
+		TEST_CHECK(-1 != tid[i], "consumer creation");
+	}
+
+	for (i = 0; i < threads; i++) {
+		pv[i].c = &c;
+		pv[i].base = 1 + i * items;
+		tid[threads + i] = thread_create(producer_main, &pv[i], 0, 0);
+		TEST_CHECK(-1 != tid[threads + i], "producer creation");
+	}
+
+	for (i = 0; i < 2 * threads; i++)
+		TEST_CHECK(0 == thread_join(tid[i], NULL), "thread join");
+
+	for (i = 0; i < c.total; i++)
+		TEST_CHECK(1 == c.seen[i], "item consumed exactly once");
+
+	TEST_CHECK(0 == mpmc_count(c.q), "drained queue");
+	TEST_CHECK(!mpmc_is_flow_controlled(c.q), "drained queue flow-control");
+	TEST_CHECK(fc.entered == fc.left, "paired flow-control transitions");
+
+	if (!silent_mode) {
+		printf("concurrent checks on %zu item%s, %u producer%s "
+			"and consumer%s: OK\n",
+			PLURAL(c.total), PLURAL(threads), plural(threads));
+		printf("  %d flow-control transition%s, %d failed enqueue%s\n",
+			PLURAL(fc.entered), PLURAL(c.full));
+	}
+
+	mpmc_free_null(&c.q, NULL);
+	XFREE_NULL(c.seen);
+	XFREE_NULL(pv);
+	XFREE_NULL(tid);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t items = TEST_ITEMS;
+	uint threads = TEST_THREADS;
+	int c;
+	const char options[] = "c:ht:S";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of items per producer */
+			items = atol(optarg);
+			break;
+		case 't':			/* amount of threads */
+			threads = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == items || 0 == threads || threads > 16)
+		usage();
+
+	check_sequential();
+	check_concurrent(items, threads);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
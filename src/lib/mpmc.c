@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bounded lock-free multi-producer / multi-consumer queue.
+ *
+ * This is meant to hand pointers (typically pmsg_t messages) from one set
+ * of threads to another, for instance between the receiving, routing and
+ * transmitting stages, without going through a mutex and a condition
+ * variable like asynchronous queues do.
+ *
+ * The queue is a ring of slots whose size is a power of two.  Each slot
+ * carries a sequence number telling whether it is free for the producer at
+ * a given position or holds data for the consumer at that position.
+ * Producers and consumers each claim positions by atomically advancing their
+ * own index, so no lock is ever taken and a stalled thread can only delay
+ * the slot it has claimed.
+ *
+ * Since the queue is bounded, mpmc_put() fails when it is full: it is up
+ * to the caller to decide whether to drop or retry.  To avoid reaching that
+ * point, the queue supports the same flow-control watermarks as message
+ * queues: a callback is invoked when the amount of queued items reaches the
+ * high watermark and when it drops back to the low watermark, letting the
+ * producing side throttle itself.
+ *
+ * Consumers can dequeue several items at once with mpmc_get_vec(), which
+ * claims all the contiguous ready slots (up to the requested amount) with
+ * a single atomic operation.
+ *
+ * Each item is timestamped when enqueued, so that the queue can report the
+ * cumulated and maximum time spent in the queue by items.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "mpmc.h"
+
+#include "atomic.h"
+#include "pow2.h"
+#include "tm.h"
+#include "unsigned.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define MPMC_CACHELINE	64		/**< Padding to avoid false sharing */
+
+/**
+ * A ring slot.
+ */
+struct mpmc_slot {
+	uint seq;					/**< Sequence number */
+	void *data;					/**< Queued item */
+	uint64 stamp;				/**< Enqueuing time (ns) */
+};
+
+enum mpmc_queue_magic { MPMC_QUEUE_MAGIC = 0x2f8e17b3 };
+
+/**
+ * A multi-producer / multi-consumer queue.
+ *
+ * The producer and consumer indices are kept in separate cache lines since
+ * they are updated concurrently by different threads.
+ */
+struct mpmc_queue {
+	enum mpmc_queue_magic magic;	/**< Magic number */
+	uint mask;						/**< Ring size - 1 */
+	struct mpmc_slot *ring;			/**< The ring of slots */
+	const char *name;				/**< Queue name, for logging */
+	mpmc_flowc_cb_t flowc_cb;		/**< Flow-control callback */
+	void *flowc_arg;				/**< Flow-control callback argument */
+	uint lowat;						/**< Low watermark (items) */
+	uint hiwat;						/**< High watermark (items) */
+	int flowc;						/**< Whether in flow-control */
+	uint64 wait_max;				/**< Maximum queuing latency (ns) */
+	AU64(enqueued);					/**< Items enqueued */
+	AU64(dequeued);					/**< Items dequeued */
+	AU64(full);						/**< Failed enqueue attempts */
+	AU64(batches);					/**< Vector dequeues */
+	AU64(flowc_count);				/**< Entries in flow-control */
+	AU64(wait_total);				/**< Total queuing latency (ns) */
+	char pad1[MPMC_CACHELINE];
+	uint head;						/**< Next producer position */
+	char pad2[MPMC_CACHELINE - sizeof(uint)];
+	uint tail;						/**< Next consumer position */
+	char pad3[MPMC_CACHELINE - sizeof(uint)];
+};
+
+static inline void
+mpmc_check(const struct mpmc_queue * const q)
+{
+	g_assert(q != NULL);
+	g_assert(MPMC_QUEUE_MAGIC == q->magic);
+}
+
+/**
+ * @return current time, in nanoseconds.
+ */
+static inline uint64
+mpmc_now(void)
+{
+	tm_nano_t now;
+
+	tm_precise_time(&now);
+	return tmn2ns(&now);
+}
+
+/**
+ * Create a new queue.
+ *
+ * @param name		queue name (static string), for logging
+ * @param capacity	maximum amount of items, rounded up to a power of 2
+ *
+ * @return a new queue, with watermarks at 1/4 and 3/4 of its capacity.
+ */
+mpmc_t *
+mpmc_make(const char *name, size_t capacity)
+{
+	mpmc_t *q;
+	uint i, size;
+
+	g_assert(name != NULL);
+	g_assert(capacity > 1);
+	g_assert(capacity <= (1U << 30));
+
+	size = next_pow2(capacity);
+
+	WALLOC0(q);
+	q->magic = MPMC_QUEUE_MAGIC;
+	q->name = name;
+	q->mask = size - 1;
+	q->lowat = size / 4;
+	q->hiwat = size - size / 4;
+
+	XMALLOC0_ARRAY(q->ring, size);
+	for (i = 0; i < size; i++)
+		q->ring[i].seq = i;
+
+	atomic_mb();
+	return q;
+}
+
+/**
+ * Free queue and nullify its pointer.
+ *
+ * The queue must no longer be accessed by other threads.
+ *
+ * @param q_ptr		pointer to the queue
+ * @param fn		if non-NULL, called on each item still held
+ */
+void
+mpmc_free_null(mpmc_t **q_ptr, free_fn_t fn)
+{
+	mpmc_t *q = *q_ptr;
+
+	if (q != NULL) {
+		void *p;
+
+		mpmc_check(q);
+
+		while (NULL != (p = mpmc_get(q))) {
+			if (fn != NULL)
+				(*fn)(p);
+		}
+
+		XFREE_NULL(q->ring);
+		q->magic = 0;
+		WFREE(q);
+		*q_ptr = NULL;
+	}
+}
+
+/**
+ * Set flow-control watermarks, in amount of items.
+ */
+void
+mpmc_set_watermarks(mpmc_t *q, size_t lowat, size_t hiwat)
+{
+	mpmc_check(q);
+	g_assert(lowat < hiwat);
+	g_assert(hiwat <= q->mask + 1);
+
+	q->lowat = lowat;
+	q->hiwat = hiwat;
+	atomic_mb();
+}
+
+/**
+ * Install callback invoked when entering or leaving flow-control.
+ */
+void
+mpmc_set_flowc(mpmc_t *q, mpmc_flowc_cb_t cb, void *arg)
+{
+	mpmc_check(q);
+
+	q->flowc_arg = arg;
+	q->flowc_cb = cb;
+	atomic_mb();
+}
+
+/**
+ * @return amount of items currently held in the queue (approximate when
+ * other threads are concurrently accessing the queue).
+ */
+size_t
+mpmc_count(const mpmc_t *q)
+{
+	uint head, tail, n;
+
+	mpmc_check(q);
+
+	/*
+	 * Read the consumer index first: it can only lag behind the producer
+	 * index, hence we cannot compute a negative count.
+	 */
+
+	tail = ATOMIC_GET(&q->tail);
+	head = ATOMIC_GET(&q->head);
+	n = head - tail;
+
+	return MIN(n, q->mask + 1);
+}
+
+/**
+ * @return maximum amount of items the queue can hold.
+ */
+size_t
+mpmc_capacity(const mpmc_t *q)
+{
+	mpmc_check(q);
+
+	return q->mask + 1;
+}
+
+/**
+ * Update flow-control status after items were added or removed.
+ *
+ * Entering and leaving flow-control is decided by the thread which manages
+ * to flip the flag, so the callback is invoked once per transition.  Because
+ * other threads keep on updating the queue meanwhile, the callback should
+ * rely on mpmc_is_flow_controlled() rather than on its argument if it needs
+ * the current state.
+ *
+ * The count we base our decision on can be stale by the time we flip the
+ * flag: a producer could enter flow-control after consumers drained the
+ * queue, and these consumers would not have seen the flag to clear it.
+ * Hence the thread flipping the flag reads the count again, and flips the
+ * flag back if the watermark no longer holds, until the state is stable.
+ */
+static void
+mpmc_update_flowc(mpmc_t *q)
+{
+	for (;;) {
+		size_t n = mpmc_count(q);
+
+		if (n >= q->hiwat) {
+			if (
+				0 != ATOMIC_GET(&q->flowc) ||
+				!atomic_int_xchg_if_eq(&q->flowc, 0, 1)
+			)
+				return;
+			AU64_INC(&q->flowc_count);
+			if (q->flowc_cb != NULL)
+				(*q->flowc_cb)(q, TRUE, q->flowc_arg);
+		} else if (n <= q->lowat) {
+			if (
+				0 == ATOMIC_GET(&q->flowc) ||
+				!atomic_int_xchg_if_eq(&q->flowc, 1, 0)
+			)
+				return;
+			if (q->flowc_cb != NULL)
+				(*q->flowc_cb)(q, FALSE, q->flowc_arg);
+		} else {
+			return;		/* Between watermarks, state is kept */
+		}
+	}
+}
+
+/**
+ * Enqueue item.
+ *
+ * @param q		the queue
+ * @param p		the item to enqueue (must not be NULL)
+ *
+ * @return TRUE if enqueued, FALSE if the queue was full.
+ */
+bool
+mpmc_put(mpmc_t *q, void *p)
+{
+	struct mpmc_slot *s;
+	uint pos;
+
+	mpmc_check(q);
+	g_assert(p != NULL);
+
+	pos = ATOMIC_GET(&q->head);
+
+	for (;;) {
+		int d;
+
+		s = &q->ring[pos & q->mask];
+		d = (int) (ATOMIC_GET(&s->seq) - pos);
+
+		if G_LIKELY(0 == d) {
+			if (atomic_uint_xchg_if_eq(&q->head, pos, pos + 1))
+				break;
+		} else if (d < 0) {
+			AU64_INC(&q->full);
+			if (!ATOMIC_GET(&q->flowc))
+				mpmc_update_flowc(q);
+			return FALSE;
+		}
+		pos = ATOMIC_GET(&q->head);
+	}
+
+	/*
+	 * We own the slot, publish the item by updating its sequence number.
+	 */
+
+	s->data = p;
+	s->stamp = mpmc_now();
+	atomic_mb();
+	s->seq = pos + 1;
+	atomic_mb();
+
+	AU64_INC(&q->enqueued);
+
+	if (!ATOMIC_GET(&q->flowc))
+		mpmc_update_flowc(q);
+
+	return TRUE;
+}
+
+/**
+ * Dequeue up to ``n'' items.
+ *
+ * All the contiguous slots ready to be consumed are claimed at once, up to
+ * the amount requested, and are returned in their enqueuing order.
+ *
+ * @param q		the queue
+ * @param vec	where dequeued items are written
+ * @param n		maximum amount of items to dequeue
+ *
+ * @return the amount of items dequeued, 0 if the queue was empty.
+ */
+size_t
+mpmc_get_vec(mpmc_t *q, void **vec, size_t n)
+{
+	uint pos, i, k;
+	uint64 now, total = 0, max = 0;
+
+	mpmc_check(q);
+	g_assert(vec != NULL);
+
+	if G_UNLIKELY(0 == n)
+		return 0;
+
+	n = MIN(n, q->mask + 1);
+
+	for (;;) {
+		int d = 0;
+
+		pos = ATOMIC_GET(&q->tail);
+
+		for (k = 0; k < n; k++) {
+			struct mpmc_slot *s = &q->ring[(pos + k) & q->mask];
+
+			d = (int) (ATOMIC_GET(&s->seq) - (pos + k + 1));
+			if (d != 0)
+				break;
+		}
+
+		if G_UNLIKELY(0 == k) {
+			if (d < 0)
+				return 0;		/* Empty */
+			continue;			/* Another consumer moved ahead */
+		}
+
+		if (atomic_uint_xchg_if_eq(&q->tail, pos, pos + k))
+			break;
+	}
+
+	/*
+	 * We own slots [pos, pos + k), copy the items out and release the
+	 * slots for the next round of producers.
+	 */
+
+	now = mpmc_now();
+
+	for (i = 0; i < k; i++) {
+		struct mpmc_slot *s = &q->ring[(pos + i) & q->mask];
+		uint64 w;
+
+		vec[i] = s->data;
+		w = now > s->stamp ? now - s->stamp : 0;
+		total += w;
+		max = MAX(max, w);
+		atomic_mb();
+		s->seq = pos + i + q->mask + 1;
+	}
+	atomic_mb();
+
+	AU64_ADD(&q->dequeued, k);
+	AU64_ADD(&q->wait_total, total);
+	AU64_INC(&q->batches);
+
+	/*
+	 * The maximum is a statistic only, a lost concurrent update is harmless.
+	 */
+
+	if G_UNLIKELY(max > q->wait_max)
+		q->wait_max = max;
+
+	if (ATOMIC_GET(&q->flowc))
+		mpmc_update_flowc(q);
+
+	return k;
+}
+
+/**
+ * Dequeue one item.
+ *
+ * @return the next item, NULL if the queue was empty.
+ */
+void *
+mpmc_get(mpmc_t *q)
+{
+	void *p;
+
+	return 0 == mpmc_get_vec(q, &p, 1) ? NULL : p;
+}
+
+/**
+ * @return queue's fullness status.
+ */
+mpmc_status_t
+mpmc_status(const mpmc_t *q)
+{
+	size_t n = mpmc_count(q);
+
+	if (0 == n)
+		return MPMC_S_EMPTY;
+
+	if (ATOMIC_GET(&q->flowc))
+		return MPMC_S_FLOWC;
+
+	return n > q->lowat ? MPMC_S_WARNZONE : MPMC_S_DELAY;
+}
+
+/**
+ * @return whether queue is flow-controlled.
+ */
+bool
+mpmc_is_flow_controlled(const mpmc_t *q)
+{
+	mpmc_check(q);
+
+	return 0 != ATOMIC_GET(&q->flowc);
+}
+
+/**
+ * Would ``additional'' items cause the queue to enter flow-control?
+ */
+bool
+mpmc_would_flow_control(const mpmc_t *q, size_t additional)
+{
+	return size_saturate_add(mpmc_count(q), additional) >= q->hiwat;
+}
+
+/**
+ * Are we already at or above the low watermark?
+ */
+bool
+mpmc_above_low_watermark(const mpmc_t *q)
+{
+	return mpmc_count(q) >= q->lowat;
+}
+
+/**
+ * Fill queue statistics.
+ */
+void
+mpmc_info(const mpmc_t *q, mpmc_info_t *info)
+{
+	mpmc_check(q);
+	g_assert(info != NULL);
+
+	info->name       = q->name;
+	info->capacity   = q->mask + 1;
+	info->count      = mpmc_count(q);
+	info->enqueued   = AU64_VALUE(&q->enqueued);
+	info->dequeued   = AU64_VALUE(&q->dequeued);
+	info->full       = AU64_VALUE(&q->full);
+	info->batches    = AU64_VALUE(&q->batches);
+	info->flowc      = AU64_VALUE(&q->flowc_count);
+	info->wait_total = AU64_VALUE(&q->wait_total);
+	info->wait_max   = q->wait_max;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
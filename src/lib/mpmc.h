@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bounded lock-free multi-producer / multi-consumer queue.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _mpmc_h_
+#define _mpmc_h_
+
+typedef struct mpmc_queue mpmc_t;
+
+/**
+ * Queue fullness status, matching the levels used by message queues.
+ */
+typedef enum {
+	MPMC_S_EMPTY = 0,		/**< Nothing queued */
+	MPMC_S_DELAY,			/**< Below low watermark */
+	MPMC_S_WARNZONE,		/**< Above low watermark */
+	MPMC_S_FLOWC			/**< In flow-control */
+} mpmc_status_t;
+
+/**
+ * Flow-control callback, invoked when the queue enters (flowc = TRUE) or
+ * leaves (flowc = FALSE) flow-control.  It runs in the context of the thread
+ * which caused the watermark to be crossed.
+ */
+typedef void (*mpmc_flowc_cb_t)(mpmc_t *q, bool flowc, void *arg);
+
+/**
+ * Queue statistics.
+ */
+typedef struct mpmc_info {
+	const char *name;		/**< Queue name (static string) */
+	size_t capacity;		/**< Maximum amount of items held */
+	size_t count;			/**< Current amount of items held */
+	uint64 enqueued;		/**< Items successfully enqueued */
+	uint64 dequeued;		/**< Items dequeued */
+	uint64 full;			/**< Enqueue attempts failed on full queue */
+	uint64 batches;			/**< Vector dequeues returning items */
+	uint64 flowc;			/**< Times we entered flow-control */
+	uint64 wait_total;		/**< Total queuing latency (ns) */
+	uint64 wait_max;		/**< Maximum queuing latency (ns) */
+} mpmc_info_t;
+
+/*
+ * Public interface.
+ */
+
+mpmc_t *mpmc_make(const char *name, size_t capacity);
+void mpmc_free_null(mpmc_t **q_ptr, free_fn_t fn);
+
+void mpmc_set_watermarks(mpmc_t *q, size_t lowat, size_t hiwat);
+void mpmc_set_flowc(mpmc_t *q, mpmc_flowc_cb_t cb, void *arg);
+
+bool mpmc_put(mpmc_t *q, void *p);
+void *mpmc_get(mpmc_t *q);
+size_t mpmc_get_vec(mpmc_t *q, void **vec, size_t n);
+
+size_t mpmc_count(const mpmc_t *q);
+size_t mpmc_capacity(const mpmc_t *q);
+mpmc_status_t mpmc_status(const mpmc_t *q);
+bool mpmc_is_flow_controlled(const mpmc_t *q);
+bool mpmc_would_flow_control(const mpmc_t *q, size_t additional);
+bool mpmc_above_low_watermark(const mpmc_t *q);
+
+void mpmc_info(const mpmc_t *q, mpmc_info_t *info);
+
+#endif /* _mpmc_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
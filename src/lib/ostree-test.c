@@ -0,0 +1,280 @@
+/*
+ * ostree-test -- order-statistics tree tests.
+ *
+ * Copyright (c) 2026, gtk-gnutella developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/ostree.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/shuffle.h"
+#include "lib/stringify.h"
+#include "lib/xmalloc.h"
+
+#define TEST_ITEMS		10000	/* Default amount of items */
+
+static bool silent_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hS] [-c items] [-R seed]\n"
+		"  -c : sets amount of items to insert\n"
+		"  -h : prints this help message\n"
+		"  -R : seed for repeatable random insertion order\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s FAILED\n", what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	fflush(stdout);
+	abort();
+}
+
+#define TEST_CHECK(x, what)	G_STMT_START {	\
+	if (!(x))								\
+		test_abort(what);					\
+} G_STMT_END
+
+struct item {
+	size_t key;
+	ostnode_t node;
+};
+
+static int
+item_cmp(const void *a, const void *b)
+{
+	const struct item *x = a, *y = b;
+
+	return CMP(x->key, y->key);
+}
+
+/**
+ * Recursively check sub-tree sizes, parent links and heap ordering.
+ *
+ * @return the size of the sub-tree rooted at the node.
+ */
+static size_t
+check_node(const ostnode_t *n, const ostnode_t *parent)
+{
+	size_t size;
+
+	if (NULL == n)
+		return 0;
+
+	TEST_CHECK(parent == n->parent, "parent link");
+	TEST_CHECK(NULL == parent || parent->prio >= n->prio, "heap ordering");
+
+	size = 1 + check_node(n->left, n) + check_node(n->right, n);
+	TEST_CHECK(size == n->size, "sub-tree size");
+
+	return size;
+}
+
+/**
+ * Check the tree structure and that it holds exactly the items flagged
+ * in the `present' array, in key order, with consistent ranks.
+ */
+static void
+check_tree(const ostree_t *t, const struct item *iv, const bool *present,
+	size_t n)
+{
+	const ostnode_t *on;
+	size_t i, count = 0, rank = 0;
+
+	for (i = 0; i < n; i++) {
+		if (present[i])
+			count++;
+	}
+
+	TEST_CHECK(count == ostree_count(t), "item count");
+	TEST_CHECK(count == check_node(t->root, NULL), "tree structure");
+
+	i = 0;
+	OSTREE_FOREACH(t, on) {
+		const struct item *it = ostree_data(t, on);
+
+		while (i < n && !present[i])
+			i++;
+
+		TEST_CHECK(i < n && &iv[i] == it, "in-order traversal");
+		TEST_CHECK(++rank == ostree_rank(t, on), "item rank");
+		TEST_CHECK(on == ostree_nth(t, rank), "item at rank");
+		i++;
+	}
+
+	TEST_CHECK(rank == count, "traversal length");
+	TEST_CHECK(NULL == ostree_nth(t, 0), "rank zero");
+	TEST_CHECK(NULL == ostree_nth(t, count + 1), "rank past the end");
+
+	/* Reverse traversal */
+
+	for (on = ostree_last(t); on != NULL; on = ostree_prev(on)) {
+		TEST_CHECK(on == ostree_nth(t, rank), "reverse traversal");
+		rank--;
+	}
+
+	TEST_CHECK(0 == rank, "reverse traversal length");
+}
+
+static void
+check_ostree(size_t n)
+{
+	ostree_t t;
+	struct item *iv, dup;
+	size_t *order, i;
+	bool *present;
+
+	XMALLOC_ARRAY(iv, n);
+	XMALLOC_ARRAY(order, n);
+	XMALLOC0_ARRAY(present, n);
+
+	for (i = 0; i < n; i++) {
+		iv[i].key = i;
+		order[i] = i;
+	}
+
+	ostree_init(&t, item_cmp, offsetof(struct item, node));
+
+	TEST_CHECK(0 == ostree_count(&t), "empty tree count");
+	TEST_CHECK(NULL == ostree_head(&t), "empty tree head");
+	TEST_CHECK(NULL == ostree_tail(&t), "empty tree tail");
+
+	/* Insert in random order */
+
+	shuffle_with(rand31_u32, order, n, sizeof order[0]);
+
+	for (i = 0; i < n; i++) {
+		struct item *it = &iv[order[i]];
+
+		TEST_CHECK(NULL == ostree_insert(&t, &it->node), "insertion");
+		TEST_CHECK(ostree_linked(&it->node), "linked node");
+		present[order[i]] = TRUE;
+	}
+
+	check_tree(&t, iv, present, n);
+	TEST_CHECK(&iv[0] == ostree_head(&t), "tree head");
+	TEST_CHECK(&iv[n - 1] == ostree_tail(&t), "tree tail");
+
+	/* Duplicate keys are rejected */
+
+	dup.key = order[0];
+	TEST_CHECK(&iv[order[0]] == ostree_insert(&t, &dup.node), "duplicate");
+	TEST_CHECK(n == ostree_count(&t), "count after duplicate");
+
+	/* Remove half of the items in random order */
+
+	shuffle_with(rand31_u32, order, n, sizeof order[0]);
+
+	for (i = 0; i < n / 2; i++) {
+		struct item *it = &iv[order[i]];
+
+		ostree_remove(&t, &it->node);
+		TEST_CHECK(!ostree_linked(&it->node), "unlinked node");
+		present[order[i]] = FALSE;
+	}
+
+	check_tree(&t, iv, present, n);
+
+	/* Insert them back */
+
+	for (i = 0; i < n / 2; i++) {
+		struct item *it = &iv[order[i]];
+
+		TEST_CHECK(NULL == ostree_insert(&t, &it->node), "re-insertion");
+		present[order[i]] = TRUE;
+	}
+
+	check_tree(&t, iv, present, n);
+
+	ostree_clear(&t);
+	TEST_CHECK(0 == ostree_count(&t), "cleared tree count");
+
+	if (!silent_mode)
+		printf("ostree checks on %zu item%s: OK\n", PLURAL(n));
+
+	XFREE_NULL(iv);
+	XFREE_NULL(order);
+	XFREE_NULL(present);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t items = TEST_ITEMS;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hR:S";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of items */
+			items = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == items)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	check_ostree(items);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Embedded order-statistics tree (within another data structure).
+ *
+ * This is a binary search tree where each node also records the size of
+ * the sub-tree it roots, allowing to compute the rank of any item, or to
+ * locate the item at a given rank, in O(log n).  Insertions and removals
+ * are also O(log n), on average.
+ *
+ * The tree is balanced as a treap: each node is given a pseudo-random
+ * priority when it is inserted, and rotations keep the nodes heap-ordered
+ * on these priorities.  Priorities are derived from the node address, which
+ * is good enough since we do not need to resist crafted input: items are
+ * allocated by the application.
+ *
+ * Like the erbtree, nodes are embedded within the items, whose comparison
+ * routine compares items, not nodes.  Duplicate keys are not allowed.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "ostree.h"
+#include "hashing.h"
+
+#include "override.h"		/* Must be the last header included */
+
+static inline uint32
+ostnode_size(const ostnode_t *n)
+{
+	return NULL == n ? 0 : n->size;
+}
+
+static inline void
+ostnode_resize(ostnode_t *n)
+{
+	n->size = 1 + ostnode_size(n->left) + ostnode_size(n->right);
+}
+
+/**
+ * Replace `old' by `new' as the child of `parent', or as the tree root.
+ */
+static inline void
+ostree_relink(ostree_t *t, ostnode_t *parent, ostnode_t *old, ostnode_t *new)
+{
+	if (NULL == parent)
+		t->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+/**
+ * Rotate `n' with its parent, moving `n' one level up.
+ */
+static void
+ostree_rotate_up(ostree_t *t, ostnode_t *n)
+{
+	ostnode_t *p = n->parent;
+	ostnode_t *g = p->parent;
+
+	if (p->left == n) {
+		p->left = n->right;
+		if (n->right != NULL)
+			n->right->parent = p;
+		n->right = p;
+	} else {
+		p->right = n->left;
+		if (n->left != NULL)
+			n->left->parent = p;
+		n->left = p;
+	}
+
+	p->parent = n;
+	n->parent = g;
+	ostree_relink(t, g, p, n);
+
+	n->size = p->size;		/* `n' now roots the whole sub-tree */
+	ostnode_resize(p);
+}
+
+/**
+ * Initialize embedded order-statistics tree.
+ *
+ * @param tree		the tree to initialize
+ * @param cmp		comparison routine for items, returns <0, 0 or >0
+ * @param offset	offset of the ostnode_t within the items
+ */
+void
+ostree_init(ostree_t *tree, cmp_fn_t cmp, size_t offset)
+{
+	g_assert(tree != NULL);
+	g_assert(cmp != NULL);
+
+	tree->magic = OSTREE_MAGIC;
+	tree->root = NULL;
+	tree->cmp = cmp;
+	tree->offset = offset;
+}
+
+/**
+ * Forget about all the items held in the tree.
+ *
+ * The embedded nodes are not reset, so they must not be used again until
+ * they are re-inserted in a tree.
+ */
+void
+ostree_clear(ostree_t *tree)
+{
+	ostree_check(tree);
+
+	tree->root = NULL;
+}
+
+/**
+ * @return the first (smallest) node in the tree, NULL if empty.
+ */
+ostnode_t *
+ostree_first(const ostree_t *tree)
+{
+	ostnode_t *n;
+
+	ostree_check(tree);
+
+	if (NULL == (n = tree->root))
+		return NULL;
+
+	while (n->left != NULL)
+		n = n->left;
+
+	return n;
+}
+
+/**
+ * @return the last (biggest) node in the tree, NULL if empty.
+ */
+ostnode_t *
+ostree_last(const ostree_t *tree)
+{
+	ostnode_t *n;
+
+	ostree_check(tree);
+
+	if (NULL == (n = tree->root))
+		return NULL;
+
+	while (n->right != NULL)
+		n = n->right;
+
+	return n;
+}
+
+/**
+ * @return the node following `node' in the tree, NULL if none.
+ */
+ostnode_t *
+ostree_next(const ostnode_t *node)
+{
+	const ostnode_t *n = node, *p;
+
+	g_assert(ostree_linked(node));
+
+	if (n->right != NULL) {
+		n = n->right;
+		while (n->left != NULL)
+			n = n->left;
+		return deconstify_pointer(n);
+	}
+
+	while (NULL != (p = n->parent) && p->right == n)
+		n = p;
+
+	return deconstify_pointer(p);
+}
+
+/**
+ * @return the node preceding `node' in the tree, NULL if none.
+ */
+ostnode_t *
+ostree_prev(const ostnode_t *node)
+{
+	const ostnode_t *n = node, *p;
+
+	g_assert(ostree_linked(node));
+
+	if (n->left != NULL) {
+		n = n->left;
+		while (n->right != NULL)
+			n = n->right;
+		return deconstify_pointer(n);
+	}
+
+	while (NULL != (p = n->parent) && p->left == n)
+		n = p;
+
+	return deconstify_pointer(p);
+}
+
+/**
+ * Get the node at a given rank.
+ *
+ * @param tree		the tree
+ * @param n			the rank, starting at 1 for the first node
+ *
+ * @return the node at rank `n', NULL if the tree has less than `n' items.
+ */
+ostnode_t *
+ostree_nth(const ostree_t *tree, size_t n)
+{
+	ostnode_t *x;
+
+	ostree_check(tree);
+
+	if (0 == n || n > ostree_count(tree))
+		return NULL;
+
+	x = tree->root;
+
+	for (;;) {
+		size_t r = ostnode_size(x->left) + 1;
+
+		if (n == r)
+			return x;
+
+		if (n < r) {
+			x = x->left;
+		} else {
+			n -= r;
+			x = x->right;
+		}
+	}
+}
+
+/**
+ * Compute the rank of a node, which must be linked in the tree.
+ *
+ * @return the rank of the node, starting at 1 for the first node.
+ */
+size_t
+ostree_rank(const ostree_t *tree, const ostnode_t *node)
+{
+	const ostnode_t *n = node, *p;
+	size_t r;
+
+	ostree_check(tree);
+	g_assert(ostree_linked(node));
+
+	r = ostnode_size(n->left) + 1;
+
+	while (NULL != (p = n->parent)) {
+		if (p->right == n)
+			r += ostnode_size(p->left) + 1;
+		n = p;
+	}
+
+	g_assert(n == tree->root);
+
+	return r;
+}
+
+/**
+ * Insert node in the tree.
+ *
+ * @return NULL if the item was inserted, the already present item with the
+ * same key otherwise (in which case the node is not inserted).
+ */
+void *
+ostree_insert(ostree_t *tree, ostnode_t *node)
+{
+	ostnode_t *n, *p = NULL;
+	const void *key;
+	int c = 0;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(!ostree_linked(node));
+
+	key = ostree_data(tree, node);
+
+	for (n = tree->root; n != NULL; /* empty */) {
+		c = (*tree->cmp)(key, ostree_data(tree, n));
+		if (0 == c)
+			return ostree_data(tree, n);
+		p = n;
+		n = c < 0 ? n->left : n->right;
+	}
+
+	node->left = node->right = NULL;
+	node->parent = p;
+	node->size = 1;
+	node->prio = hashing_mix32(pointer_to_ulong(node));
+
+	if (NULL == p)
+		tree->root = node;
+	else if (c < 0)
+		p->left = node;
+	else
+		p->right = node;
+
+	for (n = p; n != NULL; n = n->parent)
+		n->size++;
+
+	while (node->parent != NULL && node->parent->prio < node->prio)
+		ostree_rotate_up(tree, node);
+
+	return NULL;
+}
+
+/**
+ * Remove node from the tree.
+ */
+void
+ostree_remove(ostree_t *tree, ostnode_t *node)
+{
+	ostnode_t *n, *child;
+
+	ostree_check(tree);
+	g_assert(node != NULL);
+	g_assert(ostree_linked(node));
+
+	/*
+	 * Rotate the node down, picking the child with the highest priority,
+	 * until it has at most one child.
+	 */
+
+	while (node->left != NULL && node->right != NULL) {
+		ostnode_t *c = node->left->prio > node->right->prio ?
+			node->left : node->right;
+		ostree_rotate_up(tree, c);
+	}
+
+	child = NULL == node->left ? node->right : node->left;
+
+	if (child != NULL)
+		child->parent = node->parent;
+	ostree_relink(tree, node->parent, node, child);
+
+	for (n = node->parent; n != NULL; n = n->parent)
+		n->size--;
+
+	node->left = node->right = node->parent = NULL;
+	node->size = 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
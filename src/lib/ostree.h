@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Embedded order-statistics tree (within another data structure).
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _ostree_h_
+#define _ostree_h_
+
+/**
+ * A node in an order-statistics tree.
+ *
+ * A node that is not linked in any tree has a zero `size'.
+ */
+typedef struct ostnode {
+	struct ostnode *left, *right, *parent;
+	uint32 prio;			/* Heap priority */
+	uint32 size;			/* Amount of nodes in sub-tree rooted here */
+} ostnode_t;
+
+enum ostree_magic { OSTREE_MAGIC = 0x3b9e21c4 };
+
+/**
+ * An embedded order-statistics tree is represented by this structure.
+ */
+typedef struct ostree {
+	enum ostree_magic magic;
+	ostnode_t *root;
+	cmp_fn_t cmp;		/* Item comparison routine */
+	size_t offset;		/* Offset of embedded node in the item structure */
+} ostree_t;
+
+static inline void
+ostree_check(const ostree_t * const t)
+{
+	g_assert(t != NULL);
+	g_assert(OSTREE_MAGIC == t->magic);
+}
+
+/**
+ * Public interface.
+ */
+
+void ostree_init(ostree_t *tree, cmp_fn_t cmp, size_t offset);
+void ostree_clear(ostree_t *tree);
+
+ostnode_t *ostree_first(const ostree_t *tree);
+ostnode_t *ostree_last(const ostree_t *tree);
+ostnode_t *ostree_next(const ostnode_t *node);
+ostnode_t *ostree_prev(const ostnode_t *node);
+ostnode_t *ostree_nth(const ostree_t *tree, size_t n);
+size_t ostree_rank(const ostree_t *tree, const ostnode_t *node);
+void *ostree_insert(ostree_t *tree, ostnode_t *node);
+void ostree_remove(ostree_t *tree, ostnode_t *node);
+
+/**
+ * @return amount of items held in the tree.
+ */
+static inline size_t
+ostree_count(const ostree_t * const t)
+{
+	ostree_check(t);
+	return NULL == t->root ? 0 : t->root->size;
+}
+
+/**
+ * @return whether node is linked in a tree.
+ */
+static inline bool
+ostree_linked(const ostnode_t * const node)
+{
+	return 0 != node->size;
+}
+
+/**
+ * Computes the data item address given the embedded node pointer.
+ */
+static inline void *
+ostree_data(const ostree_t *t, const ostnode_t *node)
+{
+	ostree_check(t);
+	return NULL == node ? NULL : ptr_add_offset(deconstify_pointer(node),
+		-t->offset);
+}
+
+/**
+ * @return pointer to the first item of the tree, NULL if empty.
+ */
+static inline void *
+ostree_head(const ostree_t * const t)
+{
+	return ostree_data(t, ostree_first(t));
+}
+
+/**
+ * @return pointer to the last item of the tree, NULL if empty.
+ */
+static inline void *
+ostree_tail(const ostree_t * const t)
+{
+	return ostree_data(t, ostree_last(t));
+}
+
+#define OSTREE_FOREACH(tree, on) \
+	for ((on) = ostree_first(tree); (on) != NULL; (on) = ostree_next(on))
+
+#endif /* _ostree_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
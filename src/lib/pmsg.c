@@ -134,7 +134,8 @@ pmsg_fill(pmsg_t *mb, pdata_t *db, int prio, bool ext, const void *buf, int len)
 	mb->m_flags = ext ? PMSG_PF_EXT : 0;
 	mb->m_u.m_check = NULL;
 	mb->m_refcnt = 1;
-	db->d_refcnt++;
+	mb->m_qtime = 0;
+	atomic_int_inc(&db->d_refcnt);
 
 	if (buf) {
 		mb->m_rptr = db->d_arena;
@@ -449,7 +450,12 @@ pmsg_ref(pmsg_t *mb)
 	pmsg_check(mb);
 	g_assert(mb->m_refcnt != 0);
 
-	mb->m_refcnt++;
+	/*
+	 * Message blocks can be handed over to other threads through queues,
+	 * so reference counts need to be updated atomically.
+	 */
+
+	ATOMIC_INC(&mb->m_refcnt);
 
 	g_assert(mb->m_refcnt != 0);		/* Safeguard against overflows */
 
@@ -475,10 +481,8 @@ pmsg_free(pmsg_t *mb)
 	 * Don't free anything if refcnt != 1.
 	 */
 
-	if (mb->m_refcnt > 1U) {
-		mb->m_refcnt--;
+	if (ATOMIC_DEC(&mb->m_refcnt) > 1U)
 		return;
-	}
 
 	/*
 	 * Invoke free routine on extended message block.
@@ -878,7 +882,7 @@ pdata_unref(pdata_t *db)
 	g_assert(valid_ptr(db));
 	g_assert(db->d_refcnt > 0);
 
-	if (db->d_refcnt-- == 1)
+	if (atomic_int_dec_is_zero(&db->d_refcnt))
 		pdata_free(db);
 }
 
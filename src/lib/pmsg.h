@@ -36,6 +36,7 @@
 
 #include "common.h"
 
+#include "atomic.h"
 #include "endian.h"
 #include "host_addr.h"
 #include "slist.h"
@@ -99,7 +100,7 @@ static inline void
 pdata_addref(pdata_t *pd)
 {
 	pdata_check(pd);
-	pd->d_refcnt++;
+	atomic_int_inc(&pd->d_refcnt);
 }
 
 /*
@@ -124,6 +125,7 @@ struct pmsg {
 	uint8 m_flags;				/**< Message flags */
 	uint8 m_prio;				/**< Message priority (0 = normal) */
 	uint16 m_refcnt;			/**< Refs to this message block */
+	uint32 m_qtime;				/**< Time at which message was enqueued */
 	union {
 		pmsg_check_t m_check;	/**< Optional check before sending */
 		pmsg_hook_t m_hook;		/**< Optional check before transmitting */
@@ -314,6 +316,25 @@ pmsg_clear_reliable(pmsg_t *mb)
 	mb->m_flags &= ~PMSG_PF_ACKME;
 }
 
+/**
+ * Record time at which message was put into a message queue.
+ */
+static inline void
+pmsg_set_qtime(pmsg_t *mb, time_t now)
+{
+	mb->m_qtime = (uint32) now;
+}
+
+/**
+ * @return amount of seconds elapsed since message was enqueued.
+ */
+static inline uint
+pmsg_queued_for(const pmsg_t *mb, time_t now)
+{
+	pmsg_check(mb);
+	return (uint32) now - mb->m_qtime;
+}
+
 /**
  * Mark message as "compressed", whether or not it actually is.
  *
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Parallel sorting.
+ *
+ * The array is cut into as many runs as there are workers in the default
+ * thread pool, each run being sorted concurrently with xqsort().  The runs
+ * are then merged pairwise until only one remains.
+ *
+ * To keep all the workers busy during the last merging rounds, when there
+ * are fewer pairs of runs than workers, each merge is itself split into
+ * independent segments: the first run is cut at regular intervals and the
+ * matching cut points in the second run are found by binary search, so that
+ * every segment can be merged into its final place without coordination.
+ *
+ * Merging requires a temporary buffer as large as the array, which is
+ * allocated through the VMM layer.  Like xqsort(), the sort is not stable.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "psort.h"
+
+#include "tpool.h"
+#include "vmm.h"
+#include "xmalloc.h"
+#include "xsort.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define PSORT_MIN_RUN		8192	/**< Minimum amount of items in a run */
+
+/**
+ * A merging segment: merges [a_lo, a_hi) with [b_lo, b_hi) at ``out''.
+ */
+struct psort_seg {
+	size_t a_lo, a_hi;
+	size_t b_lo, b_hi;
+	size_t out;
+};
+
+/**
+ * Parallel sorting context.
+ */
+struct psort_ctx {
+	char *src;					/**< Where runs are read from */
+	char *dst;					/**< Where merged runs are written */
+	size_t s;					/**< Item size */
+	cmp_fn_t cmp;				/**< Comparison routine */
+	size_t *bounds;				/**< Run boundaries (runs + 1 entries) */
+	struct psort_seg *segs;		/**< Merging segments for current round */
+};
+
+/**
+ * Sort runs [lo, hi) in place.
+ */
+static void
+psort_runs(void *data, size_t lo, size_t hi)
+{
+	struct psort_ctx *ctx = data;
+	size_t i;
+
+	for (i = lo; i < hi; i++) {
+		size_t start = ctx->bounds[i];
+
+		xqsort(ctx->src + start * ctx->s,
+			ctx->bounds[i + 1] - start, ctx->s, ctx->cmp);
+	}
+}
+
+/**
+ * Merge segments [lo, hi) of the current round.
+ */
+static void
+psort_merge(void *data, size_t lo, size_t hi)
+{
+	struct psort_ctx *ctx = data;
+	size_t s = ctx->s;
+	cmp_fn_t cmp = ctx->cmp;
+	size_t i;
+
+	for (i = lo; i < hi; i++) {
+		const struct psort_seg *sg = &ctx->segs[i];
+		const char *a = ctx->src + sg->a_lo * s;
+		const char *ae = ctx->src + sg->a_hi * s;
+		const char *b = ctx->src + sg->b_lo * s;
+		const char *be = ctx->src + sg->b_hi * s;
+		char *o = ctx->dst + sg->out * s;
+
+		while (a < ae && b < be) {
+			if ((*cmp)(b, a) < 0) {
+				memcpy(o, b, s);
+				b += s;
+			} else {
+				memcpy(o, a, s);
+				a += s;
+			}
+			o += s;
+		}
+
+		if (a < ae)
+			memcpy(o, a, ae - a);
+		else if (b < be)
+			memcpy(o, b, be - b);
+	}
+}
+
+/**
+ * @return index of the first item in [lo, hi) not lower than ``key''.
+ */
+static size_t
+psort_lower_bound(const struct psort_ctx *ctx,
+	size_t lo, size_t hi, const void *key)
+{
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if ((*ctx->cmp)(ctx->src + mid * ctx->s, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Compute the merging segments for the current round.
+ *
+ * @return the amount of segments.
+ */
+static size_t
+psort_segments(struct psort_ctx *ctx, size_t runs, uint threads)
+{
+	size_t pairs = runs / 2, parts, p, j, n = 0;
+
+	parts = (threads + pairs - 1) / pairs;
+
+	for (p = 0; p < pairs; p++) {
+		size_t a_lo = ctx->bounds[2 * p];
+		size_t b_lo = ctx->bounds[2 * p + 1];
+		size_t b_hi = ctx->bounds[2 * p + 2];
+		size_t alen = b_lo - a_lo;
+		size_t prev_a = a_lo, prev_b = b_lo;
+
+		for (j = 1; j <= parts; j++) {
+			struct psort_seg *sg = &ctx->segs[n++];
+			size_t cut_a, cut_b;
+
+			if (j == parts) {
+				cut_a = b_lo;
+				cut_b = b_hi;
+			} else {
+				cut_a = a_lo + alen * j / parts;
+				cut_b = psort_lower_bound(ctx, prev_b, b_hi,
+					ctx->src + cut_a * ctx->s);
+			}
+
+			sg->a_lo = prev_a;
+			sg->a_hi = cut_a;
+			sg->b_lo = prev_b;
+			sg->b_hi = cut_b;
+			sg->out = prev_a + (prev_b - b_lo);
+
+			prev_a = cut_a;
+			prev_b = cut_b;
+		}
+	}
+
+	/*
+	 * An odd run is simply copied over to the destination.
+	 */
+
+	if (runs & 1) {
+		struct psort_seg *sg = &ctx->segs[n++];
+
+		sg->a_lo = sg->out = ctx->bounds[runs - 1];
+		sg->a_hi = sg->b_lo = sg->b_hi = ctx->bounds[runs];
+	}
+
+	return n;
+}
+
+/**
+ * Sort array in-place with ``n'' elements of size ``s'', using all the
+ * workers of the default thread pool, which is created on first use.
+ * The base ``b'' points to the start of the array.
+ *
+ * The contents are sorted in ascending order, as defined by the comparison
+ * function ``cmp''.
+ *
+ * Small arrays, or hosts with a single CPU, are handled by xqsort().
+ */
+void
+xsort_parallel(void *b, size_t n, size_t s, cmp_fn_t cmp)
+{
+	struct psort_ctx ctx;
+	tpool_t *tp;
+	uint threads;
+	size_t runs, i, len;
+	char *tmp;
+
+	g_assert(b != NULL || 0 == n);
+	g_assert(s != 0);
+	g_assert(cmp != NULL);
+
+	if (n < XSORT_PARALLEL_ITEMS)
+		goto sequential;
+
+	tp = tpool_default();
+	threads = tpool_threads(tp);
+	runs = MIN(threads, n / PSORT_MIN_RUN);
+
+	if (runs < 2)
+		goto sequential;
+
+	len = n * s;
+	tmp = vmm_alloc(len);
+
+	ctx.src = b;
+	ctx.dst = tmp;
+	ctx.s = s;
+	ctx.cmp = cmp;
+	XMALLOC_ARRAY(ctx.bounds, runs + 1);
+	XMALLOC_ARRAY(ctx.segs, threads + runs + 1);
+
+	for (i = 0; i <= runs; i++)
+		ctx.bounds[i] = n * i / runs;
+
+	tpool_for(tp, 0, runs, 1, psort_runs, &ctx);
+
+	while (runs > 1) {
+		size_t segs = psort_segments(&ctx, runs, threads);
+		char *swap;
+
+		tpool_for(tp, 0, segs, 1, psort_merge, &ctx);
+
+		for (i = 0; 2 * i < runs; i++)
+			ctx.bounds[i] = ctx.bounds[2 * i];
+		runs = (runs + 1) / 2;
+		ctx.bounds[runs] = n;
+
+		swap = ctx.src;
+		ctx.src = ctx.dst;
+		ctx.dst = swap;
+	}
+
+	if (ctx.src != b)
+		memcpy(b, ctx.src, len);
+
+	XFREE_NULL(ctx.bounds);
+	XFREE_NULL(ctx.segs);
+	vmm_free(tmp, len);
+	return;
+
+sequential:
+	xqsort(b, n, s, cmp);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -182,6 +182,8 @@
 #define TMALLOC_TGC_IDLE		30		/* s: idle time before clearing */
 #define TMALLOC_BEAT_THRESHOLD	20		/* s: reaction period */
 #define TMALLOC_CONTENTIONS		1.0		/* target is 1/sec max */
+#define TMALLOC_CHURN_HIGH		2.0		/* loads/sec per thread: grow M */
+#define TMALLOC_CHURN_LOW		0.05	/* loads/sec per thread: shrink M */
 #define TMALLOC_MINMAX_PERIODS	6		/* consecutive min/max periods needed */
 #define TMALLOC_GC_MAG_COUNT	256		/* Magazines freed each GC run */
 #define TMALLOC_GC_OBJ_COUNT	256		/* Objects freed each GC run */
@@ -228,6 +230,9 @@ struct tmalloc_stats {
 	AU64(tmas_contentions);			/* Total amount of lock contentions */
 	AU64(tmas_preemptions);			/* Counts "concurrent" signal processing */
 	AU64(tmas_capacity_increased);	/* Increased magazine capacity */
+	AU64(tmas_capacity_decreased);	/* Decreased magazine capacity */
+	AU64(tmas_batch_refills);		/* Magazines filled in one batch */
+	AU64(tmas_batch_objects);		/* Objects allocated via batch refills */
 	AU64(tmas_object_trash_reused);	/* Amount of trahsed object reused */
 	AU64(tmas_empty_trash_reused);	/* Empty trahsed magazines reused */
 	AU64(tmas_mag_allocated);		/* Total amount of magazines allocated */
@@ -280,6 +285,8 @@ struct tmalloc_depot {
 	void **tma_obj_trash;		/* Trashed objects, when thread exits */
 	size_t tma_obj_trash_count;	/* Amount of trashed objects */
 	time_t tma_last_contention;	/* When we last reset the contention counter */
+	uint64 tma_last_loads;		/* Magazine loads seen at last recompute */
+	size_t tma_churn;			/* Magazine loads per thread and minute */
 	cperiodic_t *tma_ev;		/* Periodic heartbeat event */
 	cperiodic_t *tma_gc_ev;		/* Periodic garbage collector event */
 	spinlock_t tma_lock;		/* Thread-safe lock */
@@ -287,6 +294,7 @@ struct tmalloc_depot {
 	/* memory layer */
 	alloc_fn_t tma_alloc;		/* Memory allocation routine */
 	free_size_fn_t tma_free;	/* Memory free routine */
+	tmalloc_vector_fn_t tma_vector;	/* Optional batch allocation routine */
 
 	/* statistics */
 	struct tmalloc_stats tma_stats;
@@ -1021,6 +1029,61 @@ tmalloc_depot_alloc(tmalloc_t *d)
 	return d->tma_alloc(d->tma_size);
 }
 
+/**
+ * Fill a magazine in one batch from the depot's memory allocator.
+ *
+ * This is used when the depot has no full magazine to hand out: rather than
+ * allocating objects one at a time through tmalloc_depot_alloc(), we get
+ * a whole magazine of objects from the underlying allocator in one call,
+ * which only needs to take its lock once.
+ *
+ * @param d		the depot from which we're allocating memory
+ *
+ * @return a non-empty magazine, or NULL if the depot cannot batch allocations.
+ */
+static tmalloc_magazine_t *
+tmalloc_depot_refill(tmalloc_t *d)
+{
+	tmalloc_magazine_t *m;
+	size_t n;
+
+	tmalloc_check(d);
+
+	if (NULL == d->tma_vector)
+		return NULL;
+
+	/*
+	 * Reuse an empty magazine from the depot if we have one, which is
+	 * typically the one we just gave back.
+	 */
+
+	tmalloc_depot_lock_hidden(d);
+	m = eslist_shift(&d->tma_empty.tml_list);
+	tmalloc_depot_unlock_hidden(d);
+
+	if (NULL == m)
+		m = tmalloc_magazine_alloc(d);
+
+	tmalloc_magazine_check_magic(m);
+	g_assert(0 == m->tmag_count);
+
+	n = (*d->tma_vector)(d->tma_size, m->tmag_objects, m->tmag_capacity);
+
+	g_assert(size_is_positive(n));
+	g_assert(n <= UNSIGNED(m->tmag_capacity));
+
+	m->tmag_count = n;
+
+	TMALLOC_LOCK_HIDDEN(d);
+	d->tma_magazines++;			/* Returning magazine to thread */
+	TMALLOC_UNLOCK_HIDDEN(d);
+
+	TMALLOC_STATS_INCX(d, batch_refills);
+	TMALLOC_STATS_ADDX(d, batch_objects, n);
+
+	return m;
+}
+
 /**
  * Put the object into the trash bin.
  *
@@ -1262,19 +1325,38 @@ tmalloc_thread_alloc(struct tmalloc_thread *t)
 			}
 
 			/*
-			 * If no magazine was available in the depot, then allocate
-			 * directly from the depot's memory allocator.
+			 * If no magazine was available in the depot, then fill one
+			 * from the depot's memory allocator, in one batch when possible,
+			 * or allocate a single object directly otherwise.
 			 */
 
-			if G_UNLIKELY(NULL == m)
-				return tmalloc_depot_alloc(t->tmt_depot);
+			if G_UNLIKELY(NULL == m) {
+				m = tmalloc_depot_refill(t->tmt_depot);
 
-			/*
-			 * Will allocate new object from the loaded magazine (full).
-			 */
+				if G_UNLIKELY(NULL == m)
+					return tmalloc_depot_alloc(t->tmt_depot);
 
-			tmalloc_magazine_check_magic(m);
-			g_assert(m->tmag_capacity == m->tmag_count);
+				om = t->tmt_mag[TMALLOC_MAG_LOADED];
+				t->tmt_mag[TMALLOC_MAG_LOADED] = m;
+
+				/*
+				 * Same check for "concurrent" allocation done whilst
+				 * in tmalloc_depot_refill().
+				 */
+
+				if G_UNLIKELY(om != NULL) {
+					tmalloc_magazine_check_magic(om);
+					TMALLOC_STATS_INCX(t->tmt_depot, preemptions);
+					tmalloc_depot_unload(t->tmt_depot, om, TMALLOC_MAG_EXTRA);
+				}
+			} else {
+				/*
+				 * Will allocate new object from the loaded magazine (full).
+				 */
+
+				tmalloc_magazine_check_magic(m);
+				g_assert(m->tmag_capacity == m->tmag_count);
+			}
 		}
 	}
 
@@ -1695,29 +1777,52 @@ tmalloc_beat(void *data)
 			d->tma_contentions / elapsed > (int) (5 * TMALLOC_CONTENTIONS))
 	) {
 		size_t contentions;
-		double rate;
+		uint64 loads;
+		double rate, churn;
+		int threads;
 
 		TMALLOC_LOCK_HIDDEN(d);
 		contentions = d->tma_contentions;
 		d->tma_contentions = 0;
 		d->tma_last_contention = now;
+		threads = MAX(1, d->tma_threads);
 		TMALLOC_UNLOCK_HIDDEN(d);
 
 		rate = contentions / (double) elapsed;
 
+		/*
+		 * The churn is the rate at which each thread needs to go back to
+		 * the depot to swap magazines: the higher it is, the smaller the
+		 * magazines are relative to the allocation pattern.
+		 */
+
+		loads = AU64_VALUE(&d->tma_stats.tmas_mag_full_loaded) +
+			AU64_VALUE(&d->tma_stats.tmas_mag_empty_loaded) +
+			AU64_VALUE(&d->tma_stats.tmas_batch_refills);
+		churn = (loads - d->tma_last_loads) / (double) elapsed / threads;
+		d->tma_last_loads = loads;
+		d->tma_churn = churn * 60.0;
+
 		if (tmalloc_debugging(2)) {
-			s_debug("%s(\"%s\"): contentions=%zu in %u secs (%.2f/sec)",
-				G_STRFUNC, d->tma_name, contentions, (uint) elapsed, rate);
+			s_debug("%s(\"%s\"): contentions=%zu in %u secs (%.2f/sec), "
+				"churn=%.2f loads/sec per thread",
+				G_STRFUNC, d->tma_name, contentions, (uint) elapsed, rate,
+				churn);
 		}
 
 		/*
 		 * If we have more lock contentions on the depot than our target,
+		 * or if threads churn through their magazines too quickly,
 		 * adjust the magazine capacity, then trash all the existing
 		 * magazines in the depot (since they are of the wrong size now).
+		 *
+		 * Conversely, when magazines are seldom exchanged and there is
+		 * no contention, shrink them back towards their default capacity
+		 * to avoid keeping too many objects cached in each thread.
 		 */
 
 		if (
-			rate > TMALLOC_CONTENTIONS &&
+			(rate > TMALLOC_CONTENTIONS || churn > TMALLOC_CHURN_HIGH) &&
 			d->tma_mag_capacity < tmalloc_magazine_max_capacity(d->tma_size)
 		) {
 			TMALLOC_LOCK_HIDDEN(d);
@@ -1732,6 +1837,22 @@ tmalloc_beat(void *data)
 				s_debug("%s(\"%s\"): M increased to %d",
 					G_STRFUNC, d->tma_name, d->tma_mag_capacity);
 			}
+		} else if (
+			0 == contentions && churn < TMALLOC_CHURN_LOW &&
+			d->tma_mag_capacity > tmalloc_magazine_default_capacity(d->tma_size)
+		) {
+			TMALLOC_LOCK_HIDDEN(d);
+			d->tma_mag_capacity--;
+			tmalloc_trash_list(&d->tma_full);
+			tmalloc_trash_list(&d->tma_empty);
+			TMALLOC_UNLOCK_HIDDEN(d);
+
+			TMALLOC_STATS_INCX(d, capacity_decreased);
+
+			if (tmalloc_debugging(1)) {
+				s_debug("%s(\"%s\"): M decreased to %d",
+					G_STRFUNC, d->tma_name, d->tma_mag_capacity);
+			}
 		}
 	}
 
@@ -1917,6 +2038,25 @@ tmalloc_create(const char *name, size_t size,
 	return tma;
 }
 
+/**
+ * Install a batch allocation routine on the depot.
+ *
+ * When set, the depot uses it to fill a whole magazine at once when it has
+ * no full magazine to give to a thread, instead of letting that thread
+ * allocate its objects one by one from the underlying allocator.
+ *
+ * @param tma		the thread magazine depot
+ * @param vector	the batch allocation routine
+ */
+void
+tmalloc_set_vector(tmalloc_t *tma, tmalloc_vector_fn_t vector)
+{
+	tmalloc_check(tma);
+	g_assert(vector != NULL);
+
+	tma->tma_vector = vector;
+}
+
 /**
  * Free the magazine lists.
  */
@@ -2865,6 +3005,7 @@ tmalloc_info_list(void)
 		tmi->mag_full_trash = eslist_count(&d->tma_full.tml_trash);
 		tmi->mag_empty_trash = eslist_count(&d->tma_empty.tml_trash);
 		tmi->mag_object_trash = d->tma_obj_trash_count;
+		tmi->mag_churn = d->tma_churn;
 
 #define STATS_COPY(name)	tmi->name = AU64_VALUE(&d->tma_stats.tmas_ ## name)
 
@@ -2884,8 +3025,13 @@ tmalloc_info_list(void)
 		STATS_COPY(smart_drop_full_mag);
 		STATS_COPY(threads);
 		STATS_COPY(contentions);
+		STATS_COPY(preemptions);
 		STATS_COPY(object_trash_reused);
 		STATS_COPY(empty_trash_reused);
+		STATS_COPY(capacity_increased);
+		STATS_COPY(capacity_decreased);
+		STATS_COPY(batch_refills);
+		STATS_COPY(batch_objects);
 		STATS_COPY(mag_allocated);
 		STATS_COPY(mag_freed);
 		STATS_COPY(mag_trashed);
@@ -2987,6 +3133,9 @@ tmalloc_all_stats(tmalloc_info_t *stats)
 		STATS_COPY(object_trash_reused);
 		STATS_COPY(empty_trash_reused);
 		STATS_COPY(capacity_increased);
+		STATS_COPY(capacity_decreased);
+		STATS_COPY(batch_refills);
+		STATS_COPY(batch_objects);
 		STATS_COPY(mag_allocated);
 		STATS_COPY(mag_freed);
 		STATS_COPY(mag_trashed);
@@ -3011,6 +3160,27 @@ tmalloc_all_stats(tmalloc_info_t *stats)
 	return depot_count;
 }
 
+/**
+ * @return total amount of object allocations made across all the depots.
+ */
+uint64
+tmalloc_allocations(void)
+{
+	tmalloc_t *d;
+	uint64 count = 0;
+
+	TMALLOC_VARS_LOCK;
+
+	ESLIST_FOREACH_DATA(&tmalloc_vars, d) {
+		tmalloc_check(d);
+		count += AU64_VALUE(&d->tma_stats.tmas_allocations);
+	}
+
+	TMALLOC_VARS_UNLOCK;
+
+	return count;
+}
+
 /**
  * Generate a SHA1 digest of the current tmalloc statistics.
  *
@@ -3065,6 +3235,9 @@ tmalloc_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(object_trash_reused);
 	DUMP(empty_trash_reused);
 	DUMP(capacity_increased);
+	DUMP(capacity_decreased);
+	DUMP(batch_refills);
+	DUMP(batch_objects);
 	DUMP(mag_full);
 	DUMP(mag_empty);
 	DUMP(mag_full_trash);
@@ -3110,6 +3283,7 @@ tmalloc_info_dump(void *data, void *udata)
 
 	DUMPS(attached);
 	DUMPS(magazines);
+	DUMPS(mag_churn);
 	DUMPL(contentions);
 	DUMPL(preemptions);
 	DUMPL(allocations);
@@ -3130,6 +3304,9 @@ tmalloc_info_dump(void *data, void *udata)
 	DUMPL(object_trash_reused);
 	DUMPL(empty_trash_reused);
 	DUMPL(capacity_increased);
+	DUMPL(capacity_decreased);
+	DUMPL(batch_refills);
+	DUMPL(batch_objects);
 	DUMPL(mag_full);
 	DUMPL(mag_empty);
 	DUMPL(mag_full_trash);
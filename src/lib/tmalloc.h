@@ -46,6 +46,17 @@ typedef struct tmalloc_depot tmalloc_t;
  */
 typedef bool (*tmalloc_better_fn_t)(const void *o, const void *n);
 
+/**
+ * Batch allocation routine signature, for tmalloc_set_vector().
+ *
+ * @param size	size of each object
+ * @param vec	vector where allocated objects are written
+ * @param n		maximum amount of objects to allocate
+ *
+ * @return amount of objects allocated, at least 1.
+ */
+typedef size_t (*tmalloc_vector_fn_t)(size_t size, void **vec, size_t n);
+
 enum tmalloc_info_magic { TMALLOC_INFO_MAGIC = 0x7e60619b };
 
 /**
@@ -63,6 +74,7 @@ typedef struct {
 	size_t mag_full_trash;			/**< Full magazines, trashed */
 	size_t mag_empty_trash;			/**< Empty magazines, trashed */
 	size_t mag_object_trash;		/**< Objects in the trash */
+	size_t mag_churn;				/**< Magazine loads per thread and minute */
 	uint64 allocations;				/**< Total amount of object allocations */
 	uint64 allocations_zeroed;		/**< Allocations zeroed */
 	uint64 depot_allocations;		/**< Allocations made via the depot layer */
@@ -83,6 +95,9 @@ typedef struct {
 	uint64 object_trash_reused;		/**< Amount of trashed objects reused */
 	uint64 empty_trash_reused;		/**< Empty trashed magazines reused */
 	uint64 capacity_increased;		/**< Magazine capacity increases */
+	uint64 capacity_decreased;		/**< Magazine capacity decreases */
+	uint64 batch_refills;			/**< Magazines filled in one batch */
+	uint64 batch_objects;			/**< Objects allocated by batch refills */
 	uint64 mag_allocated;			/**< Total amount of magazines allocated */
 	uint64 mag_freed;				/**< Total amount of magazines freed */
 	uint64 mag_trashed;				/**< Total amount of magazines trashed */
@@ -113,6 +128,7 @@ void set_tmalloc_debug(uint32 level);
 
 tmalloc_t *tmalloc_create(const char *name, size_t size,
 	alloc_fn_t allocate, free_size_fn_t deallocate);
+void tmalloc_set_vector(tmalloc_t *tma, tmalloc_vector_fn_t vector);
 void tmalloc_reset(tmalloc_t *tma);
 size_t tmalloc_size(const tmalloc_t *tma);
 
@@ -131,6 +147,7 @@ struct logagent;
 struct sha1;
 
 void tmalloc_stats_digest(struct sha1 *digest);
+uint64 tmalloc_allocations(void);
 
 struct pslist *tmalloc_info_list(void);
 void tmalloc_info_list_free_null(struct pslist **sl_ptr);
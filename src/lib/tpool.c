@@ -0,0 +1,893 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Work-stealing thread pool.
+ *
+ * A pool runs a fixed amount of worker threads, each owning one task deque
+ * per priority level.  Tasks submitted by a worker are pushed on its own
+ * deque and popped back in LIFO order, which keeps the data they touch hot
+ * in the CPU cache.  Tasks submitted by other threads are spread over the
+ * workers in a round-robin fashion.  An idle worker first looks at its own
+ * deque, then steals the oldest task from the other workers, so that the
+ * load is balanced without any central queue.  Higher-priority tasks are
+ * always looked for in all the deques before lower-priority ones.
+ *
+ * Besides plain closures, the pool can run a sequence of steps using the
+ * same conventions as background tasks (see bg.c): each invocation of a step
+ * returns BGR_MORE to be called again, BGR_NEXT to move to the next step, or
+ * BGR_DONE / BGR_ERROR to stop.  The task is requeued between invocations so
+ * that long-running computations share the workers with the other tasks.
+ *
+ * Tasks can be attached to a group, which allows waiting for the completion
+ * of all of them.  A thread waiting on a group runs pending tasks meanwhile,
+ * hence it is possible to wait for a group from within a task without risking
+ * a deadlock.  This is what tpool_for() relies on to split a range of indices
+ * into chunks processed in parallel.
+ *
+ * A process-wide pool, with one worker per CPU up to TPOOL_DFLT_THREADS, is
+ * available through tpool_default() so that CPU-intensive processing
+ * (hashing, sorting, scanning...) can share cores instead of each creating
+ * its own threads.
+ *
+ * Threads are a scarce resource (see THREAD_MAX), so a pool runs with the
+ * workers it could actually create.  When none could be created, tasks are
+ * run by the thread submitting them.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "tpool.h"
+
+#include "atomic.h"
+#include "cond.h"
+#include "elist.h"
+#include "getcpucount.h"
+#include "log.h"
+#include "mutex.h"
+#include "once.h"
+#include "spinlock.h"
+#include "stringify.h"
+#include "thread.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define TPOOL_MAX_THREADS	16		/**< Maximum amount of workers */
+#define TPOOL_DFLT_THREADS	8		/**< Maximum workers in default pool */
+#define TPOOL_FOR_SPLIT		4		/**< Chunks per worker in tpool_for() */
+
+enum tpool_task_magic { TPOOL_TASK_MAGIC = 0x6a1d02c5 };
+
+/**
+ * A task.
+ */
+struct tpool_task {
+	enum tpool_task_magic magic;	/**< Magic number */
+	tpool_fn_t fn;					/**< Closure to run, NULL for steps */
+	void *arg;						/**< Closure argument or step context */
+	tpool_step_t *steps;			/**< Steps to run (copied) */
+	tpool_done_t done;				/**< Called when steps are over */
+	tpool_group_t *group;			/**< Group to which task belongs */
+	uint count;						/**< Amount of steps */
+	uint step;						/**< Current step */
+	tpool_prio_t prio;				/**< Task priority */
+	link_t lk;						/**< Embedded link in deque */
+};
+
+static inline void
+tpool_task_check(const struct tpool_task * const t)
+{
+	g_assert(t != NULL);
+	g_assert(TPOOL_TASK_MAGIC == t->magic);
+}
+
+/**
+ * A worker, with its task deques.
+ *
+ * The owner pushes and pops tasks at the tail of its deques, other threads
+ * steal tasks from the head.
+ */
+struct tpool_worker {
+	tpool_t *tp;					/**< Pool to which worker belongs */
+	uint index;						/**< Worker index in pool */
+	int tid;						/**< Thread ID */
+	spinlock_t lock;				/**< Protects deques */
+	elist_t deque[TPOOL_PRIO_COUNT];	/**< Tasks, by priority */
+};
+
+enum tpool_magic { TPOOL_MAGIC = 0x1c6b95e0 };
+
+/**
+ * A thread pool.
+ */
+struct tpool {
+	enum tpool_magic magic;			/**< Magic number */
+	const char *name;				/**< Pool name (static string) */
+	uint threads;					/**< Amount of running workers */
+	uint slots;						/**< Allocated worker structures */
+	uint next;						/**< Next worker for external submits */
+	int queued;						/**< Tasks held in deques */
+	int idle;						/**< Threads waiting for an event */
+	int shutdown;					/**< Set when pool is being freed */
+	struct tpool_worker *workers;	/**< Worker array */
+	mutex_t lock;					/**< Protects waits on event */
+	cond_t event;					/**< Signals new tasks and completions */
+	AU64(submitted);				/**< Tasks submitted */
+	AU64(executed);					/**< Task runs */
+	AU64(stolen);					/**< Tasks stolen from other workers */
+	AU64(helped);					/**< Tasks run by group waiters */
+	AU64(sleeps);					/**< Worker sleeps */
+};
+
+static inline void
+tpool_check(const struct tpool * const tp)
+{
+	g_assert(tp != NULL);
+	g_assert(TPOOL_MAGIC == tp->magic);
+}
+
+enum tpool_group_magic { TPOOL_GROUP_MAGIC = 0x73e0b4a9 };
+
+/**
+ * A group of tasks.
+ */
+struct tpool_group {
+	enum tpool_group_magic magic;	/**< Magic number */
+	tpool_t *tp;					/**< Pool running the tasks */
+	int pending;					/**< Tasks not completed yet */
+};
+
+static inline void
+tpool_group_check(const struct tpool_group * const g)
+{
+	g_assert(g != NULL);
+	g_assert(TPOOL_GROUP_MAGIC == g->magic);
+}
+
+static thread_key_t tpool_key = THREAD_KEY_INIT;
+static once_flag_t tpool_key_inited;
+
+static tpool_t *tpool_dflt;
+static once_flag_t tpool_dflt_inited;
+
+static void
+tpool_key_init(void)
+{
+	if (-1 == thread_local_key_create(&tpool_key, NULL))
+		s_error("cannot initialize thread pool key: %m");
+}
+
+/**
+ * @return the worker structure of the current thread if it belongs to
+ * the pool, NULL otherwise.
+ */
+static struct tpool_worker *
+tpool_current_worker(const tpool_t *tp)
+{
+	struct tpool_worker *w = thread_local_get(tpool_key);
+
+	return (w != NULL && w->tp == tp) ? w : NULL;
+}
+
+/**
+ * Wakeup one thread waiting for tasks, if any.
+ */
+static void
+tpool_wakeup(tpool_t *tp)
+{
+	if (0 != ATOMIC_GET(&tp->idle)) {
+		mutex_lock(&tp->lock);
+		cond_signal(&tp->event, &tp->lock);
+		mutex_unlock(&tp->lock);
+	}
+}
+
+/**
+ * Enqueue task.
+ *
+ * @param tp		the pool
+ * @param t			the task
+ * @param oldest	if TRUE, enqueue task as the oldest one in the deque
+ */
+static void tpool_run(tpool_t *tp, struct tpool_task *t);
+
+static void
+tpool_push(tpool_t *tp, struct tpool_task *t, bool oldest)
+{
+	struct tpool_worker *w;
+
+	/*
+	 * Without any worker, the task is run by the calling thread.
+	 */
+
+	if G_UNLIKELY(0 == tp->threads) {
+		tpool_run(tp, t);
+		return;
+	}
+
+	w = tpool_current_worker(tp);
+
+	if (NULL == w)
+		w = &tp->workers[atomic_uint_inc(&tp->next) % tp->threads];
+
+	spinlock(&w->lock);
+	if (oldest)
+		elist_prepend(&w->deque[t->prio], t);
+	else
+		elist_append(&w->deque[t->prio], t);
+	spinunlock(&w->lock);
+
+	/*
+	 * The increment of the queued count must be visible before we look
+	 * whether there are idle threads: sleepers update the idle count before
+	 * checking the queued count, so one of us is bound to see the other.
+	 */
+
+	ATOMIC_INC(&tp->queued);
+	atomic_mb();
+	tpool_wakeup(tp);
+}
+
+/**
+ * Grab next task to run.
+ *
+ * @param tp		the pool
+ * @param self		the worker of the current thread, NULL if not a worker
+ * @param stolen	set to TRUE if task was taken from another worker
+ *
+ * @return the task, NULL if none was found.
+ */
+static struct tpool_task *
+tpool_take(tpool_t *tp, struct tpool_worker *self, bool *stolen)
+{
+	struct tpool_task *t = NULL;
+	uint p, i, start;
+
+	if (0 == ATOMIC_GET(&tp->queued))
+		return NULL;
+
+	start = (NULL == self) ? thread_small_id() : self->index + 1;
+
+	for (p = 0; p < TPOOL_PRIO_COUNT; p++) {
+		if (self != NULL && 0 != elist_count(&self->deque[p])) {
+			spinlock(&self->lock);
+			t = elist_tail(&self->deque[p]);
+			if (t != NULL)
+				elist_remove(&self->deque[p], t);
+			spinunlock(&self->lock);
+
+			if (t != NULL) {
+				*stolen = FALSE;
+				goto found;
+			}
+		}
+
+		for (i = 0; i < tp->threads; i++) {
+			struct tpool_worker *w = &tp->workers[(start + i) % tp->threads];
+
+			/* Unlocked peek at the count, to avoid needless locking */
+
+			if (w == self || 0 == elist_count(&w->deque[p]))
+				continue;
+
+			spinlock(&w->lock);
+			t = elist_head(&w->deque[p]);
+			if (t != NULL)
+				elist_remove(&w->deque[p], t);
+			spinunlock(&w->lock);
+
+			if (t != NULL) {
+				*stolen = TRUE;
+				goto found;
+			}
+		}
+	}
+
+	return NULL;
+
+found:
+	tpool_task_check(t);
+	ATOMIC_DEC(&tp->queued);
+	return t;
+}
+
+/**
+ * Signal completion of a task belonging to a group.
+ */
+static void
+tpool_group_done(tpool_t *tp, tpool_group_t *g)
+{
+	tpool_group_check(g);
+
+	/*
+	 * Once the pending count reaches 0, the group can be freed by the
+	 * thread waiting on it, hence we must no longer access it.
+	 */
+
+	if (atomic_int_dec_is_zero(&g->pending)) {
+		mutex_lock(&tp->lock);
+		cond_broadcast(&tp->event, &tp->lock);
+		mutex_unlock(&tp->lock);
+	}
+}
+
+/**
+ * Run task.
+ */
+static void
+tpool_run(tpool_t *tp, struct tpool_task *t)
+{
+	AU64_INC(&tp->executed);
+
+	if (t->steps != NULL) {
+		bgret_t ret;
+
+	again:
+		g_assert(t->step < t->count);
+
+		ret = (*t->steps[t->step])(t->arg);
+
+		/*
+		 * When running inline (no workers), there is nobody to share the
+		 * pool with, so we keep running the steps of the task.
+		 */
+
+		switch (ret) {
+		case BGR_MORE:
+			if G_UNLIKELY(0 == tp->threads)
+				goto again;
+			tpool_push(tp, t, TRUE);
+			return;
+		case BGR_NEXT:
+			if (++t->step < t->count) {
+				if G_UNLIKELY(0 == tp->threads)
+					goto again;
+				tpool_push(tp, t, TRUE);
+				return;
+			}
+			ret = BGR_DONE;
+			break;
+		case BGR_DONE:
+		case BGR_ERROR:
+			break;
+		}
+
+		if (t->done != NULL)
+			(*t->done)(t->arg, ret);
+
+		WFREE_ARRAY(t->steps, t->count);
+	} else {
+		(*t->fn)(t->arg);
+	}
+
+	if (t->group != NULL)
+		tpool_group_done(tp, t->group);
+
+	t->magic = 0;
+	WFREE(t);
+}
+
+/**
+ * Main entry point for worker threads.
+ */
+static void *
+tpool_worker_main(void *arg)
+{
+	struct tpool_worker *w = arg;
+	tpool_t *tp = w->tp;
+
+	thread_set_name(tp->name);
+	thread_local_set(tpool_key, w);
+
+	for (;;) {
+		struct tpool_task *t;
+		bool stolen;
+
+		t = tpool_take(tp, w, &stolen);
+
+		if (t != NULL) {
+			if (stolen)
+				AU64_INC(&tp->stolen);
+			tpool_run(tp, t);
+			continue;
+		}
+
+		mutex_lock(&tp->lock);
+
+		if (tp->shutdown && 0 == ATOMIC_GET(&tp->queued)) {
+			mutex_unlock(&tp->lock);
+			break;
+		}
+
+		ATOMIC_INC(&tp->idle);
+		atomic_mb();
+
+		if (0 == ATOMIC_GET(&tp->queued) && !tp->shutdown) {
+			AU64_INC(&tp->sleeps);
+			cond_wait_clean(&tp->event, &tp->lock);
+		}
+
+		ATOMIC_DEC(&tp->idle);
+		mutex_unlock(&tp->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Create a new thread pool.
+ *
+ * The pool can end up with less workers than requested if we cannot create
+ * that many threads, down to none, in which case submitted tasks are run
+ * by the submitting thread.
+ *
+ * @param name		pool name (static string), also used for worker threads
+ * @param threads	amount of worker threads, 0 for one per CPU
+ *
+ * @return a new thread pool.
+ */
+tpool_t *
+tpool_make(const char *name, uint threads)
+{
+	tpool_t *tp;
+	uint i, p;
+
+	g_assert(name != NULL);
+
+	ONCE_FLAG_RUN(tpool_key_inited, tpool_key_init);
+
+	if (0 == threads)
+		threads = MAX(1, getcpucount());
+	threads = MIN(threads, TPOOL_MAX_THREADS);
+
+	WALLOC0(tp);
+	tp->magic = TPOOL_MAGIC;
+	tp->name = name;
+	tp->threads = threads;
+	tp->slots = threads;
+	mutex_init(&tp->lock);
+	cond_init(&tp->event, &tp->lock);
+
+	XMALLOC0_ARRAY(tp->workers, threads);
+
+	for (i = 0; i < threads; i++) {
+		struct tpool_worker *w = &tp->workers[i];
+
+		w->tp = tp;
+		w->index = i;
+		spinlock_init(&w->lock);
+		for (p = 0; p < TPOOL_PRIO_COUNT; p++)
+			elist_init(&w->deque[p], offsetof(struct tpool_task, lk));
+	}
+
+	/*
+	 * Workers are only started once the whole pool is initialized since
+	 * they may steal from each other as soon as they run.
+	 *
+	 * We stop at the first thread we cannot create, so that running workers
+	 * always are the first ones in the array.  Workers already started can
+	 * only find empty deques beyond the final amount of workers.
+	 */
+
+	for (i = 0; i < threads; i++) {
+		struct tpool_worker *w = &tp->workers[i];
+		int tid;
+
+		tid = thread_create(tpool_worker_main, w,
+			THREAD_F_NO_CANCEL, THREAD_STACK_DFLT);
+
+		if (-1 == tid) {
+			s_warning("%s(): could only create %u/%u worker%s for \"%s\": %m",
+				G_STRFUNC, i, threads, plural(threads), name);
+			break;
+		}
+
+		w->tid = tid;
+	}
+
+	if (i != threads)
+		atomic_uint_set(&tp->threads, i);
+
+	return tp;
+}
+
+/**
+ * Free thread pool and nullify its pointer.
+ *
+ * All the tasks already submitted are run before the worker threads exit.
+ * This must not be called from a worker of the pool.
+ */
+void
+tpool_free_null(tpool_t **tp_ptr)
+{
+	tpool_t *tp = *tp_ptr;
+
+	if (tp != NULL) {
+		uint i, p;
+
+		tpool_check(tp);
+		g_assert_log(!tpool_is_worker(tp),
+			"%s(): called from a worker of the \"%s\" pool",
+			G_STRFUNC, tp->name);
+
+		mutex_lock(&tp->lock);
+		tp->shutdown = TRUE;
+		cond_broadcast(&tp->event, &tp->lock);
+		mutex_unlock(&tp->lock);
+
+		for (i = 0; i < tp->threads; i++) {
+			if (-1 == thread_join(tp->workers[i].tid, NULL)) {
+				s_warning("%s(): cannot join %s worker #%u: %m",
+					G_STRFUNC, tp->name, i);
+			}
+		}
+
+		for (i = 0; i < tp->slots; i++) {
+			struct tpool_worker *w = &tp->workers[i];
+
+			for (p = 0; p < TPOOL_PRIO_COUNT; p++)
+				g_assert(0 == elist_count(&w->deque[p]));
+			spinlock_destroy(&w->lock);
+		}
+
+		XFREE_NULL(tp->workers);
+		cond_destroy(&tp->event);
+		mutex_destroy(&tp->lock);
+		tp->magic = 0;
+		WFREE(tp);
+		*tp_ptr = NULL;
+	}
+}
+
+static void
+tpool_default_init(void)
+{
+	uint n = MAX(1, getcpucount());
+
+	tpool_dflt = tpool_make("thread pool", MIN(n, TPOOL_DFLT_THREADS));
+}
+
+/**
+ * @return the default process-wide thread pool, with one worker per CPU,
+ * up to TPOOL_DFLT_THREADS.
+ */
+tpool_t *
+tpool_default(void)
+{
+	ONCE_FLAG_RUN(tpool_dflt_inited, tpool_default_init);
+
+	return tpool_dflt;
+}
+
+/**
+ * @return whether the default thread pool was already created, without
+ * creating it.
+ */
+bool
+tpool_default_exists(void)
+{
+	return ONCE_DONE(tpool_dflt_inited);
+}
+
+/**
+ * @return the amount of worker threads in the pool, 0 if tasks are run
+ * inline by the submitting threads.
+ */
+uint
+tpool_threads(const tpool_t *tp)
+{
+	tpool_check(tp);
+
+	return tp->threads;
+}
+
+/**
+ * @return whether the current thread is a worker of the pool.
+ */
+bool
+tpool_is_worker(const tpool_t *tp)
+{
+	tpool_check(tp);
+
+	return NULL != tpool_current_worker(tp);
+}
+
+/**
+ * Allocate a new task, attached to the group if non-NULL.
+ */
+static struct tpool_task *
+tpool_task_alloc(tpool_t *tp, tpool_prio_t prio, tpool_group_t *g)
+{
+	struct tpool_task *t;
+
+	tpool_check(tp);
+	g_assert(UNSIGNED(prio) < TPOOL_PRIO_COUNT);
+
+	if (g != NULL) {
+		tpool_group_check(g);
+		g_assert(g->tp == tp);
+		ATOMIC_INC(&g->pending);
+	}
+
+	WALLOC0(t);
+	t->magic = TPOOL_TASK_MAGIC;
+	t->prio = prio;
+	t->group = g;
+
+	AU64_INC(&tp->submitted);
+
+	return t;
+}
+
+/**
+ * Submit a task running a closure.
+ *
+ * @param tp		the pool
+ * @param prio		task priority
+ * @param fn		the routine to run
+ * @param arg		argument passed to the routine
+ * @param g			the group to which the task belongs (may be NULL)
+ */
+void
+tpool_submit(tpool_t *tp, tpool_prio_t prio,
+	tpool_fn_t fn, void *arg, tpool_group_t *g)
+{
+	struct tpool_task *t;
+
+	g_assert(fn != NULL);
+
+	t = tpool_task_alloc(tp, prio, g);
+	t->fn = fn;
+	t->arg = arg;
+
+	tpool_push(tp, t, FALSE);
+}
+
+/**
+ * Submit a task running a sequence of steps.
+ *
+ * Each step is invoked repeatedly while it returns BGR_MORE, the task
+ * moving to the next step on BGR_NEXT.  The task ends after the last step
+ * or when a step returns BGR_DONE or BGR_ERROR.  Other tasks can be run
+ * between two invocations.
+ *
+ * @param tp		the pool
+ * @param prio		task priority
+ * @param steps		the steps to run (array is copied)
+ * @param count		amount of steps
+ * @param ctx		context passed to the steps and the done callback
+ * @param done		if non-NULL, invoked with the final status
+ * @param g			the group to which the task belongs (may be NULL)
+ */
+void
+tpool_submit_steps(tpool_t *tp, tpool_prio_t prio,
+	const tpool_step_t *steps, uint count, void *ctx,
+	tpool_done_t done, tpool_group_t *g)
+{
+	struct tpool_task *t;
+
+	g_assert(steps != NULL);
+	g_assert(count != 0);
+
+	t = tpool_task_alloc(tp, prio, g);
+	t->steps = WCOPY_ARRAY(steps, count);
+	t->count = count;
+	t->arg = ctx;
+	t->done = done;
+
+	tpool_push(tp, t, FALSE);
+}
+
+/**
+ * Initialize group.
+ */
+static void
+tpool_group_init(tpool_group_t *g, tpool_t *tp)
+{
+	tpool_check(tp);
+
+	g->magic = TPOOL_GROUP_MAGIC;
+	g->tp = tp;
+	g->pending = 0;
+}
+
+/**
+ * Create a new task group.
+ */
+tpool_group_t *
+tpool_group_make(tpool_t *tp)
+{
+	tpool_group_t *g;
+
+	WALLOC(g);
+	tpool_group_init(g, tp);
+
+	return g;
+}
+
+/**
+ * Wait until all the tasks of the group are completed.
+ *
+ * The calling thread runs pending tasks of the pool while waiting, and only
+ * blocks when there is nothing left to run.
+ */
+void
+tpool_group_wait(tpool_group_t *g)
+{
+	tpool_t *tp;
+	struct tpool_worker *self;
+
+	tpool_group_check(g);
+
+	tp = g->tp;
+	self = tpool_current_worker(tp);
+
+	while (0 != ATOMIC_GET(&g->pending)) {
+		struct tpool_task *t;
+		bool stolen;
+
+		t = tpool_take(tp, self, &stolen);
+
+		if (t != NULL) {
+			AU64_INC(&tp->helped);
+			tpool_run(tp, t);
+			continue;
+		}
+
+		mutex_lock(&tp->lock);
+		ATOMIC_INC(&tp->idle);
+		atomic_mb();
+
+		if (0 != ATOMIC_GET(&g->pending) && 0 == ATOMIC_GET(&tp->queued))
+			cond_wait_clean(&tp->event, &tp->lock);
+
+		ATOMIC_DEC(&tp->idle);
+		mutex_unlock(&tp->lock);
+	}
+}
+
+/**
+ * Wait for completion of all the tasks in the group, then free it and
+ * nullify its pointer.
+ */
+void
+tpool_group_free_null(tpool_group_t **g_ptr)
+{
+	tpool_group_t *g = *g_ptr;
+
+	if (g != NULL) {
+		tpool_group_wait(g);
+		g->magic = 0;
+		WFREE(g);
+		*g_ptr = NULL;
+	}
+}
+
+/**
+ * A chunk of a parallel loop.
+ */
+struct tpool_range {
+	tpool_range_fn_t fn;
+	void *ctx;
+	size_t lo, hi;
+};
+
+static void
+tpool_range_run(void *arg)
+{
+	struct tpool_range *r = arg;
+
+	(*r->fn)(r->ctx, r->lo, r->hi);
+}
+
+/**
+ * Parallel loop over the [lo, hi) interval.
+ *
+ * The interval is split in chunks of ``grain'' indices, each chunk being
+ * processed by a call to fn(ctx, start, end).  The calling thread processes
+ * the first chunk itself and helps with the others, returning only when all
+ * the chunks were processed.
+ *
+ * @param tp		the pool
+ * @param lo		first index
+ * @param hi		last index + 1
+ * @param grain		chunk size, 0 to let the pool decide
+ * @param fn		routine processing a chunk
+ * @param ctx		context passed to the routine
+ */
+void
+tpool_for(tpool_t *tp, size_t lo, size_t hi, size_t grain,
+	tpool_range_fn_t fn, void *ctx)
+{
+	struct tpool_range *rv;
+	struct tpool_group g;
+	size_t n, chunks, i;
+
+	tpool_check(tp);
+	g_assert(fn != NULL);
+
+	if (hi <= lo)
+		return;
+
+	n = hi - lo;
+
+	if (0 == grain)
+		grain = MAX(1, n / (MAX(1, tp->threads) * TPOOL_FOR_SPLIT));
+
+	if (n <= grain || tp->threads <= 1) {
+		(*fn)(ctx, lo, hi);
+		return;
+	}
+
+	chunks = (n + grain - 1) / grain;
+	XMALLOC_ARRAY(rv, chunks);
+	tpool_group_init(&g, tp);
+
+	for (i = 0; i < chunks; i++) {
+		struct tpool_range *r = &rv[i];
+
+		r->fn = fn;
+		r->ctx = ctx;
+		r->lo = lo + i * grain;
+		r->hi = MIN(r->lo + grain, hi);
+
+		if (i != 0)
+			tpool_submit(tp, TPOOL_PRIO_HIGH, tpool_range_run, r, &g);
+	}
+
+	tpool_range_run(&rv[0]);
+	tpool_group_wait(&g);
+
+	g.magic = 0;
+	XFREE_NULL(rv);
+}
+
+/**
+ * Fill pool statistics.
+ */
+void
+tpool_info(const tpool_t *tp, tpool_info_t *info)
+{
+	tpool_check(tp);
+	g_assert(info != NULL);
+
+	info->name      = tp->name;
+	info->threads   = tp->threads;
+	info->idle      = ATOMIC_GET(&tp->idle);
+	info->queued    = ATOMIC_GET(&tp->queued);
+	info->submitted = AU64_VALUE(&tp->submitted);
+	info->executed  = AU64_VALUE(&tp->executed);
+	info->stolen    = AU64_VALUE(&tp->stolen);
+	info->helped    = AU64_VALUE(&tp->helped);
+	info->sleeps    = AU64_VALUE(&tp->sleeps);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
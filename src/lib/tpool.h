@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Work-stealing thread pool.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#ifndef _tpool_h_
+#define _tpool_h_
+
+#include "bg.h"			/* For bgret_t */
+
+typedef struct tpool tpool_t;
+typedef struct tpool_group tpool_group_t;
+
+/**
+ * Task priorities.
+ */
+typedef enum {
+	TPOOL_PRIO_HIGH = 0,
+	TPOOL_PRIO_NORMAL,
+	TPOOL_PRIO_LOW,
+
+	TPOOL_PRIO_COUNT
+} tpool_prio_t;
+
+typedef void (*tpool_fn_t)(void *arg);
+typedef bgret_t (*tpool_step_t)(void *ctx);
+typedef void (*tpool_done_t)(void *ctx, bgret_t status);
+typedef void (*tpool_range_fn_t)(void *ctx, size_t lo, size_t hi);
+
+/**
+ * Pool statistics.
+ */
+typedef struct tpool_info {
+	const char *name;		/**< Pool name (static string) */
+	uint threads;			/**< Amount of worker threads */
+	uint idle;				/**< Amount of idle workers */
+	uint queued;			/**< Tasks waiting to be run */
+	uint64 submitted;		/**< Tasks submitted */
+	uint64 executed;		/**< Task runs (steps count each invocation) */
+	uint64 stolen;			/**< Tasks taken from another worker */
+	uint64 helped;			/**< Tasks run by threads waiting on groups */
+	uint64 sleeps;			/**< Times a worker went to sleep */
+} tpool_info_t;
+
+/*
+ * Public interface.
+ */
+
+tpool_t *tpool_make(const char *name, uint threads);
+void tpool_free_null(tpool_t **tp_ptr);
+tpool_t *tpool_default(void);
+bool tpool_default_exists(void);
+uint tpool_threads(const tpool_t *tp);
+bool tpool_is_worker(const tpool_t *tp);
+
+void tpool_submit(tpool_t *tp, tpool_prio_t prio,
+	tpool_fn_t fn, void *arg, tpool_group_t *g);
+void tpool_submit_steps(tpool_t *tp, tpool_prio_t prio,
+	const tpool_step_t *steps, uint count, void *ctx,
+	tpool_done_t done, tpool_group_t *g);
+
+tpool_group_t *tpool_group_make(tpool_t *tp);
+void tpool_group_wait(tpool_group_t *g);
+void tpool_group_free_null(tpool_group_t **g_ptr);
+
+void tpool_for(tpool_t *tp, size_t lo, size_t hi, size_t grain,
+	tpool_range_fn_t fn, void *ctx);
+
+void tpool_info(const tpool_t *tp, tpool_info_t *info);
+
+#endif /* _tpool_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -104,6 +104,10 @@
 
 #include "common.h"
 
+#ifdef HAS_SYSCALL
+#include <sys/syscall.h>
+#endif
+
 #define VMM_SOURCE
 #include "vmm.h"
 
@@ -117,12 +121,15 @@
 #include "entropy.h"
 #include "evq.h"
 #include "fd.h"
+#include "file.h"
+#include "filehead.h"
 #include "log.h"
 #include "memusage.h"
 #include "mutex.h"
 #include "omalloc.h"
 #include "once.h"
 #include "parse.h"
+#include "pattern.h"		/* For vstrstr() */
 #include "pow2.h"
 #include "rwlock.h"
 #include "sha1.h"
@@ -343,6 +350,13 @@ static struct vmm_stats {
 	uint64 hole_invalidated;		/**< Times we invalidate cached hole */
 	uint64 hole_updated;			/**< Times we updated the cached hole */
 	uint64 hole_unchanged;			/**< Times we left the cached hole as-is */
+	AU64(large_allocations);		/**< Allocation of large regions */
+	AU64(large_from_cache);			/**< Large regions reused from node cache */
+	AU64(large_freeings);			/**< Freeing of large regions */
+	AU64(large_to_cache);			/**< Large regions put in node cache */
+	AU64(large_expired);			/**< Large regions expired from node cache */
+	AU64(large_trimmed_pages);		/**< Pages trimmed to align large regions */
+	AU64(hugepage_advised);			/**< Bytes advised for huge page backing */
 	size_t user_memory;				/**< Amount of "user" memory allocated */
 	size_t user_pages;				/**< Amount of "user" memory pages used */
 	size_t user_blocks;				/**< Amount of "user" memory blocks */
@@ -439,6 +453,42 @@ static cperiodic_t *vmm_periodic;
 #define VMM_MAGAZINE_PAGEMAX	5	/**< Up to 5 pages */
 static tmalloc_t *vmm_magazine[VMM_MAGAZINE_PAGEMAX];
 
+/*
+ * Large regions.
+ *
+ * Regions spanning at least one huge page can be allocated through
+ * vmm_alloc_large() or vmm_core_alloc_large(): they are aligned on a
+ * huge page boundary and the kernel is advised to back them with huge
+ * pages, to cut down on TLB misses when they are accessed randomly.
+ *
+ * When they are released, they are kept for a while in a small cache
+ * specific to the NUMA node of the CPU running the freeing thread, so
+ * that they can be quickly reused with their physical pages still local.
+ * These cached regions are still accounted for as allocated memory.
+ */
+
+#define VMM_HUGEPAGE_SIZE	(2 * 1024 * 1024)	/**< Default huge page size */
+#define VMM_HUGEPAGE_PATH \
+	"/sys/kernel/mm/transparent_hugepage/hpage_pmd_size"
+#define VMM_NUMA_NODES		8	/**< NUMA nodes with a distinct cache */
+#define VMM_LARGE_CACHED	4	/**< Max amount of cached regions per node */
+#define VMM_LARGE_MAXCACHE	(32 * 1024 * 1024)	/**< Max cached per node */
+#define VMM_LARGE_LIFE		60	/**< Seconds, max cached region lifetime */
+
+struct vmm_large_region {
+	void *base;			/**< Region base, aligned on a huge page */
+	size_t size;		/**< Region size */
+	time_t stamp;		/**< When region was cached */
+	bool user_mem;		/**< Whether it was allocated as user memory */
+};
+
+static struct vmm_large_cache {
+	spinlock_t lock;
+	size_t count;		/**< Amount of cached regions */
+	size_t bytes;		/**< Total size of cached regions */
+	struct vmm_large_region region[VMM_LARGE_CACHED];
+} vmm_large_cache[VMM_NUMA_NODES];
+
 static bool safe_to_log;			/**< True when we can log */
 static bool stop_freeing;			/**< No longer release memory */
 static uint32 vmm_debug;			/**< Debug level */
@@ -492,6 +542,7 @@ static bool page_cache_coalesce_pages(void **base_ptr, size_t *pages_ptr);
 static void page_cache_free_all(bool locked);
 static tmalloc_t *vmm_get_magazine(size_t npages, bool alloc);
 static void vmm_free_internal(void *p, size_t size, bool user_mem);
+static void vmm_shrink_fragment(void *q, size_t delta, bool user_mem);
 
 /**
  * @return whether VMM is in crash mode.
@@ -4498,6 +4549,27 @@ vmm_madvise_willneed(void *p, size_t size)
 #endif	/* MADV_WILLNEED */
 }
 
+void
+vmm_madvise_hugepage(void *p, size_t size)
+{
+	g_assert(p);
+	g_assert(size_is_positive(size));
+#if defined(HAS_MADVISE) && defined(MADV_HUGEPAGE)
+	if (0 == madvise(p, size, MADV_HUGEPAGE))
+		AU64_ADD(&vmm_stats.hugepage_advised, size);
+#endif	/* MADV_HUGEPAGE */
+}
+
+void
+vmm_madvise_nohugepage(void *p, size_t size)
+{
+	g_assert(p);
+	g_assert(size_is_positive(size));
+#if defined(HAS_MADVISE) && defined(MADV_NOHUGEPAGE)
+	madvise(p, size, MADV_NOHUGEPAGE);
+#endif	/* MADV_NOHUGEPAGE */
+}
+
 /**
  * Perform memory allocation during crashes.
  *
@@ -5241,6 +5313,363 @@ vmm_core_free(void *p, size_t size)
 	vmm_free_internal(p, size, FALSE);
 }
 
+/**
+ * @return the size of huge pages, which is the alignment of large regions.
+ */
+size_t
+vmm_hugepage_size(void)
+{
+	static size_t hugepage_size;
+
+	if G_UNLIKELY(0 == hugepage_size) {
+		size_t size = VMM_HUGEPAGE_SIZE;
+
+#ifndef MINGW32
+		{
+			/* Only Linux is supported for now */
+			uint64 v = filehead_uint64(VMM_HUGEPAGE_PATH, TRUE, NULL);
+
+			if (
+				v >= compat_pagesize() && v <= VMM_LARGE_MAXCACHE &&
+				is_pow2(v)
+			)
+				size = v;
+		}
+#endif	/* !MINGW32 */
+
+		hugepage_size = size;
+	}
+
+	return hugepage_size;
+}
+
+/**
+ * @return the index of the NUMA node cache to use for the running CPU.
+ */
+static uint
+vmm_numa_node(void)
+{
+#if defined(HAS_SYSCALL) && defined(SYS_getcpu)
+	uint cpu, node;
+
+	if (0 == syscall(SYS_getcpu, &cpu, &node, NULL))
+		return node % VMM_NUMA_NODES;
+#endif	/* HAS_SYSCALL && SYS_getcpu */
+
+	return 0;
+}
+
+/**
+ * Look for a cached large region of the given size in the cache of the
+ * NUMA node we are running on.
+ *
+ * @return the region if found, NULL otherwise.
+ */
+static void *
+vmm_large_cache_get(size_t size, bool user_mem)
+{
+	struct vmm_large_cache *lc = &vmm_large_cache[vmm_numa_node()];
+	void *p = NULL;
+	size_t i;
+
+	if (0 == lc->count)
+		return NULL;		/* Dirty read is OK */
+
+	spinlock(&lc->lock);
+
+	for (i = lc->count; i != 0; i--) {
+		struct vmm_large_region *lr = &lc->region[i - 1];
+
+		if (lr->size == size && lr->user_mem == user_mem) {
+			p = lr->base;
+			lc->bytes -= size;
+			*lr = lc->region[--lc->count];
+			break;
+		}
+	}
+
+	spinunlock(&lc->lock);
+
+	return p;
+}
+
+/**
+ * Attempt to cache a large region in the cache of the NUMA node we are
+ * running on.
+ *
+ * @return TRUE if the region was cached.
+ */
+static bool
+vmm_large_cache_put(void *p, size_t size, bool user_mem)
+{
+	struct vmm_large_cache *lc = &vmm_large_cache[vmm_numa_node()];
+	bool cached = FALSE;
+
+	spinlock(&lc->lock);
+
+	if (lc->count < VMM_LARGE_CACHED && lc->bytes + size <= VMM_LARGE_MAXCACHE) {
+		struct vmm_large_region *lr = &lc->region[lc->count++];
+
+		lr->base = p;
+		lr->size = size;
+		lr->stamp = tm_time();
+		lr->user_mem = user_mem;
+		lc->bytes += size;
+		cached = TRUE;
+	}
+
+	spinunlock(&lc->lock);
+
+	return cached;
+}
+
+/**
+ * Release cached large regions that are too old, or all of them.
+ *
+ * @param all		when TRUE, release all the cached regions
+ */
+static void
+vmm_large_cache_expire(bool all)
+{
+	struct vmm_large_region expired[VMM_LARGE_CACHED];
+	time_t now = tm_time();
+	size_t i, j, n;
+
+	for (i = 0; i < N_ITEMS(vmm_large_cache); i++) {
+		struct vmm_large_cache *lc = &vmm_large_cache[i];
+
+		if (0 == lc->count)
+			continue;		/* Dirty read is OK */
+
+		spinlock(&lc->lock);
+
+		for (j = 0, n = 0; j < lc->count; /* empty */) {
+			struct vmm_large_region *lr = &lc->region[j];
+
+			if (all || delta_time(now, lr->stamp) > VMM_LARGE_LIFE) {
+				expired[n++] = *lr;
+				lc->bytes -= lr->size;
+				*lr = lc->region[--lc->count];
+			} else {
+				j++;
+			}
+		}
+
+		spinunlock(&lc->lock);
+
+		for (j = 0; j < n; j++) {
+			struct vmm_large_region *lr = &expired[j];
+
+			vmm_madvise_nohugepage(lr->base, lr->size);
+			vmm_free_internal(lr->base, lr->size, lr->user_mem);
+		}
+
+		AU64_ADD(&vmm_stats.large_expired, n);
+	}
+}
+
+/**
+ * Allocate a large region, aligned on a huge page boundary.
+ *
+ * @param size		size in bytes to allocate; will be rounded to the pagesize
+ * @param user_mem	whether this memory is meant for "user" consumption
+ *
+ * @return pointer to allocated memory region
+ */
+static void * G_NON_NULL
+vmm_alloc_large_internal(size_t size, bool user_mem)
+{
+	size_t align, len, head;
+	void *p, *q;
+
+	if G_UNLIKELY(0 == kernel_pagesize)
+		vmm_init();
+
+	size = round_pagesize_fast(size);
+	align = vmm_hugepage_size();
+
+	if (size < align || vmm_crashing)
+		return user_mem ? vmm_alloc(size) : vmm_core_alloc(size);
+
+	VMM_STATS_INCX(large_allocations);
+
+	p = vmm_large_cache_get(size, user_mem);
+
+	if (p != NULL) {
+		VMM_STATS_INCX(large_from_cache);
+		return p;
+	}
+
+	/*
+	 * Over-allocate so that we can trim the region on both ends to get
+	 * a region of the requested size starting on a huge page boundary.
+	 * The trimmed pages go back to the page cache.
+	 */
+
+	len = size + align - kernel_pagesize;
+	p = vmm_alloc_internal(len, user_mem, FALSE);
+	q = ulong_to_pointer(round_size_fast(align, pointer_to_ulong(p)));
+	head = ptr_diff(q, p);
+
+	g_assert(head + size <= len);
+
+	if (head != 0)
+		vmm_shrink_fragment(p, head, user_mem);
+	if (head + size != len)
+		vmm_shrink_fragment(ptr_add_offset(q, size), len - head - size, user_mem);
+
+	AU64_ADD(&vmm_stats.large_trimmed_pages, pagecount_fast(len - size));
+	vmm_madvise_hugepage(q, size);
+
+	return q;
+}
+
+/**
+ * Free a region allocated via vmm_alloc_large_internal().
+ *
+ * @param p			the region base
+ * @param size		the region size
+ * @param user_mem	whether this was memory used directly by callers
+ */
+static void
+vmm_free_large_internal(void *p, size_t size, bool user_mem)
+{
+	size_t align;
+
+	g_assert(p != NULL);
+
+	size = round_pagesize_fast(size);
+	align = vmm_hugepage_size();
+
+	if (size < align) {
+		if (user_mem)
+			vmm_free(p, size);
+		else
+			vmm_core_free(p, size);
+		return;
+	}
+
+	VMM_STATS_INCX(large_freeings);
+
+	/*
+	 * The region may have been moved since it was allocated, in which case
+	 * it is no longer aligned and we have no reason to keep it around.
+	 */
+
+	if (0 == (pointer_to_ulong(p) & (align - 1)) && !vmm_crashing) {
+		if (vmm_large_cache_put(p, size, user_mem)) {
+			VMM_STATS_INCX(large_to_cache);
+			return;
+		}
+		vmm_madvise_nohugepage(p, size);
+	}
+
+	vmm_free_internal(p, size, user_mem);
+}
+
+/**
+ * Allocates a large user region, aligned on a huge page boundary and
+ * advised for huge page backing.
+ *
+ * Regions smaller than a huge page are simply allocated via vmm_alloc().
+ * The region must be freed with vmm_free_large().
+ *
+ * @param size The size in bytes to allocate; will be rounded to the pagesize.
+ */
+void *
+vmm_alloc_large(size_t size)
+{
+	return vmm_alloc_large_internal(size, TRUE);
+}
+
+/**
+ * Same as vmm_alloc_large() but allocates core memory, which must be freed
+ * with vmm_core_free_large().
+ */
+void *
+vmm_core_alloc_large(size_t size)
+{
+	return vmm_alloc_large_internal(size, FALSE);
+}
+
+/**
+ * Free region allocated via vmm_alloc_large(), possibly keeping it in the
+ * cache of the current NUMA node.
+ */
+void
+vmm_free_large(void *p, size_t size)
+{
+	vmm_free_large_internal(p, size, TRUE);
+}
+
+/**
+ * Free region allocated via vmm_core_alloc_large(), possibly keeping it in
+ * the cache of the current NUMA node.
+ */
+void
+vmm_core_free_large(void *p, size_t size)
+{
+	vmm_free_large_internal(p, size, FALSE);
+}
+
+/**
+ * Release trailing or leading part of an allocated region.
+ *
+ * @param q			the start of the fragment to release, page-aligned
+ * @param delta		length of the fragment, a multiple of the page size
+ * @param user_mem	whether this was memory used directly by callers
+ */
+static void
+vmm_shrink_fragment(void *q, size_t delta, bool user_mem)
+{
+	size_t n = pagecount_fast(delta);
+
+	g_assert(n >= 1);
+
+	if (vmm_should_cache(q, n)) {
+		size_t m = n;
+		vmm_invalidate_pages(q, delta);
+		page_cache_coalesce_pages(&q, &m);
+		if (page_cache_insert_pages(q, m)) {
+			VMM_STATS_LOCK;
+			vmm_stats.free_to_cache++;
+			vmm_stats.free_to_cache_pages += n;
+		} else {
+			VMM_STATS_LOCK;		/* For later below */
+		}
+	} else {
+		size_t m = n;
+		page_cache_coalesce_pages(&q, &m);
+		free_pages(q, nsize_fast(m), TRUE);
+		VMM_STATS_LOCK;
+		vmm_stats.free_to_system++;
+		vmm_stats.free_to_system_pages += n;
+		vmm_stats.free_to_system_extra_pages += m - n;
+	}
+
+	/* Stats are already locked */
+
+	vmm_stats.shrinkings++;
+
+	if (user_mem) {
+		vmm_stats.shrinkings_user++;
+		vmm_stats.user_memory -= delta;
+		vmm_stats.user_pages -= n;
+		g_assert(size_is_non_negative(vmm_stats.user_pages));
+		g_assert(size_is_non_negative(vmm_stats.user_memory));
+		VMM_STATS_UNLOCK;
+		memusage_remove(vmm_stats.user_mem, delta);
+	} else {
+		vmm_stats.shrinkings_core++;
+		vmm_stats.core_memory -= delta;
+		vmm_stats.core_pages -= n;
+		g_assert(size_is_non_negative(vmm_stats.core_pages));
+		g_assert(size_is_non_negative(vmm_stats.core_memory));
+		VMM_STATS_UNLOCK;
+		memusage_remove(vmm_stats.core_mem, delta);
+	}
+}
+
 /**
  * Shrink allocated space via vmm_alloc() or vmm_core_alloc() down to
  * specified size.
@@ -5275,56 +5704,8 @@ vmm_shrink_internal(void *p, size_t size, size_t new_size, bool user_mem)
 
 		g_assert(nsize <= osize);
 
-		if (osize != nsize) {
-			size_t delta = osize - nsize;
-			size_t n = pagecount_fast(delta);
-			void *q = ptr_add_offset(p, nsize);
-
-			g_assert(n >= 1);
-
-			if (vmm_should_cache(q, n)) {
-				size_t m = n;
-				vmm_invalidate_pages(q, delta);
-				page_cache_coalesce_pages(&q, &m);
-				if (page_cache_insert_pages(q, m)) {
-					VMM_STATS_LOCK;
-					vmm_stats.free_to_cache++;
-					vmm_stats.free_to_cache_pages += n;
-				} else {
-					VMM_STATS_LOCK;		/* For later below */
-				}
-			} else {
-				size_t m = n;
-				page_cache_coalesce_pages(&q, &m);
-				free_pages(q, nsize_fast(m), TRUE);
-				VMM_STATS_LOCK;
-				vmm_stats.free_to_system++;
-				vmm_stats.free_to_system_pages += n;
-				vmm_stats.free_to_system_extra_pages += m - n;
-			}
-
-			/* Stats are already locked */
-
-			vmm_stats.shrinkings++;
-
-			if (user_mem) {
-				vmm_stats.shrinkings_user++;
-				vmm_stats.user_memory -= delta;
-				vmm_stats.user_pages -= n;
-				g_assert(size_is_non_negative(vmm_stats.user_pages));
-				g_assert(size_is_non_negative(vmm_stats.user_memory));
-				VMM_STATS_UNLOCK;
-				memusage_remove(vmm_stats.user_mem, delta);
-			} else {
-				vmm_stats.shrinkings_core++;
-				vmm_stats.core_memory -= delta;
-				vmm_stats.core_pages -= n;
-				g_assert(size_is_non_negative(vmm_stats.core_pages));
-				g_assert(size_is_non_negative(vmm_stats.core_memory));
-				VMM_STATS_UNLOCK;
-				memusage_remove(vmm_stats.core_mem, delta);
-			}
-		}
+		if (osize != nsize)
+			vmm_shrink_fragment(ptr_add_offset(p, nsize), osize - nsize, user_mem);
 	}
 }
 
@@ -5433,6 +5814,8 @@ page_cache_timer(void *unused_udata)
 	if G_UNLIKELY(vmm_oom_detected)
 		return FALSE;	/* Stop expire if we are in OOM condition already */
 
+	vmm_large_cache_expire(FALSE);
+
 	pc = &page_cache[page_cache_line];
 
 	/*
@@ -5952,6 +6335,25 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(hole_updated);
 	DUMP(hole_unchanged);
 
+	DUMP64(large_allocations);
+	DUMP64(large_from_cache);
+	DUMP64(large_freeings);
+	DUMP64(large_to_cache);
+	DUMP64(large_expired);
+	DUMP64(large_trimmed_pages);
+	DUMP64(hugepage_advised);
+
+	for (i = 0; i < VMM_NUMA_NODES; i++) {
+		struct vmm_large_cache *lc = &vmm_large_cache[i];
+
+		/* Don't spinlock, it's OK to have dirty reads here */
+
+		if (lc->count != 0) {
+			log_info(la, "VMM large_cached_node_%zu = %zu (%s bytes)",
+				i, lc->count, size_t_to_string_grp(lc->bytes, groupped));
+		}
+	}
+
 #undef DUMP
 #define DUMP(x) log_info(la, "VMM pmap_%s = %s", #x,	\
 	size_t_to_string_grp(x, groupped))
@@ -6045,12 +6447,77 @@ vmm_dump_stats(void)
 	vmm_dump_pmap();
 }
 
+/**
+ * Parse a field from the kernel's memory map summary.
+ *
+ * @param buf		the summary
+ * @param field		the field name, including the leading newline
+ *
+ * @return the field value in bytes, 0 if not found.
+ */
+static size_t
+vmm_smaps_field(const char *buf, const char *field)
+{
+	const char *p = vstrstr(buf, field);
+	uint64 v;
+	int error;
+
+	if (NULL == p)
+		return 0;
+
+	p = skip_ascii_blanks(p + vstrlen(field));
+	v = parse_uint64(p, NULL, 10, &error);
+
+	return error ? 0 : v * 1024;		/* Reported in KiB */
+}
+
+/**
+ * Fetch the amount of anonymous memory mapped by the process, and the part
+ * of it which is backed by huge pages, as reported by the kernel.
+ *
+ * @return TRUE if we could get the figures.
+ */
+static bool
+vmm_hugepage_usage(size_t *anon, size_t *huge)
+{
+#ifdef MINGW32
+	(void) anon;
+	(void) huge;
+	return FALSE;
+#else
+	/* Only Linux is supported for now */
+	char buf[4096];
+	ssize_t r;
+	int fd;
+
+	fd = file_open_missing("/proc/self/smaps_rollup", O_RDONLY);
+
+	if (-1 == fd)
+		return FALSE;
+
+	r = read(fd, ARYLEN(buf) - 1);		/* Reserve one byte for NUL */
+	fd_close(&fd);
+
+	if (r <= 0)
+		return FALSE;
+
+	buf[r] = '\0';
+	*anon = vmm_smaps_field(buf, "\nAnonymous:");
+	*huge = vmm_smaps_field(buf, "\nAnonHugePages:");
+
+	return *anon != 0;
+#endif	/* MINGW32 */
+}
+
 /**
  * Dump VMM usage statistics to specified logging agent.
  */
 void G_COLD
 vmm_dump_usage_log(logagent_t *la, unsigned options)
 {
+	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
+	size_t anon, huge;
+
 	if (NULL == vmm_stats.user_mem) {
 		log_warning(la, "VMM user memory usage stats not configured");
 	} else {
@@ -6061,6 +6528,15 @@ vmm_dump_usage_log(logagent_t *la, unsigned options)
 	} else {
 		memusage_summary_dump_log(vmm_stats.core_mem, la, options);
 	}
+	if (vmm_hugepage_usage(&anon, &huge)) {
+		log_info(la, "VMM anon_memory = %s",
+			size_t_to_string_grp(anon, groupped));
+		log_info(la, "VMM anon_hugepage_memory = %s (%.2f%%)",
+			size_t_to_string_grp(huge, groupped), 100.0 * huge / anon);
+	}
+	log_info(la, "VMM hugepage_advised = %s",
+		uint64_to_string_grp(AU64_VALUE(&vmm_stats.hugepage_advised),
+			groupped));
 }
 
 /**
@@ -6319,6 +6795,9 @@ vmm_early_init_once(void)
 		spinlock_init(&pc->lock);
 	}
 
+	for (i = 0; i < VMM_NUMA_NODES; i++)
+		spinlock_init(&vmm_large_cache[i].lock);
+
 	/*
 	 * Allocate the pmaps.
 	 */
@@ -6460,6 +6939,7 @@ vmm_pre_close(void)
 	 */
 
 	vmm_magazine_reset();
+	vmm_large_cache_expire(TRUE);
 	safe_to_log = FALSE;		/* Turn logging off */
 	cq_periodic_remove(&vmm_periodic);
 }
@@ -107,6 +107,12 @@ void *vmm_resize(void *p, size_t size, size_t new_size)
 	WARN_UNUSED_RESULT G_NON_NULL;
 #endif	/* VMM_SOURCE || !TRACK_VMM */
 
+void *vmm_alloc_large(size_t size) G_MALLOC G_NON_NULL;
+void *vmm_core_alloc_large(size_t size) G_MALLOC G_NON_NULL;
+void vmm_free_large(void *p, size_t size);
+void vmm_core_free_large(void *p, size_t size);
+size_t vmm_hugepage_size(void);
+
 #ifdef XMALLOC_SOURCE
 void vmm_early_init(void);
 #endif /* XMALLOC_SOURCE */
@@ -168,6 +174,8 @@ void vmm_madvise_free(void *p, size_t size);
 void vmm_madvise_normal(void *p, size_t size);
 void vmm_madvise_sequential(void *p, size_t size);
 void vmm_madvise_willneed(void *p, size_t size);
+void vmm_madvise_hugepage(void *p, size_t size);
+void vmm_madvise_nohugepage(void *p, size_t size);
 
 void *vmm_mmap(void *addr, size_t length,
 	int prot, int flags, int fd, fileoffset_t offset);
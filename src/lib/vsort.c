@@ -58,9 +58,11 @@
 
 #include "log.h"
 #include "op.h"
+#include "psort.h"
 #include "random.h"
 #include "smsort.h"
 #include "tm.h"
+#include "tpool.h"
 #include "tqsort.h"
 #include "unsigned.h"
 #include "vmm.h"
@@ -151,6 +153,17 @@ vsort_tqsort(struct vsort_timing *vt, size_t loops)
 	}
 }
 
+static void
+vsort_xsort_parallel(struct vsort_timing *vt, size_t loops)
+{
+	size_t n = loops;
+
+	while (n-- > 0) {
+		memcpy(vt->copy, vt->data, vt->len);
+		xsort_parallel(vt->copy, vt->items, vt->isize, vsort_long_cmp);
+	}
+}
+
 static void
 vsort_smsort(struct vsort_timing *vt, size_t loops)
 {
@@ -339,7 +352,7 @@ vsort_testing_cmp(const void *a, const void *b)
 /*
  * Always substitute xqsort() for tqsort() if handling less than
  * TQSORT_ITEMS at a time since tqsort() will always remap to xqsort()
- * in that case.
+ * in that case.  Likewise for xsort_parallel().
  */
 static vsort_t
 vsort_routine(const vsort_t routine, size_t items)
@@ -347,6 +360,9 @@ vsort_routine(const vsort_t routine, size_t items)
 	if (items < TQSORT_ITEMS && routine == tqsort)
 		return xqsort;
 
+	if (items < XSORT_PARALLEL_ITEMS && routine == xsort_parallel)
+		return xqsort;
+
 	return routine;
 }
 
@@ -356,14 +372,22 @@ vsort_routine_name(const char *name, size_t items)
 	if (items < TQSORT_ITEMS && 0 == strcmp(name, "tqsort"))
 		return "xqsort";
 
+	if (items < XSORT_PARALLEL_ITEMS && 0 == strcmp(name, "xsort_parallel"))
+		return "xqsort";
+
 	return name;
 }
 
 /**
- * Check which of qsort(), xqsort(), xsort() or smsort() is best for sorting
- * aligned arrays with a native item size of OPSIZ.  At identical performance
- * level, we prefer our own sorting algorithms instead of libc's qsort() for
- * memory allocation purposes.
+ * Check which of qsort(), xqsort(), xsort(), tqsort(), xsort_parallel() or
+ * smsort() is best for sorting aligned arrays with a native item size of
+ * OPSIZ.  At identical performance level, we prefer our own sorting algorithms
+ * instead of libc's qsort() for memory allocation purposes.
+ *
+ * We only consider xsort_parallel() when the default thread pool already
+ * exists: benchmarking it would otherwise create the pool at startup, with
+ * all its threads.  The pool is then created by the first large sort made
+ * through xsort_parallel().
  *
  * @param items		amount of items to use in the sorted array
  * @param idx		index of the virtual routine to update
@@ -378,16 +402,25 @@ vsort_init_items(size_t items, unsigned idx, int verbose, const char *which)
 		{ vsort_xqsort,	xqsort,	0.0, 2, "xqsort" },
 		{ vsort_xsort,	xsort,	0.0, 1, "xsort" },
 		{ vsort_tqsort,	tqsort,	0.0, 1, "tqsort" },
+		{ vsort_xsort_parallel,	xsort_parallel,	0.0, 1, "xsort_parallel" },
 		{ vsort_smsort,	smsort,	0.0, 1, "smsort" },	/* Only for almost sorted */
 	};
 	size_t len = items * OPSIZ;
 	struct vsort_timing vt;
 	size_t loops, highest_loops;
-	unsigned i;
+	unsigned i, n = N_ITEMS(tests);
 
 	g_assert(uint_is_non_negative(idx));
 	g_assert(idx < N_ITEMS(vsort_table));
 
+	/* Drop xsort_parallel(), keeping smsort() last */
+
+	if (items >= XSORT_PARALLEL_ITEMS && !tpool_default_exists()) {
+		g_assert(xsort_parallel == tests[n - 2].v_routine);
+		tests[n - 2] = tests[n - 1];	/* Struct copy */
+		n--;
+	}
+
 	vt.data = vmm_alloc(len);
 	vt.copy = vmm_alloc(len);
 	vt.items = items;
@@ -400,7 +433,7 @@ vsort_init_items(size_t items, unsigned idx, int verbose, const char *which)
 	/* The -1 below is to avoid benchmarking smsort() for the general case */
 
 retry_random:
-	for (i = 0; i < N_ITEMS(tests) - 1; i++) {
+	for (i = 0; i < n - 1; i++) {
 		tests[i].v_elapsed = vsort_timeit(tests[i].v_timer, &vt, &loops);
 
 		if (verbose > 1) {
@@ -428,7 +461,7 @@ retry_random:
 		for (j = 0; j < 2; j++) {
 			random_bytes(vt.data, len);
 
-			for (i = 0; i < N_ITEMS(tests) - 1; i++) {
+			for (i = 0; i < n - 1; i++) {
 				tests[i].v_elapsed +=
 					vsort_timeit(tests[i].v_timer, &vt, &loops);
 
@@ -448,7 +481,7 @@ retry_random:
 		}
 	}
 
-	xqsort(tests, N_ITEMS(tests) - 1, sizeof tests[0], vsort_testing_cmp);
+	xqsort(tests, n - 1, sizeof tests[0], vsort_testing_cmp);
 
 	vsort_table[idx].v_sort = vsort_routine(tests[0].v_routine, items);
 
@@ -466,7 +499,7 @@ retry_random:
 	vsort_perturb_sorted_array(vt.data, vt.items, vt.isize);
 
 retry_sorted:
-	for (i = 0; i < N_ITEMS(tests); i++) {
+	for (i = 0; i < n; i++) {
 		tests[i].v_elapsed = vsort_timeit(tests[i].v_timer, &vt, &loops);
 
 		if (verbose > 1) {
@@ -483,7 +516,7 @@ retry_sorted:
 		}
 	}
 
-	xqsort(tests, N_ITEMS(tests), sizeof tests[0], vsort_testing_cmp);
+	xqsort(tests, n, sizeof tests[0], vsort_testing_cmp);
 
 	vsort_table[idx].v_sort_almost = vsort_routine(tests[0].v_routine, items);
 
@@ -514,7 +547,8 @@ vsort_init(int verbose)
 
 	/*
 	 * Allow main thread to block during the duration of our tests.
-	 * This is needed since tqsort() can create threads and block.
+	 * This is needed since tqsort() and xsort_parallel() can create threads
+	 * and block.
 	 */
 
 	if (thread_is_main() && !thread_main_is_blockable()) {
@@ -271,6 +271,39 @@ walloc_raw(size_t size)
 	return zalloc(zone);
 }
 
+#ifndef TRACK_ZALLOC
+/**
+ * Allocate several blocks of the same size at once.
+ *
+ * This is the batch version of walloc_raw(), used to refill thread magazines.
+ * Blocks too large for zones are allocated one at a time.
+ *
+ * @return the amount of blocks written to ``vec'', at least 1.
+ */
+static size_t
+walloc_raw_vector(size_t size, void **vec, size_t n)
+{
+	zone_t *zone;
+	size_t rounded = zalloc_round(size);
+
+	g_assert(size_is_positive(size));
+
+	if G_UNLIKELY(rounded > walloc_max)
+		goto single;
+
+	zone = walloc_get_zone(rounded, TRUE);
+
+	if G_UNLIKELY(NULL == zone)
+		goto single;
+
+	return zalloc_vector(zone, vec, n);
+
+single:
+	vec[0] = walloc_raw(size);
+	return 1;
+}
+#endif	/* !TRACK_ZALLOC */
+
 /**
  * Free a block allocated via walloc_raw().
  *
@@ -412,8 +445,9 @@ walloc_get_magazine(size_t rounded)
 			}
 
 			str_bprintf(ARYLEN(name), "walloc-%zu", zsize);
-			depot = wmagazine[idx] = wmagazine[zidx] =
-				tmalloc_create(name, zsize, walloc_raw, wfree_raw);
+			depot = tmalloc_create(name, zsize, walloc_raw, wfree_raw);
+			tmalloc_set_vector(depot, walloc_raw_vector);
+			wmagazine[idx] = wmagazine[zidx] = depot;
 		}
 
 	done:
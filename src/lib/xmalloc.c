@@ -4809,10 +4809,13 @@ skip_pool:
 		 * The "user" memory is a standalone user block that will be deallocated
 		 * as a whole, the "core" memory is memory that can be fragmented,
 		 * split and reallocated before ending-up being freed.
+		 *
+		 * Standalone user blocks spanning huge pages are aligned so that
+		 * they can be backed by huge pages (large lookup tables).
 		 */
 
 		if (via_vmm)
-			p = vmm_alloc(vlen);			/* That's a standalone user block */
+			p = vmm_alloc_large(vlen);		/* That's a standalone user block */
 		else
 			p = vmm_core_alloc(vlen);		/* Parts of block will be core */
 
@@ -5221,7 +5224,7 @@ xfree(void *p)
 		xstats.vmm_user_blocks--;
 		XSTATS_UNLOCK;
 
-		vmm_free(xh, xh->length);
+		vmm_free_large(xh, xh->length);
 		return;
 	}
 
@@ -6864,6 +6867,21 @@ xmalloc_stop_freeing(void)
 	xmalloc_no_freeing = TRUE;
 }
 
+/**
+ * @return total amount of memory allocations made so far.
+ */
+uint64
+xmalloc_allocations(void)
+{
+	uint64 count;
+
+	XSTATS_LOCK;
+	count = xstats.allocations;
+	XSTATS_UNLOCK;
+
+	return count;
+}
+
 /**
  * Generate a SHA1 digest of the current xmalloc statistics.
  *
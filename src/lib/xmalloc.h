@@ -99,6 +99,7 @@ void xmalloc_dump_freelist_log(struct logagent *la);
 size_t xmalloc_freelist_check(struct logagent *la, unsigned flags);
 
 void xmalloc_stats_digest(struct sha1 *digest);
+uint64 xmalloc_allocations(void);
 
 void xgc(void);
 void xmalloc_long_term(void);
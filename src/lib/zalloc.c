@@ -211,6 +211,8 @@ struct zone {				/* Zone descriptor */
 	unsigned zn_oversized;	/**< For GC: amount of times we see oversizing */
 	unsigned zn_stid;		/**< Small thread-ID for private zones */
 	unsigned zn_subzblocks;	/**< Amount of blocks we can cram in subzones */
+	uint64 zn_allocations;	/**< Blocks allocated from the zone */
+	uint64 zn_vectors;		/**< Vector allocations (several blocks) */
 	uint embedded:1;		/**< Zone descriptor is head of first arena */
 	uint private:1;			/**< Is thread-private: no locking needed */
 	uint user:1;			/**< Is user-owned: no GC configured */
@@ -340,6 +342,7 @@ static leak_set_t *z_leakset;
  */
 static struct zstats {
 	uint64 allocations;				/**< Total amount of allocations */
+	uint64 allocations_vector;		/**< Calls to zalloc_vector() */
 	uint64 freeings;				/**< Total amount of freeings */
 	uint64 freeings_list;			/**< Total amount of freeings via list */
 	uint64 freeings_list_blocks;	/**< Amount of blocks freed via list */
@@ -867,6 +870,7 @@ zalloc(zone_t *zone)
 
 	zlock(zone);
 
+	zone->zn_allocations++;
 	blk = zone->zn_free;
 	if G_LIKELY(blk != NULL) {
 		zone->zn_free = (char **) *blk;
@@ -908,6 +912,79 @@ zalloc(zone_t *zone)
 	return zprepare(zone, blk);
 }
 
+/**
+ * Allocate several blocks at once from a zone.
+ *
+ * This takes the zone lock only once and is meant to refill caches sitting
+ * on top of the zone, such as thread magazines.  The zone is only extended
+ * when it has no free block left, and when it is being garbage-collected
+ * we only return one block.
+ *
+ * @param zone		the zone from which we allocate
+ * @param vec		vector where allocated blocks are written
+ * @param n			maximum amount of blocks to allocate
+ *
+ * @return the amount of blocks allocated and written to ``vec'', at least 1.
+ */
+size_t
+zalloc_vector(zone_t *zone, void **vec, size_t n)
+{
+	size_t i = 0;
+
+	zone_check(zone);
+	g_assert(vec != NULL);
+	g_assert(size_is_positive(n));
+
+	zlock(zone);
+
+	zone->zn_vectors++;
+
+	if G_UNLIKELY(NULL == zone->zn_free) {
+		if G_UNLIKELY(zone->zn_gc != NULL) {
+			zone->zn_allocations++;
+			vec[i++] = zgc_zalloc(zone);	/* Releases the lock */
+			goto done;
+		}
+
+		g_assert(zone->zn_blocks == zone->zn_cnt);
+
+		zn_extend(zone);
+	}
+
+	while (i < n && zone->zn_free != NULL) {
+		char **blk = zone->zn_free;
+
+		zone->zn_free = (char **) *blk;
+		zone->zn_cnt++;
+		vec[i++] = blk;
+	}
+
+	safety_assert(NULL == zone->zn_free || zbelongs(zone, zone->zn_free));
+
+	zone->zn_allocations += i;
+	zunlock(zone);
+
+	{
+		size_t j;
+
+		for (j = 0; j < i; j++)
+			vec[j] = zprepare(zone, vec[j]);
+	}
+
+	/* FALL THROUGH */
+
+done:
+	ZSTATS_LOCK;
+	zstats.allocations += i;
+	zstats.allocations_vector++;
+	zstats.user_blocks += i;
+	zstats.user_memory += i * zone->zn_size;
+	ZSTATS_UNLOCK;
+	memusage_add_batch(zone->zn_mem, i);
+
+	return i;
+}
+
 #ifdef TRACK_ZALLOC
 /**
  * Tracking version of zalloc().
@@ -3783,11 +3860,14 @@ zalloc_dump_zones_log(logagent_t *la)
 		}
 
 		log_info(la, "ZALLOC zone(%zu bytes%s): "
-			"blocks=%u, free=%u, %u %zuK-subzone%s, over=%u, %s mode",
+			"blocks=%u, free=%u, %u %zuK-subzone%s, over=%u, %s mode, "
+			"allocs=%s, vectors=%s",
 			zone->zn_size, buf, zone->zn_blocks, bcnt, zone->zn_subzones,
 			zone->zn_arena.sz_size / 1024,
 			plural(zone->zn_subzones), over,
-			zone->zn_gc != NULL ? "GC" : "normal");
+			zone->zn_gc != NULL ? "GC" : "normal",
+			uint64_to_string(zone->zn_allocations),
+			uint64_to_string2(zone->zn_vectors));
 	}
 
 	overhead += hash_table_memory(zt);
@@ -3862,6 +3942,7 @@ zalloc_dump_stats_log(logagent_t *la, unsigned options)
 } G_STMT_END
 
 	DUMP(allocations);
+	DUMP(allocations_vector);
 	DUMP(freeings);
 	DUMP(freeings_list);
 	DUMP(freeings_list_blocks);
@@ -91,6 +91,7 @@ struct eslist;
 struct sha1;
 
 void *zalloc(zone_t *) G_MALLOC G_NON_NULL;
+size_t zalloc_vector(zone_t *, void **, size_t);
 void zfree(zone_t *, void *);
 void *zmove(zone_t *zone, void *p) WARN_UNUSED_RESULT G_NON_NULL;
 void *zmoveto(zone_t *zone, void *o, void *n) G_NON_NULL;
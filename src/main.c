@@ -84,6 +84,7 @@
 #include "core/pdht.h"
 #include "core/pproxy.h"
 #include "core/publisher.h"
+#include "core/replay.h"
 #include "core/routing.h"
 #include "core/rx.h"
 #include "core/search.h"
@@ -97,6 +98,7 @@
 #include "core/tsync.h"
 #include "core/tx.h"
 #include "core/udp.h"
+#include "core/udp_ingress.h"
 #include "core/uhc.h"
 #include "core/upload_stats.h"
 #include "core/urpc.h"
@@ -804,8 +806,10 @@ gtk_gnutella_exit(int exit_code)
 			g_info("GUI shutdown completed");
 	}
 
+	DO(replay_close);		/* Stop any message replay */
 	DO(hcache_shutdown);	/* Save host caches to disk */
 	DO(oob_shutdown);		/* No longer deliver outstanding OOB hits */
+	DO(udp_ingress_close);	/* Main thread reads UDP sockets again */
 	DO(socket_shutdown);
 	DO(bsched_shutdown);
 
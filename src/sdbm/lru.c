@@ -26,6 +26,7 @@
 #include "lib/fd.h"
 #include "lib/hevset.h"
 #include "lib/log.h"
+#include "lib/lprobe.h"
 #include "lib/qlock.h"
 #include "lib/stacktrace.h"
 #include "lib/stringify.h"		/* For plural() */
@@ -1373,7 +1374,9 @@ lru_chkpage(DBM *db, char *pag, long num)
 bool
 readpag(DBM *db, char *pag, long num)
 {
+	static lprobe_t *probe;
 	ssize_t got;
+	uint64 start;
 
 	sdbm_check(db);
 	assert_sdbm_locked(db);
@@ -1388,7 +1391,9 @@ readpag(DBM *db, char *pag, long num)
 	 */
 
 	db->pagread++;
+	start = lprobe_start();
 	got = compat_pread(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+	lprobe_end(&probe, "sdbm_read", start);
 	if G_UNLIKELY(got < 0) {
 		s_critical("sdbm: \"%s\": cannot read page #%ld: %m",
 			sdbm_name(db), num);
@@ -1434,7 +1439,9 @@ readpag(DBM *db, char *pag, long num)
 bool
 flushpag(DBM *db, char *pag, long num)
 {
+	static lprobe_t *probe;
 	ssize_t w;
+	uint64 start;
 
 	sdbm_check(db);
 	assert_sdbm_locked(db);
@@ -1453,7 +1460,9 @@ flushpag(DBM *db, char *pag, long num)
 	}
 
 	db->pagwrite++;
+	start = lprobe_start();
 	w = compat_pwrite(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+	lprobe_end(&probe, "sdbm_write", start);
 
 	if (w < 0 || w != DBM_PBLKSIZ) {
 		if (w < 0) {
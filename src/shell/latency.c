@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "latency" command.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/lprobe.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/**
+ * Append duration, given in nanoseconds, as microseconds.
+ */
+static void
+shell_latency_cat(str_t *s, uint64 ns)
+{
+	str_catf(s, "%9s ", uint64_to_string(ns / 1000));
+}
+
+static enum shell_reply
+shell_exec_latency_show(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_r;
+	const option_t options[] = {
+		{ "r", &opt_r },
+	};
+	int parsed;
+	str_t *s;
+	pslist_t *info, *sl;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	shell_write(sh, "100~\n");
+	if (!lprobe_on)
+		shell_write(sh, "Latency probes are disabled.\n");
+
+	if (opt_r != NULL) {
+		shell_write(sh,
+			"  Count    p50 us    p99 us    max us Probe (last period)\n");
+	} else {
+		shell_write(sh,
+			"  Count   mean us    p50 us    p90 us    p99 us  p99.9 us"
+			"    max us Probe\n");
+	}
+
+	info = lprobe_info_list();
+	s = str_new(80);
+
+	PSLIST_FOREACH(info, sl) {
+		const lprobe_info_t *pi = sl->data;
+
+		if (opt_r != NULL) {
+			str_printf(s, "%7s ", uint64_to_string(pi->r_count));
+			shell_latency_cat(s, pi->r_p50);
+			shell_latency_cat(s, pi->r_p99);
+			shell_latency_cat(s, pi->r_max);
+		} else {
+			str_printf(s, "%7s ", uint64_to_string(pi->count));
+			shell_latency_cat(s, pi->mean);
+			shell_latency_cat(s, pi->p50);
+			shell_latency_cat(s, pi->p90);
+			shell_latency_cat(s, pi->p99);
+			shell_latency_cat(s, pi->p999);
+			shell_latency_cat(s, pi->max);
+		}
+		str_catf(s, "%s\n", pi->name);
+		shell_write(sh, str_2c(s));
+	}
+
+	str_destroy_null(&s);
+	lprobe_info_list_free_null(&info);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_on(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	lprobe_enable(TRUE);
+	shell_set_msg(sh, "Latency probes enabled");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_off(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	lprobe_enable(FALSE);
+	shell_set_msg(sh, "Latency probes disabled");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_reset(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	lprobe_reset();
+	shell_set_msg(sh, "Latency statistics reset");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_dump(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+	if (-1 == lprobe_dump_file(argv[1])) {
+		shell_set_formatted(sh, "Cannot write \"%s\": %m", argv[1]);
+		return REPLY_ERROR;
+	}
+
+	shell_set_msg(sh, "Latency statistics dumped");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_latency_autodump(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2) {
+		lprobe_set_dump_file(NULL);
+		shell_set_msg(sh, "Periodic latency dumps stopped");
+	} else {
+		lprobe_set_dump_file(argv[1]);
+		shell_set_msg(sh, "Latency statistics will be dumped periodically");
+	}
+
+	return REPLY_READY;
+}
+
+/**
+ * Handles the latency command.
+ */
+enum shell_reply
+shell_exec_latency(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_latency_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(autodump);
+	CMD(dump);
+	CMD(off);
+	CMD(on);
+	CMD(reset);
+	CMD(show);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_latency(void)
+{
+	return "Hot-path latency probes";
+}
+
+const char *
+shell_help_latency(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "autodump")) {
+			return "latency autodump [FILE]\n"
+				"dump statistics to FILE after each aggregation period\n"
+				"without FILE, stop periodic dumps\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "dump")) {
+			return "latency dump FILE\n"
+				"dump statistics to FILE, durations being in nanoseconds\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "off")) {
+			return "latency off\n"
+				"disable latency probes\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "on")) {
+			return "latency on\n"
+				"enable latency probes\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+			return "latency reset\n"
+				"clear statistics collected so far\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "show")) {
+			return "latency show [-r]\n"
+				"show latency distribution per probe since last reset\n"
+				"-r: only show distribution over the last period\n";
+		}
+	} else {
+		return
+			"latency autodump [FILE]\n"
+			"latency dump FILE\n"
+			"latency off\n"
+			"latency on\n"
+			"latency reset\n"
+			"latency show [-r]\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
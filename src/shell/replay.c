@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2026, gtk-gnutella developers
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "replay" command.
+ *
+ * @author gtk-gnutella developers
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/replay.h"
+
+#include "lib/ascii.h"
+#include "lib/parse.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/**
+ * Parse value as an unsigned 32-bit integer.
+ *
+ * @param sh		the shell for which we're processing the command
+ * @param what		the item being parsed
+ * @param value		the option value
+ * @param result	where the parsed value is returned
+ *
+ * @return TRUE if OK, FALSE on error with an error message emitted.
+ */
+static bool
+shell_replay_parse_uint32(struct gnutella_shell *sh,
+	const char *what, const char *value, uint32 *result)
+{
+	int error;
+
+	*result = parse_uint32(value, NULL, 10, &error);
+	if (error != 0) {
+		shell_write_linef(sh, REPLY_ERROR, "cannot parse %s: %s",
+			what, g_strerror(error));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Parse the options common to all the replay sub-commands starting a run.
+ *
+ * @return TRUE if OK, FALSE on error with an error message emitted.
+ */
+static bool
+shell_replay_parse_run(struct gnutella_shell *sh,
+	const char *opt_r, const char *opt_l, uint32 *rate, uint32 *loops)
+{
+	*rate = 0;
+	*loops = 1;
+
+	if (opt_r != NULL && !shell_replay_parse_uint32(sh, "-r", opt_r, rate))
+		return FALSE;
+
+	if (opt_l != NULL && !shell_replay_parse_uint32(sh, "-l", opt_l, loops))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * Report failure to start a replay.
+ */
+static enum shell_reply
+shell_replay_failed(struct gnutella_shell *sh, int error)
+{
+	switch (error) {
+	case EPERM:
+		shell_set_msg(sh, "Must be offline, and without UDP for G2 traffic");
+		break;
+	case EBUSY:
+		shell_set_msg(sh, "A replay is already running");
+		break;
+	case EINVAL:
+		shell_set_msg(sh, "No valid message to replay");
+		break;
+	default:
+		shell_set_formatted(sh, "Cannot replay: %s", g_strerror(error));
+		break;
+	}
+
+	return REPLY_ERROR;
+}
+
+static enum shell_reply
+shell_exec_replay_file(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_g, *opt_l, *opt_r;
+	const option_t options[] = {
+		{ "g",  &opt_g },			/* file holds G2 packets */
+		{ "l:", &opt_l },			/* amount of loops */
+		{ "r:", &opt_r },			/* rate, in messages per second */
+	};
+	uint32 rate, loops;
+	int parsed;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argv += parsed;		/* argv[0] is now the first command argument */
+	argc -= parsed;		/* Only counts remaining arguments */
+
+	if (argc < 1)
+		return REPLY_ERROR;
+
+	if (!shell_replay_parse_run(sh, opt_r, opt_l, &rate, &loops))
+		return REPLY_ERROR;
+
+	if (-1 == replay_file(argv[0], opt_g != NULL, rate, loops))
+		return shell_replay_failed(sh, errno);
+
+	shell_set_msg(sh, "Replay started");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_replay_synth(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_l, *opt_n, *opt_r;
+	const option_t options[] = {
+		{ "l:", &opt_l },			/* amount of loops */
+		{ "n:", &opt_n },			/* amount of messages to generate */
+		{ "r:", &opt_r },			/* rate, in messages per second */
+	};
+	uint32 rate, loops, count = 100000;
+	int parsed;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	if (!shell_replay_parse_run(sh, opt_r, opt_l, &rate, &loops))
+		return REPLY_ERROR;
+
+	if (opt_n != NULL && !shell_replay_parse_uint32(sh, "-n", opt_n, &count))
+		return REPLY_ERROR;
+
+	if (-1 == replay_synthetic(count, rate, loops))
+		return shell_replay_failed(sh, errno);
+
+	shell_set_msg(sh, "Replay started");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_replay_status(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	replay_info_t info;
+	str_t *s;
+	double secs;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (!replay_info(&info)) {
+		shell_set_msg(sh, "No replay has been run");
+		return REPLY_READY;
+	}
+
+	secs = info.elapsed / 1e9;
+	s = str_new(80);
+
+	shell_write(sh, "100~\n");
+
+	str_printf(s, "Source:       %s%s (%s)\n", info.source,
+		info.g2 ? " [G2]" : "", info.running ? "running" : "done");
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Pass:         %u/%u, %s messages each\n",
+		info.loop + 1, info.loops, uint64_to_string(info.stream_msgs));
+	shell_write(sh, str_2c(s));
+
+	if (0 == info.rate) {
+		shell_write(sh, "Target rate:  unlimited\n");
+	} else {
+		str_printf(s, "Target rate:  %u msg/s\n", info.rate);
+		shell_write(sh, str_2c(s));
+	}
+
+	str_printf(s, "Processed:    %s messages, %s bytes, %s invalid\n",
+		uint64_to_string(info.processed), uint64_to_string2(info.bytes),
+		uint64_to_string3(info.invalid));
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Replies:      %s messages, %s bytes\n",
+		uint64_to_string(info.replies), uint64_to_string2(info.reply_bytes));
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Elapsed:      %.3f secs (%.1f%% busy)\n", secs,
+		0 == info.elapsed ? 0.0 : 100.0 * info.busy / info.elapsed);
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Throughput:   %.0f msg/s, %.0f msg/s when busy\n",
+		0 == info.elapsed ? 0.0 : info.processed / secs,
+		0 == info.busy ? 0.0 : info.processed / (info.busy / 1e9));
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Allocations:  %s (%.2f per message)\n",
+		uint64_to_string(info.allocations),
+		0 == info.processed ? 0.0 :
+			(double) info.allocations / info.processed);
+	shell_write(sh, str_2c(s));
+
+	str_printf(s, "Latency (us): mean=%.2f p50=%.2f p90=%.2f p99=%.2f "
+		"max=%.2f\n",
+		info.mean / 1e3, info.p50 / 1e3, info.p90 / 1e3, info.p99 / 1e3,
+		info.max / 1e3);
+	shell_write(sh, str_2c(s));
+
+	str_destroy_null(&s);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_replay_stop(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	shell_set_msg(sh, replay_stop() ? "Replay stopped" : "No replay running");
+	return REPLY_READY;
+}
+
+/**
+ * Handles the replay command.
+ */
+enum shell_reply
+shell_exec_replay(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_replay_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(file);
+	CMD(status);
+	CMD(stop);
+	CMD(synth);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_replay(void)
+{
+	return "Replay messages to measure processing performance";
+}
+
+const char *
+shell_help_replay(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "file")) {
+			return "replay file [-g] [-l LOOPS] [-r RATE] FILE\n"
+				"replay messages captured in FILE, back to back\n"
+				"-g: FILE holds G2 packets instead of Gnutella messages\n"
+				"-l: amount of passes over the capture (default 1)\n"
+				"-r: messages per second (default 0, as fast as possible)\n"
+				"The servent must be offline, and without UDP for G2.\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "status")) {
+			return "replay status\n"
+				"show statistics about current or last replay\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "stop")) {
+			return "replay stop\n"
+				"stop current replay\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "synth")) {
+			return "replay synth [-l LOOPS] [-n COUNT] [-r RATE]\n"
+				"replay synthetic Gnutella traffic\n"
+				"-l: amount of passes over the messages (default 1)\n"
+				"-n: amount of messages to generate (default 100000)\n"
+				"-r: messages per second (default 0, as fast as possible)\n"
+				"The servent must be offline.\n";
+		}
+	} else {
+		return
+			"replay file [-g] [-l LOOPS] [-r RATE] FILE\n"
+			"replay status\n"
+			"replay stop\n"
+			"replay synth [-l LOOPS] [-n COUNT] [-r RATE]\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
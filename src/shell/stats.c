@@ -37,6 +37,9 @@
 #include "core/gnet_stats.h"
 
 #include "lib/ascii.h"
+#include "lib/atoms.h"
+#include "lib/dump_options.h"
+#include "lib/log.h"
 #include "lib/options.h"
 #include "lib/stringify.h"
 #include "lib/teq.h"
@@ -191,6 +194,33 @@ shell_exec_stats_drop(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_stats_atoms(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *pretty;
+	const option_t options[] = {
+		{ "p", &pretty },			/* pretty-print values */
+	};
+	int parsed;
+	logagent_t *la;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	la = log_agent_string_make(0, "ATOM ");
+	atoms_dump_stats_log(la, NULL == pretty ? 0 : DUMP_OPT_PRETTY);
+	shell_write(sh, log_agent_string_get(la));
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
 /**
  * Handle the stats command.
  */
@@ -211,6 +241,7 @@ shell_exec_stats(struct gnutella_shell *sh, int argc, const char *argv[])
 		return shell_exec_stats_ ## name(sh, argc - 1, argv + 1); \
 } G_STMT_END
 
+	CMD(atoms);
 	CMD(general);
 	CMD(drop);
 
@@ -238,6 +269,11 @@ shell_help_stats(int argc, const char *argv[])
 				"prints the general statistics counters.\n"
 				"-p : pretty-print with thousands separators.\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "atoms")) {
+			return "stats atoms [-p]\n"
+				"prints atom table statistics, including lock contention.\n"
+				"-p : pretty-print with thousands separators.\n";
+		}
 		else if (0 == ascii_strcasecmp(argv[1], "drop")) {
 			return "stats drop [-ptu]\n"
 				"prints the message drop cumulative counters.\n"
@@ -248,6 +284,7 @@ shell_help_stats(int argc, const char *argv[])
 	} else {
 		return
 			"stats [general] [-p]\n"
+			"stats atoms [-p]\n"
 			"stats drop [-ptu]\n"
 			;
 	}